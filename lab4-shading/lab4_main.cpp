@@ -660,6 +660,9 @@ int main(int argc, char* argv[])
 		deltaTime = timeSinceStart.count() - currentTime;
 		currentTime = timeSinceStart.count();
 
+		// Upload the textures that were decoded since the last frame
+		labhelper::uploadTextures();
+
 		// Inform imgui of new frame
 		ImGui_ImplSdlGL3_NewFrame(g_window);
 
@@ -0,0 +1,265 @@
+#include "Culling.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CULLING_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace labhelper
+{
+Frustum extractFrustum(const glm::mat4& matrix)
+{
+	// Gribb and Hartmann: a point p is inside when -w <= x, y, z <= w, with
+	// (x, y, z, w) = matrix * p. GLM matrices are column major, so row i is
+	// (matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]).
+	glm::vec4 rows[4];
+	for(int i = 0; i < 4; i++)
+	{
+		rows[i] = glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+	}
+	Frustum frustum;
+	frustum.planes[0] = rows[3] + rows[0];
+	frustum.planes[1] = rows[3] - rows[0];
+	frustum.planes[2] = rows[3] + rows[1];
+	frustum.planes[3] = rows[3] - rows[1];
+	frustum.planes[4] = rows[3] + rows[2];
+	frustum.planes[5] = rows[3] - rows[2];
+	for(glm::vec4& plane : frustum.planes)
+	{
+		const float length = glm::length(glm::vec3(plane));
+		if(length > 0.0f)
+		{
+			plane /= length;
+		}
+	}
+	return frustum;
+}
+
+bool intersects(const Frustum& frustum, const glm::vec3& aabb_min, const glm::vec3& aabb_max)
+{
+	const glm::vec3 center = 0.5f * (aabb_min + aabb_max);
+	const glm::vec3 extent = 0.5f * (aabb_max - aabb_min);
+	for(const glm::vec4& plane : frustum.planes)
+	{
+		const glm::vec3 normal(plane);
+		const float distance = glm::dot(normal, center) + plane.w;
+		const float radius = glm::dot(glm::abs(normal), extent);
+		if(distance + radius < 0.0f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void transformAABB(const glm::mat4& matrix, const glm::vec3& aabb_min, const glm::vec3& aabb_max,
+                   glm::vec3& result_min, glm::vec3& result_max)
+{
+	// Arvo: the extent along each axis is the sum of the extents of the
+	// transformed box axes
+	const glm::vec3 center = glm::vec3(matrix * glm::vec4(0.5f * (aabb_min + aabb_max), 1.0f));
+	const glm::vec3 extent = 0.5f * (aabb_max - aabb_min);
+	glm::vec3 result_extent(0.0f);
+	for(int axis = 0; axis < 3; axis++)
+	{
+		result_extent += glm::abs(glm::vec3(matrix[axis])) * extent[axis];
+	}
+	result_min = center - result_extent;
+	result_max = center + result_extent;
+}
+
+void BoxList::add(const glm::vec3& aabb_min, const glm::vec3& aabb_max)
+{
+	const glm::vec3 center = 0.5f * (aabb_min + aabb_max);
+	const glm::vec3 extent = 0.5f * (aabb_max - aabb_min);
+	center_x.push_back(center.x);
+	center_y.push_back(center.y);
+	center_z.push_back(center.z);
+	extent_x.push_back(extent.x);
+	extent_y.push_back(extent.y);
+	extent_z.push_back(extent.z);
+}
+
+void BoxList::clear()
+{
+	center_x.clear();
+	center_y.clear();
+	center_z.clear();
+	extent_x.clear();
+	extent_y.clear();
+	extent_z.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Test boxes first to first + count - 1 (at most four) of a list. Bit i of
+// `visible` is set if box first + i is at least partly inside the frustum,
+// and bit i of `inside` if it is entirely inside.
+///////////////////////////////////////////////////////////////////////////////
+static void testFourBoxes(const Frustum& frustum, const BoxList& boxes, size_t first, size_t count, int& visible,
+                          int& inside)
+{
+	count = std::min<size_t>(count, 4);
+	const std::vector<float>* arrays[6] = { &boxes.center_x, &boxes.center_y, &boxes.center_z,
+		                                    &boxes.extent_x, &boxes.extent_y, &boxes.extent_z };
+	const float* box[6];
+	// Past the end of the list, test empty boxes at the origin and ignore
+	// the result
+	float padded[6][4] = {};
+	for(int a = 0; a < 6; a++)
+	{
+		if(count == 4)
+		{
+			box[a] = arrays[a]->data() + first;
+		}
+		else
+		{
+			std::copy(arrays[a]->begin() + first, arrays[a]->begin() + first + count, padded[a]);
+			box[a] = padded[a];
+		}
+	}
+	const int mask = (1 << count) - 1;
+
+#ifdef CULLING_SSE
+	const __m128 center_x = _mm_loadu_ps(box[0]), center_y = _mm_loadu_ps(box[1]), center_z = _mm_loadu_ps(box[2]);
+	const __m128 extent_x = _mm_loadu_ps(box[3]), extent_y = _mm_loadu_ps(box[4]), extent_z = _mm_loadu_ps(box[5]);
+	const __m128 zero = _mm_setzero_ps();
+	__m128 outside = zero, crossing = zero;
+	for(const glm::vec4& plane : frustum.planes)
+	{
+		const __m128 distance = _mm_add_ps(
+		    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), center_x), _mm_mul_ps(_mm_set1_ps(plane.y), center_y)),
+		    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), center_z), _mm_set1_ps(plane.w)));
+		const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::abs(plane.x)), extent_x),
+		                                            _mm_mul_ps(_mm_set1_ps(std::abs(plane.y)), extent_y)),
+		                                 _mm_mul_ps(_mm_set1_ps(std::abs(plane.z)), extent_z));
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+		crossing = _mm_or_ps(crossing, _mm_cmplt_ps(_mm_sub_ps(distance, radius), zero));
+	}
+	visible = ~_mm_movemask_ps(outside) & mask;
+	inside = ~_mm_movemask_ps(crossing) & mask;
+#else
+	visible = 0;
+	inside = 0;
+	for(size_t i = 0; i < count; i++)
+	{
+		bool is_outside = false, is_crossing = false;
+		for(const glm::vec4& plane : frustum.planes)
+		{
+			const float distance = plane.x * box[0][i] + plane.y * box[1][i] + plane.z * box[2][i] + plane.w;
+			const float radius = std::abs(plane.x) * box[3][i] + std::abs(plane.y) * box[4][i]
+			                     + std::abs(plane.z) * box[5][i];
+			is_outside = is_outside || distance + radius < 0.0f;
+			is_crossing = is_crossing || distance - radius < 0.0f;
+		}
+		visible |= is_outside ? 0 : 1 << i;
+		inside |= is_crossing ? 0 : 1 << i;
+	}
+	visible &= mask;
+	inside &= mask;
+#endif
+}
+
+void InstanceGrid::build(const std::vector<glm::vec3>& aabb_mins, const std::vector<glm::vec3>& aabb_maxs,
+                         int instances_per_cell)
+{
+	m_cell_boxes.clear();
+	m_cell_starts.clear();
+	m_instance_ids.clear();
+	m_instance_boxes.clear();
+	const size_t count = aabb_mins.size();
+	if(count == 0)
+	{
+		return;
+	}
+
+	glm::vec3 bounds_min = aabb_mins[0], bounds_max = aabb_maxs[0];
+	for(size_t i = 0; i < count; i++)
+	{
+		bounds_min = glm::min(bounds_min, aabb_mins[i]);
+		bounds_max = glm::max(bounds_max, aabb_maxs[i]);
+	}
+	const int cells_per_side =
+	    std::max(1, int(std::sqrt(float(count) / float(std::max(instances_per_cell, 1))) + 0.5f));
+	const glm::vec3 cell_size = glm::max((bounds_max - bounds_min) / float(cells_per_side), glm::vec3(1e-6f));
+
+	// Counting sort of the instances by the cell of their centers
+	std::vector<uint32_t> cells(count);
+	std::vector<uint32_t> starts(size_t(cells_per_side) * cells_per_side + 1, 0);
+	for(size_t i = 0; i < count; i++)
+	{
+		const glm::vec3 center = 0.5f * (aabb_mins[i] + aabb_maxs[i]);
+		const int x = std::min(int((center.x - bounds_min.x) / cell_size.x), cells_per_side - 1);
+		const int z = std::min(int((center.z - bounds_min.z) / cell_size.z), cells_per_side - 1);
+		cells[i] = uint32_t(std::max(z, 0) * cells_per_side + std::max(x, 0));
+		starts[cells[i] + 1]++;
+	}
+	for(size_t c = 1; c < starts.size(); c++)
+	{
+		starts[c] += starts[c - 1];
+	}
+	std::vector<uint32_t> next(starts.begin(), starts.end() - 1);
+	m_instance_ids.resize(count);
+	for(size_t i = 0; i < count; i++)
+	{
+		m_instance_ids[next[cells[i]]++] = uint32_t(i);
+	}
+
+	// Only the cells with instances are kept, each with the box around them
+	for(size_t c = 0; c + 1 < starts.size(); c++)
+	{
+		if(starts[c] == starts[c + 1])
+		{
+			continue;
+		}
+		glm::vec3 cell_min = aabb_mins[m_instance_ids[starts[c]]], cell_max = aabb_maxs[m_instance_ids[starts[c]]];
+		for(uint32_t j = starts[c]; j < starts[c + 1]; j++)
+		{
+			const uint32_t id = m_instance_ids[j];
+			cell_min = glm::min(cell_min, aabb_mins[id]);
+			cell_max = glm::max(cell_max, aabb_maxs[id]);
+			m_instance_boxes.add(aabb_mins[id], aabb_maxs[id]);
+		}
+		m_cell_boxes.add(cell_min, cell_max);
+		m_cell_starts.push_back(starts[c]);
+	}
+	m_cell_starts.push_back(uint32_t(count));
+}
+
+void InstanceGrid::cull(const Frustum& frustum, std::vector<uint32_t>& visible) const
+{
+	visible.clear();
+	for(size_t first_cell = 0; first_cell < m_cell_boxes.size(); first_cell += 4)
+	{
+		int visible_cells, inside_cells;
+		testFourBoxes(frustum, m_cell_boxes, first_cell, m_cell_boxes.size() - first_cell, visible_cells,
+		              inside_cells);
+		for(int i = 0; i < 4; i++)
+		{
+			if(!(visible_cells & (1 << i)))
+			{
+				continue;
+			}
+			const uint32_t begin = m_cell_starts[first_cell + i], end = m_cell_starts[first_cell + i + 1];
+			if(inside_cells & (1 << i))
+			{
+				visible.insert(visible.end(), m_instance_ids.begin() + begin, m_instance_ids.begin() + end);
+				continue;
+			}
+			for(uint32_t first = begin; first < end; first += 4)
+			{
+				int visible_instances, inside_instances;
+				testFourBoxes(frustum, m_instance_boxes, first, end - first, visible_instances, inside_instances);
+				for(int j = 0; j < 4; j++)
+				{
+					if(visible_instances & (1 << j))
+					{
+						visible.push_back(m_instance_ids[first + j]);
+					}
+				}
+			}
+		}
+	}
+}
+} // namespace labhelper
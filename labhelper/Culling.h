@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// The six planes of a view frustum, with the normals pointing inwards.
+/// Extracted from projection * view the planes are in world space; from
+/// projection * view * model they are in the model's space, so boxes can
+/// be tested without transforming them.
+///////////////////////////////////////////////////////////////////////////
+struct Frustum
+{
+	glm::vec4 planes[6];
+};
+Frustum extractFrustum(const glm::mat4& matrix);
+
+/// Whether an axis aligned box is at least partly inside the frustum. Boxes
+/// outside the frustum but not entirely on the outside of one plane (near
+/// the corners) are kept, like in all plane based tests.
+bool intersects(const Frustum& frustum, const glm::vec3& aabb_min, const glm::vec3& aabb_max);
+
+/// The axis aligned box around a box transformed by `matrix`
+void transformAABB(const glm::mat4& matrix, const glm::vec3& aabb_min, const glm::vec3& aabb_max,
+                   glm::vec3& result_min, glm::vec3& result_max);
+
+///////////////////////////////////////////////////////////////////////////
+/// Axis aligned boxes as centers and half extents, one array per
+/// coordinate, so that four of them can be tested at once with SSE
+///////////////////////////////////////////////////////////////////////////
+struct BoxList
+{
+	std::vector<float> center_x, center_y, center_z;
+	std::vector<float> extent_x, extent_y, extent_z;
+
+	size_t size() const
+	{
+		return center_x.size();
+	}
+	void add(const glm::vec3& aabb_min, const glm::vec3& aabb_max);
+	void clear();
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// A uniform grid over the x/z plane of the bounding boxes of instances,
+/// such as the trees of a scene, that finds the ones in a frustum. Cells
+/// entirely in the frustum are taken whole, and only the instances of the
+/// cells on its border are tested one by one.
+///////////////////////////////////////////////////////////////////////////
+class InstanceGrid
+{
+public:
+	/// Sort the boxes of the instances into cells of about
+	/// `instances_per_cell` instances each
+	void build(const std::vector<glm::vec3>& aabb_mins, const std::vector<glm::vec3>& aabb_maxs,
+	           int instances_per_cell = 16);
+	/// Replace `visible` with the indices of the instances in the frustum
+	void cull(const Frustum& frustum, std::vector<uint32_t>& visible) const;
+
+	size_t numberOfInstances() const
+	{
+		return m_instance_ids.size();
+	}
+
+private:
+	BoxList m_cell_boxes;
+	// The instances of cell i are m_instance_ids[m_cell_starts[i]] up to
+	// m_cell_starts[i + 1], and their boxes are in the same order
+	std::vector<uint32_t> m_cell_starts;
+	std::vector<uint32_t> m_instance_ids;
+	BoxList m_instance_boxes;
+};
+} // namespace labhelper
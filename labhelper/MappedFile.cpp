@@ -0,0 +1,195 @@
+#include "MappedFile.h"
+#include <iostream>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace labhelper
+{
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::openRead(const std::string& filename)
+{
+	return open(filename, 0, false);
+}
+
+bool MappedFile::openWrite(const std::string& filename, size_t size)
+{
+	return open(filename, size, true);
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string& filename, size_t size, bool writable)
+{
+	close();
+	HANDLE file = CreateFileA(filename.c_str(), writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+	                          FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, writable ? OPEN_ALWAYS : OPEN_EXISTING,
+	                          FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	m_file = file;
+
+	if(writable)
+	{
+		LARGE_INTEGER file_size;
+		file_size.QuadPart = LONGLONG(size);
+		if(!SetFilePointerEx(file, file_size, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+		{
+			std::cout << "Could not resize " << filename << " to " << size << " bytes.\n";
+			close();
+			return false;
+		}
+	}
+	else
+	{
+		LARGE_INTEGER file_size;
+		GetFileSizeEx(file, &file_size);
+		size = size_t(file_size.QuadPart);
+	}
+	if(size == 0)
+	{
+		close();
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+	if(mapping == nullptr)
+	{
+		close();
+		return false;
+	}
+	m_mapping = mapping;
+	m_data = (uint8_t*)MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+	if(m_data == nullptr)
+	{
+		close();
+		return false;
+	}
+	m_size = size;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if(m_data)
+		UnmapViewOfFile(m_data);
+	if(m_mapping)
+		CloseHandle(m_mapping);
+	if(m_file)
+		CloseHandle(m_file);
+	m_data = nullptr;
+	m_mapping = nullptr;
+	m_file = nullptr;
+	m_size = 0;
+}
+
+void MappedFile::flush(size_t offset, size_t size)
+{
+	if(m_data == nullptr)
+		return;
+	FlushViewOfFile(m_data + offset, size);
+	FlushFileBuffers(m_file);
+}
+#else
+bool MappedFile::open(const std::string& filename, size_t size, bool writable)
+{
+	close();
+	m_file = ::open(filename.c_str(), writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+	if(m_file < 0)
+	{
+		return false;
+	}
+
+	if(writable)
+	{
+		if(ftruncate(m_file, off_t(size)) != 0)
+		{
+			std::cout << "Could not resize " << filename << " to " << size << " bytes.\n";
+			close();
+			return false;
+		}
+	}
+	else
+	{
+		struct stat file_stat;
+		if(fstat(m_file, &file_stat) != 0)
+		{
+			close();
+			return false;
+		}
+		size = size_t(file_stat.st_size);
+	}
+	if(size == 0)
+	{
+		close();
+		return false;
+	}
+
+	void* data = mmap(nullptr, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, m_file, 0);
+	if(data == MAP_FAILED)
+	{
+		close();
+		return false;
+	}
+	m_data = (uint8_t*)data;
+	m_size = size;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if(m_data)
+		munmap(m_data, m_size);
+	if(m_file >= 0)
+		::close(m_file);
+	m_data = nullptr;
+	m_file = -1;
+	m_size = 0;
+}
+
+void MappedFile::flush(size_t offset, size_t size)
+{
+	if(m_data == nullptr)
+		return;
+	// msync wants a page aligned address
+	const size_t page_size = size_t(sysconf(_SC_PAGESIZE));
+	const size_t aligned_offset = offset - offset % page_size;
+	msync(m_data + aligned_offset, size + (offset - aligned_offset), MS_SYNC);
+}
+#endif
+
+FileStamp fileStamp(const std::string& filename)
+{
+	struct stat info;
+	if(stat(filename.c_str(), &info) != 0)
+	{
+		return { -1, 0 };
+	}
+	return { int64_t(info.st_size), int64_t(info.st_mtime) };
+}
+
+uint64_t fnv1a(const uint8_t* data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for(size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ data[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+} // namespace labhelper
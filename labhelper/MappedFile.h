@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// A file mapped into memory. Opened for writing, the file is created (or
+/// resized) to the requested size, and changes are written back by the OS,
+/// or explicitly with flush().
+///////////////////////////////////////////////////////////////////////////
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	/// Map an existing file for reading
+	bool openRead(const std::string& filename);
+	/// Create or resize the file to `size` bytes and map it for writing
+	bool openWrite(const std::string& filename, size_t size);
+	void close();
+
+	/// Make sure that the given range has been written to disk
+	void flush(size_t offset, size_t size);
+
+	bool isOpen() const
+	{
+		return m_data != nullptr;
+	}
+	uint8_t* data() const
+	{
+		return m_data;
+	}
+	size_t size() const
+	{
+		return m_size;
+	}
+
+private:
+	bool open(const std::string& filename, size_t size, bool writable);
+
+	uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#else
+	int m_file = -1;
+#endif
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// What identifies a version of a file that a cache was built from. Files
+/// that do not exist have a size of -1, so that the cache also goes stale
+/// when they are created.
+///////////////////////////////////////////////////////////////////////////
+struct FileStamp
+{
+	int64_t size;
+	int64_t modified;
+};
+FileStamp fileStamp(const std::string& filename);
+
+/// The checksum of the caches
+uint64_t fnv1a(const uint8_t* data, size_t size);
+} // namespace labhelper
@@ -0,0 +1,292 @@
+#include "MeshIndexing.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////////
+// A vertex, compared bit by bit
+///////////////////////////////////////////////////////////////////////////////
+struct VertexKey
+{
+	float values[8];
+
+	bool operator==(const VertexKey& other) const
+	{
+		return memcmp(values, other.values, sizeof(values)) == 0;
+	}
+};
+
+struct VertexKeyHash
+{
+	size_t operator()(const VertexKey& key) const
+	{
+		uint32_t bits[8];
+		memcpy(bits, key.values, sizeof(bits));
+		uint64_t hash = 14695981039346656037ull;
+		for(uint32_t b : bits)
+		{
+			hash = (hash ^ b) * 1099511628211ull;
+		}
+		return size_t(hash ^ (hash >> 32));
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Forsyth's scoring. Vertices that are in the cache score higher the more
+// recently they were used (the three of the last triangle a bit lower, to
+// avoid long strips), and vertices with few triangles left score higher,
+// so that they are finished off rather than left behind.
+///////////////////////////////////////////////////////////////////////////////
+const int vertex_cache_size = 32;
+const float cache_decay_power = 1.5f;
+const float last_triangle_score = 0.75f;
+const float valence_boost_scale = 2.0f;
+const float valence_boost_power = 0.5f;
+
+static float vertexScore(int cache_position, int remaining_triangles)
+{
+	if(remaining_triangles == 0)
+	{
+		return -1.0f;
+	}
+	float score = 0.0f;
+	if(cache_position >= 0)
+	{
+		if(cache_position < 3)
+		{
+			score = last_triangle_score;
+		}
+		else
+		{
+			const float scale = 1.0f / float(vertex_cache_size - 3);
+			score = std::pow(1.0f - float(cache_position - 3) * scale, cache_decay_power);
+		}
+	}
+	return score + valence_boost_scale * std::pow(float(remaining_triangles), -valence_boost_power);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The vertices are renumbered locally first, so the work only depends on the
+// size of the mesh.
+///////////////////////////////////////////////////////////////////////////////
+void optimizeVertexCache(uint32_t* indices, size_t number_of_triangles)
+{
+	const size_t number_of_indices = number_of_triangles * 3;
+	std::unordered_map<uint32_t, uint32_t> local_ids;
+	std::vector<uint32_t> local(number_of_indices);
+	for(size_t i = 0; i < number_of_indices; i++)
+	{
+		local[i] = local_ids.emplace(indices[i], uint32_t(local_ids.size())).first->second;
+	}
+	const size_t number_of_vertices = local_ids.size();
+
+	// The triangles of each vertex, of which the first `remaining` are
+	// not drawn yet
+	std::vector<uint32_t> first_triangle(number_of_vertices + 1, 0);
+	for(uint32_t v : local)
+	{
+		first_triangle[v + 1]++;
+	}
+	for(size_t v = 0; v < number_of_vertices; v++)
+	{
+		first_triangle[v + 1] += first_triangle[v];
+	}
+	std::vector<uint32_t> vertex_triangles(number_of_indices);
+	std::vector<int> remaining(number_of_vertices, 0);
+	for(size_t i = 0; i < number_of_indices; i++)
+	{
+		const uint32_t v = local[i];
+		vertex_triangles[first_triangle[v] + remaining[v]++] = uint32_t(i / 3);
+	}
+
+	std::vector<int> cache_position(number_of_vertices, -1);
+	std::vector<float> vertex_score(number_of_vertices);
+	for(size_t v = 0; v < number_of_vertices; v++)
+	{
+		vertex_score[v] = vertexScore(-1, remaining[v]);
+	}
+	std::vector<float> triangle_score(number_of_triangles);
+	std::vector<bool> drawn(number_of_triangles, false);
+	size_t best = 0;
+	for(size_t t = 0; t < number_of_triangles; t++)
+	{
+		triangle_score[t] = vertex_score[local[t * 3]] + vertex_score[local[t * 3 + 1]] + vertex_score[local[t * 3 + 2]];
+		if(triangle_score[t] > triangle_score[best])
+		{
+			best = t;
+		}
+	}
+
+	std::vector<uint32_t> cache, new_cache;
+	cache.reserve(vertex_cache_size + 3);
+	new_cache.reserve(vertex_cache_size + 3);
+	std::vector<uint32_t> result(number_of_indices);
+	// Where to look for a triangle when none of those in the cache are left
+	size_t next_undrawn = 0;
+	for(size_t output = 0; output < number_of_triangles; output++)
+	{
+		if(best == number_of_triangles)
+		{
+			while(drawn[next_undrawn])
+			{
+				next_undrawn++;
+			}
+			best = next_undrawn;
+		}
+		const size_t t = best;
+		drawn[t] = true;
+		for(int j = 0; j < 3; j++)
+		{
+			const uint32_t v = local[t * 3 + j];
+			result[output * 3 + j] = indices[t * 3 + j];
+			// Move the triangle past the remaining ones of the vertex
+			uint32_t* triangles = &vertex_triangles[first_triangle[v]];
+			int k = 0;
+			while(triangles[k] != t)
+			{
+				k++;
+			}
+			std::swap(triangles[k], triangles[--remaining[v]]);
+		}
+
+		// The vertices of the triangle go first in the cache, then the
+		// ones that were there, and the ones that no longer fit fall out
+		new_cache.clear();
+		for(int j = 0; j < 3; j++)
+		{
+			const uint32_t v = local[t * 3 + j];
+			if(std::find(new_cache.begin(), new_cache.end(), v) == new_cache.end())
+			{
+				new_cache.push_back(v);
+			}
+		}
+		for(uint32_t v : cache)
+		{
+			if(std::find(new_cache.begin(), new_cache.end(), v) == new_cache.end())
+			{
+				new_cache.push_back(v);
+			}
+		}
+		for(size_t i = 0; i < new_cache.size(); i++)
+		{
+			cache_position[new_cache[i]] = i < size_t(vertex_cache_size) ? int(i) : -1;
+		}
+		if(new_cache.size() > size_t(vertex_cache_size))
+		{
+			new_cache.resize(vertex_cache_size);
+		}
+
+		// Rescore the vertices that moved, and their triangles. The best of
+		// those is drawn next.
+		best = number_of_triangles;
+		float best_score = -std::numeric_limits<float>::infinity();
+		for(uint32_t v : cache)
+		{
+			vertex_score[v] = vertexScore(cache_position[v], remaining[v]);
+		}
+		for(uint32_t v : new_cache)
+		{
+			vertex_score[v] = vertexScore(cache_position[v], remaining[v]);
+		}
+		for(uint32_t v : new_cache)
+		{
+			for(int k = 0; k < remaining[v]; k++)
+			{
+				const uint32_t u = vertex_triangles[first_triangle[v] + k];
+				triangle_score[u] =
+				    vertex_score[local[u * 3]] + vertex_score[local[u * 3 + 1]] + vertex_score[local[u * 3 + 2]];
+				if(triangle_score[u] > best_score)
+				{
+					best_score = triangle_score[u];
+					best = u;
+				}
+			}
+		}
+		cache.swap(new_cache);
+	}
+	std::copy(result.begin(), result.end(), indices);
+}
+
+void buildIndexedMesh(Model* model)
+{
+	const size_t number_of_corners = model->m_positions.size();
+	model->m_indices.assign(number_of_corners, 0);
+
+	///////////////////////////////////////////////////////////////////////
+	// Weld the corners of the meshes
+	///////////////////////////////////////////////////////////////////////
+	std::vector<uint32_t> welded;
+	std::unordered_map<VertexKey, uint32_t, VertexKeyHash> vertex_ids;
+	vertex_ids.reserve(number_of_corners);
+	for(const auto& mesh : model->m_meshes)
+	{
+		for(uint32_t i = mesh.m_start_index; i < mesh.m_start_index + mesh.m_number_of_vertices; i++)
+		{
+			VertexKey key;
+			memcpy(&key.values[0], &model->m_positions[i], sizeof(glm::vec3));
+			memcpy(&key.values[3], &model->m_normals[i], sizeof(glm::vec3));
+			memcpy(&key.values[6], &model->m_texture_coordinates[i], sizeof(glm::vec2));
+			auto inserted = vertex_ids.emplace(key, uint32_t(welded.size()));
+			if(inserted.second)
+			{
+				welded.push_back(i);
+			}
+			model->m_indices[i] = inserted.first->second;
+		}
+	}
+
+	for(const auto& mesh : model->m_meshes)
+	{
+		optimizeVertexCache(&model->m_indices[mesh.m_start_index], mesh.m_number_of_vertices / 3);
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Number the vertices in the order they are drawn
+	///////////////////////////////////////////////////////////////////////
+	const uint32_t unused = std::numeric_limits<uint32_t>::max();
+	std::vector<uint32_t> new_id(welded.size(), unused);
+	model->m_welded_vertices.clear();
+	model->m_welded_vertices.reserve(welded.size());
+	for(const auto& mesh : model->m_meshes)
+	{
+		for(uint32_t i = mesh.m_start_index; i < mesh.m_start_index + mesh.m_number_of_vertices; i++)
+		{
+			uint32_t& index = model->m_indices[i];
+			if(new_id[index] == unused)
+			{
+				new_id[index] = uint32_t(model->m_welded_vertices.size());
+				model->m_welded_vertices.push_back(welded[index]);
+			}
+			index = new_id[index];
+		}
+	}
+}
+
+size_t vertexShaderInvocations(const Model* model, int cache_size)
+{
+	size_t invocations = 0;
+	std::vector<uint32_t> fifo(cache_size);
+	for(const auto& mesh : model->m_meshes)
+	{
+		// Each draw call starts with an empty cache
+		std::fill(fifo.begin(), fifo.end(), std::numeric_limits<uint32_t>::max());
+		size_t next = 0;
+		for(uint32_t i = mesh.m_start_index; i < mesh.m_start_index + mesh.m_number_of_vertices; i++)
+		{
+			const uint32_t index = model->m_indices[i];
+			if(std::find(fifo.begin(), fifo.end(), index) == fifo.end())
+			{
+				fifo[next] = index;
+				next = (next + 1) % fifo.size();
+				invocations++;
+			}
+		}
+	}
+	return invocations;
+}
+} // namespace labhelper
@@ -0,0 +1,24 @@
+#pragma once
+#include "Model.h"
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// Fill in m_indices and m_welded_vertices of a model from its de-indexed
+/// buffers. Corners with bitwise identical position, normal and texture
+/// coordinates are welded into one vertex. The triangles of each mesh are
+/// then reordered for the post-transform vertex cache (Tom Forsyth's
+/// "Linear-Speed Vertex Cache Optimisation"), and the vertices renumbered
+/// in the order they are first used, so that they are also fetched in
+/// order.
+///////////////////////////////////////////////////////////////////////////
+void buildIndexedMesh(Model* model);
+
+/// Reorder the triangles of one mesh for the post-transform vertex cache,
+/// as buildIndexedMesh() does
+void optimizeVertexCache(uint32_t* indices, size_t number_of_triangles);
+
+/// Estimate how many times the vertex shader runs when the indexed meshes
+/// of a model are drawn, by simulating a FIFO post-transform cache.
+size_t vertexShaderInvocations(const Model* model, int cache_size = 32);
+} // namespace labhelper
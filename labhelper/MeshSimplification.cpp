@@ -0,0 +1,516 @@
+#include "MeshSimplification.h"
+#include "MeshIndexing.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace labhelper
+{
+// How much more moving an open edge costs than moving a surface the same
+// distance
+const double border_weight = 10.0;
+// Collapses that turn a triangle more than about 75 degrees are not made
+const float max_normal_change = 0.25f;
+
+///////////////////////////////////////////////////////////////////////////////
+// The weighted sum of the squared distances of a point x to a set of planes,
+// x^T A x + 2 b^T x + c with a symmetric A. The weights (the areas of the
+// triangles) are summed as well, so that the error can be given as a
+// distance.
+///////////////////////////////////////////////////////////////////////////////
+struct Quadric
+{
+	double a00, a01, a02, a11, a12, a22;
+	double b0, b1, b2;
+	double c;
+	double weight;
+};
+
+static Quadric planeQuadric(const glm::dvec3& normal, double d, double weight)
+{
+	Quadric q;
+	q.a00 = weight * normal.x * normal.x;
+	q.a01 = weight * normal.x * normal.y;
+	q.a02 = weight * normal.x * normal.z;
+	q.a11 = weight * normal.y * normal.y;
+	q.a12 = weight * normal.y * normal.z;
+	q.a22 = weight * normal.z * normal.z;
+	q.b0 = weight * normal.x * d;
+	q.b1 = weight * normal.y * d;
+	q.b2 = weight * normal.z * d;
+	q.c = weight * d * d;
+	q.weight = weight;
+	return q;
+}
+
+static void addQuadric(Quadric& q, const Quadric& r)
+{
+	q.a00 += r.a00;
+	q.a01 += r.a01;
+	q.a02 += r.a02;
+	q.a11 += r.a11;
+	q.a12 += r.a12;
+	q.a22 += r.a22;
+	q.b0 += r.b0;
+	q.b1 += r.b1;
+	q.b2 += r.b2;
+	q.c += r.c;
+	q.weight += r.weight;
+}
+
+// The squared distance, averaged over the weights of the planes
+static double quadricError(const Quadric& q, const glm::vec3& p)
+{
+	const double x = p.x, y = p.y, z = p.z;
+	const double error = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z
+	                     + 2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z)
+	                     + 2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+	return q.weight > 0.0 ? std::max(error, 0.0) / q.weight : 0.0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A position, compared bit by bit
+///////////////////////////////////////////////////////////////////////////////
+struct PositionKey
+{
+	uint32_t bits[3];
+
+	bool operator==(const PositionKey& other) const
+	{
+		return memcmp(bits, other.bits, sizeof(bits)) == 0;
+	}
+};
+
+struct PositionKeyHash
+{
+	size_t operator()(const PositionKey& key) const
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for(uint32_t b : key.bits)
+		{
+			hash = (hash ^ b) * 1099511628211ull;
+		}
+		return size_t(hash ^ (hash >> 32));
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Moving vertex `from` onto vertex `to`, and the other copies of `from` onto
+// copies of `to` next to them. Entries are left in the queue when either
+// vertex changes, and skipped by their versions when they come up.
+///////////////////////////////////////////////////////////////////////////////
+struct Collapse
+{
+	double cost;
+	uint32_t from, to;
+	uint32_t from_version, to_version;
+
+	// Lowest cost first in a std::priority_queue
+	bool operator<(const Collapse& other) const
+	{
+		return cost > other.cost;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// The simplification of one mesh, in local vertex numbers. Simplifying
+// further continues from where the last call stopped, so the levels of
+// detail are built one after the other from the same state.
+///////////////////////////////////////////////////////////////////////////////
+class MeshSimplifier
+{
+public:
+	MeshSimplifier(const Model* model, const uint32_t* indices, size_t number_of_indices);
+	void simplify(size_t target_triangles);
+	// The triangles left, in the model's vertex numbers
+	void getIndices(std::vector<uint32_t>& indices) const;
+	size_t numberOfTriangles() const
+	{
+		return m_triangles_left;
+	}
+	// The largest error of a collapse so far, as a distance
+	float error() const
+	{
+		return float(std::sqrt(m_max_cost));
+	}
+
+private:
+	double collapseCost(uint32_t from, uint32_t to, std::vector<uint32_t>& targets) const;
+	void pushCollapse(uint32_t from, uint32_t to);
+	bool flipsTriangles(uint32_t from, uint32_t to) const;
+	void collapse(uint32_t from, uint32_t to);
+
+	std::vector<uint32_t> m_model_vertices;
+	std::vector<glm::vec3> m_positions;
+	// The vertices with the same position as a vertex (where the texture
+	// coordinates or normals are split) form a ring through m_next_copy
+	std::vector<uint32_t> m_next_copy;
+	std::vector<uint32_t> m_targets;
+	std::vector<bool> m_removed;
+	std::vector<uint32_t> m_versions;
+	std::vector<Quadric> m_quadrics;
+	std::vector<uint32_t> m_triangles;
+	std::vector<bool> m_triangle_alive;
+	std::vector<std::vector<uint32_t>> m_vertex_triangles;
+	std::priority_queue<Collapse> m_queue;
+	size_t m_triangles_left = 0;
+	double m_max_cost = 0.0;
+};
+
+MeshSimplifier::MeshSimplifier(const Model* model, const uint32_t* indices, size_t number_of_indices)
+{
+	///////////////////////////////////////////////////////////////////////
+	// Number the vertices of the mesh locally, and link up the ones that
+	// share their position
+	///////////////////////////////////////////////////////////////////////
+	std::unordered_map<uint32_t, uint32_t> local_ids;
+	std::unordered_map<PositionKey, uint32_t, PositionKeyHash> position_ids;
+	m_triangles.resize(number_of_indices);
+	for(size_t i = 0; i < number_of_indices; i++)
+	{
+		auto inserted = local_ids.emplace(indices[i], uint32_t(m_model_vertices.size()));
+		if(inserted.second)
+		{
+			const uint32_t local = inserted.first->second;
+			const glm::vec3 position = model->m_positions[model->m_welded_vertices[indices[i]]];
+			m_model_vertices.push_back(indices[i]);
+			m_positions.push_back(position);
+			m_next_copy.push_back(local);
+			PositionKey key;
+			memcpy(key.bits, &position, sizeof(key.bits));
+			auto same_position = position_ids.emplace(key, local);
+			if(!same_position.second)
+			{
+				const uint32_t first = same_position.first->second;
+				m_next_copy[local] = m_next_copy[first];
+				m_next_copy[first] = local;
+			}
+		}
+		m_triangles[i] = inserted.first->second;
+	}
+	const size_t number_of_vertices = m_model_vertices.size();
+	const size_t number_of_triangles = number_of_indices / 3;
+	m_removed.assign(number_of_vertices, false);
+	m_versions.assign(number_of_vertices, 0);
+	m_quadrics.assign(number_of_vertices, planeQuadric(glm::dvec3(0.0), 0.0, 0.0));
+	m_triangle_alive.assign(number_of_triangles, true);
+	m_vertex_triangles.resize(number_of_vertices);
+	m_triangles_left = number_of_triangles;
+
+	///////////////////////////////////////////////////////////////////////
+	// The plane of each triangle goes to its corners, weighted by its area
+	///////////////////////////////////////////////////////////////////////
+	std::vector<glm::dvec3> triangle_normals(number_of_triangles);
+	for(size_t t = 0; t < number_of_triangles; t++)
+	{
+		const uint32_t* corners = &m_triangles[t * 3];
+		const glm::dvec3 p0(m_positions[corners[0]]), p1(m_positions[corners[1]]), p2(m_positions[corners[2]]);
+		glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+		const double length = glm::length(normal);
+		normal = length > 0.0 ? normal / length : glm::dvec3(0.0);
+		triangle_normals[t] = normal;
+		const Quadric q = planeQuadric(normal, -glm::dot(normal, p0), 0.5 * length);
+		for(int j = 0; j < 3; j++)
+		{
+			addQuadric(m_quadrics[corners[j]], q);
+			m_vertex_triangles[corners[j]].push_back(uint32_t(t));
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Edges of only one triangle get a plane through them, at right
+	// angles to the triangle, so that they stay where they are
+	///////////////////////////////////////////////////////////////////////
+	std::unordered_map<uint64_t, uint32_t> edge_counts;
+	edge_counts.reserve(number_of_indices);
+	auto edgeKey = [](uint32_t a, uint32_t b) {
+		return (uint64_t(std::min(a, b)) << 32) | uint64_t(std::max(a, b));
+	};
+	for(size_t i = 0; i < number_of_indices; i++)
+	{
+		edge_counts[edgeKey(m_triangles[i], m_triangles[i - i % 3 + (i + 1) % 3])]++;
+	}
+	for(size_t i = 0; i < number_of_indices; i++)
+	{
+		const uint32_t a = m_triangles[i], b = m_triangles[i - i % 3 + (i + 1) % 3];
+		if(edge_counts[edgeKey(a, b)] != 1)
+		{
+			continue;
+		}
+		const glm::dvec3 pa(m_positions[a]), pb(m_positions[b]);
+		const glm::dvec3 edge = pb - pa;
+		glm::dvec3 normal = glm::cross(edge, triangle_normals[i / 3]);
+		const double length = glm::length(normal);
+		if(length == 0.0)
+		{
+			continue;
+		}
+		normal /= length;
+		const Quadric q = planeQuadric(normal, -glm::dot(normal, pa), border_weight * glm::dot(edge, edge));
+		addQuadric(m_quadrics[a], q);
+		addQuadric(m_quadrics[b], q);
+	}
+
+	for(size_t i = 0; i < number_of_indices; i++)
+	{
+		const uint32_t a = m_triangles[i], b = m_triangles[i - i % 3 + (i + 1) % 3];
+		pushCollapse(a, b);
+		pushCollapse(b, a);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The cost of a collapse, the largest of its copies, and the vertex each
+// copy of `from` moves onto. A split only stays intact if every copy has a
+// copy of `to` next to it, so that it moves along the split; otherwise the
+// collapse is not possible, and the cost negative.
+///////////////////////////////////////////////////////////////////////////////
+double MeshSimplifier::collapseCost(uint32_t from, uint32_t to, std::vector<uint32_t>& targets) const
+{
+	targets.clear();
+	double cost = 0.0;
+	uint32_t copy = from;
+	do
+	{
+		uint32_t target = copy == from ? to : UINT32_MAX;
+		for(size_t i = 0; i < m_vertex_triangles[copy].size() && target == UINT32_MAX; i++)
+		{
+			const uint32_t* corners = &m_triangles[m_vertex_triangles[copy][i] * 3];
+			for(int j = 0; j < 3; j++)
+			{
+				if(corners[j] != copy && m_positions[corners[j]] == m_positions[to])
+				{
+					target = corners[j];
+				}
+			}
+		}
+		if(target == UINT32_MAX || target == copy)
+		{
+			return -1.0;
+		}
+		Quadric q = m_quadrics[copy];
+		addQuadric(q, m_quadrics[target]);
+		cost = std::max(cost, quadricError(q, m_positions[to]));
+		targets.push_back(target);
+		copy = m_next_copy[copy];
+	} while(copy != from);
+	return cost;
+}
+
+void MeshSimplifier::pushCollapse(uint32_t from, uint32_t to)
+{
+	if(from == to || m_positions[from] == m_positions[to])
+	{
+		return;
+	}
+	const double cost = collapseCost(from, to, m_targets);
+	if(cost >= 0.0)
+	{
+		m_queue.push({ cost, from, to, m_versions[from], m_versions[to] });
+	}
+}
+
+// Whether moving `from` onto `to` turns any of the triangles that are left
+// too far, or folds them over
+bool MeshSimplifier::flipsTriangles(uint32_t from, uint32_t to) const
+{
+	for(uint32_t t : m_vertex_triangles[from])
+	{
+		const uint32_t* corners = &m_triangles[t * 3];
+		if(!m_triangle_alive[t] || corners[0] == to || corners[1] == to || corners[2] == to)
+		{
+			continue;
+		}
+		glm::vec3 p[3], moved[3];
+		for(int j = 0; j < 3; j++)
+		{
+			p[j] = m_positions[corners[j]];
+			moved[j] = corners[j] == from ? m_positions[to] : p[j];
+		}
+		const glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+		const glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+		const float after_length = glm::length(after);
+		if(after_length == 0.0f
+		   || glm::dot(before, after) < max_normal_change * glm::length(before) * after_length)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void MeshSimplifier::collapse(uint32_t from, uint32_t to)
+{
+	for(uint32_t t : m_vertex_triangles[from])
+	{
+		if(!m_triangle_alive[t])
+		{
+			continue;
+		}
+		uint32_t* corners = &m_triangles[t * 3];
+		if(corners[0] == to || corners[1] == to || corners[2] == to)
+		{
+			m_triangle_alive[t] = false;
+			m_triangles_left--;
+			continue;
+		}
+		for(int j = 0; j < 3; j++)
+		{
+			corners[j] = corners[j] == from ? to : corners[j];
+		}
+		m_vertex_triangles[to].push_back(t);
+	}
+	m_vertex_triangles[from].clear();
+	m_removed[from] = true;
+	addQuadric(m_quadrics[to], m_quadrics[from]);
+	m_versions[to]++;
+
+	// The costs of all edges of `to` have changed
+	std::vector<uint32_t>& triangles = m_vertex_triangles[to];
+	triangles.erase(std::remove_if(triangles.begin(), triangles.end(),
+	                               [&](uint32_t t) { return !m_triangle_alive[t]; }),
+	                triangles.end());
+	for(uint32_t t : triangles)
+	{
+		for(int j = 0; j < 3; j++)
+		{
+			const uint32_t other = m_triangles[t * 3 + j];
+			pushCollapse(other, to);
+			pushCollapse(to, other);
+		}
+	}
+}
+
+void MeshSimplifier::simplify(size_t target_triangles)
+{
+	while(m_triangles_left > target_triangles && !m_queue.empty())
+	{
+		const Collapse c = m_queue.top();
+		m_queue.pop();
+		if(m_removed[c.from] || m_removed[c.to] || c.from_version != m_versions[c.from]
+		   || c.to_version != m_versions[c.to])
+		{
+			continue;
+		}
+		// The other copies may have changed since
+		const double cost = collapseCost(c.from, c.to, m_targets);
+		if(cost < 0.0)
+		{
+			continue;
+		}
+		if(cost > c.cost)
+		{
+			m_queue.push({ cost, c.from, c.to, c.from_version, c.to_version });
+			continue;
+		}
+		bool flips = false;
+		uint32_t copy = c.from;
+		for(uint32_t target : m_targets)
+		{
+			flips = flips || flipsTriangles(copy, target);
+			copy = m_next_copy[copy];
+		}
+		if(flips)
+		{
+			continue;
+		}
+		// collapse() pushes new collapses, which reuses m_targets
+		std::vector<uint32_t> copies;
+		do
+		{
+			copies.push_back(copy);
+			copy = m_next_copy[copy];
+		} while(copy != c.from);
+		const std::vector<uint32_t> targets = m_targets;
+		for(size_t i = 0; i < copies.size(); i++)
+		{
+			collapse(copies[i], targets[i]);
+		}
+		m_max_cost = std::max(m_max_cost, cost);
+	}
+}
+
+void MeshSimplifier::getIndices(std::vector<uint32_t>& indices) const
+{
+	indices.clear();
+	for(size_t t = 0; t < m_triangle_alive.size(); t++)
+	{
+		if(m_triangle_alive[t])
+		{
+			for(int j = 0; j < 3; j++)
+			{
+				indices.push_back(m_model_vertices[m_triangles[t * 3 + j]]);
+			}
+		}
+	}
+}
+
+void buildLevelsOfDetail(Model* model, int max_levels, float reduction)
+{
+	model->m_levels_of_detail.clear();
+	model->m_lod_indices.clear();
+	if(model->m_indices.empty())
+	{
+		return;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Simplify the meshes on all cores, each down through all levels
+	///////////////////////////////////////////////////////////////////////
+	const size_t number_of_meshes = model->m_meshes.size();
+	std::vector<std::vector<std::vector<uint32_t>>> mesh_levels(number_of_meshes);
+	std::vector<std::vector<float>> mesh_errors(number_of_meshes);
+	const int number_of_threads = numberOfThreads(number_of_meshes, 1);
+	parallelFor(number_of_threads, [&](int thread) {
+		for(size_t m = thread; m < number_of_meshes; m += number_of_threads)
+		{
+			const Mesh& mesh = model->m_meshes[m];
+			MeshSimplifier simplifier(model, &model->m_indices[mesh.m_start_index], mesh.m_number_of_vertices);
+			float target = float(mesh.m_number_of_vertices / 3);
+			for(int level = 0; level < max_levels; level++)
+			{
+				target *= reduction;
+				simplifier.simplify(size_t(target));
+				mesh_levels[m].emplace_back();
+				std::vector<uint32_t>& indices = mesh_levels[m].back();
+				simplifier.getIndices(indices);
+				optimizeVertexCache(indices.data(), indices.size() / 3);
+				mesh_errors[m].push_back(simplifier.error());
+			}
+		}
+	});
+
+	///////////////////////////////////////////////////////////////////////
+	// Keep the levels that are worth drawing instead of the one before
+	///////////////////////////////////////////////////////////////////////
+	size_t previous_indices = model->m_indices.size();
+	for(int level = 0; level < max_levels; level++)
+	{
+		size_t level_indices = 0;
+		for(size_t m = 0; m < number_of_meshes; m++)
+		{
+			level_indices += mesh_levels[m][level].size();
+		}
+		if(level_indices == 0 || level_indices > previous_indices * 9 / 10)
+		{
+			break;
+		}
+		previous_indices = level_indices;
+		LevelOfDetail lod;
+		lod.m_error = 0.0f;
+		for(size_t m = 0; m < number_of_meshes; m++)
+		{
+			const std::vector<uint32_t>& indices = mesh_levels[m][level];
+			lod.m_error = std::max(lod.m_error, mesh_errors[m][level]);
+			lod.m_start_index.push_back(uint32_t(model->m_lod_indices.size()));
+			lod.m_number_of_indices.push_back(uint32_t(indices.size()));
+			model->m_lod_indices.insert(model->m_lod_indices.end(), indices.begin(), indices.end());
+		}
+		model->m_levels_of_detail.push_back(lod);
+	}
+}
+} // namespace labhelper
@@ -0,0 +1,23 @@
+#pragma once
+#include "Model.h"
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// Fill in m_levels_of_detail and m_lod_indices of an indexed model.
+///
+/// Each mesh is simplified with Garland and Heckbert's quadric error
+/// metric, by collapsing edges into one of their vertices, so that the
+/// simplified meshes keep using the model's vertices. Every level has about
+/// `reduction` times the triangles of the one before, and levels are added
+/// until there are `max_levels` of them or the meshes do not simplify any
+/// further.
+///
+/// Where the texture coordinates or normals are split, the vertices with
+/// the same position move together, and only along the split. The open
+/// edges of a mesh are kept in place by planes along them. Small separate
+/// pieces, such as the leaves of a tree, then end up as the last things to
+/// go, and disappear whole.
+///////////////////////////////////////////////////////////////////////////
+void buildLevelsOfDetail(Model* model, int max_levels = 4, float reduction = 0.5f);
+} // namespace labhelper
@@ -1,29 +1,30 @@
 #include "Model.h"
 #include "labhelper.h"
+#include "ModelCache.h"
+#include "MeshIndexing.h"
+#include "MeshSimplification.h"
+#include "Parallel.h"
 #include <iostream>
 #define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
 #include <tiny_obj_loader.h>
-//#include <experimental/tinyobj_loader_opt.h>
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <sstream>
 #include <iomanip>
+#include <iterator>
+#include <map>
+#include <thread>
 #include <GL/glew.h>
-#include <stb_image.h>
 
 namespace labhelper
 {
 void Texture::free()
 {
-	if(data)
-	{
-		stbi_image_free(data);
-		data = nullptr;
-	}
-	if(gl_id_internal)
-	{
-		glDeleteTextures(1, &gl_id_internal);
-		gl_id_internal = 0;
-	}
+	image.reset();
+	data = nullptr;
 }
 
 bool Texture::load(const std::string& _directory, const std::string& _filename, int _components)
@@ -31,49 +32,29 @@ bool Texture::load(const std::string& _directory, const std::string& _filename,
 	filename = file::normalise(_filename);
 	directory = file::normalise(_directory);
 	valid = true;
-	int components;
-	data = stbi_load((directory + filename).c_str(), &width, &height, &components, _components);
-	if(data == nullptr)
-	{
-		std::cout << "ERROR: loadModelFromOBJ(): Failed to load texture: " << filename << " in " << directory
-		          << "\n";
-		exit(1);
-	}
-	glGenTextures(1, &gl_id_internal);
-	gl_id = gl_id_internal;
-	glBindTexture(GL_TEXTURE_2D, gl_id_internal);
-	GLenum format, internal_format;
 	n_components = _components;
-	if(_components == 1)
-	{
-		format = GL_R;
-		internal_format = GL_R8;
-	}
-	else if(_components == 3)
-	{
-		format = GL_RGB;
-		internal_format = GL_RGB;
-	}
-	else if(_components == 4)
+	image = requestTexture(directory + filename, _components);
+	return true;
+}
+
+void Texture::wait()
+{
+	if(image)
 	{
-		format = GL_RGBA;
-		internal_format = GL_RGBA;
+		waitForTexture(*image);
+		width = image->width;
+		height = image->height;
+		data = image->data;
 	}
-	else
+}
+
+uint32_t Texture::glId() const
+{
+	if(gl_id != 0)
 	{
-		std::cout << "Texture loading not implemented for this number of compenents.\n";
-		exit(1);
+		return gl_id;
 	}
-	glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16);
-
-	glBindTexture(GL_TEXTURE_2D, 0);
-	return true;
+	return image && image->state == TextureImage::Uploaded ? image->gl_id : 0;
 }
 
 glm::vec4 Texture::sample(glm::vec2 uv) const
@@ -116,35 +97,316 @@ Model::~Model()
 	glDeleteBuffers(1, &m_positions_bo);
 	glDeleteBuffers(1, &m_normals_bo);
 	glDeleteBuffers(1, &m_texture_coordinates_bo);
+	if(m_indices_bo != 0)
+		glDeleteBuffers(1, &m_indices_bo);
+	if(m_materials_bo != 0)
+		glDeleteBuffers(1, &m_materials_bo);
+	if(m_instances_bo != 0)
+		glDeleteBuffers(1, &m_instances_bo);
 }
 
 
-Model* loadModelFromOBJ(std::string path)
+///////////////////////////////////////////////////////////////////////////
+// A multithreaded tinyobj::LoadObj(), with triangulation
+//
+// The file is read into memory and split into one chunk of lines per
+// thread. Each thread first finds and counts the lines of its chunk. The
+// counts tell where each chunk's vertex data goes, and how many vertices
+// precede each face (which relative indices refer to), so the threads can
+// then parse the vertex data and faces of their chunks with tinyobj's own
+// functions. The statements that change the state of the parser (groups,
+// objects and materials) are replayed in order at the end, in the same way
+// as tinyobj::LoadObj() handles them. The result is the same as that of
+// tinyobj::LoadObj().
+///////////////////////////////////////////////////////////////////////////
+enum ObjLineType
 {
-	std::string filename, extension, directory;
+	OBJ_POSITION,
+	OBJ_NORMAL,
+	OBJ_TEXCOORD,
+	OBJ_FACE,
+	OBJ_OTHER
+};
 
-	filename = file::normalise(path);
-	directory = file::parent_path(path);
-	filename = file::file_stem(path);
-	extension = file::file_extension(path);
+struct ObjLine
+{
+	ObjLineType type;
+	// The first character of the line that is not white space
+	const char* token;
+};
 
-	if(extension != ".obj")
+struct ObjChunk
+{
+	char* begin;
+	char* end;
+	std::vector<ObjLine> lines;
+	size_t number_of_positions = 0, number_of_normals = 0, number_of_texcoords = 0;
+	// How many of each come before this chunk
+	size_t first_position = 0, first_normal = 0, first_texcoord = 0;
+	std::vector<std::vector<tinyobj::vertex_index>> faces;
+};
+
+static bool isLineEnd(char c)
+{
+	return c == '\n' || c == '\r';
+}
+
+static void findLines(ObjChunk& chunk)
+{
+	// Terminate every line, so tinyobj's parsing functions stop at its end
+	std::replace_if(chunk.begin, chunk.end, isLineEnd, '\0');
+	for(const char* line = chunk.begin; line < chunk.end; line += strlen(line) + 1)
 	{
-		std::cout << "Fatal: loadModelFromOBJ(): Expecting filename ending in '.obj'\n";
-		exit(1);
+		const char* token = line + strspn(line, " \t");
+		if(token[0] == '\0' || token[0] == '#')
+		{
+			continue;
+		}
+		ObjLineType type = OBJ_OTHER;
+		if(token[0] == 'v' && IS_SPACE(token[1]))
+		{
+			type = OBJ_POSITION;
+			chunk.number_of_positions++;
+		}
+		else if(token[0] == 'v' && token[1] == 'n' && IS_SPACE(token[2]))
+		{
+			type = OBJ_NORMAL;
+			chunk.number_of_normals++;
+		}
+		else if(token[0] == 'v' && token[1] == 't' && IS_SPACE(token[2]))
+		{
+			type = OBJ_TEXCOORD;
+			chunk.number_of_texcoords++;
+		}
+		else if(token[0] == 'f' && IS_SPACE(token[1]))
+		{
+			type = OBJ_FACE;
+		}
+		chunk.lines.push_back({ type, token });
 	}
+}
+
+static void parseChunk(ObjChunk& chunk, tinyobj::attrib_t& attrib)
+{
+	size_t positions = chunk.first_position, normals = chunk.first_normal, texcoords = chunk.first_texcoord;
+	for(const ObjLine& line : chunk.lines)
+	{
+		const char* token = line.token;
+		if(line.type == OBJ_POSITION)
+		{
+			token += 2;
+			tinyobj::real_t* v = &attrib.vertices[3 * positions++];
+			tinyobj::parseReal3(&v[0], &v[1], &v[2], &token);
+		}
+		else if(line.type == OBJ_NORMAL)
+		{
+			token += 3;
+			tinyobj::real_t* vn = &attrib.normals[3 * normals++];
+			tinyobj::parseReal3(&vn[0], &vn[1], &vn[2], &token);
+		}
+		else if(line.type == OBJ_TEXCOORD)
+		{
+			token += 3;
+			tinyobj::real_t* vt = &attrib.texcoords[2 * texcoords++];
+			tinyobj::parseReal2(&vt[0], &vt[1], &token);
+		}
+		else if(line.type == OBJ_FACE)
+		{
+			token += 2;
+			token += strspn(token, " \t");
+			std::vector<tinyobj::vertex_index> face;
+			face.reserve(3);
+			while(!IS_NEW_LINE(token[0]))
+			{
+				face.push_back(tinyobj::parseTriple(&token, int(positions), int(normals), int(texcoords)));
+				token += strspn(token, " \t\r");
+			}
+			chunk.faces.push_back(std::move(face));
+		}
+	}
+}
+
+// Reads the first word after `token` the way tinyobj does
+static void scanName(const char* token, char (&namebuf)[TINYOBJ_SSCANF_BUFFER_SIZE])
+{
+#ifdef _MSC_VER
+	sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
+#else
+	std::sscanf(token, "%s", namebuf);
+#endif
+}
+
+static bool loadObjParallel(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+                            std::vector<tinyobj::material_t>* materials, std::string* err,
+                            const std::string& filename, const std::string& mtl_basedir)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if(!file)
+	{
+		(*err) += "Cannot open file [" + filename + "]\n";
+		return false;
+	}
+	std::vector<char> text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	text.push_back('\0');
 
 	///////////////////////////////////////////////////////////////////////
-	// Parse the OBJ file using tinyobj
+	// Split the file into chunks that start at the beginning of a line
+	///////////////////////////////////////////////////////////////////////
+	const int number_of_threads = numberOfThreads(text.size(), 1 << 20);
+	std::vector<ObjChunk> chunks(number_of_threads);
+	char* const text_end = text.data() + text.size();
+	char* chunk_begin = text.data();
+	for(int t = 0; t < number_of_threads; t++)
+	{
+		char* chunk_end = t + 1 == number_of_threads ? text_end
+		                                              : text.data() + text.size() * (t + 1) / number_of_threads;
+		chunk_end = std::max(chunk_end, chunk_begin);
+		while(chunk_end < text_end && chunk_end != chunk_begin && !isLineEnd(chunk_end[-1]))
+		{
+			chunk_end++;
+		}
+		chunks[t].begin = chunk_begin;
+		chunks[t].end = chunk_end;
+		chunk_begin = chunk_end;
+	}
+
+	parallelFor(number_of_threads, [&](int t) { findLines(chunks[t]); });
+
+	size_t positions = 0, normals = 0, texcoords = 0;
+	for(auto& chunk : chunks)
+	{
+		chunk.first_position = positions;
+		chunk.first_normal = normals;
+		chunk.first_texcoord = texcoords;
+		positions += chunk.number_of_positions;
+		normals += chunk.number_of_normals;
+		texcoords += chunk.number_of_texcoords;
+	}
+	attrib->vertices.assign(3 * positions, 0.0f);
+	attrib->normals.assign(3 * normals, 0.0f);
+	attrib->texcoords.assign(2 * texcoords, 0.0f);
+	shapes->clear();
+
+	parallelFor(number_of_threads, [&](int t) { parseChunk(chunks[t], *attrib); });
+
+	///////////////////////////////////////////////////////////////////////
+	// Replay the statements in order and gather the faces into shapes
+	///////////////////////////////////////////////////////////////////////
+	tinyobj::MaterialFileReader material_reader(mtl_basedir);
+	std::map<std::string, int> material_map;
+	std::vector<tinyobj::tag_t> tags;
+	std::vector<std::vector<tinyobj::vertex_index>> face_group;
+	std::string name;
+	int material = -1;
+	tinyobj::shape_t shape;
+	char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
+	for(auto& chunk : chunks)
+	{
+		size_t next_face = 0;
+		for(const ObjLine& line : chunk.lines)
+		{
+			const char* token = line.token;
+			if(line.type == OBJ_FACE)
+			{
+				face_group.push_back(std::move(chunk.faces[next_face++]));
+			}
+			// Anything else but the statements below is ignored, like the
+			// subdivision surface tags (t) that Model has no use for
+			if(line.type != OBJ_OTHER)
+			{
+				continue;
+			}
+			if(0 == strncmp(token, "usemtl", 6) && IS_SPACE(token[6]))
+			{
+				token += 7;
+				scanName(token, namebuf);
+				auto it = material_map.find(namebuf);
+				const int new_material = it == material_map.end() ? -1 : it->second;
+				if(new_material != material)
+				{
+					tinyobj::exportFaceGroupToShape(&shape, face_group, tags, material, name, true);
+					face_group.clear();
+					material = new_material;
+				}
+			}
+			else if(0 == strncmp(token, "mtllib", 6) && IS_SPACE(token[6]))
+			{
+				token += 7;
+				std::vector<std::string> filenames;
+				tinyobj::SplitString(std::string(token), ' ', filenames);
+				bool found = false;
+				for(const auto& mtl_filename : filenames)
+				{
+					std::string err_mtl;
+					found = material_reader(mtl_filename.c_str(), materials, &material_map, &err_mtl);
+					(*err) += err_mtl;
+					if(found)
+					{
+						break;
+					}
+				}
+				if(filenames.empty())
+				{
+					(*err) += "WARN: Looks like empty filename for mtllib. Use default material. \n";
+				}
+				else if(!found)
+				{
+					(*err) += "WARN: Failed to load material file(s). Use default material.\n";
+				}
+			}
+			else if((token[0] == 'g' || token[0] == 'o') && IS_SPACE(token[1]))
+			{
+				// A new group or object ends the shape
+				if(tinyobj::exportFaceGroupToShape(&shape, face_group, tags, material, name, true))
+				{
+					shapes->push_back(shape);
+				}
+				shape = tinyobj::shape_t();
+				face_group.clear();
+				if(token[0] == 'g')
+				{
+					// The first name of the group, 'g' itself being the 0th
+					std::vector<std::string> names;
+					while(!IS_NEW_LINE(token[0]))
+					{
+						names.push_back(tinyobj::parseString(&token));
+						token += strspn(token, " \t\r");
+					}
+					name = names.size() > 1 ? names[1] : "";
+				}
+				else
+				{
+					token += 2;
+					scanName(token, namebuf);
+					name = namebuf;
+				}
+			}
+		}
+	}
+	// As in tinyobj, a shape that ended with usemtl already has its faces
+	if(tinyobj::exportFaceGroupToShape(&shape, face_group, tags, material, name, true) || !shape.mesh.indices.empty())
+	{
+		shapes->push_back(shape);
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Parse an OBJ file into the materials, meshes and vertex streams of a
+// Model. Textures are only named here, they are loaded by the caller.
+///////////////////////////////////////////////////////////////////////////
+static void parseOBJ(const std::string& obj_filename, const std::string& directory, Model* model,
+                     std::vector<MaterialTextureFiles>& textures)
+{
+	///////////////////////////////////////////////////////////////////////
+	// Parse the OBJ file
 	///////////////////////////////////////////////////////////////////////
-	std::cout << "Loading " << path << "..." << std::flush;
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
 	std::string err;
 	// Expect '.mtl' file in the same directory and triangulate meshes
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err,
-	                            (directory + filename + extension).c_str(), directory.c_str(), true);
+	bool ret = loadObjParallel(&attrib, &shapes, &materials, &err, obj_filename, directory);
 	if(!err.empty())
 	{ // `err` may contain warning message.
 		std::cerr << err << std::endl;
@@ -153,9 +415,6 @@ Model* loadModelFromOBJ(std::string path)
 	{
 		exit(1);
 	}
-	Model* model = new Model;
-	model->m_name = filename;
-	model->m_filename = path;
 
 	///////////////////////////////////////////////////////////////////////
 	// Transform all materials into our datastructure
@@ -163,216 +422,433 @@ Model* loadModelFromOBJ(std::string path)
 	for(const auto& m : materials)
 	{
 		Material material;
+		MaterialTextureFiles files;
 		material.m_name = m.name;
 		material.m_color = glm::vec3(m.diffuse[0], m.diffuse[1], m.diffuse[2]);
-		if(m.diffuse_texname != "")
-		{
-			material.m_color_texture.load(directory, m.diffuse_texname, 4);
-		}
+		files.color = m.diffuse_texname;
 		material.m_metalness = m.metallic;
-		if(m.metallic_texname != "")
-		{
-			material.m_metalness_texture.load(directory, m.metallic_texname, 1);
-		}
+		files.metalness = m.metallic_texname;
 		material.m_fresnel = m.specular[0];
-		if(m.specular_texname != "")
-		{
-			material.m_fresnel_texture.load(directory, m.specular_texname, 1);
-		}
+		files.fresnel = m.specular_texname;
 		material.m_shininess = m.roughness;
-		if(m.roughness_texname != "")
-		{
-			material.m_shininess_texture.load(directory, m.roughness_texname, 1);
-		}
+		files.shininess = m.roughness_texname;
 		material.m_emission = glm::vec3(m.emission[0], m.emission[1], m.emission[2]);
-		if(m.emissive_texname != "")
-		{
-			material.m_emission_texture.load(directory, m.emissive_texname, 4);
-		}
+		files.emission = m.emissive_texname;
 		material.m_transparency = m.transmittance[0];
 		material.m_ior = m.ior;
 		model->m_materials.push_back(material);
+		textures.push_back(files);
 	}
 
 	///////////////////////////////////////////////////////////////////////
 	// A vertex in the OBJ file may have different indices for position,
-	// normal and texture coordinate. We will not even attempt to use
-	// indexed lookups, but will store a simple vertex stream per mesh.
+	// normal and texture coordinate. We store a simple vertex stream per
+	// mesh here, which buildIndexedMesh() then welds into indexed vertices.
 	///////////////////////////////////////////////////////////////////////
 	uint64_t number_of_vertices = 0;
-	for(const auto& shape : shapes)
+	std::vector<size_t> first_face(shapes.size() + 1, 0);
+	for(size_t s = 0; s < shapes.size(); s++)
 	{
-		number_of_vertices += shape.mesh.indices.size();
+		number_of_vertices += shapes[s].mesh.indices.size();
+		first_face[s + 1] = first_face[s] + shapes[s].mesh.indices.size() / 3;
 	}
+	const size_t number_of_faces = first_face.back();
 	model->m_positions.resize(number_of_vertices);
 	model->m_normals.resize(number_of_vertices);
 	model->m_texture_coordinates.resize(number_of_vertices);
+	const int number_of_threads = numberOfThreads(number_of_faces, 1 << 14);
+	auto face_index = [&](size_t s, size_t f, int j) -> const tinyobj::index_t& {
+		return shapes[s].mesh.indices[f * 3 + j];
+	};
 
 	///////////////////////////////////////////////////////////////////////
 	// For each vertex _position_ auto generate a normal that will be used
-	// if no normal is supplied.
+	// if no normal is supplied. The face normals are computed in parallel.
+	// Each thread then adds them up for a range of the vertices, in the
+	// order of the faces, so the sums don't depend on the threads.
 	///////////////////////////////////////////////////////////////////////
-	std::vector<glm::vec4> auto_normals(attrib.vertices.size() / 3);
-	for(const auto& shape : shapes)
-	{
-		for(int face = 0; face < int(shape.mesh.indices.size()) / 3; face++)
+	auto position = [&](int v) {
+		return glm::vec3(attrib.vertices[v * 3 + 0], attrib.vertices[v * 3 + 1], attrib.vertices[v * 3 + 2]);
+	};
+	std::vector<glm::vec3> face_normals(number_of_faces);
+	parallelFor(number_of_threads, [&](int t) {
+		for(size_t s = 0; s < shapes.size(); s++)
 		{
-			glm::vec3 v0 = glm::vec3(attrib.vertices[shape.mesh.indices[face * 3 + 0].vertex_index * 3 + 0],
-			                         attrib.vertices[shape.mesh.indices[face * 3 + 0].vertex_index * 3 + 1],
-			                         attrib.vertices[shape.mesh.indices[face * 3 + 0].vertex_index * 3 + 2]);
-			glm::vec3 v1 = glm::vec3(attrib.vertices[shape.mesh.indices[face * 3 + 1].vertex_index * 3 + 0],
-			                         attrib.vertices[shape.mesh.indices[face * 3 + 1].vertex_index * 3 + 1],
-			                         attrib.vertices[shape.mesh.indices[face * 3 + 1].vertex_index * 3 + 2]);
-			glm::vec3 v2 = glm::vec3(attrib.vertices[shape.mesh.indices[face * 3 + 2].vertex_index * 3 + 0],
-			                         attrib.vertices[shape.mesh.indices[face * 3 + 2].vertex_index * 3 + 1],
-			                         attrib.vertices[shape.mesh.indices[face * 3 + 2].vertex_index * 3 + 2]);
-
-			glm::vec3 e0 = glm::normalize(v1 - v0);
-			glm::vec3 e1 = glm::normalize(v2 - v0);
-			glm::vec3 face_normal = cross(e0, e1);
+			const size_t begin = std::max(first_face[s], number_of_faces * t / number_of_threads);
+			const size_t end = std::min(first_face[s + 1], number_of_faces * (t + 1) / number_of_threads);
+			for(size_t face = begin; face < end; face++)
+			{
+				glm::vec3 v0 = position(face_index(s, face - first_face[s], 0).vertex_index);
+				glm::vec3 v1 = position(face_index(s, face - first_face[s], 1).vertex_index);
+				glm::vec3 v2 = position(face_index(s, face - first_face[s], 2).vertex_index);
 
-			auto_normals[shape.mesh.indices[face * 3 + 0].vertex_index] += glm::vec4(face_normal, 1.0f);
-			auto_normals[shape.mesh.indices[face * 3 + 1].vertex_index] += glm::vec4(face_normal, 1.0f);
-			auto_normals[shape.mesh.indices[face * 3 + 2].vertex_index] += glm::vec4(face_normal, 1.0f);
+				glm::vec3 e0 = glm::normalize(v1 - v0);
+				glm::vec3 e1 = glm::normalize(v2 - v0);
+				face_normals[face] = cross(e0, e1);
+			}
 		}
-	}
-	for(auto& normal : auto_normals)
-	{
-		normal = (1.0f / normal.w) * normal;
-	}
+	});
+	const size_t number_of_positions = attrib.vertices.size() / 3;
+	std::vector<glm::vec4> auto_normals(number_of_positions);
+	parallelFor(number_of_threads, [&](int t) {
+		const int begin = int(number_of_positions * t / number_of_threads);
+		const int end = int(number_of_positions * (t + 1) / number_of_threads);
+		for(size_t s = 0; s < shapes.size(); s++)
+		{
+			for(size_t face = first_face[s]; face < first_face[s + 1]; face++)
+			{
+				for(int j = 0; j < 3; j++)
+				{
+					const int v = face_index(s, face - first_face[s], j).vertex_index;
+					if(v >= begin && v < end)
+					{
+						auto_normals[v] += glm::vec4(face_normals[face], 1.0f);
+					}
+				}
+			}
+		}
+		for(int v = begin; v < end; v++)
+		{
+			auto_normals[v] = (1.0f / auto_normals[v].w) * auto_normals[v];
+		}
+	});
 
 	///////////////////////////////////////////////////////////////////////
 	// Now we will turn all shapes into Meshes. A shape that has several
-	// materials will be split into several meshes with unique names
+	// materials will be split into several meshes with unique names, in
+	// the order the materials are first used. Faces without a material
+	// are left out, and so is a shape whose first face has none. The
+	// meshes are laid out first, and then filled in in parallel.
 	///////////////////////////////////////////////////////////////////////
-	int vertices_so_far = 0;
-	for(int s = 0; s < shapes.size(); ++s)
+	std::vector<int64_t> face_destination(number_of_faces, -1);
+	std::vector<uint32_t> faces_with_material(materials.size(), 0);
+	std::vector<uint32_t> material_cursor(materials.size(), 0);
+	uint32_t vertices_so_far = 0;
+	for(size_t s = 0; s < shapes.size(); ++s)
 	{
 		const auto& shape = shapes[s];
-		///////////////////////////////////////////////////////////////////
-		// The shapes in an OBJ file may several different materials.
-		// If so, we will split the shape into one Mesh per Material
-		///////////////////////////////////////////////////////////////////
-		int next_material_index = shape.mesh.material_ids[0];
-		int next_material_starting_face = 0;
-		std::vector<bool> finished_materials(materials.size(), false);
-		int number_of_materials_in_shape = 0;
-		while(next_material_index != -1)
-		{
-			int current_material_index = next_material_index;
-			int current_material_starting_face = next_material_starting_face;
-			next_material_index = -1;
-			next_material_starting_face = -1;
-			// Process a new Mesh with a unique material
+		if(shape.mesh.material_ids[0] == -1)
+		{
+			continue;
+		}
+		std::vector<int> shape_materials;
+		for(int material : shape.mesh.material_ids)
+		{
+			if(material >= 0 && faces_with_material[material]++ == 0)
+			{
+				shape_materials.push_back(material);
+			}
+		}
+		for(int material : shape_materials)
+		{
 			Mesh mesh;
-			mesh.m_name = shape.name + "_" + materials[current_material_index].name;
-			mesh.m_material_idx = current_material_index;
+			mesh.m_name = shape_materials.size() == 1 ? shape.name : shape.name + "_" + materials[material].name;
+			mesh.m_material_idx = material;
 			mesh.m_start_index = vertices_so_far;
-			number_of_materials_in_shape += 1;
-
-			uint64_t number_of_faces = shape.mesh.indices.size() / 3;
-			for(int i = current_material_starting_face; i < number_of_faces; i++)
+			mesh.m_number_of_vertices = 3 * faces_with_material[material];
+			model->m_meshes.push_back(mesh);
+			material_cursor[material] = vertices_so_far;
+			vertices_so_far += mesh.m_number_of_vertices;
+		}
+		for(size_t i = 0; i < shape.mesh.material_ids.size(); i++)
+		{
+			const int material = shape.mesh.material_ids[i];
+			if(material >= 0)
 			{
-				if(shape.mesh.material_ids[i] != current_material_index)
+				face_destination[first_face[s] + i] = material_cursor[material];
+				material_cursor[material] += 3;
+			}
+		}
+		for(int material : shape_materials)
+		{
+			faces_with_material[material] = 0;
+		}
+	}
+	parallelFor(number_of_threads, [&](int t) {
+		for(size_t s = 0; s < shapes.size(); s++)
+		{
+			const size_t begin = std::max(first_face[s], number_of_faces * t / number_of_threads);
+			const size_t end = std::min(first_face[s + 1], number_of_faces * (t + 1) / number_of_threads);
+			for(size_t face = begin; face < end; face++)
+			{
+				if(face_destination[face] < 0)
 				{
-					if(next_material_index >= 0)
-						continue;
-					else if(finished_materials[shape.mesh.material_ids[i]])
-						continue;
-					else
-					{ // Found a new material that we have not processed.
-						next_material_index = shape.mesh.material_ids[i];
-						next_material_starting_face = i;
-					}
+					continue;
 				}
-				else
+				for(int j = 0; j < 3; j++)
 				{
-					///////////////////////////////////////////////////////
-					// Now we generate the vertices
-					///////////////////////////////////////////////////////
-					for(int j = 0; j < 3; j++)
+					const size_t vertex = size_t(face_destination[face]) + j;
+					const tinyobj::index_t& index = face_index(s, face - first_face[s], j);
+					model->m_positions[vertex] = position(index.vertex_index);
+					if(index.normal_index == -1)
+					{
+						// No normal, use the autogenerated
+						model->m_normals[vertex] = glm::vec3(auto_normals[index.vertex_index]);
+					}
+					else
+					{
+						model->m_normals[vertex] = glm::vec3(attrib.normals[index.normal_index * 3 + 0],
+						                                     attrib.normals[index.normal_index * 3 + 1],
+						                                     attrib.normals[index.normal_index * 3 + 2]);
+					}
+					if(index.texcoord_index == -1)
+					{
+						// No UV coordinates. Use null.
+						model->m_texture_coordinates[vertex] = glm::vec2(0.0f);
+					}
+					else
 					{
-						int v = shape.mesh.indices[i * 3 + j].vertex_index;
-						model->m_positions[vertices_so_far + j] =
-						    glm::vec3(attrib.vertices[shape.mesh.indices[i * 3 + j].vertex_index * 3 + 0],
-						              attrib.vertices[shape.mesh.indices[i * 3 + j].vertex_index * 3 + 1],
-						              attrib.vertices[shape.mesh.indices[i * 3 + j].vertex_index * 3 + 2]);
-						if(shape.mesh.indices[i * 3 + j].normal_index == -1)
-						{
-							// No normal, use the autogenerated
-							model->m_normals[vertices_so_far + j] = glm::vec3(
-							    auto_normals[shape.mesh.indices[i * 3 + j].vertex_index]);
-						}
-						else
-						{
-							model->m_normals[vertices_so_far + j] =
-							    glm::vec3(attrib.normals[shape.mesh.indices[i * 3 + j].normal_index * 3 + 0],
-							              attrib.normals[shape.mesh.indices[i * 3 + j].normal_index * 3 + 1],
-							              attrib.normals[shape.mesh.indices[i * 3 + j].normal_index * 3 + 2]);
-						}
-						if(shape.mesh.indices[i * 3 + j].texcoord_index == -1)
-						{
-							// No UV coordinates. Use null.
-							model->m_texture_coordinates[vertices_so_far + j] = glm::vec2(0.0f);
-						}
-						else
-						{
-							model->m_texture_coordinates[vertices_so_far + j] = glm::vec2(
-							    attrib.texcoords[shape.mesh.indices[i * 3 + j].texcoord_index * 2 + 0],
-							    attrib.texcoords[shape.mesh.indices[i * 3 + j].texcoord_index * 2 + 1]);
-						}
+						model->m_texture_coordinates[vertex] =
+						    glm::vec2(attrib.texcoords[index.texcoord_index * 2 + 0],
+						              attrib.texcoords[index.texcoord_index * 2 + 1]);
 					}
-					vertices_so_far += 3;
 				}
 			}
-			///////////////////////////////////////////////////////////////
-			// Finalize and push this mesh to the list
-			///////////////////////////////////////////////////////////////
-			mesh.m_number_of_vertices = vertices_so_far - mesh.m_start_index;
-			model->m_meshes.push_back(mesh);
-			finished_materials[current_material_index] = true;
 		}
-		if(number_of_materials_in_shape == 1)
+	});
+
+	std::sort(model->m_meshes.begin(), model->m_meshes.end(),
+	          [](const Mesh& a, const Mesh& b) { return a.m_name < b.m_name; });
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The files a model is parsed from: the OBJ file and the material
+// libraries it names
+///////////////////////////////////////////////////////////////////////////
+static std::vector<std::string> objSources(const std::string& obj_filename, const std::string& directory)
+{
+	std::vector<std::string> sources = { obj_filename };
+	std::ifstream file(obj_filename);
+	std::string line;
+	while(std::getline(file, line))
+	{
+		if(line.compare(0, 6, "mtllib") != 0)
+		{
+			continue;
+		}
+		std::istringstream in(line.substr(6));
+		std::string name;
+		while(in >> name)
 		{
-			// If there's only one material, we don't need the material name in the mesh name
-			model->m_meshes.back().m_name = shape.name;
+			sources.push_back(directory + name);
 		}
 	}
+	return sources;
+}
 
-	std::sort(model->m_meshes.begin(), model->m_meshes.end(),
-	          [](const Mesh& a, const Mesh& b) { return a.m_name < b.m_name; });
+bool use_indexed_models = true;
+bool print_model_statistics = false;
+
+// The bounding boxes of the meshes and of the whole model, for culling
+static void computeBounds(Model* model)
+{
+	model->m_aabb_min = glm::vec3(0.0f);
+	model->m_aabb_max = glm::vec3(0.0f);
+	bool first_mesh = true;
+	for(Mesh& mesh : model->m_meshes)
+	{
+		mesh.m_aabb_min = glm::vec3(0.0f);
+		mesh.m_aabb_max = glm::vec3(0.0f);
+		if(mesh.m_number_of_vertices == 0)
+		{
+			continue;
+		}
+		// The corners of a mesh are a range of the de-indexed positions,
+		// also when the model is drawn indexed
+		const glm::vec3* positions = &model->m_positions[mesh.m_start_index];
+		mesh.m_aabb_min = mesh.m_aabb_max = positions[0];
+		for(uint32_t i = 1; i < mesh.m_number_of_vertices; i++)
+		{
+			mesh.m_aabb_min = glm::min(mesh.m_aabb_min, positions[i]);
+			mesh.m_aabb_max = glm::max(mesh.m_aabb_max, positions[i]);
+		}
+		model->m_aabb_min = first_mesh ? mesh.m_aabb_min : glm::min(model->m_aabb_min, mesh.m_aabb_min);
+		model->m_aabb_max = first_mesh ? mesh.m_aabb_max : glm::max(model->m_aabb_max, mesh.m_aabb_max);
+		first_mesh = false;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Upload the vertex streams of a model to the GPU. Indexed models get the
+// welded vertices and an element buffer, others one vertex per corner.
+///////////////////////////////////////////////////////////////////////////
+static void uploadModel(Model* model)
+{
+	const bool indexed = use_indexed_models && !model->m_indices.empty();
+	std::vector<glm::vec3> welded_positions, welded_normals;
+	std::vector<glm::vec2> welded_texture_coordinates;
+	if(indexed)
+	{
+		for(uint32_t v : model->m_welded_vertices)
+		{
+			welded_positions.push_back(model->m_positions[v]);
+			welded_normals.push_back(model->m_normals[v]);
+			welded_texture_coordinates.push_back(model->m_texture_coordinates[v]);
+		}
+	}
+	const std::vector<glm::vec3>& positions = indexed ? welded_positions : model->m_positions;
+	const std::vector<glm::vec3>& normals = indexed ? welded_normals : model->m_normals;
+	const std::vector<glm::vec2>& texture_coordinates =
+	    indexed ? welded_texture_coordinates : model->m_texture_coordinates;
 
-	///////////////////////////////////////////////////////////////////////
-	// Upload to GPU
-	///////////////////////////////////////////////////////////////////////
 	glGenVertexArrays(1, &model->m_vaob);
 	glBindVertexArray(model->m_vaob);
 	glGenBuffers(1, &model->m_positions_bo);
 	glBindBuffer(GL_ARRAY_BUFFER, model->m_positions_bo);
-	glBufferData(GL_ARRAY_BUFFER, model->m_positions.size() * sizeof(glm::vec3), &model->m_positions[0].x,
-	             GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), &positions[0].x, GL_STATIC_DRAW);
 	glVertexAttribPointer(0, 3, GL_FLOAT, false, 0, 0);
 	glEnableVertexAttribArray(0);
 	glGenBuffers(1, &model->m_normals_bo);
 	glBindBuffer(GL_ARRAY_BUFFER, model->m_normals_bo);
-	glBufferData(GL_ARRAY_BUFFER, model->m_normals.size() * sizeof(glm::vec3), &model->m_normals[0].x,
-	             GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), &normals[0].x, GL_STATIC_DRAW);
 	glVertexAttribPointer(1, 3, GL_FLOAT, false, 0, 0);
 	glEnableVertexAttribArray(1);
 	glGenBuffers(1, &model->m_texture_coordinates_bo);
 	glBindBuffer(GL_ARRAY_BUFFER, model->m_texture_coordinates_bo);
-	glBufferData(GL_ARRAY_BUFFER, model->m_texture_coordinates.size() * sizeof(glm::vec2),
-	             &model->m_texture_coordinates[0].x, GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, texture_coordinates.size() * sizeof(glm::vec2), &texture_coordinates[0].x,
+	             GL_STATIC_DRAW);
 	glVertexAttribPointer(2, 2, GL_FLOAT, false, 0, 0);
 	glEnableVertexAttribArray(2);
+	if(indexed)
+	{
+		// The element buffer binding is part of the vertex array object. The
+		// levels of detail follow the full meshes.
+		const size_t full_size = model->m_indices.size() * sizeof(uint32_t);
+		const size_t lod_size = model->m_lod_indices.size() * sizeof(uint32_t);
+		glGenBuffers(1, &model->m_indices_bo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->m_indices_bo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, full_size + lod_size, nullptr, GL_STATIC_DRAW);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, full_size, model->m_indices.data());
+		if(lod_size != 0)
+		{
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, full_size, lod_size, model->m_lod_indices.data());
+		}
+	}
 
 	glBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	updateMaterials(model);
+}
+
+Model* loadModelFromOBJ(std::string path)
+{
+	std::string filename, extension, directory;
+
+	filename = file::normalise(path);
+	directory = file::parent_path(path);
+	filename = file::file_stem(path);
+	extension = file::file_extension(path);
+
+	if(extension != ".obj")
+	{
+		std::cout << "Fatal: loadModelFromOBJ(): Expecting filename ending in '.obj'\n";
+		exit(1);
+	}
+
+	std::cout << "Loading " << path << "..." << std::flush;
+	auto start_time = std::chrono::high_resolution_clock::now();
+	Model* model = new Model;
+	model->m_name = filename;
+	model->m_filename = path;
+
+	///////////////////////////////////////////////////////////////////////
+	// Use the binary cache if it is up to date, and otherwise parse the
+	// OBJ file and write the cache for the next time
+	///////////////////////////////////////////////////////////////////////
+	const std::string obj_filename = directory + filename + extension;
+	std::vector<MaterialTextureFiles> textures;
+	const bool from_cache = readModelCache(obj_filename, model, textures);
+	if(!from_cache)
+	{
+		parseOBJ(obj_filename, directory, model, textures);
+		buildIndexedMesh(model);
+		buildLevelsOfDetail(model);
+		writeModelCache(obj_filename, objSources(obj_filename, directory), model, textures);
+	}
+	computeBounds(model);
 
-	std::cout << "done.\n";
+	///////////////////////////////////////////////////////////////////////
+	// Load the textures of the materials
+	///////////////////////////////////////////////////////////////////////
+	for(size_t i = 0; i < model->m_materials.size(); i++)
+	{
+		Material& material = model->m_materials[i];
+		const MaterialTextureFiles& files = textures[i];
+		if(files.color != "")
+		{
+			material.m_color_texture.load(directory, files.color, 4);
+		}
+		if(files.metalness != "")
+		{
+			material.m_metalness_texture.load(directory, files.metalness, 1);
+		}
+		if(files.fresnel != "")
+		{
+			material.m_fresnel_texture.load(directory, files.fresnel, 1);
+		}
+		if(files.shininess != "")
+		{
+			material.m_shininess_texture.load(directory, files.shininess, 1);
+		}
+		if(files.emission != "")
+		{
+			material.m_emission_texture.load(directory, files.emission, 4);
+		}
+	}
+
+	uploadModel(model);
+
+	std::chrono::duration<double, std::milli> load_time = std::chrono::high_resolution_clock::now() - start_time;
+	std::cout << "done (" << (from_cache ? "from cache, " : "") << std::fixed << std::setprecision(1)
+	          << load_time.count() << std::defaultfloat << " ms).\n";
+	if(print_model_statistics && model->m_indices_bo != 0)
+	{
+		const size_t vertex_size = 2 * sizeof(glm::vec3) + sizeof(glm::vec2);
+		const size_t corners = model->m_indices.size();
+		const size_t vertices = model->m_welded_vertices.size();
+		std::cout << "    " << vertices << " vertices for " << corners << " corners, "
+		          << (vertices * vertex_size + corners * sizeof(uint32_t)) / 1024 << " of "
+		          << corners * vertex_size / 1024 << " KB";
+		// Simulating the post-transform cache takes a while, so it is only
+		// done when the indices have just been optimized for it. Each corner
+		// is one vertex shader invocation when drawn de-indexed.
+		if(!from_cache)
+		{
+			std::cout << ", about " << vertexShaderInvocations(model) << " vertex shader invocations per render() instead of "
+			          << corners;
+		}
+		std::cout << ".\n";
+		if(!model->m_levels_of_detail.empty())
+		{
+			std::cout << "    Levels of detail:";
+			for(int level = 0; level < numberOfLevels(model); level++)
+			{
+				std::cout << (level == 0 ? " " : ", ") << numberOfTriangles(model, level) << " triangles";
+				if(level > 0)
+				{
+					std::cout << " (error " << model->m_levels_of_detail[level - 1].m_error << ")";
+				}
+			}
+			std::cout << ".\n";
+		}
+	}
 	return model;
 }
 
+void waitForTextures(Model* model)
+{
+	for(auto& material : model->m_materials)
+	{
+		material.m_color_texture.wait();
+		material.m_shininess_texture.wait();
+		material.m_metalness_texture.wait();
+		material.m_fresnel_texture.wait();
+		material.m_emission_texture.wait();
+	}
+}
+
 void saveModelMaterialsToMTL(Model* model, std::string filename)
 {
 	///////////////////////////////////////////////////////////////////////
@@ -478,30 +954,172 @@ void freeModel(Model* model)
 		delete model;
 }
 
-///////////////////////////////////////////////////////////////////////
-// Loop through all Meshes in the Model and render them
-///////////////////////////////////////////////////////////////////////
-void render(const Model* model, const bool submitMaterials)
+///////////////////////////////////////////////////////////////////////////////
+// The MaterialBlock of the shaders, in std140 layout
+///////////////////////////////////////////////////////////////////////////////
+struct MaterialBlock
+{
+	glm::vec3 color;
+	float metalness;
+	glm::vec3 emission;
+	float fresnel;
+	float shininess;
+	float padding[3];
+};
+static const GLuint material_block_binding = 0;
+
+static MaterialBlock materialBlock(const Material& material)
+{
+	MaterialBlock block = {};
+	block.color = material.m_color;
+	block.metalness = material.m_metalness;
+	block.emission = material.m_emission;
+	block.fresnel = material.m_fresnel;
+	block.shininess = material.m_shininess;
+	return block;
+}
+
+void updateMaterials(Model* model)
+{
+	if(model->m_materials.empty())
+	{
+		return;
+	}
+	if(model->m_materials_bo == 0)
+	{
+		// Each material starts where a range of the buffer may be bound
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		alignment = std::max(alignment, 1);
+		model->m_material_stride = uint32_t((sizeof(MaterialBlock) + alignment - 1) / alignment * alignment);
+		glGenBuffers(1, &model->m_materials_bo);
+	}
+	std::vector<uint8_t> blocks(model->m_materials.size() * model->m_material_stride);
+	for(size_t i = 0; i < model->m_materials.size(); i++)
+	{
+		const MaterialBlock block = materialBlock(model->m_materials[i]);
+		memcpy(&blocks[i * model->m_material_stride], &block, sizeof(block));
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, model->m_materials_bo);
+	glBufferData(GL_UNIFORM_BUFFER, blocks.size(), blocks.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void bindDefaultMaterial()
+{
+	static GLuint buffer = 0;
+	if(buffer == 0)
+	{
+		Material material;
+		material.m_color = glm::vec3(1.0f);
+		material.m_metalness = 0.0f;
+		material.m_emission = glm::vec3(0.0f);
+		material.m_fresnel = 0.0f;
+		material.m_shininess = 0.0f;
+		const MaterialBlock block = materialBlock(material);
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(block), &block, GL_STATIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	glBindBufferBase(GL_UNIFORM_BUFFER, material_block_binding, buffer);
+}
+
+enum MaterialUniform
+{
+	HasColorTexture,
+	HasEmissionTexture,
+	MaterialColor,
+	MaterialMetalness,
+	MaterialFresnel,
+	MaterialShininess,
+	MaterialEmission,
+	NumberOfMaterialUniforms
+};
+static const char* const material_uniform_names[NumberOfMaterialUniforms] = {
+	"has_color_texture", "has_emission_texture", "material_color",   "material_metalness",
+	"material_fresnel",  "material_shininess",   "material_emission"
+};
+static const char* const material_block_names[] = { "MaterialBlock" };
+
+void setInstanceMatrices(Model* model, const std::vector<glm::mat4>& matrices)
+{
+	if(model->m_instances_bo == 0)
+	{
+		// A mat4 attribute takes four locations, one per column
+		glGenBuffers(1, &model->m_instances_bo);
+		glBindVertexArray(model->m_vaob);
+		glBindBuffer(GL_ARRAY_BUFFER, model->m_instances_bo);
+		for(int column = 0; column < 4; column++)
+		{
+			const GLuint location = 3 + column;
+			glVertexAttribPointer(location, 4, GL_FLOAT, false, sizeof(glm::mat4),
+			                      (const void*)(column * sizeof(glm::vec4)));
+			glEnableVertexAttribArray(location);
+			glVertexAttribDivisor(location, 1);
+		}
+		glBindVertexArray(0);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, model->m_instances_bo);
+	// Dynamic, since a culled set of instances is set every frame
+	glBufferData(GL_ARRAY_BUFFER, matrices.size() * sizeof(glm::mat4), matrices.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	model->m_number_of_instances = uint32_t(matrices.size());
+}
+
+// Draws `instances` instances of each mesh at a level of detail, or the mesh
+// on its own if 0. Meshes outside `frustum` are skipped, if there is one.
+// Returns the number of meshes drawn.
+static size_t renderMeshes(const Model* model, const bool submitMaterials, const GLsizei instances,
+                           const Frustum* frustum, const int level = 0)
 {
 	GLint current_program = 0;
 	glGetIntegerv(GL_CURRENT_PROGRAM, &current_program);
+	const GLint* uniforms = nullptr;
+	bool material_block = false;
+	if(submitMaterials)
+	{
+		uniforms = getUniformLocations(current_program, material_uniform_names, NumberOfMaterialUniforms);
+		material_block = model->m_materials_bo != 0
+		                 && getUniformBlockIndices(current_program, material_block_names, 1)[0] != GL_INVALID_INDEX;
+	}
 
 	glBindVertexArray(model->m_vaob);
-	for(auto& mesh : model->m_meshes)
+	uint32_t bound_material = UINT32_MAX;
+	size_t drawn = 0;
+	const LevelOfDetail* lod = level > 0 ? &model->m_levels_of_detail[level - 1] : nullptr;
+	for(size_t m = 0; m < model->m_meshes.size(); m++)
 	{
+		const Mesh& mesh = model->m_meshes[m];
+		if(frustum != nullptr && !intersects(*frustum, mesh.m_aabb_min, mesh.m_aabb_max))
+		{
+			continue;
+		}
+		// Meshes simplified away entirely
+		if(lod != nullptr && lod->m_number_of_indices[m] == 0)
+		{
+			continue;
+		}
+		drawn++;
 		if(submitMaterials)
 		{
 			const Material& material = model->m_materials[mesh.m_material_idx];
 
-			bool has_color_texture = material.m_color_texture.valid;
+			// Textures that are still loading are left out, and the
+			// material's own values stand in for them until they are
+			// uploaded
+			const uint32_t color_texture = material.m_color_texture.valid ? material.m_color_texture.glId() : 0;
+			const uint32_t emission_texture =
+			    material.m_emission_texture.valid ? material.m_emission_texture.glId() : 0;
+			bool has_color_texture = color_texture != 0;
 			bool has_metalness_texture = material.m_metalness_texture.valid;
 			bool has_fresnel_texture = material.m_fresnel_texture.valid;
 			bool has_shininess_texture = material.m_shininess_texture.valid;
-			bool has_emission_texture = material.m_emission_texture.valid;
+			bool has_emission_texture = emission_texture != 0;
 			if(has_color_texture)
 			{
 				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, material.m_color_texture.gl_id);
+				glBindTexture(GL_TEXTURE_2D, color_texture);
 			}
 			// Actually unused in the labs
 			/*
@@ -524,18 +1142,31 @@ void render(const Model* model, const bool submitMaterials)
 			if(has_emission_texture)
 			{
 				glActiveTexture(GL_TEXTURE5);
-				glBindTexture(GL_TEXTURE_2D, material.m_emission_texture.gl_id);
+				glBindTexture(GL_TEXTURE_2D, emission_texture);
 			}
 			glActiveTexture(GL_TEXTURE0);
 
-			setUniformSlow(current_program, "has_color_texture", has_color_texture);
-			setUniformSlow(current_program, "has_emission_texture", has_emission_texture);
+			glUniform1i(uniforms[HasColorTexture], has_color_texture ? 1 : 0);
+			glUniform1i(uniforms[HasEmissionTexture], has_emission_texture ? 1 : 0);
 
-			setUniformSlow(current_program, "material_color", material.m_color);
-			setUniformSlow(current_program, "material_metalness", material.m_metalness);
-			setUniformSlow(current_program, "material_fresnel", material.m_fresnel);
-			setUniformSlow(current_program, "material_shininess", material.m_shininess);
-			setUniformSlow(current_program, "material_emission", material.m_emission);
+			if(material_block)
+			{
+				if(mesh.m_material_idx != bound_material)
+				{
+					glBindBufferRange(GL_UNIFORM_BUFFER, material_block_binding, model->m_materials_bo,
+					                  GLintptr(mesh.m_material_idx) * model->m_material_stride,
+					                  sizeof(MaterialBlock));
+					bound_material = mesh.m_material_idx;
+				}
+			}
+			else
+			{
+				glUniform3fv(uniforms[MaterialColor], 1, &material.m_color.x);
+				glUniform1f(uniforms[MaterialMetalness], material.m_metalness);
+				glUniform1f(uniforms[MaterialFresnel], material.m_fresnel);
+				glUniform1f(uniforms[MaterialShininess], material.m_shininess);
+				glUniform3fv(uniforms[MaterialEmission], 1, &material.m_emission.x);
+			}
 
 			// Actually unused in the labs
 			/*
@@ -544,8 +1175,137 @@ void render(const Model* model, const bool submitMaterials)
 			setUniformSlow( current_program, "has_shininess_texture", has_shininess_texture );
 			*/
 		}
-		glDrawArrays(GL_TRIANGLES, mesh.m_start_index, (GLsizei)mesh.m_number_of_vertices);
+		GLsizei count = (GLsizei)mesh.m_number_of_vertices;
+		if(model->m_indices_bo != 0)
+		{
+			size_t start_index = mesh.m_start_index;
+			if(lod != nullptr)
+			{
+				start_index = model->m_indices.size() + lod->m_start_index[m];
+				count = GLsizei(lod->m_number_of_indices[m]);
+			}
+			const void* first_index = (const void*)(start_index * sizeof(uint32_t));
+			if(instances > 0)
+			{
+				glDrawElementsInstanced(GL_TRIANGLES, count, GL_UNSIGNED_INT, first_index, instances);
+			}
+			else
+			{
+				glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, first_index);
+			}
+		}
+		else if(instances > 0)
+		{
+			glDrawArraysInstanced(GL_TRIANGLES, mesh.m_start_index, count, instances);
+		}
+		else
+		{
+			glDrawArrays(GL_TRIANGLES, mesh.m_start_index, count);
+		}
 	}
 	glBindVertexArray(0);
+	return drawn;
+}
+
+void render(const Model* model, const bool submitMaterials)
+{
+	renderMeshes(model, submitMaterials, 0, nullptr);
+}
+
+size_t render(const Model* model, const Frustum& frustum, const bool submitMaterials)
+{
+	return renderMeshes(model, submitMaterials, 0, &frustum);
+}
+
+void render(const Model* model, int level, const bool submitMaterials)
+{
+	renderMeshes(model, submitMaterials, 0, nullptr, std::min(level, numberOfLevels(model) - 1));
+}
+
+size_t render(const Model* model, const Frustum& frustum, int level, const bool submitMaterials)
+{
+	return renderMeshes(model, submitMaterials, 0, &frustum, std::min(level, numberOfLevels(model) - 1));
+}
+
+void renderInstanced(const Model* model, const bool submitMaterials)
+{
+	if(model->m_number_of_instances > 0)
+	{
+		renderMeshes(model, submitMaterials, GLsizei(model->m_number_of_instances), nullptr);
+	}
+}
+
+// Points the instance attributes at the matrix of instance `first`
+static void setFirstInstance(const Model* model, uint32_t first)
+{
+	glBindVertexArray(model->m_vaob);
+	glBindBuffer(GL_ARRAY_BUFFER, model->m_instances_bo);
+	for(int column = 0; column < 4; column++)
+	{
+		glVertexAttribPointer(3 + column, 4, GL_FLOAT, false, sizeof(glm::mat4),
+		                      (const void*)(first * sizeof(glm::mat4) + column * sizeof(glm::vec4)));
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+void renderInstanced(const Model* model, uint32_t first, uint32_t count, int level, const bool submitMaterials)
+{
+	count = first < model->m_number_of_instances ? std::min(count, model->m_number_of_instances - first) : 0;
+	if(count == 0)
+	{
+		return;
+	}
+	// The base instance of glDrawElementsInstancedBaseInstance() needs
+	// OpenGL 4.2, so the attributes are moved instead
+	if(first != 0)
+	{
+		setFirstInstance(model, first);
+	}
+	renderMeshes(model, submitMaterials, GLsizei(count), nullptr, std::min(level, numberOfLevels(model) - 1));
+	if(first != 0)
+	{
+		setFirstInstance(model, 0);
+	}
+}
+
+int numberOfLevels(const Model* model)
+{
+	return model->m_indices_bo != 0 ? 1 + int(model->m_levels_of_detail.size()) : 1;
+}
+
+size_t numberOfTriangles(const Model* model, int level)
+{
+	if(level <= 0 || level >= numberOfLevels(model))
+	{
+		return model->m_positions.size() / 3;
+	}
+	size_t indices = 0;
+	for(uint32_t count : model->m_levels_of_detail[level - 1].m_number_of_indices)
+	{
+		indices += count;
+	}
+	return indices / 3;
+}
+
+int selectLevelOfDetail(const Model* model, int current_level, float scale, float distance, float pixels_per_unit,
+                        float max_error_pixels, float hysteresis)
+{
+	const int levels = numberOfLevels(model);
+	// The size on screen of the error of a level
+	auto errorPixels = [&](int level) {
+		const float error = level > 0 ? model->m_levels_of_detail[level - 1].m_error : 0.0f;
+		return error * scale * pixels_per_unit / std::max(distance, 1e-6f);
+	};
+	int level = std::min(std::max(current_level, 0), levels - 1);
+	while(level > 0 && errorPixels(level) > max_error_pixels * (1.0f + hysteresis))
+	{
+		level--;
+	}
+	while(level + 1 < levels && errorPixels(level + 1) < max_error_pixels * (1.0f - hysteresis))
+	{
+		level++;
+	}
+	return level;
 }
 } // namespace labhelper
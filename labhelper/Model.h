@@ -2,23 +2,32 @@
 #include <string>
 #include <vector>
 #include <memory>
-#include <memory>
 #include <glm/glm.hpp>
+#include "Culling.h"
+#include "TextureCache.h"
 
 namespace labhelper
 {
 struct Texture
 {
 	bool valid = false;
+	// If not 0, bound instead of the loaded image
 	uint32_t gl_id = 0;
-	uint32_t gl_id_internal = 0;
 	std::string filename;
 	std::string directory;
-	int width, height;
-	uint8_t* data;
+	// Filled in by wait()
+	int width = 0, height = 0;
+	uint8_t* data = nullptr;
 	uint8_t n_components = 4;
+	// Shared with every other Texture that loads the same file
+	std::shared_ptr<TextureImage> image;
 
+	// Starts loading the file, see TextureCache.h
 	bool load(const std::string& directory, const std::string& filename, int nof_components);
+	// Blocks until the file is decoded, for use of the pixels on the CPU
+	void wait();
+	// The texture to bind, 0 while the image is not uploaded yet
+	uint32_t glId() const;
 	glm::vec4 sample(glm::vec2 uv) const;
 	void free();
 };
@@ -54,6 +63,23 @@ struct Mesh
 	// Where this Mesh's vertices start
 	uint32_t m_start_index;
 	uint32_t m_number_of_vertices;
+	// Bounding box in model space
+	glm::vec3 m_aabb_min;
+	glm::vec3 m_aabb_max;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// A simplified version of all meshes of a model, see MeshSimplification.h.
+/// Its triangles use the welded vertices of the full model.
+///////////////////////////////////////////////////////////////////////////
+struct LevelOfDetail
+{
+	// How far the simplified surface is from the original, in model space
+	float m_error;
+	// The triangles of mesh i are m_number_of_indices[i] indices of
+	// Model::m_lod_indices, from m_start_index[i]
+	std::vector<uint32_t> m_start_index;
+	std::vector<uint32_t> m_number_of_indices;
 };
 
 class Model
@@ -68,21 +94,125 @@ public:
 	std::vector<Material> m_materials;
 	// A model will contain one or more "Meshes"
 	std::vector<Mesh> m_meshes;
-	// Buffers on CPU
+	// Bounding box of all meshes, in model space
+	glm::vec3 m_aabb_min;
+	glm::vec3 m_aabb_max;
+	// Buffers on CPU, with one vertex per triangle corner
 	std::vector<glm::vec3> m_positions;
 	std::vector<glm::vec3> m_normals;
 	std::vector<glm::vec2> m_texture_coordinates;
+	// Indexed version of the buffers above, which is what is drawn. Vertex i
+	// of it is a copy of vertex m_welded_vertices[i] above, and identical
+	// vertices are only stored once. The triangles of a mesh are in the
+	// same range of m_indices as its vertices above, in the order that
+	// makes the best use of the GPU's vertex cache.
+	std::vector<uint32_t> m_indices;
+	std::vector<uint32_t> m_welded_vertices;
+	// Simplified versions of the indexed meshes, each coarser than the one
+	// before. They follow m_indices in the element buffer.
+	std::vector<LevelOfDetail> m_levels_of_detail;
+	std::vector<uint32_t> m_lod_indices;
 	// Buffers on GPU
 	uint32_t m_positions_bo;
 	uint32_t m_normals_bo;
 	uint32_t m_texture_coordinates_bo;
+	// 0 if the model is drawn from the de-indexed buffers
+	uint32_t m_indices_bo = 0;
+	// The materials as MaterialBlocks (see render()), m_material_stride
+	// bytes apart
+	uint32_t m_materials_bo = 0;
+	uint32_t m_material_stride = 0;
+	// Model matrices of the instances drawn by renderInstanced()
+	uint32_t m_instances_bo = 0;
+	uint32_t m_number_of_instances = 0;
 	// Vertex Array Object
 	uint32_t m_vaob;
 };
 
+///////////////////////////////////////////////////////////////////////////
+/// Models loaded while this is set are drawn indexed. Set it to false to
+/// draw them from the de-indexed buffers instead.
+///////////////////////////////////////////////////////////////////////////
+extern bool use_indexed_models;
+
+///////////////////////////////////////////////////////////////////////////
+/// Print the vertex, index and level of detail counts of models as they
+/// are loaded. Off by default.
+///////////////////////////////////////////////////////////////////////////
+extern bool print_model_statistics;
+
 Model* loadModelFromOBJ(std::string filename);
+// The textures of a model are loaded in the background, and drawn once
+// uploadTextures() has uploaded them. This waits until their pixels are
+// available on the CPU.
+void waitForTextures(Model* model);
 void saveModelToOBJ(Model* model, std::string filename);
 void saveModelMaterialsToMTL(Model* model, std::string filename);
 void freeModel(Model* model);
+
+///////////////////////////////////////////////////////////////////////////
+/// Draws the meshes of a model. With submitMaterials, each mesh's textures
+/// are bound, and its material is passed to the current program:
+///
+/// layout(std140, binding = 0) uniform MaterialBlock
+/// {
+/// 	vec3 material_color;
+/// 	float material_metalness;
+/// 	vec3 material_emission;
+/// 	float material_fresnel;
+/// 	float material_shininess;
+/// };
+///
+/// That is a range of a buffer that is uploaded with the model, so nothing
+/// is set per mesh but has_color_texture and has_emission_texture. Programs
+/// without the block get the material as plain uniforms of the same names.
+///////////////////////////////////////////////////////////////////////////
 void render(const Model* model, const bool submitMaterials = true);
+// Like render(), but skips the meshes outside a frustum in the model's
+// space, extractFrustum(projection * view * model). Returns the number of
+// meshes drawn.
+size_t render(const Model* model, const Frustum& frustum, const bool submitMaterials = true);
+// Upload the materials again after changing them, for programs with the
+// MaterialBlock
+void updateMaterials(Model* model);
+
+///////////////////////////////////////////////////////////////////////////
+/// Instanced drawing, for many copies of the same model. The matrices are
+/// uploaded to the GPU and stay there until set again, and are passed to
+/// the vertex shader as
+///
+/// layout(location = 3) in mat4 modelMatrix;
+///
+/// renderInstanced() draws all instances of each mesh with one draw call,
+/// and sets the material once per mesh instead of once per instance. To
+/// draw only the visible instances, set the matrices of those every frame
+/// (see InstanceGrid in Culling.h).
+///////////////////////////////////////////////////////////////////////////
+void setInstanceMatrices(Model* model, const std::vector<glm::mat4>& matrices);
+void renderInstanced(const Model* model, const bool submitMaterials = true);
+// Draws instances first to first + count - 1 at a level of detail, so that
+// instances sorted by level can be drawn with one call per level and mesh
+void renderInstanced(const Model* model, uint32_t first, uint32_t count, int level,
+                     const bool submitMaterials = true);
+
+///////////////////////////////////////////////////////////////////////////
+/// Levels of detail. Level 0 is the model itself, and level i > 0 is
+/// m_levels_of_detail[i - 1]. Models drawn de-indexed only have level 0.
+///////////////////////////////////////////////////////////////////////////
+int numberOfLevels(const Model* model);
+size_t numberOfTriangles(const Model* model, int level = 0);
+// render() at a level of detail, with or without a frustum
+void render(const Model* model, int level, const bool submitMaterials = true);
+size_t render(const Model* model, const Frustum& frustum, int level, const bool submitMaterials = true);
+// The coarsest level whose error covers at most `max_error_pixels` pixels
+// on screen, for a model scaled by `scale` at `distance` from the camera.
+// `pixels_per_unit` is the size on screen of one unit at distance one,
+// projection[1][1] * viewport height / 2. The level drawn last frame is
+// kept until the error is `hysteresis` (a fraction) past the limit either
+// way, so that models at the limit do not switch back and forth.
+int selectLevelOfDetail(const Model* model, int current_level, float scale, float distance, float pixels_per_unit,
+                        float max_error_pixels = 1.0f, float hysteresis = 0.2f);
+// Binds a white, rough, non-metallic material as the MaterialBlock, for
+// drawing something that is not a Model with the same shaders
+void bindDefaultMaterial();
 } // namespace labhelper
\ No newline at end of file
@@ -0,0 +1,342 @@
+#include "ModelCache.h"
+#include "MappedFile.h"
+#include "labhelper.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////////
+// File layout: a CacheHeader, followed by the payload. The payload holds the
+// source files, the materials and the meshes, and then the vertex streams,
+// the indices and the welded vertices, each aligned to 16 bytes, and last
+// the levels of detail and their indices. Bump the
+// version whenever the layout, or what loadModelFromOBJ() builds from an OBJ
+// file, changes.
+///////////////////////////////////////////////////////////////////////////////
+const char model_cache_magic[8] = "LHMODEL";
+const uint32_t model_cache_version = 3;
+const size_t model_cache_alignment = 16;
+
+struct CacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	// Catches caches written by a build with other type sizes
+	uint32_t vertex_size;
+	uint64_t payload_size;
+	uint64_t payload_checksum;
+};
+
+std::string modelCacheFilename(const std::string& obj_filename)
+{
+	return file::change_extension(obj_filename, ".objcache");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Writing: the payload is built in memory and then written in one go
+///////////////////////////////////////////////////////////////////////////////
+struct CacheWriter
+{
+	std::vector<uint8_t> bytes;
+
+	void write(const void* data, size_t size)
+	{
+		const uint8_t* p = static_cast<const uint8_t*>(data);
+		bytes.insert(bytes.end(), p, p + size);
+	}
+	template<typename T>
+	void write(const T& value)
+	{
+		write(&value, sizeof(T));
+	}
+	void writeString(const std::string& s)
+	{
+		write(uint32_t(s.size()));
+		write(s.data(), s.size());
+	}
+	template<typename T>
+	void writeArray(const std::vector<T>& v)
+	{
+		bytes.resize((bytes.size() + model_cache_alignment - 1) / model_cache_alignment * model_cache_alignment, 0);
+		if(!v.empty())
+		{
+			write(v.data(), v.size() * sizeof(T));
+		}
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Reading, with every read checked against the end of the file
+///////////////////////////////////////////////////////////////////////////////
+struct CacheReader
+{
+	const uint8_t* begin;
+	const uint8_t* position;
+	const uint8_t* end;
+	bool failed = false;
+
+	bool read(void* data, size_t size)
+	{
+		if(failed || size_t(end - position) < size)
+		{
+			failed = true;
+			return false;
+		}
+		memcpy(data, position, size);
+		position += size;
+		return true;
+	}
+	template<typename T>
+	T read()
+	{
+		T value = T();
+		read(&value, sizeof(T));
+		return value;
+	}
+	std::string readString()
+	{
+		const uint32_t size = read<uint32_t>();
+		if(failed || size_t(end - position) < size)
+		{
+			failed = true;
+			return std::string();
+		}
+		std::string s(reinterpret_cast<const char*>(position), size);
+		position += size;
+		return s;
+	}
+	template<typename T>
+	void readArray(std::vector<T>& v, size_t count)
+	{
+		const size_t offset = size_t(position - begin);
+		const size_t aligned = (offset + model_cache_alignment - 1) / model_cache_alignment * model_cache_alignment;
+		if(failed || size_t(end - begin) < aligned || size_t(end - begin) - aligned < count * sizeof(T))
+		{
+			failed = true;
+			return;
+		}
+		position = begin + aligned;
+		v.resize(count);
+		if(count != 0)
+		{
+			read(v.data(), count * sizeof(T));
+		}
+	}
+};
+
+bool readModelCache(const std::string& obj_filename, Model* model, std::vector<MaterialTextureFiles>& textures)
+{
+	MappedFile file;
+	if(!file.openRead(modelCacheFilename(obj_filename)) || file.size() < sizeof(CacheHeader))
+	{
+		return false;
+	}
+	CacheHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	if(memcmp(header.magic, model_cache_magic, sizeof(model_cache_magic)) != 0
+	   || header.version != model_cache_version || header.vertex_size != sizeof(glm::vec3)
+	   || header.payload_size != file.size() - sizeof(CacheHeader))
+	{
+		return false;
+	}
+	CacheReader in;
+	in.begin = file.data() + sizeof(CacheHeader);
+	in.position = in.begin;
+	in.end = in.begin + header.payload_size;
+
+	// Check that the sources are unchanged before anything else is read
+	const uint32_t number_of_sources = in.read<uint32_t>();
+	for(uint32_t i = 0; i < number_of_sources && !in.failed; i++)
+	{
+		const std::string source = in.readString();
+		FileStamp stamp;
+		stamp.size = in.read<int64_t>();
+		stamp.modified = in.read<int64_t>();
+		const FileStamp current = fileStamp(source);
+		if(current.size != stamp.size || current.modified != stamp.modified)
+		{
+			return false;
+		}
+	}
+	if(in.failed || fnv1a(in.begin, header.payload_size) != header.payload_checksum)
+	{
+		std::cout << modelCacheFilename(obj_filename) << " is damaged, parsing " << obj_filename << " instead.\n";
+		return false;
+	}
+
+	const uint32_t number_of_materials = in.read<uint32_t>();
+	std::vector<Material> materials;
+	textures.clear();
+	for(uint32_t i = 0; i < number_of_materials && !in.failed; i++)
+	{
+		Material material;
+		material.m_name = in.readString();
+		material.m_color = in.read<glm::vec3>();
+		material.m_shininess = in.read<float>();
+		material.m_metalness = in.read<float>();
+		material.m_fresnel = in.read<float>();
+		material.m_emission = in.read<glm::vec3>();
+		material.m_transparency = in.read<float>();
+		material.m_ior = in.read<float>();
+		materials.push_back(material);
+		MaterialTextureFiles files;
+		files.color = in.readString();
+		files.metalness = in.readString();
+		files.fresnel = in.readString();
+		files.shininess = in.readString();
+		files.emission = in.readString();
+		textures.push_back(files);
+	}
+	const uint32_t number_of_meshes = in.read<uint32_t>();
+	std::vector<Mesh> meshes;
+	for(uint32_t i = 0; i < number_of_meshes && !in.failed; i++)
+	{
+		Mesh mesh;
+		mesh.m_name = in.readString();
+		mesh.m_material_idx = in.read<uint32_t>();
+		mesh.m_start_index = in.read<uint32_t>();
+		mesh.m_number_of_vertices = in.read<uint32_t>();
+		meshes.push_back(mesh);
+	}
+	const uint64_t number_of_vertices = in.read<uint64_t>();
+	if(in.failed || number_of_vertices > header.payload_size)
+	{
+		return false;
+	}
+	in.readArray(model->m_positions, size_t(number_of_vertices));
+	in.readArray(model->m_normals, size_t(number_of_vertices));
+	in.readArray(model->m_texture_coordinates, size_t(number_of_vertices));
+	in.readArray(model->m_indices, size_t(number_of_vertices));
+	const uint64_t number_of_welded_vertices = in.read<uint64_t>();
+	if(number_of_welded_vertices > number_of_vertices)
+	{
+		in.failed = true;
+	}
+	in.readArray(model->m_welded_vertices, size_t(number_of_welded_vertices));
+	const uint32_t number_of_levels = in.read<uint32_t>();
+	std::vector<LevelOfDetail> levels;
+	for(uint32_t i = 0; i < number_of_levels && !in.failed; i++)
+	{
+		LevelOfDetail level;
+		level.m_error = in.read<float>();
+		for(uint32_t j = 0; j < number_of_meshes && !in.failed; j++)
+		{
+			level.m_start_index.push_back(in.read<uint32_t>());
+			level.m_number_of_indices.push_back(in.read<uint32_t>());
+		}
+		levels.push_back(level);
+	}
+	const uint64_t number_of_lod_indices = in.read<uint64_t>();
+	if(number_of_lod_indices > header.payload_size)
+	{
+		in.failed = true;
+	}
+	in.readArray(model->m_lod_indices, size_t(number_of_lod_indices));
+	if(in.failed)
+	{
+		model->m_positions.clear();
+		model->m_normals.clear();
+		model->m_texture_coordinates.clear();
+		model->m_indices.clear();
+		model->m_welded_vertices.clear();
+		model->m_lod_indices.clear();
+		return false;
+	}
+	model->m_materials = materials;
+	model->m_meshes = meshes;
+	model->m_levels_of_detail = levels;
+	return true;
+}
+
+void writeModelCache(const std::string& obj_filename, const std::vector<std::string>& sources, const Model* model,
+                     const std::vector<MaterialTextureFiles>& textures)
+{
+	CacheWriter out;
+	out.write(uint32_t(sources.size()));
+	for(const auto& source : sources)
+	{
+		const FileStamp stamp = fileStamp(source);
+		out.writeString(source);
+		out.write(stamp.size);
+		out.write(stamp.modified);
+	}
+	out.write(uint32_t(model->m_materials.size()));
+	for(size_t i = 0; i < model->m_materials.size(); i++)
+	{
+		const Material& material = model->m_materials[i];
+		out.writeString(material.m_name);
+		out.write(material.m_color);
+		out.write(material.m_shininess);
+		out.write(material.m_metalness);
+		out.write(material.m_fresnel);
+		out.write(material.m_emission);
+		out.write(material.m_transparency);
+		out.write(material.m_ior);
+		out.writeString(textures[i].color);
+		out.writeString(textures[i].metalness);
+		out.writeString(textures[i].fresnel);
+		out.writeString(textures[i].shininess);
+		out.writeString(textures[i].emission);
+	}
+	out.write(uint32_t(model->m_meshes.size()));
+	for(const auto& mesh : model->m_meshes)
+	{
+		out.writeString(mesh.m_name);
+		out.write(mesh.m_material_idx);
+		out.write(mesh.m_start_index);
+		out.write(mesh.m_number_of_vertices);
+	}
+	out.write(uint64_t(model->m_positions.size()));
+	out.writeArray(model->m_positions);
+	out.writeArray(model->m_normals);
+	out.writeArray(model->m_texture_coordinates);
+	out.writeArray(model->m_indices);
+	out.write(uint64_t(model->m_welded_vertices.size()));
+	out.writeArray(model->m_welded_vertices);
+	out.write(uint32_t(model->m_levels_of_detail.size()));
+	for(const auto& level : model->m_levels_of_detail)
+	{
+		out.write(level.m_error);
+		for(size_t j = 0; j < model->m_meshes.size(); j++)
+		{
+			out.write(level.m_start_index[j]);
+			out.write(level.m_number_of_indices[j]);
+		}
+	}
+	out.write(uint64_t(model->m_lod_indices.size()));
+	out.writeArray(model->m_lod_indices);
+
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, model_cache_magic, sizeof(model_cache_magic));
+	header.version = model_cache_version;
+	header.vertex_size = sizeof(glm::vec3);
+	header.payload_size = out.bytes.size();
+	header.payload_checksum = fnv1a(out.bytes.data(), out.bytes.size());
+
+	///////////////////////////////////////////////////////////////////////////
+	// Write to a temporary file and rename it, so that a half written cache
+	// is never found. Failing is fine, the OBJ file is parsed the next time.
+	///////////////////////////////////////////////////////////////////////////
+	const std::string filename = modelCacheFilename(obj_filename);
+	const std::string temporary = filename + ".tmp";
+	{
+		MappedFile file;
+		if(!file.openWrite(temporary, sizeof(CacheHeader) + out.bytes.size()))
+		{
+			std::cout << "Could not write " << filename << ".\n";
+			return;
+		}
+		memcpy(file.data(), &header, sizeof(header));
+		memcpy(file.data() + sizeof(header), out.bytes.data(), out.bytes.size());
+	}
+	std::remove(filename.c_str());
+	if(std::rename(temporary.c_str(), filename.c_str()) != 0)
+	{
+		std::cout << "Could not write " << filename << ".\n";
+		std::remove(temporary.c_str());
+	}
+}
+} // namespace labhelper
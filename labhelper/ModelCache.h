@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Model.h"
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// The texture files of a material, as named in the .mtl file. They are
+/// kept apart from the Material, as textures are loaded after the rest of
+/// the Model, whether that was parsed or read from the cache.
+///////////////////////////////////////////////////////////////////////////
+struct MaterialTextureFiles
+{
+	std::string color;
+	std::string metalness;
+	std::string fresnel;
+	std::string shininess;
+	std::string emission;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Binary cache of a parsed OBJ file
+///
+/// The cache is written next to the .obj file the first time it is loaded,
+/// and holds everything loadModelFromOBJ() builds from it: the materials
+/// (with the names of their textures), the meshes, the vertex streams, the
+/// indexed version of them and its levels of detail.
+/// Later loads map the cache into memory and copy the streams straight
+/// into the Model. A cache is only used if the .obj and .mtl files it was
+/// built from still have the size and modification time they had, and it
+/// was written by this version of the loader.
+///////////////////////////////////////////////////////////////////////////
+std::string modelCacheFilename(const std::string& obj_filename);
+
+/// Fill in the materials, meshes and vertex streams of `model` from the
+/// cache of an .obj file. Returns false if there is no usable cache.
+bool readModelCache(const std::string& obj_filename, Model* model, std::vector<MaterialTextureFiles>& textures);
+
+/// Write the cache of an .obj file. `sources` are the files the model was
+/// parsed from, the cache is out of date once any of them changes.
+void writeModelCache(const std::string& obj_filename, const std::vector<std::string>& sources, const Model* model,
+                     const std::vector<MaterialTextureFiles>& textures);
+} // namespace labhelper
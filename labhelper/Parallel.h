@@ -0,0 +1,35 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+// Run work(thread) on `number_of_threads` threads, the calling one included
+///////////////////////////////////////////////////////////////////////////
+template<typename Work>
+void parallelFor(int number_of_threads, Work work)
+{
+	std::vector<std::thread> threads;
+	for(int t = 1; t < number_of_threads; t++)
+	{
+		threads.emplace_back(work, t);
+	}
+	work(0);
+	for(auto& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////
+// One thread per core, but none with less than `min_items` to work on
+///////////////////////////////////////////////////////////////////////////
+inline int numberOfThreads(size_t items, size_t min_items)
+{
+	const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+	return int(std::max<size_t>(1, std::min(cores, items / min_items)));
+}
+} // namespace labhelper
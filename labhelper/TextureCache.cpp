@@ -0,0 +1,415 @@
+#include "TextureCache.h"
+#include "labhelper.h"
+#include <GL/glew.h>
+#include <stb_image.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace labhelper
+{
+TextureCompression texture_compression = TextureCompression::Fast;
+bool texture_uploads = true;
+
+TextureImage::~TextureImage()
+{
+	if(data)
+	{
+		stbi_image_free(data);
+	}
+	if(gl_id)
+	{
+		glDeleteTextures(1, &gl_id);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The cache only holds weak references, so an image goes away with the last
+// Texture that uses it, also while it is waiting to be decoded or uploaded.
+///////////////////////////////////////////////////////////////////////////////
+struct TextureCache
+{
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::condition_variable image_decoded;
+	std::unordered_map<std::string, std::weak_ptr<TextureImage>> images;
+	std::deque<std::weak_ptr<TextureImage>> decode_queue;
+	std::deque<std::weak_ptr<TextureImage>> upload_queue;
+	std::vector<std::thread> workers;
+	bool stopping = false;
+	size_t requests = 0;
+	size_t hits = 0;
+	size_t uploads = 0;
+	double upload_milliseconds = 0.0;
+
+	~TextureCache()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		work_available.notify_all();
+		for(auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+};
+
+static TextureCache cache;
+
+///////////////////////////////////////////////////////////////////////////////
+// Decode the pixels of an image, unless that has been done already. Images
+// read from the compressed cache are only decoded if the pixels are needed
+// on the CPU, or the GL can not use the compressed format.
+///////////////////////////////////////////////////////////////////////////////
+static bool decodePixels(TextureImage& image)
+{
+	std::lock_guard<std::mutex> decode_lock(image.decode_mutex);
+	if(image.data)
+	{
+		return true;
+	}
+	int width, height, components;
+	uint8_t* data = stbi_load(image.path.c_str(), &width, &height, &components, image.components);
+	if(data == nullptr)
+	{
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(cache.mutex);
+	image.width = width;
+	image.height = height;
+	image.data = data;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Read an image from the compressed cache, or decode its pixels. Images that
+// are not in the cache are only encoded once uploadTextures() asks for them,
+// which is never for images that are only sampled on the CPU.
+///////////////////////////////////////////////////////////////////////////////
+static void decodeImage(TextureImage& image)
+{
+	if(image.data == nullptr)
+	{
+		if(image.compression != TextureCompression::None
+		   && readCompressedTexture(image.path, image.components, image.compression, image.compressed))
+		{
+			std::lock_guard<std::mutex> lock(cache.mutex);
+			image.width = image.compressed.levels[0].width;
+			image.height = image.compressed.levels[0].height;
+			return;
+		}
+		decodePixels(image);
+		return;
+	}
+	const auto start_time = std::chrono::high_resolution_clock::now();
+	// There is a worker per core already, so each encodes on its own thread
+	compressTexture(image.data, image.width, image.height, image.components, image.compression, image.compressed,
+	                false);
+	writeCompressedTexture(image.path, image.components, image.compression, image.compressed);
+	std::chrono::duration<double, std::milli> time = std::chrono::high_resolution_clock::now() - start_time;
+	std::ostringstream message;
+	message << "Compressed " << image.path << " to " << compressedFormatName(image.compressed.gl_format) << " ("
+	        << std::fixed << std::setprecision(1) << time.count() << " ms).\n";
+	std::cout << message.str();
+}
+
+static void decodeImages()
+{
+	for(;;)
+	{
+		std::shared_ptr<TextureImage> image;
+		{
+			std::unique_lock<std::mutex> lock(cache.mutex);
+			cache.work_available.wait(lock, [] { return cache.stopping || !cache.decode_queue.empty(); });
+			if(cache.stopping)
+			{
+				return;
+			}
+			image = cache.decode_queue.front().lock();
+			cache.decode_queue.pop_front();
+		}
+		if(!image)
+		{
+			continue;
+		}
+		decodeImage(*image);
+		{
+			std::lock_guard<std::mutex> lock(cache.mutex);
+			const bool decoded = image->data != nullptr || !image->compressed.levels.empty();
+			image->state = decoded ? TextureImage::Decoded : TextureImage::Failed;
+			if(texture_uploads)
+			{
+				cache.upload_queue.push_back(image);
+			}
+			// Let go of the image before it can be uploaded, so that it is
+			// never deleted on this thread once it has a GL texture
+			image.reset();
+		}
+		cache.image_decoded.notify_all();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The same file may be named through different directories, e.g.
+// "scenes/a/../b.png" and "scenes/b.png", so "." and ".." are resolved
+// before the path is used as a key.
+///////////////////////////////////////////////////////////////////////////////
+static std::string cacheKey(const std::string& path, int components)
+{
+	const std::string name = file::normalise(path);
+	std::vector<std::string> parts;
+	size_t begin = 0;
+	while(begin <= name.size())
+	{
+		size_t end = name.find('/', begin);
+		if(end == std::string::npos)
+		{
+			end = name.size();
+		}
+		const std::string part = name.substr(begin, end - begin);
+		if(part == ".." && !parts.empty() && parts.back() != ".." && parts.back() != "")
+		{
+			parts.pop_back();
+		}
+		else if(part != "." && (part != "" || parts.empty()))
+		{
+			parts.push_back(part);
+		}
+		begin = end + 1;
+	}
+	std::string key;
+	for(const auto& part : parts)
+	{
+		key += part + "/";
+	}
+	return key + std::to_string(components);
+}
+
+std::shared_ptr<TextureImage> requestTexture(const std::string& path, int components)
+{
+	const std::string key = cacheKey(path, components);
+	std::lock_guard<std::mutex> lock(cache.mutex);
+	if(cache.workers.empty())
+	{
+		const int number_of_workers = std::max(1, int(std::thread::hardware_concurrency()) - 1);
+		for(int i = 0; i < number_of_workers; i++)
+		{
+			cache.workers.emplace_back(decodeImages);
+		}
+	}
+	cache.requests++;
+	std::weak_ptr<TextureImage>& entry = cache.images[key];
+	std::shared_ptr<TextureImage> image = entry.lock();
+	if(image)
+	{
+		cache.hits++;
+		return image;
+	}
+	image = std::make_shared<TextureImage>();
+	image->path = path;
+	image->components = components;
+	image->compression = texture_compression;
+	entry = image;
+	cache.decode_queue.push_back(image);
+	cache.work_available.notify_one();
+	return image;
+}
+
+static void reportFailure(const TextureImage& image)
+{
+	std::cout << "ERROR: loadModelFromOBJ(): Failed to load texture: " << image.path << "\n";
+	exit(1);
+}
+
+void waitForTexture(TextureImage& image)
+{
+	{
+		std::unique_lock<std::mutex> lock(cache.mutex);
+		cache.image_decoded.wait(lock, [&] { return image.state != TextureImage::Decoding; });
+	}
+	if(image.state == TextureImage::Failed || !decodePixels(image))
+	{
+		reportFailure(image);
+	}
+}
+
+static bool compressedFormatSupported(uint32_t gl_format)
+{
+	switch(gl_format)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		return GLEW_EXT_texture_compression_s3tc != 0;
+	case GL_COMPRESSED_RED_RGTC1:
+	case GL_COMPRESSED_RG_RGTC2:
+		return GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc;
+	case GL_COMPRESSED_RGBA_BPTC_UNORM:
+		return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+	default:
+		return false;
+	}
+}
+
+static void uploadPixels(TextureImage& image)
+{
+	GLenum format, internal_format;
+	if(image.components == 1)
+	{
+		format = GL_R;
+		internal_format = GL_R8;
+	}
+	else if(image.components == 3)
+	{
+		format = GL_RGB;
+		internal_format = GL_RGB;
+	}
+	else if(image.components == 4)
+	{
+		format = GL_RGBA;
+		internal_format = GL_RGBA;
+	}
+	else
+	{
+		std::cout << "Texture loading not implemented for this number of compenents.\n";
+		exit(1);
+	}
+	glTexImage2D(GL_TEXTURE_2D, 0, internal_format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE,
+	             image.data);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	image.gpu_bytes = image.uncompressed_bytes;
+}
+
+static void uploadCompressed(TextureImage& image)
+{
+	const CompressedTexture& compressed = image.compressed;
+	for(size_t i = 0; i < compressed.levels.size(); i++)
+	{
+		const CompressedTexture::Level& level = compressed.levels[i];
+		glCompressedTexImage2D(GL_TEXTURE_2D, GLint(i), compressed.gl_format, level.width, level.height, 0,
+		                       GLsizei(level.size), compressed.data.data() + level.offset);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(compressed.levels.size() - 1));
+	image.gpu_bytes = compressed.data.size();
+}
+
+static void uploadImage(TextureImage& image)
+{
+	const auto start_time = std::chrono::high_resolution_clock::now();
+	const bool compressed = !image.compressed.levels.empty() && compressedFormatSupported(image.compressed.gl_format);
+	if(!compressed && !decodePixels(image))
+	{
+		reportFailure(image);
+	}
+	// The mip chain adds a third
+	image.uncompressed_bytes = size_t(image.width) * size_t(image.height) * image.components * 4 / 3;
+
+	glGenTextures(1, &image.gl_id);
+	glBindTexture(GL_TEXTURE_2D, image.gl_id);
+	if(compressed)
+	{
+		uploadCompressed(image);
+	}
+	else
+	{
+		uploadPixels(image);
+	}
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	std::chrono::duration<double, std::milli> time = std::chrono::high_resolution_clock::now() - start_time;
+	{
+		std::lock_guard<std::mutex> lock(cache.mutex);
+		cache.uploads++;
+		cache.upload_milliseconds += time.count();
+	}
+
+	// Only the GL copy of the compressed texture is needed from now on
+	image.compressed = CompressedTexture();
+	image.state = TextureImage::Uploaded;
+}
+
+void uploadTextures(double max_milliseconds)
+{
+	const auto start_time = std::chrono::high_resolution_clock::now();
+	for(;;)
+	{
+		std::shared_ptr<TextureImage> image;
+		{
+			std::lock_guard<std::mutex> lock(cache.mutex);
+			if(cache.upload_queue.empty())
+			{
+				return;
+			}
+			image = cache.upload_queue.front().lock();
+			cache.upload_queue.pop_front();
+		}
+		if(!image || image->state == TextureImage::Uploaded)
+		{
+			continue;
+		}
+		if(image->state == TextureImage::Failed)
+		{
+			reportFailure(*image);
+		}
+		if(image->compression != TextureCompression::None && image->compressed.levels.empty())
+		{
+			// Decoded, but not encoded yet: back to the workers first
+			std::lock_guard<std::mutex> lock(cache.mutex);
+			cache.decode_queue.push_back(image);
+			cache.work_available.notify_one();
+			continue;
+		}
+		uploadImage(*image);
+		std::chrono::duration<double, std::milli> time = std::chrono::high_resolution_clock::now() - start_time;
+		if(time.count() > max_milliseconds)
+		{
+			return;
+		}
+	}
+}
+
+TextureCacheStats textureCacheStats()
+{
+	TextureCacheStats stats = {};
+	std::lock_guard<std::mutex> lock(cache.mutex);
+	stats.requests = cache.requests;
+	stats.hits = cache.hits;
+	stats.uploads = cache.uploads;
+	stats.upload_milliseconds = cache.upload_milliseconds;
+	for(auto it = cache.images.begin(); it != cache.images.end();)
+	{
+		std::shared_ptr<TextureImage> image = it->second.lock();
+		if(!image)
+		{
+			it = cache.images.erase(it);
+			continue;
+		}
+		stats.images++;
+		if(image->state == TextureImage::Decoding || image->state == TextureImage::Decoded)
+		{
+			stats.pending++;
+		}
+		if(image->data)
+		{
+			stats.cpu_bytes += size_t(image->width) * size_t(image->height) * image->components;
+		}
+		stats.gpu_bytes += image->gpu_bytes;
+		stats.uncompressed_gpu_bytes += image->uncompressed_bytes;
+		++it;
+	}
+	return stats;
+}
+} // namespace labhelper
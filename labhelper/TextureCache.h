@@ -0,0 +1,97 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "TextureCompression.h"
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// How textures loaded from now on are stored on the GPU. Compressed
+/// textures are encoded the first time an image is uploaded, and cached on
+/// disk next to it. Set this to None to compare with uncompressed ones, or
+/// when textures are only sampled on the CPU.
+///////////////////////////////////////////////////////////////////////////
+extern TextureCompression texture_compression;
+
+///////////////////////////////////////////////////////////////////////////
+/// Whether decoded images wait for uploadTextures(). Programs that never
+/// call it, like the path tracer, turn this off so that the images do not
+/// pile up in the upload queue.
+///////////////////////////////////////////////////////////////////////////
+extern bool texture_uploads;
+
+///////////////////////////////////////////////////////////////////////////
+/// An image file, decoded once and shared by every Texture that loads it
+///
+/// Images are decoded, or read from the compressed texture cache, by
+/// worker threads, and uploaded to the GPU on the render thread by
+/// uploadTextures(). Decoded pixels are kept on the CPU (the path tracer
+/// samples them). An image lives as long as some Texture refers to it.
+///////////////////////////////////////////////////////////////////////////
+struct TextureImage
+{
+	enum State
+	{
+		Decoding,
+		Decoded,
+		Uploaded,
+		Failed
+	};
+
+	TextureImage() = default;
+	TextureImage(const TextureImage&) = delete;
+	TextureImage& operator=(const TextureImage&) = delete;
+	~TextureImage();
+
+	std::string path;
+	int components = 4;
+	TextureCompression compression = TextureCompression::None;
+	std::atomic<int> state{ Decoding };
+	// Valid once the image is decoded. Images read from the compressed
+	// cache have no pixels until waitForTexture() asks for them.
+	int width = 0, height = 0;
+	uint8_t* data = nullptr;
+	std::mutex decode_mutex;
+	// Until the image is uploaded
+	CompressedTexture compressed;
+	// Valid once the image is uploaded
+	uint32_t gl_id = 0;
+	size_t gpu_bytes = 0;
+	size_t uncompressed_bytes = 0;
+};
+
+/// Get the image of a file, decoded to `components` channels. The file is
+/// only decoded if no Texture refers to it already.
+std::shared_ptr<TextureImage> requestTexture(const std::string& path, int components);
+
+/// Block until the pixels of an image are decoded. Exits if the file could
+/// not be read.
+void waitForTexture(TextureImage& image);
+
+/// Upload decoded images to the GPU. Called on the render thread once per
+/// frame; stops after `max_milliseconds`, and the rest wait for the next
+/// frame. Until its image is uploaded, a material is drawn with its
+/// constant value in place of the texture.
+void uploadTextures(double max_milliseconds = 4.0);
+
+struct TextureCacheStats
+{
+	// Calls to requestTexture(), and how many found the image already there
+	size_t requests;
+	size_t hits;
+	size_t images;
+	size_t pending;
+	size_t cpu_bytes;
+	size_t gpu_bytes;
+	// What the uploaded textures would take without compression
+	size_t uncompressed_gpu_bytes;
+	// Images uploaded so far, and the time spent on it
+	size_t uploads;
+	double upload_milliseconds;
+};
+TextureCacheStats textureCacheStats();
+} // namespace labhelper
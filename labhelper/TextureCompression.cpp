@@ -0,0 +1,514 @@
+#include "TextureCompression.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+// The default of stb_dxt 1.07 takes the wrong number of arguments
+#define STBD_MEMSET memset
+#define STB_DXT_IMPLEMENTATION
+#include <stb_dxt.h>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////////
+// BC7 mode 6: one pair of RGBA endpoints with 7 bits per channel and a
+// shared lowest bit per endpoint, and a 4 bit index per texel. That is the
+// only mode we encode. It is much better than BC1 for opaque textures, but
+// alpha that does not follow the color needs the modes with separate alpha
+// indices, so textures with alpha are still encoded as BC3.
+///////////////////////////////////////////////////////////////////////////////
+static const int bc7_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BC7Mode6Block
+{
+	int endpoints[2][4];
+	int p[2];
+	uint8_t indices[16];
+	int error;
+};
+
+// Quantize two endpoints with the given lowest bits, and pick the best
+// index for each texel
+static void fitBC7Mode6(const float endpoints[2][4], int p0, int p1, const uint8_t* rgba, BC7Mode6Block& block)
+{
+	int palette[16][4];
+	int values[2][4];
+	block.p[0] = p0;
+	block.p[1] = p1;
+	for(int e = 0; e < 2; e++)
+	{
+		for(int c = 0; c < 4; c++)
+		{
+			const int p = block.p[e];
+			const int q = int(std::floor((endpoints[e][c] - float(p)) * 0.5f + 0.5f));
+			block.endpoints[e][c] = std::min(std::max(q, 0), 127);
+			values[e][c] = (block.endpoints[e][c] << 1) | p;
+		}
+	}
+	for(int i = 0; i < 16; i++)
+	{
+		for(int c = 0; c < 4; c++)
+		{
+			palette[i][c] = ((64 - bc7_weights[i]) * values[0][c] + bc7_weights[i] * values[1][c] + 32) >> 6;
+		}
+	}
+	block.error = 0;
+	for(int t = 0; t < 16; t++)
+	{
+		const uint8_t* texel = &rgba[t * 4];
+		int best_error = 1 << 30;
+		for(int i = 0; i < 16; i++)
+		{
+			int error = 0;
+			for(int c = 0; c < 4; c++)
+			{
+				const int d = palette[i][c] - int(texel[c]);
+				error += d * d;
+			}
+			if(error < best_error)
+			{
+				best_error = error;
+				block.indices[t] = uint8_t(i);
+			}
+		}
+		block.error += best_error;
+	}
+}
+
+// Opaque blocks must keep an alpha of 255, which takes lowest bits of 1
+static void fitBC7Mode6(const float endpoints[2][4], const uint8_t* rgba, bool opaque, BC7Mode6Block& best)
+{
+	best.error = 1 << 30;
+	for(int p = opaque ? 3 : 0; p < 4; p++)
+	{
+		BC7Mode6Block block;
+		fitBC7Mode6(endpoints, p & 1, p >> 1, rgba, block);
+		if(block.error < best.error)
+		{
+			best = block;
+		}
+	}
+}
+
+static void compressBC7Block(uint8_t* dest, const uint8_t* rgba)
+{
+	bool opaque = true;
+	for(int t = 0; t < 16; t++)
+	{
+		opaque = opaque && rgba[t * 4 + 3] == 255;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Endpoints at the extremes of the principal axis of the texels
+	///////////////////////////////////////////////////////////////////////
+	float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for(int t = 0; t < 16; t++)
+	{
+		for(int c = 0; c < 4; c++)
+		{
+			mean[c] += float(rgba[t * 4 + c]) / 16.0f;
+		}
+	}
+	float covariance[4][4] = {};
+	for(int t = 0; t < 16; t++)
+	{
+		float d[4];
+		for(int c = 0; c < 4; c++)
+		{
+			d[c] = float(rgba[t * 4 + c]) - mean[c];
+		}
+		for(int i = 0; i < 4; i++)
+		{
+			for(int j = 0; j < 4; j++)
+			{
+				covariance[i][j] += d[i] * d[j];
+			}
+		}
+	}
+	// Power iteration, from the channel that varies the most. Starting from
+	// gray instead never finds axes like red against green.
+	int largest_channel = 0;
+	for(int c = 1; c < 4; c++)
+	{
+		if(covariance[c][c] > covariance[largest_channel][largest_channel])
+		{
+			largest_channel = c;
+		}
+	}
+	float axis[4];
+	for(int c = 0; c < 4; c++)
+	{
+		axis[c] = covariance[largest_channel][c];
+	}
+	if(covariance[largest_channel][largest_channel] == 0.0f)
+	{
+		axis[0] = 1.0f;
+	}
+	for(int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		float largest = 0.0f;
+		for(int i = 0; i < 4; i++)
+		{
+			for(int j = 0; j < 4; j++)
+			{
+				next[i] += covariance[i][j] * axis[j];
+			}
+			largest = std::max(largest, std::abs(next[i]));
+		}
+		if(largest == 0.0f)
+		{
+			break;
+		}
+		for(int i = 0; i < 4; i++)
+		{
+			axis[i] = next[i] / largest;
+		}
+	}
+	const float length2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] + axis[3] * axis[3];
+	float t_min = 0.0f, t_max = 0.0f;
+	for(int t = 0; t < 16; t++)
+	{
+		float projection = 0.0f;
+		for(int c = 0; c < 4; c++)
+		{
+			projection += (float(rgba[t * 4 + c]) - mean[c]) * axis[c];
+		}
+		projection /= length2;
+		t_min = std::min(t_min, projection);
+		t_max = std::max(t_max, projection);
+	}
+	float endpoints[2][4];
+	for(int c = 0; c < 4; c++)
+	{
+		endpoints[0][c] = std::min(std::max(mean[c] + t_min * axis[c], 0.0f), 255.0f);
+		endpoints[1][c] = std::min(std::max(mean[c] + t_max * axis[c], 0.0f), 255.0f);
+	}
+	BC7Mode6Block block;
+	fitBC7Mode6(endpoints, rgba, opaque, block);
+
+	///////////////////////////////////////////////////////////////////////
+	// Refine the endpoints with a least squares fit to the chosen indices
+	///////////////////////////////////////////////////////////////////////
+	float a = 0.0f, b = 0.0f, d = 0.0f;
+	float x0[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, x1[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for(int t = 0; t < 16; t++)
+	{
+		const float w = float(bc7_weights[block.indices[t]]) / 64.0f;
+		a += (1.0f - w) * (1.0f - w);
+		b += (1.0f - w) * w;
+		d += w * w;
+		for(int c = 0; c < 4; c++)
+		{
+			x0[c] += (1.0f - w) * float(rgba[t * 4 + c]);
+			x1[c] += w * float(rgba[t * 4 + c]);
+		}
+	}
+	const float determinant = a * d - b * b;
+	if(std::abs(determinant) > 1e-6f)
+	{
+		for(int c = 0; c < 4; c++)
+		{
+			endpoints[0][c] = std::min(std::max((d * x0[c] - b * x1[c]) / determinant, 0.0f), 255.0f);
+			endpoints[1][c] = std::min(std::max((a * x1[c] - b * x0[c]) / determinant, 0.0f), 255.0f);
+		}
+		BC7Mode6Block refined;
+		fitBC7Mode6(endpoints, rgba, opaque, refined);
+		if(refined.error < block.error)
+		{
+			block = refined;
+		}
+	}
+
+	// The highest bit of the first index is implicitly 0
+	if(block.indices[0] & 8)
+	{
+		for(int c = 0; c < 4; c++)
+		{
+			std::swap(block.endpoints[0][c], block.endpoints[1][c]);
+		}
+		std::swap(block.p[0], block.p[1]);
+		for(int t = 0; t < 16; t++)
+		{
+			block.indices[t] = uint8_t(15 - block.indices[t]);
+		}
+	}
+
+	memset(dest, 0, 16);
+	int bit = 0;
+	auto write = [&](int value, int bits) {
+		for(int i = 0; i < bits; i++, bit++)
+		{
+			if((value >> i) & 1)
+			{
+				dest[bit >> 3] |= uint8_t(1 << (bit & 7));
+			}
+		}
+	};
+	write(1 << 6, 7);
+	for(int c = 0; c < 4; c++)
+	{
+		write(block.endpoints[0][c], 7);
+		write(block.endpoints[1][c], 7);
+	}
+	write(block.p[0], 1);
+	write(block.p[1], 1);
+	write(block.indices[0], 3);
+	for(int t = 1; t < 16; t++)
+	{
+		write(block.indices[t], 4);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Box filter to half size, like glGenerateMipmap(). Odd sizes drop the last
+// row or column.
+///////////////////////////////////////////////////////////////////////////////
+static std::vector<uint8_t> downsample(const std::vector<uint8_t>& source, int width, int height, int components)
+{
+	const int w = std::max(width / 2, 1), h = std::max(height / 2, 1);
+	std::vector<uint8_t> result(size_t(w) * h * components);
+	for(int y = 0; y < h; y++)
+	{
+		const int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+		for(int x = 0; x < w; x++)
+		{
+			const int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+			for(int c = 0; c < components; c++)
+			{
+				const int sum = source[(size_t(y0) * width + x0) * components + c]
+				                + source[(size_t(y0) * width + x1) * components + c]
+				                + source[(size_t(y1) * width + x0) * components + c]
+				                + source[(size_t(y1) * width + x1) * components + c];
+				result[(size_t(y) * w + x) * components + c] = uint8_t((sum + 2) / 4);
+			}
+		}
+	}
+	return result;
+}
+
+void compressTexture(const uint8_t* pixels, int width, int height, int components, TextureCompression mode,
+                     CompressedTexture& compressed, bool parallel)
+{
+	bool opaque = true;
+	for(size_t i = 3; components == 4 && i < size_t(width) * height * 4; i += 4)
+	{
+		opaque = opaque && pixels[i] == 255;
+	}
+	if(components == 1)
+	{
+		compressed.gl_format = GL_COMPRESSED_RED_RGTC1;
+	}
+	else if(components == 2)
+	{
+		compressed.gl_format = GL_COMPRESSED_RG_RGTC2;
+	}
+	else if(mode == TextureCompression::HighQuality && opaque)
+	{
+		compressed.gl_format = GL_COMPRESSED_RGBA_BPTC_UNORM;
+	}
+	else
+	{
+		compressed.gl_format = opaque ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	}
+	const size_t block_size =
+	    compressed.gl_format == GL_COMPRESSED_RED_RGTC1 || compressed.gl_format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? 8 : 16;
+
+	compressed.levels.clear();
+	compressed.data.clear();
+	std::vector<uint8_t> level(pixels, pixels + size_t(width) * height * components);
+	int w = width, h = height;
+	for(;;)
+	{
+		const int blocks_x = (w + 3) / 4, blocks_y = (h + 3) / 4;
+		const size_t offset = compressed.data.size();
+		compressed.levels.push_back({ w, h, offset, size_t(blocks_x) * blocks_y * block_size });
+		compressed.data.resize(offset + size_t(blocks_x) * blocks_y * block_size);
+
+		const int number_of_threads = parallel ? numberOfThreads(size_t(blocks_x) * blocks_y, 1024) : 1;
+		parallelFor(number_of_threads, [&](int thread) {
+			for(int by = thread; by < blocks_y; by += number_of_threads)
+			{
+				for(int bx = 0; bx < blocks_x; bx++)
+				{
+					// The texels of the block as RGBA, with the edges
+					// repeated where the block sticks out of the image
+					uint8_t texels[16 * 4];
+					for(int t = 0; t < 16; t++)
+					{
+						const int x = std::min(bx * 4 + t % 4, w - 1), y = std::min(by * 4 + t / 4, h - 1);
+						const uint8_t* texel = &level[(size_t(y) * w + x) * components];
+						for(int c = 0; c < 4; c++)
+						{
+							texels[t * 4 + c] = c < components ? texel[c] : (c == 3 ? 255 : texel[0]);
+						}
+					}
+					uint8_t* dest = &compressed.data[offset + (size_t(by) * blocks_x + bx) * block_size];
+					if(compressed.gl_format == GL_COMPRESSED_RED_RGTC1)
+					{
+						uint8_t r[16];
+						for(int t = 0; t < 16; t++)
+						{
+							r[t] = texels[t * 4];
+						}
+						stb_compress_bc4_block(dest, r);
+					}
+					else if(compressed.gl_format == GL_COMPRESSED_RG_RGTC2)
+					{
+						uint8_t rg[32];
+						for(int t = 0; t < 16; t++)
+						{
+							rg[t * 2] = texels[t * 4];
+							rg[t * 2 + 1] = texels[t * 4 + 1];
+						}
+						stb_compress_bc5_block(dest, rg);
+					}
+					else if(compressed.gl_format == GL_COMPRESSED_RGBA_BPTC_UNORM)
+					{
+						compressBC7Block(dest, texels);
+					}
+					else
+					{
+						const int alpha = compressed.gl_format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? 1 : 0;
+						stb_compress_dxt_block(dest, texels, alpha, STB_DXT_HIGHQUAL);
+					}
+				}
+			}
+		});
+
+		if(w == 1 && h == 1)
+		{
+			break;
+		}
+		level = downsample(level, w, h, components);
+		w = std::max(w / 2, 1);
+		h = std::max(h / 2, 1);
+	}
+}
+
+const char* compressedFormatName(uint32_t gl_format)
+{
+	switch(gl_format)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		return "BC1";
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		return "BC3";
+	case GL_COMPRESSED_RED_RGTC1:
+		return "BC4";
+	case GL_COMPRESSED_RG_RGTC2:
+		return "BC5";
+	case GL_COMPRESSED_RGBA_BPTC_UNORM:
+		return "BC7";
+	default:
+		return "uncompressed";
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// File layout: a header, the levels, and then the blocks of all levels.
+// Bump the version whenever the layout or the encoders change.
+///////////////////////////////////////////////////////////////////////////////
+const char texture_cache_magic[8] = "LHTEX";
+const uint32_t texture_cache_version = 1;
+
+struct TextureCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t gl_format;
+	uint32_t number_of_levels;
+	uint32_t padding;
+	FileStamp source;
+	uint64_t data_size;
+	uint64_t checksum;
+};
+
+std::string compressedTextureFilename(const std::string& image_filename, int components, TextureCompression mode)
+{
+	return image_filename + "." + std::to_string(components)
+	       + (mode == TextureCompression::HighQuality ? ".bc7" : ".bc") + ".texcache";
+}
+
+bool readCompressedTexture(const std::string& image_filename, int components, TextureCompression mode,
+                           CompressedTexture& compressed)
+{
+	const std::string filename = compressedTextureFilename(image_filename, components, mode);
+	MappedFile file;
+	if(!file.openRead(filename) || file.size() < sizeof(TextureCacheHeader))
+	{
+		return false;
+	}
+	TextureCacheHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	const FileStamp source = fileStamp(image_filename);
+	if(memcmp(header.magic, texture_cache_magic, sizeof(texture_cache_magic)) != 0
+	   || header.version != texture_cache_version || header.source.size != source.size
+	   || header.source.modified != source.modified)
+	{
+		return false;
+	}
+	const size_t levels_size = size_t(header.number_of_levels) * sizeof(CompressedTexture::Level);
+	if(header.number_of_levels > 32 || file.size() != sizeof(header) + levels_size + header.data_size
+	   || fnv1a(file.data() + sizeof(header), levels_size + header.data_size) != header.checksum)
+	{
+		std::cout << filename << " is damaged, compressing " << image_filename << " again.\n";
+		return false;
+	}
+	compressed.gl_format = header.gl_format;
+	compressed.levels.resize(header.number_of_levels);
+	memcpy(compressed.levels.data(), file.data() + sizeof(header), levels_size);
+	for(const auto& level : compressed.levels)
+	{
+		if(level.offset > header.data_size || header.data_size - level.offset < level.size)
+		{
+			std::cout << filename << " is damaged, compressing " << image_filename << " again.\n";
+			return false;
+		}
+	}
+	const uint8_t* data = file.data() + sizeof(header) + levels_size;
+	compressed.data.assign(data, data + header.data_size);
+	return true;
+}
+
+void writeCompressedTexture(const std::string& image_filename, int components, TextureCompression mode,
+                            const CompressedTexture& compressed)
+{
+	const std::string filename = compressedTextureFilename(image_filename, components, mode);
+	const size_t levels_size = compressed.levels.size() * sizeof(CompressedTexture::Level);
+	TextureCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, texture_cache_magic, sizeof(texture_cache_magic));
+	header.version = texture_cache_version;
+	header.gl_format = compressed.gl_format;
+	header.number_of_levels = uint32_t(compressed.levels.size());
+	header.source = fileStamp(image_filename);
+	header.data_size = compressed.data.size();
+
+	// Write to a temporary file and rename it, as the model cache does
+	const std::string temporary = filename + ".tmp";
+	{
+		MappedFile file;
+		if(!file.openWrite(temporary, sizeof(header) + levels_size + compressed.data.size()))
+		{
+			std::cout << "Could not write " << filename << ".\n";
+			return;
+		}
+		memcpy(file.data() + sizeof(header), compressed.levels.data(), levels_size);
+		memcpy(file.data() + sizeof(header) + levels_size, compressed.data.data(), compressed.data.size());
+		header.checksum = fnv1a(file.data() + sizeof(header), levels_size + compressed.data.size());
+		memcpy(file.data(), &header, sizeof(header));
+	}
+	std::remove(filename.c_str());
+	if(std::rename(temporary.c_str(), filename.c_str()) != 0)
+	{
+		std::cout << "Could not write " << filename << ".\n";
+		std::remove(temporary.c_str());
+	}
+}
+} // namespace labhelper
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// How model textures are stored on the GPU
+///
+/// Fast:        BC1 for opaque color textures, BC3 for those with alpha,
+///              BC4 and BC5 for one and two channel textures.
+/// HighQuality: BC7 for opaque color textures, which is twice the size of
+///              BC1 but keeps gradients and colors much better.
+/// None:        Uncompressed, with mipmaps built by the driver.
+///////////////////////////////////////////////////////////////////////////
+enum class TextureCompression
+{
+	None,
+	Fast,
+	HighQuality
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// A block compressed texture with its full mip chain, in one buffer
+///////////////////////////////////////////////////////////////////////////
+struct CompressedTexture
+{
+	struct Level
+	{
+		int width, height;
+		size_t offset, size;
+	};
+	uint32_t gl_format = 0;
+	std::vector<Level> levels;
+	std::vector<uint8_t> data;
+};
+
+/// Build the mip chain of an image with `components` 8 bit channels and
+/// encode it, on all cores if `parallel` is set. Callers that already run
+/// one thread per core, like the TextureCache workers, encode serially.
+/// `mode` must not be None.
+void compressTexture(const uint8_t* pixels, int width, int height, int components, TextureCompression mode,
+                     CompressedTexture& compressed, bool parallel = true);
+
+const char* compressedFormatName(uint32_t gl_format);
+
+///////////////////////////////////////////////////////////////////////////
+/// The compressed texture cache
+///
+/// Encoding is far too slow to do at every load, so the compressed mip
+/// chain is written next to the image the first time, and read from there
+/// as long as the image keeps its size and modification time.
+///////////////////////////////////////////////////////////////////////////
+std::string compressedTextureFilename(const std::string& image_filename, int components, TextureCompression mode);
+bool readCompressedTexture(const std::string& image_filename, int components, TextureCompression mode,
+                           CompressedTexture& compressed);
+void writeCompressedTexture(const std::string& image_filename, int components, TextureCompression mode,
+                            const CompressedTexture& compressed);
+} // namespace labhelper
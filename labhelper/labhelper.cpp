@@ -574,8 +574,31 @@ GLuint loadShaderProgram(const std::string& vertexShader, const std::string& fra
 }
 
 
+struct UniformLocations
+{
+	GLuint program;
+	const char* const* names;
+	std::vector<GLint> locations;
+	// Or, for getUniformBlockIndices(), the indices of uniform blocks
+	std::vector<GLuint> block_indices;
+};
+// A handful of programs and lists, so a linear search beats hashing
+static std::vector<UniformLocations> uniform_locations;
+
+static void forgetUniformLocations(GLuint shaderProgram)
+{
+	uniform_locations.erase(std::remove_if(uniform_locations.begin(), uniform_locations.end(),
+	                                       [&](const UniformLocations& cached) {
+		                                       return cached.program == shaderProgram;
+	                                       }),
+	                        uniform_locations.end());
+}
+
 bool linkShaderProgram(GLuint shaderProgram, bool allow_errors)
 {
+	// The uniforms may have moved, or this is a new program that reuses
+	// the name of a deleted one
+	forgetUniformLocations(shaderProgram);
 	glLinkProgram(shaderProgram);
 	GLint linkOk = 0;
 	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &linkOk);
@@ -671,6 +694,46 @@ void setUniformSlow(GLuint shaderProgram, const char* name, const uint32_t nof_v
 	glUniform3fv(glGetUniformLocation(shaderProgram, name), nof_values, (float*)values);
 }
 
+const GLint* getUniformLocations(GLuint shaderProgram, const char* const* names, int count)
+{
+	for(const UniformLocations& cached : uniform_locations)
+	{
+		if(cached.program == shaderProgram && cached.names == names)
+		{
+			return cached.locations.data();
+		}
+	}
+	UniformLocations cached;
+	cached.program = shaderProgram;
+	cached.names = names;
+	for(int i = 0; i < count; i++)
+	{
+		cached.locations.push_back(glGetUniformLocation(shaderProgram, names[i]));
+	}
+	uniform_locations.push_back(std::move(cached));
+	return uniform_locations.back().locations.data();
+}
+
+const GLuint* getUniformBlockIndices(GLuint shaderProgram, const char* const* names, int count)
+{
+	for(const UniformLocations& cached : uniform_locations)
+	{
+		if(cached.program == shaderProgram && cached.names == names)
+		{
+			return cached.block_indices.data();
+		}
+	}
+	UniformLocations cached;
+	cached.program = shaderProgram;
+	cached.names = names;
+	for(int i = 0; i < count; i++)
+	{
+		cached.block_indices.push_back(glGetUniformBlockIndex(shaderProgram, names[i]));
+	}
+	uniform_locations.push_back(std::move(cached));
+	return uniform_locations.back().block_indices.data();
+}
+
 void debugDrawArrow(const glm::mat4& viewMat, const glm::mat4& projMat, glm::vec3 start, glm::vec3 point)
 {
 	using namespace glm;
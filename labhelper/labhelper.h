@@ -164,6 +164,21 @@ void setUniformSlow(GLuint shaderProgram, const char* name, const bool value);
 void setUniformSlow(GLuint shaderProgram, const char* name, const glm::vec3& value);
 void setUniformSlow(GLuint shaderProgram, const char* name, const uint32_t nof_values, const glm::vec3* values);
 
+///////////////////////////////////////////////////////////////////////////
+/// The locations of `count` uniforms of a shader program, found with
+/// glGetUniformLocation() the first time and cached after that. `names`
+/// must be a static array, since the cache is keyed on the program and the
+/// address of the array rather than on strings. linkShaderProgram()
+/// forgets the locations of the program it links.
+///////////////////////////////////////////////////////////////////////////
+const GLint* getUniformLocations(GLuint shaderProgram, const char* const* names, int count);
+
+///////////////////////////////////////////////////////////////////////////
+/// The same for the indices of uniform blocks, GL_INVALID_INDEX for the
+/// blocks the program does not have
+///////////////////////////////////////////////////////////////////////////
+const GLuint* getUniformBlockIndices(GLuint shaderProgram, const char* const* names, int count);
+
 ///////////////////////////////////////////////////////////////////////////
 /// Draws a single quad (two triangles) that cover the entire screen
 ///////////////////////////////////////////////////////////////////////////
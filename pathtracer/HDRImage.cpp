@@ -4,15 +4,25 @@
 using namespace std;
 using namespace glm;
 
-void HDRImage::load(const string& filename)
+bool HDRImage::load(const string& filename)
 {
 	stbi_set_flip_vertically_on_load(true);
-	data = stbi_loadf(filename.c_str(), &width, &height, &components, 3);
-	if(data == NULL)
+	int new_width, new_height, new_components;
+	float* new_data = stbi_loadf(filename.c_str(), &new_width, &new_height, &new_components, 3);
+	if(new_data == NULL)
 	{
 		std::cout << "Failed to load image: " << filename << ".\n";
-		exit(1);
+		return false;
 	}
+	if(data != nullptr)
+	{
+		stbi_image_free(data);
+	}
+	data = new_data;
+	width = new_width;
+	height = new_height;
+	components = new_components;
+	return true;
 };
 
 vec3 HDRImage::sample(float u, float v)
@@ -16,6 +16,7 @@ struct HDRImage
 		if(data != nullptr)
 			stbi_image_free(data);
 	};
-	void load(const std::string& filename);
+	// Replaces the current image. On failure the current image is kept.
+	bool load(const std::string& filename);
 	glm::vec3 sample(float u, float v);
 };
\ No newline at end of file
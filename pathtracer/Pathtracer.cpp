@@ -6,7 +6,14 @@
 #include "material.h"
 #include "embree.h"
 #include "sampling.h"
+#include "statistics.h"
+#include "texture.h"
+#include "lights.h"
+#include "guiding.h"
+#include "radiancecache.h"
+#include "photonmap.h"
 #include "labhelper.h"
+#include <chrono>
 
 using namespace std;
 using namespace glm;
@@ -22,6 +29,7 @@ Environment environment;
 Image rendered_image;
 PointLight point_light;
 std::vector<DiscLight> disc_lights;
+static uint32_t restart_generation = 0;
 
 ///////////////////////////////////////////////////////////////////////////
 // Restart rendering of image
@@ -30,6 +38,12 @@ void restart()
 {
 	// No need to clear image,
 	rendered_image.number_of_samples = 0;
+	restart_generation += 1;
+}
+
+uint32_t getRestartGeneration()
+{
+	return restart_generation;
 }
 
 int getSampleCount()
@@ -55,6 +69,10 @@ void resize(int w, int h)
 ///////////////////////////////////////////////////////////////////////////
 vec3 Lenvironment(const vec3& wi)
 {
+	if(environment.octahedral_map.isValid())
+	{
+		return environment.multiplier * environment.octahedral_map.lookup(wi);
+	}
 	const float theta = acos(std::max(-1.0f, std::min(1.0f, wi.y)));
 	float phi = atan(wi.z, wi.x);
 	if(phi < 0.0f)
@@ -63,36 +81,302 @@ vec3 Lenvironment(const vec3& wi)
 	return environment.multiplier * environment.map.sample(lookup.x, lookup.y);
 }
 
+///////////////////////////////////////////////////////////////////////////
+/// Test a shadow ray, counting it (and its time) in the statistics
+///////////////////////////////////////////////////////////////////////////
+static bool occludedTimed(Ray& shadow_ray)
+{
+	ThreadStatistics& stats = threadStatistics();
+	stats.shadow_rays += 1;
+	ScopedTimer embree_timer(stats.embree_seconds, statistics_settings.measure_embree_time);
+	return occluded(shadow_ray);
+}
+
+// Vertices deeper into a path than this are not recorded for path guiding
+// or the radiance cache
+const int max_recorded_vertices = 16;
+
+static vec3 divideThroughput(const vec3& contribution, const vec3& t)
+{
+	return vec3(t.x > 0.0f ? contribution.x / t.x : 0.0f, t.y > 0.0f ? contribution.y / t.y : 0.0f,
+	            t.z > 0.0f ? contribution.z / t.z : 0.0f);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// The vertices of a path that wait for the radiance found further along
+/// it: the sampled directions for path guiding, where the throughput
+/// includes the direction (so dividing by it gives the radiance that
+/// arrived from it), and the surfaces for the radiance cache, where it
+/// stops at the surface (giving the radiance that left it).
+///////////////////////////////////////////////////////////////////////////
+struct PathRecord
+{
+	GuidingVertex guiding[max_recorded_vertices];
+	int guiding_count = 0;
+	RadianceCacheVertex cache[max_recorded_vertices];
+	int cache_count = 0;
+
+	void addContribution(vec3& L, const vec3& contribution)
+	{
+		L += contribution;
+		for(int i = 0; i < guiding_count; i++)
+		{
+			guiding[i].radiance += divideThroughput(contribution, guiding[i].throughput);
+		}
+		for(int i = 0; i < cache_count; i++)
+		{
+			cache[i].radiance += divideThroughput(contribution, cache[i].throughput);
+		}
+	}
+};
+
 ///////////////////////////////////////////////////////////////////////////
 /// Calculate the radiance going from one point (r.hitPosition()) in one
 /// direction (-r.d), through path tracing.
 ///////////////////////////////////////////////////////////////////////////
-vec3 Li(Ray& primary_ray)
+vec3 Li(Ray& primary_ray, const RayDifferential& differential)
 {
 	vec3 L = vec3(0.0f);
 	vec3 path_throughput = vec3(1.0);
 	Ray current_ray = primary_ray;
+	ThreadStatistics& stats = threadStatistics();
+	// Solid angle pdf of the direction sampled at the previous vertex
+	float previous_pdf = 0.0f;
+	bool previous_specular = false;
+	// Whether every vertex so far has been specular, so that caustics are
+	// still to be gathered
+	bool specular_chain = true;
+	PathRecord record;
+	const bool record_guiding = isGuidingRecording();
+
+	for(int bounces = 0;; bounces++)
+	{
+		///////////////////////////////////////////////////////////////////
+		// Get the intersection information from the ray
+		///////////////////////////////////////////////////////////////////
+		Intersection hit = getIntersection(current_ray);
+		if(bounces == 0)
+		{
+			computeTextureFootprint(current_ray, differential, hit);
+		}
+		stats.path_vertices += 1;
+
+		///////////////////////////////////////////////////////////////////
+		// Create a Material tree for evaluating brdfs and calculating
+		// sample directions.
+		///////////////////////////////////////////////////////////////////
+		const vec3 color = materialColor(hit);
+		const float fresnel = materialFresnel(hit);
+		const float metalness = materialMetalness(hit);
+		Diffuse diffuse(color);
+		MicrofacetBRDF microfacet(hit.material->m_shininess);
+		DielectricBSDF dielectric(&microfacet, &diffuse, fresnel);
+		MetalBSDF metal(&microfacet, color, fresnel);
+		BSDFLinearBlend metal_blend(metalness, &metal, &dielectric);
+#if SOLUTION_PROJECT == PROJECT_REFRACTIONS
+		GlassBTDF glass(hit.material->m_ior);
+		TransparentBSDF transparent(hit.material->m_transparency, &glass, &metal_blend);
+		BSDF& mat = transparent;
+#else
+		BSDF& mat = metal_blend;
+#endif
+
+		///////////////////////////////////////////////////////////////////
+		// With path guiding, directions are sampled from a mix of the
+		// material and the learned distribution of incoming radiance, and
+		// the pdf of a direction is that of the mix
+		///////////////////////////////////////////////////////////////////
+		const DirectionalTree* guide = guidingDistribution(hit.position);
+		const float bsdf_fraction = guide ? guiding_settings.bsdf_sampling_fraction : 1.0f;
+		auto scatteringPdf = [&](const vec3& wi) {
+			float pdf = mat.pdf(wi, hit.wo, hit.shading_normal);
+			return guide ? bsdf_fraction * pdf + (1.0f - bsdf_fraction) * guide->pdf(wi) : pdf;
+		};
+
+		///////////////////////////////////////////////////////////////////
+		// Light emitted by the surface itself. After a bounce, the same
+		// light could have been found by sampling the emissive triangles
+		// at the previous vertex, so it is weighted with MIS.
+		///////////////////////////////////////////////////////////////////
+		vec3 Le = materialEmission(hit);
+		if(Le != vec3(0.0f))
+		{
+			float weight = bounces == 0 || previous_specular ? 1.0f
+			                                                 : powerHeuristic(previous_pdf, emissiveTrianglePdf(current_ray));
+			record.addContribution(L, path_throughput * Le * weight);
+		}
+
+		///////////////////////////////////////////////////////////////////
+		// Radiance cache. After a few bounces, end the path with the
+		// cached radiance leaving this surface if there is one. Otherwise
+		// the radiance that leaves it along this path (apart from its own
+		// emission) goes into the cache.
+		///////////////////////////////////////////////////////////////////
+		if(hit.material->m_transparency <= 0.0f && isRadianceCacheable(hit.material->m_shininess, metalness))
+		{
+			const vec3 cache_normal =
+			    dot(hit.wo, hit.geometry_normal) >= 0.0f ? hit.geometry_normal : -hit.geometry_normal;
+			vec3 cached;
+			if(bounces >= radiance_cache_settings.start_bounce && lookupRadianceCache(hit.position, cache_normal, cached))
+			{
+				stats.radiance_cache_hits += 1;
+				record.addContribution(L, path_throughput * cached);
+				break;
+			}
+			if(record.cache_count < max_recorded_vertices)
+			{
+				RadianceCacheVertex& v = record.cache[record.cache_count++];
+				v.position = hit.position;
+				v.normal = cache_normal;
+				v.throughput = path_throughput;
+				v.radiance = vec3(0.0f);
+			}
+		}
+
+		///////////////////////////////////////////////////////////////////
+		// Light from the point light that came through glass, from the
+		// photon map, at the first surface that is not pure glass
+		///////////////////////////////////////////////////////////////////
+		if(specular_chain && hit.material->m_transparency < 1.0f && hasCausticPhotons())
+		{
+			record.addContribution(L, path_throughput * gatherCaustics(hit.position, hit.wo, hit.shading_normal, mat));
+		}
+
+		///////////////////////////////////////////////////////////////////
+		// Calculate Direct Illumination from light.
+		///////////////////////////////////////////////////////////////////
+		{
+			const vec3 to_light = point_light.position - hit.position;
+			const float distance_to_light = length(to_light);
+			const vec3 wi = to_light / distance_to_light;
+			const vec3 f = mat.f(wi, hit.wo, hit.shading_normal) * std::max(0.0f, dot(wi, hit.shading_normal));
+			if(f != vec3(0.0f))
+			{
+				Ray shadow_ray(offsetRayOrigin(hit, wi), wi, 0.0f, distance_to_light - EPSILON);
+				if(!occludedTimed(shadow_ray))
+				{
+					const float falloff_factor = 1.0f / (distance_to_light * distance_to_light);
+					vec3 Li = point_light.intensity_multiplier * point_light.color * falloff_factor;
+					record.addContribution(L, path_throughput * f * Li);
+				}
+			}
+		}
+
+		///////////////////////////////////////////////////////////////////
+		// Direct illumination from emissive triangles, weighted against
+		// finding them by sampling the material
+		///////////////////////////////////////////////////////////////////
+		LightSample light;
+		if(sampleEmissiveTriangles(hit.position, light) && light.Le != vec3(0.0f))
+		{
+			const vec3 f = mat.f(light.wi, hit.wo, hit.shading_normal) * abs(dot(light.wi, hit.shading_normal));
+			if(f != vec3(0.0f))
+			{
+				// Stop just short of the emitter, so that it doesn't occlude itself
+				Ray shadow_ray(offsetRayOrigin(hit, light.wi), light.wi, 0.0f,
+				               light.distance * (1.0f - EPSILON) - EPSILON);
+				if(!occludedTimed(shadow_ray))
+				{
+					float weight = powerHeuristic(light.pdf, scatteringPdf(light.wi));
+					record.addContribution(L, path_throughput * f * light.Le * (weight / light.pdf));
+				}
+			}
+		}
+
+		if(bounces >= settings.max_bounces)
+		{
+			break;
+		}
+
+		///////////////////////////////////////////////////////////////////
+		// Sample the material (or the guiding distribution) to continue
+		// the path
+		///////////////////////////////////////////////////////////////////
+		WiSample r;
+		if(guide == nullptr)
+		{
+			r = mat.sample_wi(hit.wo, hit.shading_normal);
+		}
+		else
+		{
+			if(randf() < bsdf_fraction)
+			{
+				r = mat.sample_wi(hit.wo, hit.shading_normal);
+			}
+			else
+			{
+				float guide_pdf;
+				r.wi = guide->sample(guide_pdf);
+			}
+			if(r.specular)
+			{
+				// Only the material's part of the mix can find it
+				r.pdf *= bsdf_fraction;
+			}
+			else
+			{
+				r.f = mat.f(r.wi, hit.wo, hit.shading_normal);
+				r.pdf = scatteringPdf(r.wi);
+			}
+		}
+		if(r.pdf < EPSILON)
+		{
+			break;
+		}
+		path_throughput = path_throughput * r.f * abs(dot(r.wi, hit.shading_normal)) / r.pdf;
+		if(path_throughput == vec3(0.0f))
+		{
+			break;
+		}
+		if(record_guiding && !r.specular && record.guiding_count < max_recorded_vertices)
+		{
+			GuidingVertex& v = record.guiding[record.guiding_count++];
+			v.position = hit.position;
+			v.wi = r.wi;
+			v.throughput = path_throughput;
+			v.pdf = r.pdf;
+			v.radiance = vec3(0.0f);
+		}
+
+		// Russian roulette, once the path has had a few bounces to pick
+		// up most of its contribution
+		if(bounces >= 3)
+		{
+			float survival = std::min(std::max(path_throughput.x, std::max(path_throughput.y, path_throughput.z)), 0.95f);
+			if(randf() >= survival)
+			{
+				stats.russian_roulette_kills += 1;
+				break;
+			}
+			path_throughput /= survival;
+		}
 
-	///////////////////////////////////////////////////////////////////
-	// Get the intersection information from the ray
-	///////////////////////////////////////////////////////////////////
-	Intersection hit = getIntersection(current_ray);
-	///////////////////////////////////////////////////////////////////
-	// Create a Material tree for evaluating brdfs and calculating
-	// sample directions.
-	///////////////////////////////////////////////////////////////////
-
-	Diffuse diffuse(hit.material->m_color);
-	BTDF& mat = diffuse;
-	///////////////////////////////////////////////////////////////////
-	// Calculate Direct Illumination from light.
-	///////////////////////////////////////////////////////////////////
+		previous_pdf = r.pdf;
+		previous_specular = r.specular;
+		specular_chain = specular_chain && r.specular;
+		current_ray = Ray(offsetRayOrigin(hit, r.wi), r.wi);
+		stats.secondary_rays += 1;
+		bool hit_something;
+		{
+			ScopedTimer embree_timer(stats.embree_seconds, statistics_settings.measure_embree_time);
+			hit_something = intersect(current_ray);
+		}
+		if(!hit_something)
+		{
+			stats.environment_hits += 1;
+			record.addContribution(L, path_throughput * Lenvironment(r.wi));
+			break;
+		}
+	}
+	for(int i = 0; i < record.guiding_count; i++)
+	{
+		const GuidingVertex& v = record.guiding[i];
+		recordGuidingRadiance(v.position, v.wi, (v.radiance.x + v.radiance.y + v.radiance.z) / 3.0f, v.pdf);
+	}
+	for(int i = 0; i < record.cache_count; i++)
 	{
-		const float distance_to_light = length(point_light.position - hit.position);
-		const float falloff_factor = 1.0f / (distance_to_light * distance_to_light);
-		vec3 Li = point_light.intensity_multiplier * point_light.color * falloff_factor;
-		vec3 wi = normalize(point_light.position - hit.position);
-		L = mat.f(wi, hit.wo, hit.shading_normal) * Li * std::max(0.0f, dot(wi, hit.shading_normal));
+		const RadianceCacheVertex& v = record.cache[i];
+		recordRadianceCache(v.position, v.normal, v.radiance);
 	}
 	// Return the final outgoing radiance for the primary ray
 	return L;
@@ -106,10 +390,55 @@ inline static glm::vec3 homogenize(const glm::vec4& p)
 	return glm::vec3(p * (1.f / p.w));
 }
 
+///////////////////////////////////////////////////////////////////////////
+/// Trace one sample through pixel (x, y). The random sequence is seeded
+/// from the pixel and the sample index, so the result does not depend on
+/// which thread (or which process) traces it.
+///////////////////////////////////////////////////////////////////////////
+static vec3 tracePixel(const mat4& inverse_PV, const vec3& camera_pos, int x, int y, uint32_t sample_index)
+{
+	ThreadStatistics& stats = threadStatistics();
+	seedRandom(uint32_t(y * rendered_image.width + x), sample_index);
+
+	Ray primaryRay;
+	primaryRay.o = camera_pos;
+	// Create a ray that starts in the camera position and points toward
+	// the current pixel on a virtual screen.
+	vec2 screenCoord = vec2(float(x) / float(rendered_image.width), float(y) / float(rendered_image.height));
+	// Calculate direction
+	vec4 viewCoord = vec4(screenCoord.x * 2.0f - 1.0f, screenCoord.y * 2.0f - 1.0f, 1.0f, 1.0f);
+	vec3 p = homogenize(inverse_PV * viewCoord);
+	primaryRay.d = normalize(p - camera_pos);
+	// The rays through the next pixel in x and y, for texture filtering
+	RayDifferential differential;
+	differential.valid = true;
+	differential.dodx = differential.dody = vec3(0.0f);
+	vec3 px = homogenize(inverse_PV * (viewCoord + vec4(2.0f / float(rendered_image.width), 0.0f, 0.0f, 0.0f)));
+	vec3 py = homogenize(inverse_PV * (viewCoord + vec4(0.0f, 2.0f / float(rendered_image.height), 0.0f, 0.0f)));
+	differential.dddx = normalize(px - camera_pos) - primaryRay.d;
+	differential.dddy = normalize(py - camera_pos) - primaryRay.d;
+	// Intersect ray with scene
+	bool hit;
+	{
+		ScopedTimer embree_timer(stats.embree_seconds, statistics_settings.measure_embree_time);
+		hit = intersect(primaryRay);
+	}
+	stats.primary_rays += 1;
+	stats.paths += 1;
+	if(hit)
+	{
+		// If it hit something, evaluate the radiance from that point
+		return Li(primaryRay, differential);
+	}
+	// Otherwise evaluate environment
+	stats.environment_hits += 1;
+	return Lenvironment(primaryRay.d);
+}
+
 ///////////////////////////////////////////////////////////////////////////
 /// Trace one path per pixel and accumulate the result in an image
 ///////////////////////////////////////////////////////////////////////////
-void tracePaths(const glm::mat4& V, const glm::mat4& P)
+void tracePaths(const glm::mat4& V, const glm::mat4& P, uint32_t sample_stream)
 {
 	// Stop here if we have as many samples as we want
 	if((int(rendered_image.number_of_samples) > settings.max_paths_per_pixel)
@@ -117,39 +446,24 @@ void tracePaths(const glm::mat4& V, const glm::mat4& P)
 	{
 		return;
 	}
+	auto pass_start = std::chrono::high_resolution_clock::now();
+	beginStatisticsPass();
+	beginGuidingPass();
+	beginRadianceCachePass();
 	vec3 camera_pos = vec3(glm::inverse(V) * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	mat4 inverse_PV = inverse(P * V);
+	const int sample_index = rendered_image.number_of_samples;
+	tracePhotons(sample_index, sample_stream);
+
 	// Trace one path per pixel (the omp parallel stuf magically distributes the
 	// pathtracing on all cores of your CPU).
-	int num_rays = 0;
-	vector<vec4> local_image(rendered_image.width * rendered_image.height, vec4(0.0f));
-
 #pragma omp parallel for
 	for(int y = 0; y < rendered_image.height; y++)
 	{
+		ScopedTimer busy_timer(threadStatistics().busy_seconds, true);
 		for(int x = 0; x < rendered_image.width; x++)
 		{
-			vec3 color;
-			Ray primaryRay;
-			primaryRay.o = camera_pos;
-			// Create a ray that starts in the camera position and points toward
-			// the current pixel on a virtual screen.
-			vec2 screenCoord = vec2(float(x) / float(rendered_image.width),
-			                        float(y) / float(rendered_image.height));
-			// Calculate direction
-			vec4 viewCoord = vec4(screenCoord.x * 2.0f - 1.0f, screenCoord.y * 2.0f - 1.0f, 1.0f, 1.0f);
-			vec3 p = homogenize(inverse(P * V) * viewCoord);
-			primaryRay.d = normalize(p - camera_pos);
-			// Intersect ray with scene
-			if(intersect(primaryRay))
-			{
-				// If it hit something, evaluate the radiance from that point
-				color = Li(primaryRay);
-			}
-			else
-			{
-				// Otherwise evaluate environment
-				color = Lenvironment(primaryRay.d);
-			}
+			vec3 color = tracePixel(inverse_PV, camera_pos, x, y, uint32_t(sample_index) | sample_stream);
 			// Accumulate the obtained radiance to the pixels color
 			float n = float(rendered_image.number_of_samples);
 			rendered_image.data[y * rendered_image.width + x] =
@@ -158,5 +472,43 @@ void tracePaths(const glm::mat4& V, const glm::mat4& P)
 		}
 	}
 	rendered_image.number_of_samples += 1;
+	std::chrono::duration<double> pass_time = std::chrono::high_resolution_clock::now() - pass_start;
+	endStatisticsPass(pass_time.count(), rendered_image.number_of_samples);
+	endGuidingPass();
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Trace samples [sample_begin, sample_end) for the pixels in a rectangle
+/// and return the sum of the radiance for each pixel.
+///////////////////////////////////////////////////////////////////////////
+void traceTile(const mat4& V,
+               const mat4& P,
+               int x0,
+               int y0,
+               int x1,
+               int y1,
+               int sample_begin,
+               int sample_end,
+               std::vector<vec3>& sums)
+{
+	vec3 camera_pos = vec3(glm::inverse(V) * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	mat4 inverse_PV = inverse(P * V);
+	const int tile_width = x1 - x0;
+	sums.assign(size_t(tile_width) * size_t(y1 - y0), vec3(0.0f));
+
+#pragma omp parallel for schedule(dynamic)
+	for(int y = y0; y < y1; y++)
+	{
+		ScopedTimer busy_timer(threadStatistics().busy_seconds, true);
+		for(int x = x0; x < x1; x++)
+		{
+			vec3 sum(0.0f);
+			for(int s = sample_begin; s < sample_end; s++)
+			{
+				sum += tracePixel(inverse_PV, camera_pos, x, y, uint32_t(s));
+			}
+			sums[(y - y0) * tile_width + (x - x0)] = sum;
+		}
+	}
 }
 }; // namespace pathtracer
@@ -4,6 +4,7 @@
 #include <Model.h>
 #include <omp.h>
 #include "HDRImage.h"
+#include "envmap.h"
 
 #ifdef M_PI
 #undef M_PI
@@ -36,6 +37,8 @@ extern struct Environment
 {
 	float multiplier;
 	HDRImage map;
+	// `map` re-projected for fast lookups, see envmap.h
+	OctahedralMap octahedral_map;
 };
 extern Environment environment;
 
@@ -79,6 +82,12 @@ extern std::vector<DiscLight> disc_lights;
 ///////////////////////////////////////////////////////////////////////////
 void restart();
 
+///////////////////////////////////////////////////////////////////////////
+/// Counts the calls to restart(), so that code which renders into the
+/// image elsewhere (see distributed.h) can tell that it should start over
+///////////////////////////////////////////////////////////////////////////
+uint32_t getRestartGeneration();
+
 ///////////////////////////////////////////////////////////////////////////
 /// Get the amount of samples taken in the current image
 ///////////////////////////////////////////////////////////////////////////
@@ -91,7 +100,24 @@ int getSampleCount();
 void resize(int w, int h);
 
 ///////////////////////////////////////////////////////////////////////////
-/// Trace one path per pixel
+/// Trace one path per pixel. The sample stream is or:ed into the sample
+/// index the random numbers are seeded from, so that images rendered with
+/// different streams are independent of each other.
+///////////////////////////////////////////////////////////////////////////
+void tracePaths(const mat4& V, const mat4& P, uint32_t sample_stream = 0);
+
+///////////////////////////////////////////////////////////////////////////
+/// Trace samples [sample_begin, sample_end) for the pixels x0 <= x < x1,
+/// y0 <= y < y1 of rendered_image, and return the summed radiance per pixel
+/// (row major within the tile). Used by distributed rendering workers.
 ///////////////////////////////////////////////////////////////////////////
-void tracePaths(const mat4& V, const mat4& P);
+void traceTile(const mat4& V,
+               const mat4& P,
+               int x0,
+               int y0,
+               int x1,
+               int y1,
+               int sample_begin,
+               int sample_end,
+               std::vector<vec3>& sums);
 }; // namespace pathtracer
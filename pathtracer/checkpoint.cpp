@@ -0,0 +1,475 @@
+#include "checkpoint.h"
+#include "embree.h"
+#include <MappedFile.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace labhelper;
+
+namespace pathtracer
+{
+CheckpointSettings checkpoint_settings;
+
+///////////////////////////////////////////////////////////////////////////////
+// File layout: one page with a FileHeader, followed by two slots. Each slot
+// starts with a page holding its SlotHeader, followed by the pixels. Keeping
+// everything page aligned lets each part be flushed on its own.
+///////////////////////////////////////////////////////////////////////////////
+const char checkpoint_magic[8] = "PTCKPT";
+const uint32_t checkpoint_version = 2;
+const size_t checkpoint_page_size = 4096;
+// Pixels are flushed in bands of this many bytes, so that the OS writes them
+// out progressively instead of in one burst at the end
+const size_t checkpoint_band_size = 1 << 20;
+
+struct FileHeader
+{
+	char magic[8];
+	uint32_t version;
+	int32_t width, height;
+};
+
+struct CheckpointState
+{
+	mat4 V, P;
+	Settings settings;
+	float environment_multiplier;
+	PointLight point_light;
+	// Materials can be edited without saving them, see hashSceneMaterials()
+	uint64_t materials_hash;
+	char scene_name[64];
+};
+
+struct SlotHeader
+{
+	// Slots are written with increasing sequence numbers, 0 = never written
+	uint64_t sequence;
+	int32_t number_of_samples;
+	CheckpointState state;
+	// Of everything above, so a half written header is never trusted
+	uint64_t checksum;
+};
+
+static size_t alignToPage(size_t size)
+{
+	return (size + checkpoint_page_size - 1) / checkpoint_page_size * checkpoint_page_size;
+}
+
+static size_t slotSize(int width, int height)
+{
+	return checkpoint_page_size + alignToPage(size_t(width) * size_t(height) * sizeof(vec3));
+}
+
+static size_t slotOffset(int slot, int width, int height)
+{
+	return checkpoint_page_size + size_t(slot) * slotSize(width, height);
+}
+
+static size_t checkpointFileSize(int width, int height)
+{
+	return checkpoint_page_size + 2 * slotSize(width, height);
+}
+
+static uint64_t slotChecksum(const SlotHeader& header)
+{
+	return fnv1a((const uint8_t*)&header, offsetof(SlotHeader, checksum));
+}
+
+static CheckpointState makeCheckpointState(const mat4& V, const mat4& P, const string& scene_name)
+{
+	CheckpointState state;
+	memset(&state, 0, sizeof(state));
+	state.V = V;
+	state.P = P;
+	state.settings = settings;
+	state.environment_multiplier = environment.multiplier;
+	state.point_light = point_light;
+	state.materials_hash = hashSceneMaterials();
+	strncpy(state.scene_name, scene_name.c_str(), sizeof(state.scene_name) - 1);
+	return state;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The camera is restored from the stored view matrix on resume, which does
+// not give back the exact same bits, so the matrices are compared with some
+// tolerance.
+///////////////////////////////////////////////////////////////////////////////
+static bool sameMatrix(const mat4& a, const mat4& b)
+{
+	for(int i = 0; i < 4; i++)
+	{
+		if(any(greaterThan(abs(a[i] - b[i]), vec4(1e-4f))))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool sameCheckpointState(const CheckpointState& a, const CheckpointState& b)
+{
+	return sameMatrix(a.V, b.V) && sameMatrix(a.P, b.P)
+	       && memcmp(&a.settings, &b.settings, sizeof(Settings)) == 0
+	       && a.environment_multiplier == b.environment_multiplier
+	       && memcmp(&a.point_light, &b.point_light, sizeof(PointLight)) == 0
+	       && a.materials_hash == b.materials_hash
+	       && strncmp(a.scene_name, b.scene_name, sizeof(a.scene_name)) == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Find the most recent slot with a valid header, or -1
+///////////////////////////////////////////////////////////////////////////////
+static int latestSlot(const MappedFile& file, int width, int height, SlotHeader& latest)
+{
+	int result = -1;
+	for(int slot = 0; slot < 2; slot++)
+	{
+		SlotHeader header;
+		memcpy(&header, file.data() + slotOffset(slot, width, height), sizeof(SlotHeader));
+		if(header.sequence != 0 && header.checksum == slotChecksum(header)
+		   && (result == -1 || header.sequence > latest.sequence))
+		{
+			latest = header;
+			result = slot;
+		}
+	}
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Open a checkpoint file for reading and check that it is complete
+///////////////////////////////////////////////////////////////////////////////
+static bool openCheckpoint(const string& filename, MappedFile& file, FileHeader& header)
+{
+	if(!file.openRead(filename))
+	{
+		cout << "Could not open checkpoint " << filename << ".\n";
+		return false;
+	}
+	if(file.size() < checkpoint_page_size)
+	{
+		cout << filename << " is not a checkpoint.\n";
+		return false;
+	}
+	memcpy(&header, file.data(), sizeof(FileHeader));
+	if(memcmp(header.magic, checkpoint_magic, sizeof(checkpoint_magic)) != 0
+	   || header.version != checkpoint_version)
+	{
+		cout << filename << " is not a checkpoint, or was written by another version.\n";
+		return false;
+	}
+	if(header.width <= 0 || header.height <= 0 || file.size() < checkpointFileSize(header.width, header.height))
+	{
+		cout << "Checkpoint " << filename << " is truncated.\n";
+		return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The writer thread. updateCheckpoint() fills in the snapshot and sets
+// `pending`. The snapshot is then only touched by the writer thread until
+// it has cleared `writing`.
+///////////////////////////////////////////////////////////////////////////////
+struct CheckpointWriter
+{
+	thread writer_thread;
+	mutex lock;
+	condition_variable wake;
+	bool quit = false;
+	bool pending = false;
+	bool writing = false;
+
+	string snapshot_filename;
+	int snapshot_width = 0, snapshot_height = 0;
+	SlotHeader snapshot_header;
+	vector<vec3> snapshot;
+
+	// Only used by the writer thread
+	MappedFile file;
+	string file_name;
+	int file_width = 0, file_height = 0;
+	uint64_t sequence = 0;
+
+	atomic<int> last_written_samples{ 0 };
+
+	// Only used by the main thread
+	bool clock_started = false;
+	chrono::steady_clock::time_point last_checkpoint_time;
+	CheckpointState last_state;
+	int last_samples = -1;
+};
+static CheckpointWriter writer;
+
+///////////////////////////////////////////////////////////////////////////////
+// Make sure the mapped file matches the snapshot's filename and resolution.
+// An existing checkpoint of the same resolution is kept, so that its latest
+// slot survives until a newer one has been written.
+///////////////////////////////////////////////////////////////////////////////
+static bool prepareCheckpointFile()
+{
+	const int width = writer.snapshot_width, height = writer.snapshot_height;
+	if(writer.file.isOpen() && writer.file_name == writer.snapshot_filename && writer.file_width == width
+	   && writer.file_height == height)
+	{
+		return true;
+	}
+	writer.file.close();
+	if(!writer.file.openWrite(writer.snapshot_filename, checkpointFileSize(width, height)))
+	{
+		cout << "Could not open checkpoint " << writer.snapshot_filename << " for writing.\n";
+		return false;
+	}
+	writer.file_name = writer.snapshot_filename;
+	writer.file_width = width;
+	writer.file_height = height;
+
+	FileHeader header;
+	memcpy(&header, writer.file.data(), sizeof(FileHeader));
+	SlotHeader latest;
+	if(memcmp(header.magic, checkpoint_magic, sizeof(checkpoint_magic)) == 0
+	   && header.version == checkpoint_version && header.width == width && header.height == height
+	   && latestSlot(writer.file, width, height, latest) != -1)
+	{
+		writer.sequence = latest.sequence;
+		return true;
+	}
+
+	// A new file, or one we can't use. Invalidate both slots before writing
+	// the file header.
+	SlotHeader empty;
+	memset(&empty, 0, sizeof(empty));
+	for(int slot = 0; slot < 2; slot++)
+	{
+		memcpy(writer.file.data() + slotOffset(slot, width, height), &empty, sizeof(empty));
+		writer.file.flush(slotOffset(slot, width, height), sizeof(empty));
+	}
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, checkpoint_magic, sizeof(checkpoint_magic));
+	header.version = checkpoint_version;
+	header.width = width;
+	header.height = height;
+	memcpy(writer.file.data(), &header, sizeof(header));
+	writer.file.flush(0, sizeof(header));
+	writer.sequence = 0;
+	return true;
+}
+
+static void writeSnapshot()
+{
+	if(!prepareCheckpointFile())
+	{
+		return;
+	}
+	const int width = writer.file_width, height = writer.file_height;
+
+	// Overwrite the slot that does not hold the latest checkpoint
+	SlotHeader latest;
+	const int slot = 1 - std::max(latestSlot(writer.file, width, height, latest), 0);
+	const size_t offset = slotOffset(slot, width, height);
+	const size_t data_offset = offset + checkpoint_page_size;
+	const size_t data_size = writer.snapshot.size() * sizeof(vec3);
+	const uint8_t* source = (const uint8_t*)writer.snapshot.data();
+
+	for(size_t band = 0; band < data_size; band += checkpoint_band_size)
+	{
+		size_t band_size = std::min(checkpoint_band_size, data_size - band);
+		memcpy(writer.file.data() + data_offset + band, source + band, band_size);
+		writer.file.flush(data_offset + band, band_size);
+	}
+
+	// Only now that the pixels are on disk does the slot become valid
+	SlotHeader header = writer.snapshot_header;
+	header.sequence = ++writer.sequence;
+	header.checksum = slotChecksum(header);
+	memcpy(writer.file.data() + offset, &header, sizeof(header));
+	writer.file.flush(offset, sizeof(header));
+
+	writer.last_written_samples = header.number_of_samples;
+}
+
+static void writerThread()
+{
+	unique_lock<mutex> lock(writer.lock);
+	for(;;)
+	{
+		writer.wake.wait(lock, [] { return writer.pending || writer.quit; });
+		if(writer.pending)
+		{
+			writer.pending = false;
+			writer.writing = true;
+			lock.unlock();
+			writeSnapshot();
+			lock.lock();
+			writer.writing = false;
+			writer.wake.notify_all();
+		}
+		else if(writer.quit)
+		{
+			break;
+		}
+	}
+	writer.file.close();
+}
+
+void updateCheckpoint(const mat4& V, const mat4& P, const std::string& scene_name)
+{
+	if(!checkpoint_settings.enabled || rendered_image.number_of_samples == 0)
+	{
+		return;
+	}
+	auto now = chrono::steady_clock::now();
+	if(!writer.clock_started)
+	{
+		writer.clock_started = true;
+		writer.last_checkpoint_time = now;
+	}
+	if(chrono::duration<float>(now - writer.last_checkpoint_time).count() < checkpoint_settings.interval)
+	{
+		return;
+	}
+	CheckpointState state = makeCheckpointState(V, P, scene_name);
+	if(rendered_image.number_of_samples == writer.last_samples && sameCheckpointState(state, writer.last_state))
+	{
+		// Nothing new since the last checkpoint
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(writer.lock);
+		if(writer.pending || writer.writing)
+		{
+			// Still busy with the previous one, try again next frame
+			return;
+		}
+		if(!writer.writer_thread.joinable())
+		{
+			writer.quit = false;
+			writer.writer_thread = thread(writerThread);
+		}
+		writer.snapshot_filename = checkpoint_settings.filename;
+		writer.snapshot_width = rendered_image.width;
+		writer.snapshot_height = rendered_image.height;
+		memset(&writer.snapshot_header, 0, sizeof(SlotHeader));
+		writer.snapshot_header.number_of_samples = rendered_image.number_of_samples;
+		writer.snapshot_header.state = state;
+		// The copy is all the main thread pays for a checkpoint
+		writer.snapshot = rendered_image.data;
+		writer.pending = true;
+	}
+	writer.wake.notify_all();
+
+	writer.last_checkpoint_time = now;
+	writer.last_state = state;
+	writer.last_samples = rendered_image.number_of_samples;
+}
+
+bool readCheckpointInfo(const std::string& filename, CheckpointInfo& info)
+{
+	MappedFile file;
+	FileHeader header;
+	if(!openCheckpoint(filename, file, header))
+	{
+		return false;
+	}
+	SlotHeader latest;
+	if(latestSlot(file, header.width, header.height, latest) == -1)
+	{
+		cout << "Checkpoint " << filename << " has no complete snapshot.\n";
+		return false;
+	}
+	latest.state.scene_name[sizeof(latest.state.scene_name) - 1] = '\0';
+	info.scene_name = latest.state.scene_name;
+	info.V = latest.state.V;
+	info.P = latest.state.P;
+	info.width = header.width;
+	info.height = header.height;
+	info.number_of_samples = latest.number_of_samples;
+	info.settings = latest.state.settings;
+	info.environment_multiplier = latest.state.environment_multiplier;
+	info.point_light = latest.state.point_light;
+	return true;
+}
+
+bool resumeFromCheckpoint(const std::string& filename, const mat4& V, const mat4& P, const std::string& scene_name)
+{
+	MappedFile file;
+	FileHeader header;
+	if(!openCheckpoint(filename, file, header))
+	{
+		return false;
+	}
+	if(header.width != rendered_image.width || header.height != rendered_image.height)
+	{
+		cout << "Checkpoint " << filename << " is " << header.width << "x" << header.height
+		     << " but the image is " << rendered_image.width << "x" << rendered_image.height
+		     << ". The window may not have been allowed to grow to the size it was rendered at.\n";
+		return false;
+	}
+	SlotHeader latest;
+	int slot = latestSlot(file, header.width, header.height, latest);
+	if(slot == -1)
+	{
+		cout << "Checkpoint " << filename << " has no complete snapshot.\n";
+		return false;
+	}
+	CheckpointState state = makeCheckpointState(V, P, scene_name);
+	if(state.materials_hash != latest.state.materials_hash)
+	{
+		cout << "Checkpoint " << filename << " was rendered with edited materials, which are not saved.\n";
+		return false;
+	}
+	if(!sameCheckpointState(state, latest.state))
+	{
+		cout << "Checkpoint " << filename << " was rendered with another scene, camera or settings.\n";
+		return false;
+	}
+
+	memcpy(rendered_image.data.data(),
+	       file.data() + slotOffset(slot, header.width, header.height) + checkpoint_page_size,
+	       rendered_image.data.size() * sizeof(vec3));
+	rendered_image.number_of_samples = latest.number_of_samples;
+
+	// Don't write the same thing back right away
+	writer.clock_started = true;
+	writer.last_checkpoint_time = chrono::steady_clock::now();
+	writer.last_state = state;
+	writer.last_samples = latest.number_of_samples;
+	writer.last_written_samples = latest.number_of_samples;
+	cout << "Resumed from " << filename << " at " << latest.number_of_samples << " samples.\n";
+	return true;
+}
+
+int lastCheckpointSamples()
+{
+	return writer.last_written_samples;
+}
+
+bool isCheckpointWriting()
+{
+	lock_guard<mutex> lock(writer.lock);
+	return writer.pending || writer.writing;
+}
+
+void stopCheckpointing()
+{
+	{
+		lock_guard<mutex> lock(writer.lock);
+		writer.quit = true;
+	}
+	writer.wake.notify_all();
+	if(writer.writer_thread.joinable())
+	{
+		writer.writer_thread.join();
+	}
+}
+} // namespace pathtracer
@@ -0,0 +1,75 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <string>
+#include "Pathtracer.h"
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////////
+// Checkpointing of progressive renders
+//
+// The accumulated image is periodically snapshotted into a memory mapped
+// file. The file holds two slots that are written alternately by a
+// background thread, and a slot's header is only written once its pixels
+// are on disk, so a crash while checkpointing leaves the previous slot
+// intact. Since every sample is seeded from its pixel and sample index, the
+// sample count is all the sampler state needed to continue the exact same
+// sequence after a resume.
+///////////////////////////////////////////////////////////////////////////////
+struct CheckpointSettings
+{
+	bool enabled = false;
+	// Seconds between checkpoints
+	float interval = 30.0f;
+	std::string filename = "pathtracer.checkpoint";
+};
+extern CheckpointSettings checkpoint_settings;
+
+///////////////////////////////////////////////////////////////////////////////
+// What was being rendered when the checkpoint was written
+///////////////////////////////////////////////////////////////////////////////
+struct CheckpointInfo
+{
+	std::string scene_name;
+	mat4 V, P;
+	int width = 0, height = 0;
+	int number_of_samples = 0;
+	Settings settings;
+	float environment_multiplier = 1.0f;
+	PointLight point_light;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Called once per frame after tracing. Hands a copy of rendered_image to
+/// the writer thread when checkpoint_settings.interval has passed and the
+/// previous checkpoint has been written.
+///////////////////////////////////////////////////////////////////////////
+void updateCheckpoint(const mat4& V, const mat4& P, const std::string& scene_name);
+
+///////////////////////////////////////////////////////////////////////////
+/// Read what the latest complete snapshot in a checkpoint file contains, so
+/// that the scene, camera and settings can be restored before resuming.
+///////////////////////////////////////////////////////////////////////////
+bool readCheckpointInfo(const std::string& filename, CheckpointInfo& info);
+
+///////////////////////////////////////////////////////////////////////////
+/// Load the latest snapshot into rendered_image, if it was rendered with
+/// the same scene, materials, camera, settings and resolution as now. tracePaths then
+/// continues from the stored sample count.
+///////////////////////////////////////////////////////////////////////////
+bool resumeFromCheckpoint(const std::string& filename, const mat4& V, const mat4& P, const std::string& scene_name);
+
+///////////////////////////////////////////////////////////////////////////
+/// Sample count of the last snapshot written, and whether one is being
+/// written right now
+///////////////////////////////////////////////////////////////////////////
+int lastCheckpointSamples();
+bool isCheckpointWriting();
+
+///////////////////////////////////////////////////////////////////////////
+/// Finish the checkpoint being written, if any, and stop the writer thread
+///////////////////////////////////////////////////////////////////////////
+void stopCheckpointing();
+} // namespace pathtracer
@@ -0,0 +1,842 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#undef near
+#undef far
+typedef SOCKET socket_t;
+static const socket_t invalid_socket = INVALID_SOCKET;
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <signal.h>
+typedef int socket_t;
+static const socket_t invalid_socket = -1;
+#endif
+
+#include "distributed.h"
+#include "Pathtracer.h"
+#include "guiding.h"
+#include "radiancecache.h"
+#include "photonmap.h"
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+DistributedSettings distributed_settings;
+
+///////////////////////////////////////////////////////////////////////////////
+// Socket helpers
+///////////////////////////////////////////////////////////////////////////////
+static void initSockets()
+{
+	static bool initialized = false;
+	if(initialized)
+		return;
+	initialized = true;
+#ifdef _WIN32
+	WSADATA wsa_data;
+	WSAStartup(MAKEWORD(2, 2), &wsa_data);
+#else
+	// Writing to a socket whose peer died should fail, not kill us
+	signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+static void closeSocket(socket_t s)
+{
+#ifdef _WIN32
+	closesocket(s);
+#else
+	close(s);
+#endif
+}
+
+// Makes any blocking call on the socket return
+static void shutdownSocket(socket_t s)
+{
+#ifdef _WIN32
+	shutdown(s, SD_BOTH);
+#else
+	shutdown(s, SHUT_RDWR);
+#endif
+}
+
+static void setReceiveTimeout(socket_t s, float seconds)
+{
+#ifdef _WIN32
+	DWORD timeout = DWORD(seconds * 1000.0f);
+#else
+	timeval timeout;
+	timeout.tv_sec = long(seconds);
+	timeout.tv_usec = long((seconds - float(timeout.tv_sec)) * 1e6f);
+#endif
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+}
+
+static void setNoDelay(socket_t s)
+{
+	int flag = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&flag, sizeof(flag));
+}
+
+static bool sendAll(socket_t s, const void* data, size_t size)
+{
+	const char* p = (const char*)data;
+	while(size > 0)
+	{
+		int n = send(s, p, int(std::min(size, size_t(1) << 20)), 0);
+		if(n <= 0)
+			return false;
+		p += n;
+		size -= size_t(n);
+	}
+	return true;
+}
+
+static bool recvAll(socket_t s, void* data, size_t size)
+{
+	char* p = (char*)data;
+	while(size > 0)
+	{
+		int n = recv(s, p, int(std::min(size, size_t(1) << 20)), 0);
+		if(n <= 0)
+			return false;
+		p += n;
+		size -= size_t(n);
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Protocol. Both ends are assumed to be the same build on the same
+// architecture, so structs are sent as they are.
+///////////////////////////////////////////////////////////////////////////////
+enum MessageType : uint32_t
+{
+	MessageRenderState = 1,
+	MessageJob = 2,
+	MessageResult = 3,
+};
+
+struct MessageHeader
+{
+	uint32_t type;
+	uint32_t size;
+};
+
+const int max_distributed_disc_lights = 8;
+
+// The photon settings, with 4 byte members only so that the render state
+// has no padding
+struct PhotonState
+{
+	int32_t enabled;
+	int32_t photons_per_pass;
+	float initial_radius;
+	float alpha;
+	int32_t max_memory_mb;
+	int32_t max_depth;
+};
+
+// The material properties that can be edited in the GUI
+struct MaterialState
+{
+	vec3 color;
+	float shininess, metalness, fresnel;
+	vec3 emission;
+	float transparency, ior;
+};
+
+// Everything a worker needs to reproduce the coordinator's samples. It is
+// followed by `number_of_materials` MaterialStates, for the materials of
+// the scene's models in order.
+struct RenderState
+{
+	uint32_t generation;
+	int32_t width, height;
+	mat4 V, P;
+	Settings settings;
+	float environment_multiplier;
+	PointLight point_light;
+	int32_t number_of_disc_lights;
+	DiscLight disc_lights[max_distributed_disc_lights];
+	PhotonState photons;
+	int32_t number_of_materials;
+	char scene_name[64];
+};
+
+struct JobMessage
+{
+	uint32_t generation;
+	int32_t x0, y0, x1, y1;
+	int32_t sample_begin, sample_end;
+};
+
+static bool sendMessage(socket_t s, MessageType type, const void* data, size_t size)
+{
+	MessageHeader header = { type, uint32_t(size) };
+	return sendAll(s, &header, sizeof(header)) && sendAll(s, data, size);
+}
+
+static bool sendState(socket_t s, const RenderState& state, const vector<MaterialState>& materials)
+{
+	MessageHeader header = { MessageRenderState,
+		                     uint32_t(sizeof(RenderState) + materials.size() * sizeof(MaterialState)) };
+	return sendAll(s, &header, sizeof(header)) && sendAll(s, &state, sizeof(state))
+	       && sendAll(s, materials.data(), materials.size() * sizeof(MaterialState));
+}
+
+static RenderState makeRenderState(const mat4& V,
+                                   const mat4& P,
+                                   const string& scene_name,
+                                   const vector<labhelper::Model*>& models,
+                                   vector<MaterialState>& materials)
+{
+	RenderState state;
+	// All members are 4 byte sized, so there is no padding, but clear the
+	// struct anyway since states are compared with memcmp.
+	memset(&state, 0, sizeof(state));
+	state.width = rendered_image.width;
+	state.height = rendered_image.height;
+	state.V = V;
+	state.P = P;
+	state.settings = settings;
+	state.environment_multiplier = environment.multiplier;
+	state.point_light = point_light;
+	state.number_of_disc_lights = int32_t(std::min(int(disc_lights.size()), max_distributed_disc_lights));
+	for(int i = 0; i < state.number_of_disc_lights; i++)
+	{
+		state.disc_lights[i] = disc_lights[i];
+	}
+	state.photons.enabled = photon_settings.enabled ? 1 : 0;
+	state.photons.photons_per_pass = photon_settings.photons_per_pass;
+	state.photons.initial_radius = photon_settings.initial_radius;
+	state.photons.alpha = photon_settings.alpha;
+	state.photons.max_memory_mb = photon_settings.max_memory_mb;
+	state.photons.max_depth = photon_settings.max_depth;
+	strncpy(state.scene_name, scene_name.c_str(), sizeof(state.scene_name) - 1);
+
+	materials.clear();
+	for(const labhelper::Model* model : models)
+	{
+		for(const labhelper::Material& m : model->m_materials)
+		{
+			MaterialState material;
+			material.color = m.m_color;
+			material.shininess = m.m_shininess;
+			material.metalness = m.m_metalness;
+			material.fresnel = m.m_fresnel;
+			material.emission = m.m_emission;
+			material.transparency = m.m_transparency;
+			material.ior = m.m_ior;
+			materials.push_back(material);
+		}
+	}
+	state.number_of_materials = int32_t(materials.size());
+	return state;
+}
+
+static bool sameRenderState(RenderState a, const RenderState& b)
+{
+	a.generation = b.generation;
+	return memcmp(&a, &b, sizeof(RenderState)) == 0;
+}
+
+// MaterialState is all floats, so it has no padding either
+static bool sameMaterials(const vector<MaterialState>& a, const vector<MaterialState>& b)
+{
+	return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(MaterialState)) == 0);
+}
+
+// Set the materials of a worker's models to those of the coordinator
+static void applyMaterials(const vector<MaterialState>& materials, const vector<labhelper::Model*>& models)
+{
+	size_t count = 0;
+	for(const labhelper::Model* model : models)
+	{
+		count += model->m_materials.size();
+	}
+	if(count != materials.size())
+	{
+		cout << "The coordinator sent " << materials.size() << " materials, but the scene has " << count
+		     << ". Keeping the materials as loaded.\n";
+		return;
+	}
+	size_t i = 0;
+	for(labhelper::Model* model : models)
+	{
+		for(labhelper::Material& m : model->m_materials)
+		{
+			const MaterialState& material = materials[i++];
+			m.m_color = material.color;
+			m.m_shininess = material.shininess;
+			m.m_metalness = material.metalness;
+			m.m_fresnel = material.fresnel;
+			m.m_emission = material.emission;
+			m.m_transparency = material.transparency;
+			m.m_ior = material.ior;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Coordinator
+///////////////////////////////////////////////////////////////////////////////
+struct WorkerConnection
+{
+	socket_t socket = invalid_socket;
+	thread worker_thread;
+	bool finished = false;
+};
+
+struct Coordinator
+{
+	mutex lock;
+	condition_variable jobs_changed;
+	atomic<bool> running;
+	socket_t listen_socket = invalid_socket;
+	thread accept_thread;
+	list<WorkerConnection> workers;
+
+	// The current render state, and the job queue for it
+	RenderState state;
+	vector<MaterialState> materials;
+	bool has_state = false;
+	int tile_size = 0, tiles_x = 0, tiles_y = 0;
+	int next_job = 0;
+	deque<JobMessage> requeued;
+
+	// Accumulated radiance, and the number of samples in each tile
+	vector<vec3> sums;
+	vector<int> tile_samples;
+	bool image_dirty = false;
+	// getRestartGeneration() when the job queue was last restarted
+	uint32_t restart_generation = 0;
+
+	CoordinatorStatus status;
+
+	Coordinator() : running(false)
+	{
+	}
+};
+static Coordinator coordinator;
+
+// Must be called with the lock held
+static bool takeJob(JobMessage& job, RenderState& state)
+{
+	if(!coordinator.has_state)
+		return false;
+	if(!coordinator.requeued.empty())
+	{
+		job = coordinator.requeued.front();
+		coordinator.requeued.pop_front();
+	}
+	else
+	{
+		const int num_tiles = coordinator.tiles_x * coordinator.tiles_y;
+		const int pass = coordinator.next_job / num_tiles;
+		const int tile = coordinator.next_job % num_tiles;
+		const int max_paths = coordinator.state.settings.max_paths_per_pixel;
+		job.sample_begin = pass * distributed_settings.samples_per_job;
+		job.sample_end = job.sample_begin + distributed_settings.samples_per_job;
+		if(max_paths != 0)
+		{
+			if(job.sample_begin >= max_paths)
+				return false;
+			job.sample_end = std::min(job.sample_end, max_paths);
+		}
+		job.generation = coordinator.state.generation;
+		job.x0 = (tile % coordinator.tiles_x) * coordinator.tile_size;
+		job.y0 = (tile / coordinator.tiles_x) * coordinator.tile_size;
+		job.x1 = std::min(job.x0 + coordinator.tile_size, int(coordinator.state.width));
+		job.y1 = std::min(job.y0 + coordinator.tile_size, int(coordinator.state.height));
+		coordinator.next_job += 1;
+	}
+	state = coordinator.state;
+	coordinator.status.jobs_in_flight += 1;
+	return true;
+}
+
+// Must be called with the lock held
+static void mergeJob(const JobMessage& job, const vector<vec3>& result)
+{
+	const int tile_width = job.x1 - job.x0;
+	for(int y = job.y0; y < job.y1; y++)
+	{
+		for(int x = job.x0; x < job.x1; x++)
+		{
+			coordinator.sums[y * coordinator.state.width + x] += result[(y - job.y0) * tile_width + (x - job.x0)];
+		}
+	}
+	const int tile = (job.y0 / coordinator.tile_size) * coordinator.tiles_x + job.x0 / coordinator.tile_size;
+	coordinator.tile_samples[tile] += job.sample_end - job.sample_begin;
+	coordinator.image_dirty = true;
+}
+
+static void workerConnectionThread(WorkerConnection* connection)
+{
+	const socket_t s = connection->socket;
+	setReceiveTimeout(s, distributed_settings.worker_timeout);
+	uint32_t sent_generation = 0;
+	vector<vec3> result;
+	vector<MaterialState> materials;
+
+	while(coordinator.running)
+	{
+		JobMessage job;
+		RenderState state;
+		{
+			unique_lock<mutex> guard(coordinator.lock);
+			while(coordinator.running && !takeJob(job, state))
+			{
+				coordinator.jobs_changed.wait_for(guard, chrono::milliseconds(200));
+			}
+			if(!coordinator.running)
+				break;
+			if(state.generation != sent_generation)
+			{
+				materials = coordinator.materials;
+			}
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		// Send the job (and the render state if the worker hasn't got it)
+		// and wait for the result.
+		///////////////////////////////////////////////////////////////////////
+		bool ok = true;
+		if(state.generation != sent_generation)
+		{
+			ok = sendState(s, state, materials);
+			sent_generation = state.generation;
+		}
+		ok = ok && sendMessage(s, MessageJob, &job, sizeof(job));
+
+		const size_t num_pixels = size_t(job.x1 - job.x0) * size_t(job.y1 - job.y0);
+		MessageHeader header;
+		JobMessage returned_job;
+		ok = ok && recvAll(s, &header, sizeof(header)) && header.type == MessageResult
+		     && header.size == sizeof(JobMessage) + num_pixels * sizeof(vec3)
+		     && recvAll(s, &returned_job, sizeof(returned_job))
+		     && memcmp(&returned_job, &job, sizeof(JobMessage)) == 0;
+		if(ok)
+		{
+			result.resize(num_pixels);
+			ok = recvAll(s, result.data(), num_pixels * sizeof(vec3));
+		}
+
+		lock_guard<mutex> guard(coordinator.lock);
+		coordinator.status.jobs_in_flight -= 1;
+		if(!ok)
+		{
+			///////////////////////////////////////////////////////////////////
+			// The worker died, hung or sent garbage. Give its job to someone
+			// else, unless the job is outdated anyway.
+			///////////////////////////////////////////////////////////////////
+			if(coordinator.running)
+			{
+				cout << "Lost connection to a worker, requeueing its tile.\n";
+				coordinator.status.workers_lost += 1;
+			}
+			if(job.generation == coordinator.state.generation)
+			{
+				coordinator.requeued.push_front(job);
+				coordinator.status.jobs_requeued += 1;
+				coordinator.jobs_changed.notify_all();
+			}
+			break;
+		}
+		if(job.generation == coordinator.state.generation)
+		{
+			mergeJob(job, result);
+			coordinator.status.jobs_completed += 1;
+		}
+	}
+
+	lock_guard<mutex> guard(coordinator.lock);
+	connection->finished = true;
+	coordinator.status.connected_workers -= 1;
+}
+
+static void acceptThread()
+{
+	while(coordinator.running)
+	{
+		fd_set read_set;
+		FD_ZERO(&read_set);
+		FD_SET(coordinator.listen_socket, &read_set);
+		timeval timeout = { 0, 200000 };
+		if(select(int(coordinator.listen_socket + 1), &read_set, nullptr, nullptr, &timeout) <= 0)
+			continue;
+
+		socket_t s = accept(coordinator.listen_socket, nullptr, nullptr);
+		if(s == invalid_socket)
+			continue;
+		setNoDelay(s);
+
+		lock_guard<mutex> guard(coordinator.lock);
+		coordinator.workers.emplace_back();
+		WorkerConnection& connection = coordinator.workers.back();
+		connection.socket = s;
+		connection.worker_thread = thread(workerConnectionThread, &connection);
+		coordinator.status.connected_workers += 1;
+		cout << "Worker connected.\n";
+	}
+}
+
+bool startCoordinator()
+{
+	if(coordinator.running)
+		return true;
+	initSockets();
+
+	socket_t s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if(s == invalid_socket)
+	{
+		cout << "Could not create coordinator socket.\n";
+		return false;
+	}
+	int reuse = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(uint16_t(distributed_settings.port));
+	if(::bind(s, (sockaddr*)&address, sizeof(address)) != 0 || listen(s, 16) != 0)
+	{
+		cout << "Could not listen on port " << distributed_settings.port << ".\n";
+		closeSocket(s);
+		return false;
+	}
+
+	coordinator.listen_socket = s;
+	coordinator.has_state = false;
+	coordinator.status = CoordinatorStatus();
+	coordinator.running = true;
+	coordinator.accept_thread = thread(acceptThread);
+	cout << "Coordinator listening on port " << distributed_settings.port << ".\n";
+	return true;
+}
+
+void stopCoordinator()
+{
+	if(!coordinator.running)
+		return;
+	coordinator.running = false;
+	coordinator.jobs_changed.notify_all();
+	coordinator.accept_thread.join();
+	closeSocket(coordinator.listen_socket);
+	coordinator.listen_socket = invalid_socket;
+
+	// Unblock the connection threads waiting for results, then wait for them
+	{
+		lock_guard<mutex> guard(coordinator.lock);
+		for(auto& connection : coordinator.workers)
+		{
+			shutdownSocket(connection.socket);
+		}
+	}
+	for(auto& connection : coordinator.workers)
+	{
+		connection.worker_thread.join();
+		closeSocket(connection.socket);
+	}
+	coordinator.workers.clear();
+	coordinator.requeued.clear();
+	coordinator.has_state = false;
+	// Let local rendering start over
+	restart();
+}
+
+bool isCoordinatorRunning()
+{
+	return coordinator.running;
+}
+
+void updateCoordinator(const mat4& V,
+                       const mat4& P,
+                       const string& scene_name,
+                       const vector<labhelper::Model*>& models)
+{
+	vector<MaterialState> materials;
+	RenderState state = makeRenderState(V, P, scene_name, models, materials);
+	lock_guard<mutex> guard(coordinator.lock);
+
+	// Clean up after workers that have gone away
+	for(auto it = coordinator.workers.begin(); it != coordinator.workers.end();)
+	{
+		if(it->finished)
+		{
+			it->worker_thread.join();
+			closeSocket(it->socket);
+			it = coordinator.workers.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Start over if anything has changed, or if someone called restart()
+	///////////////////////////////////////////////////////////////////////////
+	const bool restarted = getRestartGeneration() != coordinator.restart_generation;
+	if(!coordinator.has_state || restarted || !sameRenderState(state, coordinator.state)
+	   || !sameMaterials(materials, coordinator.materials))
+	{
+		state.generation = coordinator.state.generation + 1;
+		coordinator.state = state;
+		coordinator.materials.swap(materials);
+		coordinator.has_state = true;
+		coordinator.tile_size = std::max(distributed_settings.tile_size, 8);
+		coordinator.tiles_x = (state.width + coordinator.tile_size - 1) / coordinator.tile_size;
+		coordinator.tiles_y = (state.height + coordinator.tile_size - 1) / coordinator.tile_size;
+		coordinator.next_job = 0;
+		coordinator.requeued.clear();
+		coordinator.sums.assign(size_t(state.width) * size_t(state.height), vec3(0.0f));
+		coordinator.tile_samples.assign(coordinator.tiles_x * coordinator.tiles_y, 0);
+		coordinator.image_dirty = false;
+		coordinator.restart_generation = getRestartGeneration();
+		rendered_image.number_of_samples = 0;
+		coordinator.jobs_changed.notify_all();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Merge what the workers have returned into the displayed image
+	///////////////////////////////////////////////////////////////////////////
+	if(coordinator.image_dirty)
+	{
+		const int w = coordinator.state.width;
+		const int h = coordinator.state.height;
+		int min_samples = INT_MAX;
+		for(int ty = 0; ty < coordinator.tiles_y; ty++)
+		{
+			for(int tx = 0; tx < coordinator.tiles_x; tx++)
+			{
+				const int n = coordinator.tile_samples[ty * coordinator.tiles_x + tx];
+				min_samples = std::min(min_samples, n);
+				if(n == 0)
+					continue;
+				const float inv_n = 1.0f / float(n);
+				const int x1 = std::min((tx + 1) * coordinator.tile_size, w);
+				const int y1 = std::min((ty + 1) * coordinator.tile_size, h);
+				for(int y = ty * coordinator.tile_size; y < y1; y++)
+				{
+					for(int x = tx * coordinator.tile_size; x < x1; x++)
+					{
+						rendered_image.data[y * w + x] = coordinator.sums[y * w + x] * inv_n;
+					}
+				}
+			}
+		}
+		rendered_image.number_of_samples = min_samples;
+		coordinator.image_dirty = false;
+	}
+}
+
+CoordinatorStatus getCoordinatorStatus()
+{
+	lock_guard<mutex> guard(coordinator.lock);
+	return coordinator.status;
+}
+
+bool spawnLocalWorker(const string& executable)
+{
+	const string address = "127.0.0.1:" + to_string(distributed_settings.port);
+#ifdef _WIN32
+	string command_line = "\"" + executable + "\" --worker " + address;
+	STARTUPINFOA startup_info;
+	PROCESS_INFORMATION process_info;
+	memset(&startup_info, 0, sizeof(startup_info));
+	startup_info.cb = sizeof(startup_info);
+	if(!CreateProcessA(nullptr, &command_line[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr,
+	                   &startup_info, &process_info))
+	{
+		cout << "Could not start worker process.\n";
+		return false;
+	}
+	CloseHandle(process_info.hThread);
+	CloseHandle(process_info.hProcess);
+	return true;
+#else
+	// Let finished workers be reaped automatically
+	signal(SIGCHLD, SIG_IGN);
+	pid_t pid = fork();
+	if(pid == 0)
+	{
+		execl(executable.c_str(), executable.c_str(), "--worker", address.c_str(), (char*)nullptr);
+		_exit(1);
+	}
+	if(pid < 0)
+	{
+		cout << "Could not start worker process.\n";
+		return false;
+	}
+	return true;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Worker
+///////////////////////////////////////////////////////////////////////////////
+static socket_t connectToCoordinator(const string& host, int port)
+{
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* addresses = nullptr;
+	if(getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &addresses) != 0)
+	{
+		cout << "Could not resolve " << host << ".\n";
+		return invalid_socket;
+	}
+
+	// The coordinator may not be up yet, so keep trying for a while
+	socket_t s = invalid_socket;
+	for(int attempt = 0; attempt < 20 && s == invalid_socket; attempt++)
+	{
+		s = socket(addresses->ai_family, addresses->ai_socktype, addresses->ai_protocol);
+		if(s != invalid_socket && connect(s, addresses->ai_addr, int(addresses->ai_addrlen)) != 0)
+		{
+			closeSocket(s);
+			s = invalid_socket;
+			this_thread::sleep_for(chrono::milliseconds(500));
+		}
+	}
+	freeaddrinfo(addresses);
+	return s;
+}
+
+int runWorker(const string& host, int port, function<vector<labhelper::Model*>(const string&)> load_scene)
+{
+	initSockets();
+	socket_t s = connectToCoordinator(host, port);
+	if(s == invalid_socket)
+	{
+		cout << "Could not connect to coordinator at " << host << ":" << port << ".\n";
+		return 1;
+	}
+	setNoDelay(s);
+	cout << "Connected to coordinator at " << host << ":" << port << ".\n";
+
+	RenderState state;
+	bool has_state = false;
+	string loaded_scene;
+	vector<labhelper::Model*> models;
+	vector<MaterialState> materials;
+	vector<vec3> sums, sample_sums;
+	// The pass whose photons are in the photon map, if any
+	int photon_pass = -1;
+
+	///////////////////////////////////////////////////////////////////////////
+	// Path guiding and the radiance cache learn from the whole image, pass
+	// after pass, which a worker that only traces some tiles cannot redo.
+	// They are left off, also in the coordinator's UI.
+	///////////////////////////////////////////////////////////////////////////
+	guiding_settings.enabled = false;
+	radiance_cache_settings.enabled = false;
+
+	while(true)
+	{
+		MessageHeader header;
+		if(!recvAll(s, &header, sizeof(header)))
+			break;
+
+		if(header.type == MessageRenderState && header.size >= sizeof(RenderState))
+		{
+			if(!recvAll(s, &state, sizeof(state)) || state.number_of_materials < 0
+			   || header.size != sizeof(RenderState) + size_t(state.number_of_materials) * sizeof(MaterialState))
+				break;
+			materials.resize(size_t(state.number_of_materials));
+			if(!recvAll(s, materials.data(), materials.size() * sizeof(MaterialState)))
+				break;
+			has_state = true;
+			if(loaded_scene != state.scene_name)
+			{
+				loaded_scene = state.scene_name;
+				models = load_scene(loaded_scene);
+			}
+			applyMaterials(materials, models);
+			settings = state.settings;
+			environment.multiplier = state.environment_multiplier;
+			point_light = state.point_light;
+			disc_lights.assign(state.disc_lights, state.disc_lights + state.number_of_disc_lights);
+			photon_settings.enabled = state.photons.enabled != 0;
+			photon_settings.photons_per_pass = state.photons.photons_per_pass;
+			photon_settings.initial_radius = state.photons.initial_radius;
+			photon_settings.alpha = state.photons.alpha;
+			photon_settings.max_memory_mb = state.photons.max_memory_mb;
+			photon_settings.max_depth = state.photons.max_depth;
+			photon_pass = -1;
+			rendered_image.width = state.width;
+			rendered_image.height = state.height;
+		}
+		else if(header.type == MessageJob && header.size == sizeof(JobMessage) && has_state)
+		{
+			JobMessage job;
+			if(!recvAll(s, &job, sizeof(job)))
+				break;
+			if(!photon_settings.enabled)
+			{
+				traceTile(state.V, state.P, job.x0, job.y0, job.x1, job.y1, job.sample_begin, job.sample_end, sums);
+			}
+			else
+			{
+				// The photons of a pass are seeded from its index, so each
+				// sample gets the same photon map as in a local render
+				sums.assign(size_t(job.x1 - job.x0) * size_t(job.y1 - job.y0), vec3(0.0f));
+				for(int sample = job.sample_begin; sample < job.sample_end; sample++)
+				{
+					if(photon_pass != sample)
+					{
+						tracePhotons(sample);
+						photon_pass = sample;
+					}
+					traceTile(state.V, state.P, job.x0, job.y0, job.x1, job.y1, sample, sample + 1, sample_sums);
+					for(size_t i = 0; i < sums.size(); i++)
+					{
+						sums[i] += sample_sums[i];
+					}
+				}
+			}
+
+			MessageHeader result_header = { MessageResult,
+				                            uint32_t(sizeof(JobMessage) + sums.size() * sizeof(vec3)) };
+			if(!sendAll(s, &result_header, sizeof(result_header)) || !sendAll(s, &job, sizeof(job))
+			   || !sendAll(s, sums.data(), sums.size() * sizeof(vec3)))
+				break;
+		}
+		else
+		{
+			cout << "Unexpected message from coordinator.\n";
+			break;
+		}
+	}
+	cout << "Coordinator disconnected.\n";
+	closeSocket(s);
+	return 0;
+}
+} // namespace pathtracer
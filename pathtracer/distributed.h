@@ -0,0 +1,84 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+#include <Model.h>
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////////
+// Distributed rendering
+//
+// A coordinator splits the image into tiles and hands out (tile, sample
+// range) jobs to worker processes over TCP, so it works with workers on the
+// same machine as well as on others. Since every sample is seeded from its
+// pixel and sample index, the merged image is the same as if it had been
+// rendered locally. Jobs held by a worker that disconnects or times out are
+// put back in the queue.
+//
+// Workers get the camera, settings, lights, photon settings and the GUI
+// editable material properties. Path guiding and the radiance cache learn
+// from whole passes in order, which tiles rendered here and there cannot
+// reproduce, so they are not used in distributed renders.
+///////////////////////////////////////////////////////////////////////////////
+struct DistributedSettings
+{
+	int port = 5555;
+	int tile_size = 128;
+	int samples_per_job = 4;
+	// A worker that has not returned its job after this long is dropped
+	float worker_timeout = 120.0f;
+};
+extern DistributedSettings distributed_settings;
+
+struct CoordinatorStatus
+{
+	int connected_workers = 0;
+	int jobs_in_flight = 0;
+	int jobs_completed = 0;
+	int jobs_requeued = 0;
+	int workers_lost = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Start listening for workers on distributed_settings.port
+///////////////////////////////////////////////////////////////////////////
+bool startCoordinator();
+
+///////////////////////////////////////////////////////////////////////////
+/// Disconnect all workers and stop listening
+///////////////////////////////////////////////////////////////////////////
+void stopCoordinator();
+
+bool isCoordinatorRunning();
+
+///////////////////////////////////////////////////////////////////////////
+/// Called once per frame instead of tracePaths while the coordinator is
+/// running. Restarts the job queue if the camera, settings, materials of
+/// `models` or scene has changed, or restart() has been called, and merges
+/// the results returned so far into rendered_image.
+///////////////////////////////////////////////////////////////////////////
+void updateCoordinator(const mat4& V,
+                       const mat4& P,
+                       const std::string& scene_name,
+                       const std::vector<labhelper::Model*>& models);
+
+CoordinatorStatus getCoordinatorStatus();
+
+///////////////////////////////////////////////////////////////////////////
+/// Start `executable --worker 127.0.0.1:<port>` as a separate process
+///////////////////////////////////////////////////////////////////////////
+bool spawnLocalWorker(const std::string& executable);
+
+///////////////////////////////////////////////////////////////////////////
+/// Connect to a coordinator and render jobs until it disconnects.
+/// `load_scene` is called whenever the coordinator switches scene, and
+/// returns the scene's models, in the order the coordinator passes them.
+///////////////////////////////////////////////////////////////////////////
+int runWorker(const std::string& host,
+              int port,
+              std::function<std::vector<labhelper::Model*>(const std::string&)> load_scene);
+} // namespace pathtracer
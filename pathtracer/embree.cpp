@@ -1,5 +1,13 @@
 #include "embree.h"
+#include "texture.h"
+#include "lights.h"
+#include "guiding.h"
+#include "radiancecache.h"
+#include "Pathtracer.h"
+#include "labhelper.h"
+#include <MappedFile.h>
 #include <iostream>
+#include <algorithm>
 #include <map>
 
 
@@ -22,6 +30,11 @@ void buildBVH()
 	cout << "Embree building BVH..." << flush;
 	rtcCommit(embree_scene);
 	cout << "done.\n";
+	buildLightDistribution();
+	RTCBounds bounds;
+	rtcGetBounds(embree_scene, bounds);
+	resetGuiding(vec3(bounds.lower_x, bounds.lower_y, bounds.lower_z), vec3(bounds.upper_x, bounds.upper_y, bounds.upper_z));
+	clearRadianceCache();
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -38,6 +51,7 @@ void embreeErrorHandler(void* userval, const RTCError code, const char* str)
 ///////////////////////////////////////////////////////////////////////////
 map<uint32_t, const labhelper::Model*> map_geom_ID_to_model;
 map<uint32_t, const labhelper::Mesh*> map_geom_ID_to_mesh;
+map<uint32_t, mat4> map_geom_ID_to_matrix;
 
 void initEmbree()
 {
@@ -65,6 +79,43 @@ void reinitScene()
 	}
 
 	embree_scene = rtcDeviceNewScene(embree_device, RTC_SCENE_STATIC, RTC_INTERSECT1);
+	map_geom_ID_to_model.clear();
+	map_geom_ID_to_mesh.clear();
+	map_geom_ID_to_matrix.clear();
+	clearEmissiveTriangles();
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The models added to the scene, once each
+///////////////////////////////////////////////////////////////////////////
+vector<const labhelper::Model*> getSceneModels()
+{
+	vector<const labhelper::Model*> models;
+	for(auto& geom : map_geom_ID_to_model)
+	{
+		if(std::find(models.begin(), models.end(), geom.second) == models.end())
+		{
+			models.push_back(geom.second);
+		}
+	}
+	return models;
+}
+
+uint64_t hashSceneMaterials()
+{
+	vector<float> values;
+	for(const labhelper::Model* model : getSceneModels())
+	{
+		for(const labhelper::Material& m : model->m_materials)
+		{
+			const float v[] = { m.m_color.r, m.m_color.g, m.m_color.b,
+			                    m.m_shininess, m.m_metalness, m.m_fresnel,
+			                    m.m_emission.r, m.m_emission.g, m.m_emission.b,
+			                    m.m_transparency, m.m_ior };
+			values.insert(values.end(), v, v + sizeof(v) / sizeof(v[0]));
+		}
+	}
+	return labhelper::fnv1a((const uint8_t*)values.data(), values.size() * sizeof(float));
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -86,12 +137,15 @@ void addModel(const labhelper::Model* model, const mat4& model_matrix)
 	// Material.
 	///////////////////////////////////////////////////////////////////////
 	cout << "Adding " << model->m_name << " to embree scene..." << flush;
+	// Textures first, emissive triangles are weighted by them
+	convertTextures(model);
 	for(auto& mesh : model->m_meshes)
 	{
 		uint32_t geom_ID = rtcNewTriangleMesh(embree_scene, RTC_GEOMETRY_STATIC,
 		                                      mesh.m_number_of_vertices / 3, mesh.m_number_of_vertices);
 		map_geom_ID_to_mesh[geom_ID] = &mesh;
 		map_geom_ID_to_model[geom_ID] = model;
+		map_geom_ID_to_matrix[geom_ID] = model_matrix;
 		// Transform and commit vertices
 		vec4* embree_vertices = (vec4*)rtcMapBuffer(embree_scene, geom_ID, RTC_VERTEX_BUFFER);
 		for(uint32_t i = 0; i < mesh.m_number_of_vertices; i++)
@@ -106,6 +160,7 @@ void addModel(const labhelper::Model* model, const mat4& model_matrix)
 			embree_tri_idxs[i] = i;
 		}
 		rtcUnmapBuffer(embree_scene, geom_ID, RTC_INDEX_BUFFER);
+		addEmissiveTriangles(geom_ID, model, mesh, model_matrix);
 	}
 	cout << "done.\n";
 }
@@ -132,6 +187,29 @@ Intersection getIntersection(const Ray& r)
 	vec2 uv1 = model->m_texture_coordinates[((mesh->m_start_index / 3) + r.primID) * 3 + 1];
 	vec2 uv2 = model->m_texture_coordinates[((mesh->m_start_index / 3) + r.primID) * 3 + 2];
 	i.uv = w * uv0 + r.u * uv1 + r.v * uv2;
+
+	// Solve p0 - p2 = du02 * dpdu + dv02 * dpdv (and the same for p1 - p2)
+	// for the world space tangents along u and v
+	const mat3 model_matrix = mat3(map_geom_ID_to_matrix[r.geomID]);
+	vec3 p0 = model->m_positions[((mesh->m_start_index / 3) + r.primID) * 3 + 0];
+	vec3 p1 = model->m_positions[((mesh->m_start_index / 3) + r.primID) * 3 + 1];
+	vec3 p2 = model->m_positions[((mesh->m_start_index / 3) + r.primID) * 3 + 2];
+	vec2 duv02 = uv0 - uv2, duv12 = uv1 - uv2;
+	vec3 dp02 = model_matrix * (p0 - p2), dp12 = model_matrix * (p1 - p2);
+	float determinant = duv02.x * duv12.y - duv02.y * duv12.x;
+	if(abs(determinant) < 1e-12f)
+	{
+		// Degenerate uvs, any tangent frame will do
+		mat3 tbn = labhelper::tangentSpace(i.geometry_normal);
+		i.dpdu = tbn[0];
+		i.dpdv = tbn[1];
+	}
+	else
+	{
+		float inv_determinant = 1.0f / determinant;
+		i.dpdu = (duv12.y * dp02 - duv02.y * dp12) * inv_determinant;
+		i.dpdv = (duv02.x * dp12 - duv12.x * dp02) * inv_determinant;
+	}
 	return i;
 }
 
@@ -153,4 +231,9 @@ bool occluded(Ray& r)
 	rtcOccluded(embree_scene, *((RTCRay*)&r));
 	return r.geomID != RTC_INVALID_GEOMETRY_ID;
 }
+
+vec3 offsetRayOrigin(const Intersection& hit, const vec3& wi)
+{
+	return hit.position + (dot(wi, hit.geometry_normal) > 0.0f ? EPSILON : -EPSILON) * hit.geometry_normal;
+}
 } // namespace pathtracer
\ No newline at end of file
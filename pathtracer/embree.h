@@ -4,6 +4,7 @@
 #include "Model.h"
 #include <glm/glm.hpp>
 #include <map>
+#include <vector>
 
 namespace pathtracer
 {
@@ -28,6 +29,13 @@ struct Intersection
 	// Interpolated UV coordinates between the 3 vertices of the triangle
 	glm::vec2 uv;
 
+	// How the position changes with the UV coordinates over the triangle
+	glm::vec3 dpdu, dpdv;
+
+	// How the UV coordinates change over one pixel (see texture.h). Zero
+	// unless computeTextureFootprint() has been called.
+	glm::vec2 duvdx = glm::vec2(0.0f), duvdy = glm::vec2(0.0f);
+
 	// Material information of the hit triangle
 	const labhelper::Material* material;
 };
@@ -92,6 +100,13 @@ void addModel(const labhelper::Model* model, const glm::mat4& model_matrix);
 // Build an acceleration structure for the scene
 void buildBVH();
 
+// The models added to the scene since it was last reinitialized
+std::vector<const labhelper::Model*> getSceneModels();
+
+// A hash of the materials of the models in the scene, which changes when
+// one of them is edited
+uint64_t hashSceneMaterials();
+
 ///////////////////////////////////////////////////////////////////////////
 // Reinitialize the scene
 ///////////////////////////////////////////////////////////////////////////
@@ -114,4 +129,8 @@ Intersection getIntersection(const Ray& r);
 // (does not return an intersection, as it doesn't find the closest one)
 bool occluded(Ray& r);
 
+// Start a new ray from a hit, offset to the side of the surface that it
+// leaves through so that it does not hit the same surface again
+glm::vec3 offsetRayOrigin(const Intersection& hit, const glm::vec3& wi);
+
 } // namespace pathtracer
@@ -0,0 +1,253 @@
+#include "envmap.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ENVMAP_USE_SSE
+#endif
+
+#ifdef M_PI
+#undef M_PI
+#endif
+#define M_PI 3.14159265359f
+
+using namespace std;
+
+namespace pathtracer
+{
+static inline float signNotZero(float v)
+{
+	return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Octahedral mapping with y up. The upper hemisphere is the inner diamond of
+// the [-1, 1] square, and the lower one is folded out into the corners.
+///////////////////////////////////////////////////////////////////////////////
+static inline vec2 octahedralEncode(const vec3& d)
+{
+	float inv_l1 = 1.0f / (abs(d.x) + abs(d.y) + abs(d.z));
+	float u = d.x * inv_l1, v = d.z * inv_l1;
+	if(d.y < 0.0f)
+	{
+		float folded_u = (1.0f - abs(v)) * signNotZero(u);
+		float folded_v = (1.0f - abs(u)) * signNotZero(v);
+		u = folded_u;
+		v = folded_v;
+	}
+	return vec2(u, v);
+}
+
+static inline vec3 octahedralDecode(vec2 p)
+{
+	// Positions just outside the square (the border texels) continue on
+	// the other side of the closest edge, mirrored
+	if(abs(p.x) > 1.0f)
+	{
+		p.x = signNotZero(p.x) * (2.0f - abs(p.x));
+		p.y = -p.y;
+	}
+	if(abs(p.y) > 1.0f)
+	{
+		p.y = signNotZero(p.y) * (2.0f - abs(p.y));
+		p.x = -p.x;
+	}
+	vec3 d(p.x, 1.0f - abs(p.x) - abs(p.y), p.y);
+	if(d.y < 0.0f)
+	{
+		d.x = (1.0f - abs(p.y)) * signNotZero(p.x);
+		d.z = (1.0f - abs(p.x)) * signNotZero(p.y);
+	}
+	return normalize(d);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The lat-long mapping of the original Lenvironment, with bilinear filtering
+///////////////////////////////////////////////////////////////////////////////
+static vec3 latlongBilinear(const HDRImage& latlong, const vec3& d)
+{
+	const float theta = acos(std::max(-1.0f, std::min(1.0f, d.y)));
+	float phi = atan2(d.z, d.x);
+	if(phi < 0.0f)
+		phi = phi + 2.0f * M_PI;
+	float x = phi / (2.0f * M_PI) * latlong.width - 0.5f;
+	float y = (1.0f - theta / M_PI) * latlong.height - 0.5f;
+	float fx = floor(x), fy = floor(y);
+	float tx = x - fx, ty = y - fy;
+	int x0 = (int(fx) + latlong.width) % latlong.width;
+	int x1 = (x0 + 1) % latlong.width;
+	int y0 = std::max(int(fy), 0);
+	int y1 = std::min(int(fy) + 1, latlong.height - 1);
+	auto texel = [&](int tx, int ty) {
+		const float* t = &latlong.data[(ty * latlong.width + tx) * 3];
+		return vec3(t[0], t[1], t[2]);
+	};
+	return mix(mix(texel(x0, y0), texel(x1, y0), tx), mix(texel(x0, y1), texel(x1, y1), tx), ty);
+}
+
+void OctahedralMap::build(HDRImage& latlong, int _resolution)
+{
+	if(_resolution <= 0)
+	{
+		_resolution = int(sqrt(float(latlong.width) * float(latlong.height)));
+	}
+	resolution = _resolution;
+	stride = resolution + 2;
+	texels.resize(size_t(stride) * stride);
+
+	// Average 2x2 directions per texel, so that the re-projection doesn't
+	// alias where the lat-long map is denser than the octahedral one
+	const float subsamples[2] = { 0.25f, 0.75f };
+#pragma omp parallel for
+	for(int y = 0; y < stride; y++)
+	{
+		for(int x = 0; x < stride; x++)
+		{
+			vec3 sum(0.0f);
+			for(float sy : subsamples)
+			{
+				for(float sx : subsamples)
+				{
+					// Texel 1 is the first one inside the square
+					vec2 p = vec2(float(x) - 1.0f + sx, float(y) - 1.0f + sy) / float(resolution) * 2.0f - 1.0f;
+					sum += latlongBilinear(latlong, octahedralDecode(p));
+				}
+			}
+			texels[y * stride + x] = 0.25f * sum;
+		}
+	}
+}
+
+vec3 OctahedralMap::fetchBilinear(float x, float y) const
+{
+	// x, y >= 0.5, so truncation is floor
+	int x0 = int(x), y0 = int(y);
+	float tx = x - float(x0), ty = y - float(y0);
+	const vec3* t = &texels[y0 * stride + x0];
+	return mix(mix(t[0], t[1], tx), mix(t[stride], t[stride + 1], tx), ty);
+}
+
+vec3 OctahedralMap::lookup(const vec3& d) const
+{
+	vec2 p = octahedralEncode(d);
+	// Texel centers are at half integers, offset by the border
+	float x = (p.x * 0.5f + 0.5f) * float(resolution) + 0.5f;
+	float y = (p.y * 0.5f + 0.5f) * float(resolution) + 0.5f;
+	return fetchBilinear(x, y);
+}
+
+void OctahedralMap::lookup(const vec3* directions, vec3* radiance, int count) const
+{
+	int i = 0;
+#ifdef ENVMAP_USE_SSE
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 minus_one = _mm_set1_ps(-1.0f);
+	const __m128 scale = _mm_set1_ps(0.5f * float(resolution));
+	const __m128 offset = _mm_set1_ps(0.5f * float(resolution) + 0.5f);
+	alignas(16) int ix[4], iy[4];
+	alignas(16) float fx[4], fy[4];
+	for(; i + 4 <= count; i += 4)
+	{
+		const vec3* d = directions + i;
+		__m128 x = _mm_setr_ps(d[0].x, d[1].x, d[2].x, d[3].x);
+		__m128 y = _mm_setr_ps(d[0].y, d[1].y, d[2].y, d[3].y);
+		__m128 z = _mm_setr_ps(d[0].z, d[1].z, d[2].z, d[3].z);
+		__m128 l1 = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(sign_mask, x), _mm_andnot_ps(sign_mask, y)),
+		                       _mm_andnot_ps(sign_mask, z));
+		__m128 inv_l1 = _mm_div_ps(one, l1);
+		__m128 u = _mm_mul_ps(x, inv_l1);
+		__m128 v = _mm_mul_ps(z, inv_l1);
+
+		// Fold the lower hemisphere
+		__m128 abs_u = _mm_andnot_ps(sign_mask, u), abs_v = _mm_andnot_ps(sign_mask, v);
+		__m128 u_positive = _mm_cmpge_ps(u, zero), v_positive = _mm_cmpge_ps(v, zero);
+		__m128 sign_u = _mm_or_ps(_mm_and_ps(u_positive, one), _mm_andnot_ps(u_positive, minus_one));
+		__m128 sign_v = _mm_or_ps(_mm_and_ps(v_positive, one), _mm_andnot_ps(v_positive, minus_one));
+		__m128 folded_u = _mm_mul_ps(_mm_sub_ps(one, abs_v), sign_u);
+		__m128 folded_v = _mm_mul_ps(_mm_sub_ps(one, abs_u), sign_v);
+		__m128 lower = _mm_cmplt_ps(y, zero);
+		u = _mm_or_ps(_mm_and_ps(lower, folded_u), _mm_andnot_ps(lower, u));
+		v = _mm_or_ps(_mm_and_ps(lower, folded_v), _mm_andnot_ps(lower, v));
+
+		// Texel coordinates and bilinear weights
+		__m128 px = _mm_add_ps(_mm_mul_ps(u, scale), offset);
+		__m128 py = _mm_add_ps(_mm_mul_ps(v, scale), offset);
+		__m128i x0 = _mm_cvttps_epi32(px), y0 = _mm_cvttps_epi32(py);
+		_mm_store_si128((__m128i*)ix, x0);
+		_mm_store_si128((__m128i*)iy, y0);
+		_mm_store_ps(fx, _mm_sub_ps(px, _mm_cvtepi32_ps(x0)));
+		_mm_store_ps(fy, _mm_sub_ps(py, _mm_cvtepi32_ps(y0)));
+
+		for(int j = 0; j < 4; j++)
+		{
+			const vec3* t = &texels[iy[j] * stride + ix[j]];
+			radiance[i + j] = mix(mix(t[0], t[1], fx[j]), mix(t[stride], t[stride + 1], fx[j]), fy[j]);
+		}
+	}
+#endif
+	for(; i < count; i++)
+	{
+		radiance[i] = lookup(directions[i]);
+	}
+}
+
+EnvironmentBenchmark benchmarkEnvironmentLookup(HDRImage& latlong, const OctahedralMap& octahedral, int count)
+{
+	// Directions uniformly distributed on the sphere
+	std::vector<vec3> directions(count);
+	std::mt19937 generator(1234);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	for(auto& d : directions)
+	{
+		float z = 1.0f - 2.0f * uniform(generator);
+		float r = sqrt(std::max(0.0f, 1.0f - z * z));
+		float phi = 2.0f * M_PI * uniform(generator);
+		d = vec3(r * cos(phi), r * sin(phi), z);
+	}
+	std::vector<vec3> radiance(count);
+
+	using clock = std::chrono::high_resolution_clock;
+	auto millionsPerSecond = [count](clock::time_point start) {
+		std::chrono::duration<double> seconds = clock::now() - start;
+		return float(double(count) / seconds.count() * 1e-6);
+	};
+	EnvironmentBenchmark result;
+
+	// The original Lenvironment
+	auto start = clock::now();
+	for(int i = 0; i < count; i++)
+	{
+		const vec3& wi = directions[i];
+		const float theta = acos(std::max(-1.0f, std::min(1.0f, wi.y)));
+		float phi = atan2(wi.z, wi.x);
+		if(phi < 0.0f)
+			phi = phi + 2.0f * M_PI;
+		radiance[i] = latlong.sample(phi / (2.0f * M_PI), 1.0f - theta / M_PI);
+	}
+	result.latlong_nearest = millionsPerSecond(start);
+	vec3 checksum = radiance[count / 2];
+
+	start = clock::now();
+	for(int i = 0; i < count; i++)
+	{
+		radiance[i] = octahedral.lookup(directions[i]);
+	}
+	result.octahedral = millionsPerSecond(start);
+	checksum += radiance[count / 2];
+
+	start = clock::now();
+	octahedral.lookup(directions.data(), radiance.data(), count);
+	result.octahedral_batch = millionsPerSecond(start);
+	checksum += radiance[count / 2];
+
+	cout << "Environment lookups (M/s): lat-long nearest " << result.latlong_nearest << ", octahedral "
+	     << result.octahedral << ", octahedral batch " << result.octahedral_batch << " (" << checksum.x << ")\n";
+	return result;
+}
+} // namespace pathtracer
@@ -0,0 +1,67 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include "HDRImage.h"
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////////
+// The environment map re-projected to an octahedral layout. Mapping a
+// direction to a texel then only takes an abs, a divide and a fold, instead
+// of the acos and atan needed for the lat-long map. Each side has a one
+// texel border holding the neighbours across the octahedron's seams, so
+// bilinear lookups never need to wrap.
+///////////////////////////////////////////////////////////////////////////////
+class OctahedralMap
+{
+public:
+	///////////////////////////////////////////////////////////////////////
+	/// Re-project a lat-long map (as looked up by the original
+	/// Lenvironment). A resolution of 0 picks one with about as many
+	/// texels as the source.
+	///////////////////////////////////////////////////////////////////////
+	void build(HDRImage& latlong, int resolution = 0);
+
+	///////////////////////////////////////////////////////////////////////
+	/// Bilinearly filtered radiance in direction `d` (must be normalized)
+	///////////////////////////////////////////////////////////////////////
+	vec3 lookup(const vec3& d) const;
+
+	///////////////////////////////////////////////////////////////////////
+	/// Look up `count` directions at once. The texel coordinates and
+	/// weights are computed four directions at a time with SSE.
+	///////////////////////////////////////////////////////////////////////
+	void lookup(const vec3* directions, vec3* radiance, int count) const;
+
+	bool isValid() const
+	{
+		return resolution > 0;
+	}
+
+private:
+	vec3 fetchBilinear(float x, float y) const;
+
+	int resolution = 0;
+	// resolution + 2 border texels
+	int stride = 0;
+	std::vector<vec3> texels;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Environment miss throughput, in millions of lookups per second
+///////////////////////////////////////////////////////////////////////////////
+struct EnvironmentBenchmark
+{
+	float latlong_nearest = 0.0f;
+	float octahedral = 0.0f;
+	float octahedral_batch = 0.0f;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Time `count` random direction lookups with the original lat-long
+/// lookup, the octahedral one, and the octahedral batch lookup
+///////////////////////////////////////////////////////////////////////////
+EnvironmentBenchmark benchmarkEnvironmentLookup(HDRImage& latlong, const OctahedralMap& octahedral, int count);
+} // namespace pathtracer
@@ -0,0 +1,442 @@
+#include "guiding.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include "Pathtracer.h"
+#include "sampling.h"
+
+using namespace std;
+
+namespace pathtracer
+{
+GuidingSettings guiding_settings;
+
+// Deeper quadtree nodes cover less than a millionth of the sphere
+const int max_directional_depth = 20;
+
+static void atomicAdd(std::atomic<float>& a, float value)
+{
+	float current = a.load(std::memory_order_relaxed);
+	while(!a.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+	{
+	}
+}
+
+static vec2 directionToSquare(const vec3& d)
+{
+	float phi = atan2(d.y, d.x);
+	if(phi < 0.0f)
+		phi += 2.0f * M_PI;
+	return clamp(vec2((d.z + 1.0f) * 0.5f, phi / (2.0f * M_PI)), vec2(0.0f), vec2(1.0f));
+}
+
+static vec3 squareToDirection(const vec2& p)
+{
+	const float cos_theta = 2.0f * p.x - 1.0f;
+	const float sin_theta = sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+	const float phi = 2.0f * M_PI * p.y;
+	return vec3(sin_theta * cos(phi), sin_theta * sin(phi), cos_theta);
+}
+
+// Pick the quadrant that p is in, and move p into the quadrant's own unit square
+static int descend(vec2& p)
+{
+	const int q = (p.x >= 0.5f ? 1 : 0) | (p.y >= 0.5f ? 2 : 0);
+	p = p * 2.0f - vec2(float(q & 1), float(q >> 1));
+	return q;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// DirectionalTree
+///////////////////////////////////////////////////////////////////////////////
+DirectionalTree::Node::Node()
+{
+	for(int i = 0; i < 4; i++)
+	{
+		sum[i].store(0.0f, std::memory_order_relaxed);
+		child[i] = 0;
+	}
+}
+
+DirectionalTree::Node::Node(const Node& other)
+{
+	*this = other;
+}
+
+DirectionalTree::Node& DirectionalTree::Node::operator=(const Node& other)
+{
+	for(int i = 0; i < 4; i++)
+	{
+		sum[i].store(other.sum[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		child[i] = other.child[i];
+	}
+	return *this;
+}
+
+DirectionalTree::DirectionalTree() : nodes(1), records(0)
+{
+}
+
+DirectionalTree::DirectionalTree(const DirectionalTree& other) : nodes(other.nodes), records(other.records.load())
+{
+}
+
+DirectionalTree& DirectionalTree::operator=(const DirectionalTree& other)
+{
+	nodes = other.nodes;
+	records = other.records.load();
+	return *this;
+}
+
+void DirectionalTree::record(const vec3& wi, float value)
+{
+	records++;
+	if(!(value > 0.0f) || std::isinf(value))
+	{
+		return;
+	}
+	vec2 p = directionToSquare(wi);
+	uint32_t node = 0;
+	for(;;)
+	{
+		const int q = descend(p);
+		if(nodes[node].child[q] == 0)
+		{
+			atomicAdd(nodes[node].sum[q], value);
+			return;
+		}
+		node = nodes[node].child[q];
+	}
+}
+
+float DirectionalTree::buildNode(uint32_t node)
+{
+	float total = 0.0f;
+	for(int q = 0; q < 4; q++)
+	{
+		if(nodes[node].child[q] != 0)
+		{
+			nodes[node].sum[q].store(buildNode(nodes[node].child[q]), std::memory_order_relaxed);
+		}
+		total += nodes[node].sum[q].load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+void DirectionalTree::build()
+{
+	buildNode(0);
+}
+
+float DirectionalTree::total() const
+{
+	const Node& root = nodes[0];
+	return root.sum[0].load(std::memory_order_relaxed) + root.sum[1].load(std::memory_order_relaxed)
+	       + root.sum[2].load(std::memory_order_relaxed) + root.sum[3].load(std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Pick a quadrant proportional to its energy at each level. Every level
+// halves the side of the square, so the density goes up by 4 * the
+// fraction of the energy in the chosen quadrant. Mapping the unit square to
+// the sphere divides it by 4pi.
+///////////////////////////////////////////////////////////////////////////////
+vec3 DirectionalTree::sample(float& pdf) const
+{
+	vec2 origin(0.0f);
+	float size = 1.0f;
+	float square_pdf = 1.0f;
+	uint32_t node = 0;
+	for(;;)
+	{
+		float sums[4];
+		float total = 0.0f;
+		for(int q = 0; q < 4; q++)
+		{
+			sums[q] = nodes[node].sum[q].load(std::memory_order_relaxed);
+			total += sums[q];
+		}
+		if(total <= 0.0f)
+		{
+			break;
+		}
+		float u = randf() * total;
+		int q = 0;
+		while(q < 3 && u >= sums[q])
+		{
+			u -= sums[q];
+			q++;
+		}
+		// Rounding could end on an empty quadrant
+		while(sums[q] <= 0.0f)
+		{
+			q--;
+		}
+		square_pdf *= 4.0f * sums[q] / total;
+		size *= 0.5f;
+		origin += size * vec2(float(q & 1), float(q >> 1));
+		if(nodes[node].child[q] == 0)
+		{
+			break;
+		}
+		node = nodes[node].child[q];
+	}
+	pdf = square_pdf / (4.0f * M_PI);
+	return squareToDirection(origin + size * vec2(randf(), randf()));
+}
+
+float DirectionalTree::pdf(const vec3& wi) const
+{
+	vec2 p = directionToSquare(wi);
+	float square_pdf = 1.0f;
+	uint32_t node = 0;
+	for(;;)
+	{
+		const Node& n = nodes[node];
+		const float total = n.sum[0].load(std::memory_order_relaxed) + n.sum[1].load(std::memory_order_relaxed)
+		                    + n.sum[2].load(std::memory_order_relaxed) + n.sum[3].load(std::memory_order_relaxed);
+		if(total <= 0.0f)
+		{
+			break;
+		}
+		const int q = descend(p);
+		square_pdf *= 4.0f * n.sum[q].load(std::memory_order_relaxed) / total;
+		if(n.child[q] == 0 || square_pdf == 0.0f)
+		{
+			break;
+		}
+		node = n.child[q];
+	}
+	return square_pdf / (4.0f * M_PI);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// `node` is -1 below the leaves of this tree, where the energy of the leaf
+// is assumed to be evenly spread over its quadrants
+///////////////////////////////////////////////////////////////////////////////
+void DirectionalTree::refineNode(DirectionalTree& out, uint32_t out_node, int node, float energy, int depth, float threshold) const
+{
+	for(int q = 0; q < 4; q++)
+	{
+		const float e = node >= 0 ? nodes[node].sum[q].load(std::memory_order_relaxed) : energy * 0.25f;
+		if(depth < max_directional_depth && e > threshold)
+		{
+			const uint32_t child = uint32_t(out.nodes.size());
+			out.nodes.emplace_back();
+			out.nodes[out_node].child[q] = child;
+			const int next = node >= 0 && nodes[node].child[q] != 0 ? int(nodes[node].child[q]) : -1;
+			refineNode(out, child, next, e, depth + 1, threshold);
+		}
+	}
+}
+
+void DirectionalTree::refine(DirectionalTree& out, float threshold) const
+{
+	out = DirectionalTree();
+	const float total_energy = total();
+	if(total_energy > 0.0f)
+	{
+		refineNode(out, 0, 0, total_energy, 1, threshold * total_energy);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The spatial tree. The bounds are made a cube, so that splitting the axes
+// in turn keeps the cells close to cubes.
+///////////////////////////////////////////////////////////////////////////////
+struct SpatialNode
+{
+	int axis = 0;
+	// The two halves, 0 for a leaf
+	uint32_t child[2] = { 0, 0 };
+	DirectionalTree sampling;
+	DirectionalTree building;
+};
+
+static std::vector<SpatialNode> spatial_nodes(1);
+static vec3 bounds_min(0.0f);
+static float bounds_size = 0.0f;
+static int iteration = 0;
+static int passes_in_iteration = 0;
+static int training_passes_done = 0;
+static bool recording = false;
+
+static uint32_t spatialLeaf(const vec3& position)
+{
+	vec3 p = clamp((position - bounds_min) / bounds_size, vec3(0.0f), vec3(1.0f));
+	uint32_t node = 0;
+	while(spatial_nodes[node].child[0] != 0)
+	{
+		const int axis = spatial_nodes[node].axis;
+		if(p[axis] < 0.5f)
+		{
+			p[axis] *= 2.0f;
+			node = spatial_nodes[node].child[0];
+		}
+		else
+		{
+			p[axis] = p[axis] * 2.0f - 1.0f;
+			node = spatial_nodes[node].child[1];
+		}
+	}
+	return node;
+}
+
+static bool isTraining()
+{
+	return guiding_settings.enabled && bounds_size > 0.0f
+	       && training_passes_done < guiding_settings.training_passes;
+}
+
+GuidingStatus getGuidingStatus()
+{
+	GuidingStatus status;
+	status.training = isTraining();
+	status.iteration = iteration;
+	status.training_passes_done = training_passes_done;
+	status.memory_bytes = spatial_nodes.capacity() * sizeof(SpatialNode);
+	for(const SpatialNode& node : spatial_nodes)
+	{
+		if(node.child[0] == 0)
+		{
+			status.spatial_leaves++;
+		}
+		status.directional_nodes += node.sampling.numberOfNodes() + node.building.numberOfNodes();
+		status.memory_bytes += node.sampling.memoryUsage() + node.building.memoryUsage();
+	}
+	return status;
+}
+
+void restartGuiding()
+{
+	spatial_nodes.assign(1, SpatialNode());
+	iteration = 0;
+	passes_in_iteration = 0;
+	training_passes_done = 0;
+}
+
+void resetGuiding(const vec3& scene_min, const vec3& scene_max)
+{
+	if(any(greaterThan(scene_min, scene_max)))
+	{
+		bounds_size = 0.0f;
+	}
+	else
+	{
+		const vec3 extent = scene_max - scene_min;
+		bounds_size = std::max(extent.x, std::max(extent.y, extent.z)) * 1.01f + EPSILON;
+		bounds_min = 0.5f * (scene_min + scene_max) - vec3(0.5f * bounds_size);
+	}
+	restartGuiding();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// End of a training iteration. The building trees have the records of the
+// iteration. Split the spatial leaves that got many of them (each half
+// keeps a copy of the trees, with half of the records), then let the
+// building trees become the sampling trees and refine them for the next
+// iteration.
+///////////////////////////////////////////////////////////////////////////////
+static void finishIteration()
+{
+	const float split_threshold = guiding_settings.spatial_threshold * sqrt(float(1 << std::min(iteration, 30)));
+	for(size_t i = 0; i < spatial_nodes.size(); i++)
+	{
+		if(spatial_nodes[i].child[0] != 0)
+		{
+			continue;
+		}
+		spatial_nodes[i].building.build();
+		if(spatial_nodes[i].building.numberOfRecords() > split_threshold)
+		{
+			SpatialNode half;
+			half.axis = (spatial_nodes[i].axis + 1) % 3;
+			half.sampling = spatial_nodes[i].sampling;
+			half.building = spatial_nodes[i].building;
+			half.building.setNumberOfRecords(spatial_nodes[i].building.numberOfRecords() / 2);
+			const uint32_t first = uint32_t(spatial_nodes.size());
+			spatial_nodes.push_back(half);
+			spatial_nodes.push_back(half);
+			spatial_nodes[i].child[0] = first;
+			spatial_nodes[i].child[1] = first + 1;
+			spatial_nodes[i].sampling = DirectionalTree();
+			spatial_nodes[i].building = DirectionalTree();
+		}
+	}
+
+	const bool last = training_passes_done >= guiding_settings.training_passes;
+	for(SpatialNode& node : spatial_nodes)
+	{
+		if(node.child[0] != 0)
+		{
+			continue;
+		}
+		node.sampling = node.building;
+		if(last)
+		{
+			// Nothing more will be recorded
+			node.building = DirectionalTree();
+		}
+		else
+		{
+			node.sampling.refine(node.building, guiding_settings.flux_threshold);
+		}
+	}
+
+	GuidingStatus status = getGuidingStatus();
+	cout << "Path guiding: iteration " << iteration << " done after " << training_passes_done << " passes, "
+	     << status.spatial_leaves << " spatial leaves, " << status.directional_nodes << " directional nodes, "
+	     << status.memory_bytes / (1024 * 1024) << " MB\n";
+}
+
+void beginGuidingPass()
+{
+	recording = isTraining();
+}
+
+void endGuidingPass()
+{
+	if(!recording)
+	{
+		return;
+	}
+	recording = false;
+	passes_in_iteration++;
+	training_passes_done++;
+	const bool last = training_passes_done >= guiding_settings.training_passes;
+	if(passes_in_iteration >= (1 << std::min(iteration, 30)) || last)
+	{
+		finishIteration();
+		iteration++;
+		passes_in_iteration = 0;
+		if(last && guiding_settings.restart_after_training)
+		{
+			restart();
+		}
+	}
+}
+
+bool isGuidingRecording()
+{
+	return recording;
+}
+
+const DirectionalTree* guidingDistribution(const vec3& position)
+{
+	if(!guiding_settings.enabled || bounds_size <= 0.0f || iteration == 0)
+	{
+		return nullptr;
+	}
+	const DirectionalTree& tree = spatial_nodes[spatialLeaf(position)].sampling;
+	return tree.total() > 0.0f ? &tree : nullptr;
+}
+
+void recordGuidingRadiance(const vec3& position, const vec3& wi, float radiance, float pdf)
+{
+	if(!(pdf > 0.0f))
+	{
+		return;
+	}
+	spatial_nodes[spatialLeaf(position)].building.record(wi, radiance / pdf);
+}
+} // namespace pathtracer
@@ -0,0 +1,178 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////////
+// Path guiding with an SD-tree (Muller et al., "Practical Path Guiding for
+// Efficient Light-Transport Simulation")
+//
+// A binary tree over the scene bounds, where every leaf holds a quadtree
+// over the sphere of directions. Training runs in iterations of 1, 2, 4, ...
+// passes. During an iteration, the radiance arriving at each path vertex
+// from the direction it continued in is recorded in the leaves' building
+// quadtrees. When the iteration ends, leaves that got many records are
+// split, the building quadtrees become the sampling quadtrees, and new
+// building quadtrees are subdivided where the old ones held much energy.
+// After training, the final sampling quadtrees are only sampled from.
+///////////////////////////////////////////////////////////////////////////////
+struct GuidingSettings
+{
+	bool enabled = false;
+	// Passes spent training (1 + 2 + 4 + ... per iteration). Later passes
+	// sample the trees from the last iteration without recording.
+	int training_passes = 63;
+	// Restart the image when training ends, so that the early passes with
+	// poorly trained trees are not part of it
+	bool restart_after_training = true;
+	// Probability of sampling the material rather than the quadtree
+	float bsdf_sampling_fraction = 0.5f;
+	// A spatial leaf is split when it gets more than
+	// spatial_threshold * sqrt(2^iteration) records in an iteration
+	int spatial_threshold = 12000;
+	// Quadtree nodes with more than this fraction of the energy are split
+	float flux_threshold = 0.01f;
+};
+extern GuidingSettings guiding_settings;
+
+///////////////////////////////////////////////////////////////////////////////
+// A distribution over the sphere of directions. Directions map to the unit
+// square through (cos(theta) + 1) / 2 and phi / 2pi, which preserves area,
+// and the square is adaptively subdivided into quadrants.
+///////////////////////////////////////////////////////////////////////////////
+class DirectionalTree
+{
+public:
+	DirectionalTree();
+
+	///////////////////////////////////////////////////////////////////////
+	/// Add to the energy of the leaf that `wi` falls in. Thread safe.
+	///////////////////////////////////////////////////////////////////////
+	void record(const vec3& wi, float value);
+
+	///////////////////////////////////////////////////////////////////////
+	/// Sum up the energy recorded in the leaves into their parents, so that
+	/// the tree can be sampled. Not thread safe.
+	///////////////////////////////////////////////////////////////////////
+	void build();
+
+	///////////////////////////////////////////////////////////////////////
+	/// Sample a direction proportional to the energy, and return the solid
+	/// angle pdf. Only valid for built trees with a nonzero total.
+	///////////////////////////////////////////////////////////////////////
+	vec3 sample(float& pdf) const;
+	float pdf(const vec3& wi) const;
+
+	///////////////////////////////////////////////////////////////////////
+	/// An empty tree for the next iteration, with the nodes that hold more
+	/// than `threshold` of the energy of this (built) tree subdivided
+	///////////////////////////////////////////////////////////////////////
+	void refine(DirectionalTree& out, float threshold) const;
+
+	float total() const;
+	uint32_t numberOfRecords() const
+	{
+		return records;
+	}
+	void setNumberOfRecords(uint32_t n)
+	{
+		records = n;
+	}
+	size_t numberOfNodes() const
+	{
+		return nodes.size();
+	}
+	size_t memoryUsage() const
+	{
+		return nodes.capacity() * sizeof(Node);
+	}
+
+	DirectionalTree(const DirectionalTree& other);
+	DirectionalTree& operator=(const DirectionalTree& other);
+
+private:
+	struct Node
+	{
+		std::atomic<float> sum[4];
+		// Index of the node covering each quadrant, 0 if it is a leaf
+		uint32_t child[4];
+		Node();
+		Node(const Node& other);
+		Node& operator=(const Node& other);
+	};
+	float buildNode(uint32_t node);
+	void refineNode(DirectionalTree& out, uint32_t out_node, int node, float energy, int depth, float threshold) const;
+
+	std::vector<Node> nodes;
+	std::atomic<uint32_t> records;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Where the training is at, for the UI
+///////////////////////////////////////////////////////////////////////////////
+struct GuidingStatus
+{
+	bool training = false;
+	int iteration = 0;
+	int training_passes_done = 0;
+	int spatial_leaves = 0;
+	size_t directional_nodes = 0;
+	size_t memory_bytes = 0;
+};
+GuidingStatus getGuidingStatus();
+
+///////////////////////////////////////////////////////////////////////////
+/// Start over with an empty tree over the given bounds. Called when the
+/// scene is rebuilt.
+///////////////////////////////////////////////////////////////////////////
+void resetGuiding(const vec3& scene_min, const vec3& scene_max);
+
+///////////////////////////////////////////////////////////////////////////
+/// Start training again within the current bounds
+///////////////////////////////////////////////////////////////////////////
+void restartGuiding();
+
+///////////////////////////////////////////////////////////////////////////
+/// Called by tracePaths around each pass. The trees only change in
+/// endGuidingPass(), so they can be read and recorded into freely while
+/// the pass runs.
+///////////////////////////////////////////////////////////////////////////
+void beginGuidingPass();
+void endGuidingPass();
+
+///////////////////////////////////////////////////////////////////////////
+/// Whether the paths of the current pass should be recorded
+///////////////////////////////////////////////////////////////////////////
+bool isGuidingRecording();
+
+///////////////////////////////////////////////////////////////////////////
+/// The sampling quadtree for a position, or nullptr if guiding is off or
+/// there is nothing to sample yet
+///////////////////////////////////////////////////////////////////////////
+const DirectionalTree* guidingDistribution(const vec3& position);
+
+///////////////////////////////////////////////////////////////////////////
+/// Record the radiance that arrived at `position` from `wi`, which was
+/// sampled with solid angle pdf `pdf`
+///////////////////////////////////////////////////////////////////////////
+void recordGuidingRadiance(const vec3& position, const vec3& wi, float radiance, float pdf);
+
+///////////////////////////////////////////////////////////////////////////
+/// A path vertex waiting for the radiance found further along the path
+///////////////////////////////////////////////////////////////////////////
+struct GuidingVertex
+{
+	vec3 position;
+	vec3 wi;
+	// Path throughput including the sampled direction
+	vec3 throughput;
+	float pdf;
+	vec3 radiance;
+};
+} // namespace pathtracer
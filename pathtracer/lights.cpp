@@ -0,0 +1,172 @@
+#include "lights.h"
+#include <iostream>
+#include <vector>
+#include "sampling.h"
+#include "texture.h"
+
+using namespace std;
+
+namespace pathtracer
+{
+struct EmissiveTriangle
+{
+	vec3 p0, e1, e2;
+	// Unit geometric normal
+	vec3 normal;
+	float area;
+	vec2 uv0, uv1, uv2;
+	const labhelper::Material* material;
+};
+
+static vector<EmissiveTriangle> emissive_triangles;
+// Index of the first emissive triangle of each embree geometry, or -1. A
+// mesh has a single material, so either all or none of its triangles are
+// emissive.
+static vector<int> geom_first_triangle;
+static AliasTable triangle_distribution;
+
+static bool isEmissive(const labhelper::Material& material)
+{
+	return material.m_emission_texture.valid || material.m_emission != vec3(0.0f);
+}
+
+static float luminance(const vec3& c)
+{
+	return dot(c, vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+static vec3 emission(const labhelper::Material& material, vec2 uv)
+{
+	const MipTexture* texture = getMipTexture(material.m_emission_texture);
+	if(texture)
+	{
+		return vec3(texture->sample(uv, 0.0f));
+	}
+	return material.m_emission;
+}
+
+void clearEmissiveTriangles()
+{
+	emissive_triangles.clear();
+	geom_first_triangle.clear();
+	triangle_distribution = AliasTable();
+}
+
+void addEmissiveTriangles(uint32_t geom_ID,
+                          const labhelper::Model* model,
+                          const labhelper::Mesh& mesh,
+                          const mat4& model_matrix)
+{
+	const labhelper::Material& material = model->m_materials[mesh.m_material_idx];
+	if(!isEmissive(material))
+	{
+		return;
+	}
+	if(geom_first_triangle.size() <= geom_ID)
+	{
+		geom_first_triangle.resize(geom_ID + 1, -1);
+	}
+	geom_first_triangle[geom_ID] = int(emissive_triangles.size());
+
+	for(uint32_t i = 0; i < mesh.m_number_of_vertices; i += 3)
+	{
+		const uint32_t v = mesh.m_start_index + i;
+		EmissiveTriangle t;
+		t.p0 = vec3(model_matrix * vec4(model->m_positions[v + 0], 1.0f));
+		t.e1 = vec3(model_matrix * vec4(model->m_positions[v + 1], 1.0f)) - t.p0;
+		t.e2 = vec3(model_matrix * vec4(model->m_positions[v + 2], 1.0f)) - t.p0;
+		vec3 c = cross(t.e1, t.e2);
+		t.area = 0.5f * length(c);
+		t.normal = t.area > 0.0f ? c / (2.0f * t.area) : vec3(0.0f, 1.0f, 0.0f);
+		t.uv0 = model->m_texture_coordinates[v + 0];
+		t.uv1 = model->m_texture_coordinates[v + 1];
+		t.uv2 = model->m_texture_coordinates[v + 2];
+		t.material = &material;
+		// Degenerate triangles are kept so that primID still indexes them,
+		// but get zero weight
+		emissive_triangles.push_back(t);
+	}
+}
+
+void buildLightDistribution()
+{
+	vector<float> weights(emissive_triangles.size());
+	for(size_t i = 0; i < emissive_triangles.size(); i++)
+	{
+		const EmissiveTriangle& t = emissive_triangles[i];
+		// Weigh textured emitters by their average over the triangle
+		// (approximated at the centroid, at a level where a texel covers
+		// the triangle's uv area)
+		vec3 average = t.material->m_emission;
+		const MipTexture* texture = getMipTexture(t.material->m_emission_texture);
+		if(texture)
+		{
+			vec2 centroid = (t.uv0 + t.uv1 + t.uv2) / 3.0f;
+			float uv_area = 0.5f * abs((t.uv1.x - t.uv0.x) * (t.uv2.y - t.uv0.y)
+			                           - (t.uv2.x - t.uv0.x) * (t.uv1.y - t.uv0.y));
+			float texels = uv_area * float(1 << (2 * (texture->numberOfLevels() - 1)));
+			average = vec3(texture->sample(centroid, 0.5f * log2(std::max(texels, 1.0f))));
+		}
+		weights[i] = t.area * std::max(luminance(average), 0.0f);
+	}
+	triangle_distribution.build(weights);
+	if(!emissive_triangles.empty())
+	{
+		cout << "Found " << emissive_triangles.size() << " emissive triangles.\n";
+	}
+}
+
+int numberOfEmissiveTriangles()
+{
+	return triangle_distribution.empty() ? 0 : int(emissive_triangles.size());
+}
+
+bool sampleEmissiveTriangles(const vec3& from, LightSample& sample)
+{
+	if(triangle_distribution.empty())
+	{
+		return false;
+	}
+	const int index = triangle_distribution.sample(randf());
+	const EmissiveTriangle& t = emissive_triangles[index];
+	vec2 b = uniformSampleTriangle();
+	vec3 p = t.p0 + b.x * t.e1 + b.y * t.e2;
+
+	vec3 d = p - from;
+	float distance2 = dot(d, d);
+	if(distance2 <= 0.0f)
+	{
+		return false;
+	}
+	sample.distance = sqrt(distance2);
+	sample.wi = d / sample.distance;
+	float cos_light = abs(dot(t.normal, sample.wi));
+	if(cos_light <= 0.0f)
+	{
+		return false;
+	}
+	// Convert the area pdf to solid angle
+	sample.pdf = triangle_distribution.pdf[index] / t.area * distance2 / cos_light;
+	vec2 uv = (1.0f - b.x - b.y) * t.uv0 + b.x * t.uv1 + b.y * t.uv2;
+	sample.Le = emission(*t.material, uv);
+	return true;
+}
+
+float emissiveTrianglePdf(const Ray& ray)
+{
+	if(ray.geomID >= geom_first_triangle.size() || geom_first_triangle[ray.geomID] < 0
+	   || triangle_distribution.empty())
+	{
+		return 0.0f;
+	}
+	const int index = geom_first_triangle[ray.geomID] + int(ray.primID);
+	const EmissiveTriangle& t = emissive_triangles[index];
+	float cos_light = abs(dot(t.normal, ray.d)) / length(ray.d);
+	if(cos_light <= 0.0f || t.area <= 0.0f)
+	{
+		return 0.0f;
+	}
+	float distance = ray.tfar * length(ray.d);
+	return triangle_distribution.pdf[index] / t.area * distance * distance / cos_light;
+}
+} // namespace pathtracer
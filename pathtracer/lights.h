@@ -0,0 +1,64 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <Model.h>
+#include "embree.h"
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////////
+// Emissive triangles as light sources
+//
+// While the scene is built, every triangle with an emissive material is
+// collected. They are then sampled for next event estimation in proportion
+// to their area times their (average) emitted radiance, using an alias
+// table. Emitters are two sided, like in the rasterized labs.
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////
+/// Forget all emissive triangles. Called from reinitScene().
+///////////////////////////////////////////////////////////////////////////
+void clearEmissiveTriangles();
+
+///////////////////////////////////////////////////////////////////////////
+/// Collect the emissive triangles of a mesh that has been added to embree
+/// as geometry `geom_ID`
+///////////////////////////////////////////////////////////////////////////
+void addEmissiveTriangles(uint32_t geom_ID,
+                          const labhelper::Model* model,
+                          const labhelper::Mesh& mesh,
+                          const mat4& model_matrix);
+
+///////////////////////////////////////////////////////////////////////////
+/// Build the distribution to sample the triangles from. Called from
+/// buildBVH().
+///////////////////////////////////////////////////////////////////////////
+void buildLightDistribution();
+
+int numberOfEmissiveTriangles();
+
+struct LightSample
+{
+	// Direction and distance from the shaded point to the sampled point
+	vec3 wi;
+	float distance;
+	// Emitted radiance towards the shaded point
+	vec3 Le;
+	// Solid angle pdf
+	float pdf = 0.0f;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Pick an emissive triangle and a point on it, as seen from `from`.
+/// Returns false if there are no emitters or the sample is degenerate.
+///////////////////////////////////////////////////////////////////////////
+bool sampleEmissiveTriangles(const vec3& from, LightSample& sample);
+
+///////////////////////////////////////////////////////////////////////////
+/// The solid angle pdf with which sampleEmissiveTriangles() would have
+/// picked the point that `ray` (starting at the shaded point) hit. Zero
+/// if it hit something that is not emissive.
+///////////////////////////////////////////////////////////////////////////
+float emissiveTrianglePdf(const Ray& ray);
+} // namespace pathtracer
@@ -13,6 +13,16 @@
 #include "Pathtracer.h"
 #include "embree.h"
 #include "sampling.h"
+#include "quality.h"
+#include "statistics.h"
+#include "distributed.h"
+#include "checkpoint.h"
+#include "validation.h"
+#include "guiding.h"
+#include "radiancecache.h"
+#include "photonmap.h"
+#include "scenefile.h"
+#include "texture.h"
 
 
 using namespace glm;
@@ -64,86 +74,313 @@ struct scene_t
 		labhelper::Model* model;
 		mat4 modelMat;
 	};
+	// Empty until the scene is first shown, and again once it is unloaded
 	std::vector<scene_object_t> models;
 
 	camera_t camera;
+
+	pathtracer::SceneDescription description;
+	// Memory the loaded models take, and when the scene was last shown
+	size_t memory_bytes = 0;
+	uint64_t last_used = 0;
 };
 
 std::map<std::string, scene_t> scenes;
 std::string currentScene;
+// The first scene in the scene file, shown at start
+std::string startScene;
+std::string sceneFile = "../pathtracer/scenes.txt";
+// Scenes that are not shown are unloaded, the least recently shown first,
+// while the loaded scenes take more than this
+int sceneMemoryBudgetMB = 1024;
+std::string loadedEnvironmentMap;
 camera_t camera;
 
+bool runQualityTestOnStart = false;
+std::string executablePath;
+std::vector<pathtracer::QualityCurve> qualityResults;
+// Checkpoint to load once the pathtraced image has been sized
+std::string resumeCheckpointFile;
+// Checkpoint that could not be resumed from, shown in the gui
+std::string failedCheckpointFile;
+
 int selected_model_index = 0;
 int selected_mesh_index = 0;
 int selected_material_index = 0;
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Read the scene descriptions. The models are not loaded until a scene is
+// shown.
+///////////////////////////////////////////////////////////////////////////////
 void loadScenes()
 {
-	scenes["Sphere"] = { {
-		                     // Models
-		                     { labhelper::loadModelFromOBJ("../scenes/sphere.obj"), mat4(1.f) },
-		                 },
-		                 {
-		                     // Camera
-		                     vec3(-15, 0, 15),
-		                     normalize(-vec3(-15, 0, 15)),
-		                 } };
-	scenes["Ship"] = { {
-		                   // Models
-		                   { labhelper::loadModelFromOBJ("../scenes/space-ship.obj"),
-		                     translate(vec3(0.f, 8.f, 0.f)) },
-		                   { labhelper::loadModelFromOBJ("../scenes/landingpad.obj"), mat4(1.f) },
-		               },
-		               {
-		                   // Camera
-		                   vec3(-30, 15, 30),
-		                   normalize(-vec3(-30, 8, 30)),
-		               } };
-	// Modify the landingpad screen's color
-	scenes["Ship"].models[1].model->m_materials[8].m_color = glm::vec3(0.380392, 0.588235, 0.266667);
-
-	scenes["Refractions"] = { {
-		                          // Models
-		                          { labhelper::loadModelFromOBJ("../scenes/refractions.obj"), mat4(1.f) },
-		                      },
-		                      {
-		                          // Camera
-		                          vec3(7.3, 3.2, 7.2),
-		                          normalize(vec3(-0.43, -0.27, -0.85)),
-		                      } };
+	std::vector<pathtracer::SceneDescription> descriptions;
+	if(!pathtracer::loadSceneDescriptions(sceneFile, descriptions))
+	{
+		exit(1);
+	}
+	for(const auto& d : descriptions)
+	{
+		scene_t& scene = scenes[d.name];
+		scene.description = d;
+		scene.camera = { d.camera_position, d.camera_direction };
+	}
+	startScene = descriptions.front().name;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// What a model takes in main memory: the vertex data and the textures
+///////////////////////////////////////////////////////////////////////////////
+size_t modelMemory(const labhelper::Model* model)
+{
+	size_t bytes = model->m_positions.capacity() * sizeof(vec3) + model->m_normals.capacity() * sizeof(vec3)
+	               + model->m_texture_coordinates.capacity() * sizeof(vec2);
+	for(const auto& material : model->m_materials)
+	{
+		for(const labhelper::Texture* texture :
+		    { &material.m_color_texture, &material.m_shininess_texture, &material.m_metalness_texture,
+		      &material.m_fresnel_texture, &material.m_emission_texture })
+		{
+			if(texture->valid)
+			{
+				bytes += size_t(texture->width) * size_t(texture->height) * texture->n_components;
+			}
+		}
+	}
+	return bytes;
+}
+
+void applyMaterialOverride(labhelper::Model* model, const pathtracer::SceneDescription::MaterialOverride& o)
+{
+	if(o.material_index >= int(model->m_materials.size()))
+	{
+		std::cout << model->m_filename << " has no material " << o.material_index << ".\n";
+		return;
+	}
+	labhelper::Material& material = model->m_materials[o.material_index];
+	if(o.property == "color")
+		material.m_color = o.value;
+	else if(o.property == "emission")
+		material.m_emission = o.value;
+	else if(o.property == "shininess")
+		material.m_shininess = o.value.x;
+	else if(o.property == "metalness")
+		material.m_metalness = o.value.x;
+	else if(o.property == "fresnel")
+		material.m_fresnel = o.value.x;
+	else if(o.property == "transparency")
+		material.m_transparency = o.value.x;
+	else if(o.property == "ior")
+		material.m_ior = o.value.x;
+}
+
+void loadScene(scene_t& scene)
+{
+	if(!scene.models.empty())
+	{
+		return;
+	}
+	for(const auto& m : scene.description.models)
+	{
+		labhelper::Model* model = labhelper::loadModelFromOBJ(m.filename);
+		// The path tracer samples the textures on the CPU
+		labhelper::waitForTextures(model);
+		for(const auto& o : m.material_overrides)
+		{
+			applyMaterialOverride(model, o);
+		}
+		scene.models.push_back({ model, m.transform });
+		scene.memory_bytes += modelMemory(model);
+	}
+}
+
+void unloadScene(scene_t& scene)
+{
+	for(auto& o : scene.models)
+	{
+		pathtracer::releaseTextures(o.model);
+		labhelper::freeModel(o.model);
+	}
+	scene.models.clear();
+	scene.memory_bytes = 0;
+}
+
+size_t loadedSceneMemory()
+{
+	size_t bytes = 0;
+	for(auto& it : scenes)
+	{
+		bytes += it.second.memory_bytes;
+	}
+	return bytes;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unload the least recently shown scenes until the loaded ones fit in the
+// budget. The current scene is never unloaded, it is in the pathtracer's
+// BVH.
+///////////////////////////////////////////////////////////////////////////////
+void unloadUnusedScenes()
+{
+	const size_t budget = size_t(std::max(sceneMemoryBudgetMB, 0)) * 1024 * 1024;
+	while(loadedSceneMemory() > budget)
+	{
+		std::string oldest;
+		for(auto& it : scenes)
+		{
+			if(it.first != currentScene && !it.second.models.empty()
+			   && (oldest.empty() || it.second.last_used < scenes[oldest].last_used))
+			{
+				oldest = it.first;
+			}
+		}
+		if(oldest.empty())
+		{
+			return;
+		}
+		std::cout << "Unloading scene " << oldest << ".\n";
+		unloadScene(scenes[oldest]);
+	}
+}
+
+// The models of a loaded scene, in the order they were added to it
+std::vector<labhelper::Model*> sceneModels(const scene_t& scene)
+{
+	std::vector<labhelper::Model*> models;
+	for(const auto& o : scene.models)
+	{
+		models.push_back(o.model);
+	}
+	return models;
 }
 
 void changeScene(std::string sceneName)
 {
+	static uint64_t scene_changes = 0;
 	currentScene = sceneName;
-	camera = scenes[currentScene].camera;
+	scene_t& scene = scenes[currentScene];
+	loadScene(scene);
+	scene.last_used = ++scene_changes;
+	camera = scene.camera;
 
 	selected_model_index = 0;
 	selected_mesh_index = 0;
-	selected_material_index = scenes[currentScene].models[0].model->m_meshes[0].m_material_idx;
+	selected_material_index = scene.models[0].model->m_meshes[0].m_material_idx;
 
+	///////////////////////////////////////////////////////////////////////////
+	// The scene's environment and light, if it has them
+	///////////////////////////////////////////////////////////////////////////
+	const pathtracer::SceneDescription& d = scene.description;
+	if(!d.environment_map.empty())
+	{
+		if(d.environment_map != loadedEnvironmentMap)
+		{
+			if(pathtracer::environment.map.load(d.environment_map))
+			{
+				pathtracer::environment.octahedral_map.build(pathtracer::environment.map);
+				loadedEnvironmentMap = d.environment_map;
+			}
+			else
+			{
+				std::cout << "Keeping environment map " << loadedEnvironmentMap << " for scene " << sceneName
+				          << ".\n";
+			}
+		}
+		pathtracer::environment.multiplier = d.environment_multiplier;
+	}
+	if(d.has_point_light)
+	{
+		pathtracer::point_light.position = d.point_light_position;
+		pathtracer::point_light.color = d.point_light_color;
+		pathtracer::point_light.intensity_multiplier = d.point_light_intensity;
+	}
 
 	pathtracer::reinitScene();
 
 	// Add models to pathtracer scene
-	for(auto& o : scenes[currentScene].models)
+	for(auto& o : scene.models)
 	{
 		pathtracer::addModel(o.model, o.modelMat);
 	}
 	pathtracer::buildBVH();
 
+	// The previous scene is no longer in the BVH, and can go if needed
+	unloadUnusedScenes();
+
 	pathtracer::restart();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// View and projection matrices of the current camera, matching the size of
+// the pathtraced image
+///////////////////////////////////////////////////////////////////////////////
+void getCameraMatrices(mat4& viewMatrix, mat4& projMatrix)
+{
+	viewMatrix = lookAt(camera.position, camera.position + camera.direction, worldUp);
+	projMatrix = perspective(radians(45.0f),
+	                         float(pathtracer::rendered_image.width) / float(pathtracer::rendered_image.height),
+	                         0.1f, 100.0f);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Render every scene with the current settings for a fixed time budget and
+// compare against (cached) high spp reference images.
+///////////////////////////////////////////////////////////////////////////////
+void runQualityHarness()
+{
+	const std::string previousScene = currentScene;
+	qualityResults.clear();
+	for(auto& it : scenes)
+	{
+		changeScene(it.first);
+		mat4 viewMatrix, projMatrix;
+		getCameraMatrices(viewMatrix, projMatrix);
+
+		std::vector<vec3> reference;
+		pathtracer::loadOrRenderReference(it.first, viewMatrix, projMatrix, reference);
+		pathtracer::QualityCurve curve =
+		    pathtracer::measureTimeToQuality(it.first, viewMatrix, projMatrix, reference);
+		pathtracer::writeQualityCurveCSV("time_to_quality.csv", curve);
+		qualityResults.push_back(curve);
+	}
+	changeScene(previousScene);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Restore the scene, camera and settings a checkpoint was rendered with. The
+// image itself is loaded by display() once it has been resized to match.
+///////////////////////////////////////////////////////////////////////////////
+bool loadCheckpoint(const std::string& filename)
+{
+	pathtracer::CheckpointInfo info;
+	if(!pathtracer::readCheckpointInfo(filename, info))
+	{
+		return false;
+	}
+	if(scenes.count(info.scene_name) == 0)
+	{
+		std::cout << "Checkpoint " << filename << " is of unknown scene " << info.scene_name << ".\n";
+		return false;
+	}
+	changeScene(info.scene_name);
+	mat4 inverseView = inverse(info.V);
+	camera.position = vec3(inverseView[3]);
+	camera.direction = -vec3(inverseView[2]);
+	pathtracer::settings = info.settings;
+	pathtracer::environment.multiplier = info.environment_multiplier;
+	pathtracer::point_light = info.point_light;
+	SDL_SetWindowSize(g_window, info.width * info.settings.subsampling, info.height * info.settings.subsampling);
+	pathtracer::checkpoint_settings.filename = filename;
+	resumeCheckpointFile = filename;
+	return true;
+}
+
 void cleanupScenes()
 {
 	for(auto& it : scenes)
 	{
-		for(auto m : it.second.models)
-		{
-			labhelper::freeModel(m.model);
-		}
+		unloadScene(it.second);
 	}
 }
 
@@ -153,6 +390,11 @@ void cleanupScenes()
 ///////////////////////////////////////////////////////////////////////////////
 void initialize()
 {
+	// Textures are only sampled on the CPU, so there is no use compressing
+	// or uploading them
+	labhelper::texture_compression = labhelper::TextureCompression::None;
+	labhelper::texture_uploads = false;
+
 	///////////////////////////////////////////////////////////////////////////
 	// Load shader program
 	///////////////////////////////////////////////////////////////////////////
@@ -211,18 +453,22 @@ void initialize()
 	*/
 
 	///////////////////////////////////////////////////////////////////////////
-	// Load environment map
+	// Load environment map. Scenes can have their own, this one is used by
+	// those that don't.
 	///////////////////////////////////////////////////////////////////////////
-	pathtracer::environment.map.load("../scenes/envmaps/001.hdr");
+	loadedEnvironmentMap = "../scenes/envmaps/001.hdr";
+	if(!pathtracer::environment.map.load(loadedEnvironmentMap))
+	{
+		exit(1);
+	}
+	pathtracer::environment.octahedral_map.build(pathtracer::environment.map);
 	pathtracer::environment.multiplier = 1.0f;
 
 	///////////////////////////////////////////////////////////////////////////
 	// Load .obj models to scene
 	///////////////////////////////////////////////////////////////////////////
 	loadScenes();
-	changeScene("Ship");
-	//changeScene("Sphere");
-	//changeScene("Refractions");
+	changeScene(startScene);
 
 
 	///////////////////////////////////////////////////////////////////////////
@@ -245,7 +491,7 @@ void display(void)
 		{
 			pathtracer::resize(w, h);
 			windowWidth = w;
-			windowWidth = h;
+			windowHeight = h;
 			old_subsampling = pathtracer::settings.subsampling;
 		}
 	}
@@ -253,12 +499,31 @@ void display(void)
 	///////////////////////////////////////////////////////////////////////////
 	// Trace one path per pixel
 	///////////////////////////////////////////////////////////////////////////
-	mat4 viewMatrix = lookAt(camera.position, camera.position + camera.direction, worldUp);
-	mat4 projMatrix = perspective(radians(45.0f),
-	                              float(pathtracer::rendered_image.width)
-	                                  / float(pathtracer::rendered_image.height),
-	                              0.1f, 100.0f);
-	pathtracer::tracePaths(viewMatrix, projMatrix);
+	mat4 viewMatrix, projMatrix;
+	getCameraMatrices(viewMatrix, projMatrix);
+	if(!resumeCheckpointFile.empty())
+	{
+		failedCheckpointFile.clear();
+		if(!pathtracer::resumeFromCheckpoint(resumeCheckpointFile, viewMatrix, projMatrix, currentScene))
+		{
+			// Writing on would replace the snapshot with an unrelated image
+			pathtracer::checkpoint_settings.enabled = false;
+			failedCheckpointFile = resumeCheckpointFile;
+			std::cout << "Not resuming from " << resumeCheckpointFile
+			          << ", checkpoints are turned off so that it is not overwritten.\n";
+		}
+		resumeCheckpointFile.clear();
+	}
+	if(pathtracer::isCoordinatorRunning())
+	{
+		// Workers do the tracing, we just merge what they send back
+		pathtracer::updateCoordinator(viewMatrix, projMatrix, currentScene, sceneModels(scenes[currentScene]));
+	}
+	else
+	{
+		pathtracer::tracePaths(viewMatrix, projMatrix);
+	}
+	pathtracer::updateCheckpoint(viewMatrix, projMatrix, currentScene);
 
 	///////////////////////////////////////////////////////////////////////////
 	// Copy pathtraced image to texture for display
@@ -416,13 +681,25 @@ void gui()
 	{
 		if(ImGui::BeginMenu("Scene"))
 		{
-			for(auto it : scenes)
+			for(auto& it : scenes)
 			{
-				if(ImGui::MenuItem(it.first.c_str(), nullptr, it.first == currentScene))
+				// Show the size of the scenes that are loaded
+				char size[32] = "";
+				if(!it.second.models.empty())
+				{
+					snprintf(size, sizeof(size), "%.1f MB", it.second.memory_bytes / (1024.0 * 1024.0));
+				}
+				if(ImGui::MenuItem(it.first.c_str(), size[0] ? size : nullptr, it.first == currentScene))
 				{
 					changeScene(it.first);
 				}
 			}
+			ImGui::Separator();
+			ImGui::Text("Loaded scenes: %.1f MB", loadedSceneMemory() / (1024.0 * 1024.0));
+			if(ImGui::SliderInt("Memory budget (MB)", &sceneMemoryBudgetMB, 0, 8192))
+			{
+				unloadUnusedScenes();
+			}
 			ImGui::EndMenu();
 		}
 		ImGui::EndMainMenuBar();
@@ -481,6 +758,241 @@ void gui()
 			pathtracer::restart();
 		}
 		ImGui::Text("Num. samples: %d", pathtracer::getSampleCount());
+
+		if(ImGui::TreeNode("Statistics (last pass)"))
+		{
+			const pathtracer::PassStatistics& stats = pathtracer::last_pass_statistics;
+			const pathtracer::ThreadStatistics& t = stats.totals;
+			ImGui::Text("Pass time: %.1f ms (%d threads)", 1000.0 * stats.pass_seconds, stats.number_of_threads);
+			ImGui::Text("Rays: %.2f Mrays/s", stats.raysPerSecond() * 1e-6);
+			ImGui::Text("  Primary: %llu", (unsigned long long)t.primary_rays);
+			ImGui::Text("  Secondary: %llu", (unsigned long long)t.secondary_rays);
+			ImGui::Text("  Shadow: %llu", (unsigned long long)t.shadow_rays);
+			const double busy = std::max(t.busy_seconds, 1e-9);
+			ImGui::Text("Embree: %.1f%%, shading: %.1f%%", 100.0 * t.embree_seconds / busy,
+			            100.0 * stats.shadingSeconds() / busy);
+			ImGui::Text("Average path depth: %.2f", stats.averagePathDepth());
+			ImGui::Text("Russian roulette kills: %llu", (unsigned long long)t.russian_roulette_kills);
+			ImGui::Text("Environment hits: %llu", (unsigned long long)t.environment_hits);
+			ImGui::Text("Radiance cache hits: %llu", (unsigned long long)t.radiance_cache_hits);
+			ImGui::Checkbox("Measure embree time", &pathtracer::statistics_settings.measure_embree_time);
+			static char log_filename[256] = "pathtracer_statistics.csv";
+			ImGui::InputText("Log file (.csv/.json)", log_filename, sizeof(log_filename));
+			if(ImGui::Checkbox("Log to file", &pathtracer::statistics_settings.log_to_file))
+			{
+				pathtracer::statistics_settings.log_filename = log_filename;
+			}
+			ImGui::TreePop();
+		}
+
+		if(ImGui::TreeNode("Environment lookup benchmark"))
+		{
+			static pathtracer::EnvironmentBenchmark benchmark;
+			if(ImGui::Button("Run"))
+			{
+				benchmark = pathtracer::benchmarkEnvironmentLookup(
+				    pathtracer::environment.map, pathtracer::environment.octahedral_map, 1 << 22);
+			}
+			ImGui::Text("Lat-long, nearest: %.1f M/s", benchmark.latlong_nearest);
+			ImGui::Text("Octahedral, bilinear: %.1f M/s", benchmark.octahedral);
+			ImGui::Text("Octahedral, bilinear, SSE batch: %.1f M/s", benchmark.octahedral_batch);
+			ImGui::TreePop();
+		}
+
+		if(ImGui::TreeNode("Material validation"))
+		{
+			static std::vector<pathtracer::MaterialTestResult> results;
+			if(ImGui::Button("Run"))
+			{
+				results = pathtracer::validateMaterials();
+			}
+			for(const auto& r : results)
+			{
+				ImGui::Text("%s %s: albedo %.3f / %.3f, chi2 p %.3f", r.passed ? "pass" : "FAIL", r.name.c_str(),
+				            r.albedo_importance, r.albedo_uniform, r.chi_square_p_value);
+			}
+			ImGui::TreePop();
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Path guiding
+	///////////////////////////////////////////////////////////////////////////
+	if(ImGui::CollapsingHeader("Path guiding", "guiding_ch", true, false))
+	{
+		if(pathtracer::isCoordinatorRunning())
+		{
+			ImGui::Text("Not used while rendering distributed");
+		}
+		if(ImGui::Checkbox("Use path guiding", &pathtracer::guiding_settings.enabled))
+		{
+			pathtracer::restart();
+		}
+		ImGui::SliderInt("Training passes", &pathtracer::guiding_settings.training_passes, 0, 1023);
+		ImGui::Checkbox("Restart image after training", &pathtracer::guiding_settings.restart_after_training);
+		if(ImGui::SliderFloat("BSDF sampling fraction", &pathtracer::guiding_settings.bsdf_sampling_fraction, 0.1f, 1.0f))
+		{
+			pathtracer::restart();
+		}
+		ImGui::SliderInt("Spatial threshold", &pathtracer::guiding_settings.spatial_threshold, 1000, 100000);
+		ImGui::SliderFloat("Flux threshold", &pathtracer::guiding_settings.flux_threshold, 0.001f, 0.1f, "%.3f");
+		pathtracer::GuidingStatus status = pathtracer::getGuidingStatus();
+		if(status.training)
+		{
+			ImGui::Text("Training: iteration %d, %d/%d passes", status.iteration, status.training_passes_done,
+			            pathtracer::guiding_settings.training_passes);
+		}
+		else
+		{
+			ImGui::Text("Rendering with the trees from %d iterations", status.iteration);
+		}
+		ImGui::Text("%d spatial leaves, %d directional nodes", status.spatial_leaves, int(status.directional_nodes));
+		ImGui::Text("Memory: %.2f MB", double(status.memory_bytes) / (1024.0 * 1024.0));
+		if(ImGui::Button("Restart training"))
+		{
+			pathtracer::restartGuiding();
+			pathtracer::restart();
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Radiance cache
+	///////////////////////////////////////////////////////////////////////////
+	if(ImGui::CollapsingHeader("Radiance cache", "radiance_cache_ch", true, false))
+	{
+		if(pathtracer::isCoordinatorRunning())
+		{
+			ImGui::Text("Not used while rendering distributed");
+		}
+		pathtracer::RadianceCacheSettings& cache = pathtracer::radiance_cache_settings;
+		bool changed = ImGui::Checkbox("Use radiance cache", &cache.enabled);
+		changed |= ImGui::SliderFloat("Cell size", &cache.cell_size, 0.05f, 5.0f, "%.2f", 2.0f);
+		changed |= ImGui::SliderInt("Start bounce", &cache.start_bounce, 1, 8);
+		changed |= ImGui::SliderInt("Min samples", &cache.min_samples, 1, 1024);
+		changed |= ImGui::SliderFloat("Max shininess", &cache.max_shininess, 0.0f, 5000.0f, "%.1f", 2.0f);
+		changed |= ImGui::SliderFloat("Max metalness", &cache.max_metalness, 0.0f, 1.0f);
+		changed |= ImGui::SliderInt("Size (MB)", &cache.size_mb, 1, 1024);
+		if(changed)
+		{
+			pathtracer::restart();
+		}
+		pathtracer::RadianceCacheStatus status = pathtracer::getRadianceCacheStatus();
+		ImGui::Text("%d / %d entries used, %.1f MB", int(status.used_entries), int(status.entries),
+		            double(status.memory_bytes) / (1024.0 * 1024.0));
+		if(ImGui::Button("Clear cache"))
+		{
+			pathtracer::clearRadianceCache();
+			pathtracer::restart();
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Caustics
+	///////////////////////////////////////////////////////////////////////////
+	if(ImGui::CollapsingHeader("Caustics (photon mapping)", "caustics_ch", true, false))
+	{
+		pathtracer::PhotonSettings& photons = pathtracer::photon_settings;
+		bool changed = ImGui::Checkbox("Use photon map", &photons.enabled);
+		changed |= ImGui::SliderInt("Photons per pass", &photons.photons_per_pass, 1000, 4000000);
+		changed |= ImGui::SliderFloat("Initial radius", &photons.initial_radius, 0.005f, 2.0f, "%.3f", 2.0f);
+		changed |= ImGui::SliderFloat("Alpha", &photons.alpha, 0.1f, 1.0f);
+		changed |= ImGui::SliderInt("Max depth", &photons.max_depth, 1, 64);
+		changed |= ImGui::SliderInt("Memory cap (MB)", &photons.max_memory_mb, 1, 4096);
+		if(changed)
+		{
+			pathtracer::restart();
+		}
+		const pathtracer::PhotonStatistics& stats = pathtracer::last_photon_statistics;
+		ImGui::Text("Emitted: %d, stored: %d, dropped: %d", stats.emitted, stats.stored, stats.dropped);
+		ImGui::Text("%.2f M photons/s, grid built in %.1f ms", stats.photonsPerSecond() * 1e-6,
+		            1000.0 * stats.build_seconds);
+		ImGui::Text("Radius: %.4f, memory: %.1f MB", stats.radius, double(stats.memory_bytes) / (1024.0 * 1024.0));
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Distributed rendering
+	///////////////////////////////////////////////////////////////////////////
+	if(ImGui::CollapsingHeader("Distributed rendering", "distributed_ch", true, false))
+	{
+		if(!pathtracer::isCoordinatorRunning())
+		{
+			ImGui::InputInt("Port", &pathtracer::distributed_settings.port);
+			ImGui::SliderInt("Tile size", &pathtracer::distributed_settings.tile_size, 16, 512);
+			ImGui::SliderInt("Samples per job", &pathtracer::distributed_settings.samples_per_job, 1, 64);
+			ImGui::SliderFloat("Worker timeout (s)", &pathtracer::distributed_settings.worker_timeout, 1.0f, 600.0f);
+			ImGui::Text("Path guiding and the radiance cache are off on the workers");
+			if(ImGui::Button("Start coordinator"))
+			{
+				pathtracer::startCoordinator();
+			}
+		}
+		else
+		{
+			pathtracer::CoordinatorStatus status = pathtracer::getCoordinatorStatus();
+			ImGui::Text("Listening on port %d", pathtracer::distributed_settings.port);
+			ImGui::Text("Workers: %d (%d lost)", status.connected_workers, status.workers_lost);
+			ImGui::Text("Jobs: %d in flight, %d done, %d requeued", status.jobs_in_flight,
+			            status.jobs_completed, status.jobs_requeued);
+			ImGui::Text("Path guiding and the radiance cache are off on the workers");
+			if(ImGui::Button("Spawn local worker"))
+			{
+				pathtracer::spawnLocalWorker(executablePath);
+			}
+			ImGui::SameLine();
+			if(ImGui::Button("Stop coordinator"))
+			{
+				pathtracer::stopCoordinator();
+			}
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Checkpointing
+	///////////////////////////////////////////////////////////////////////////
+	if(ImGui::CollapsingHeader("Checkpoint", "checkpoint_ch", true, false))
+	{
+		ImGui::Checkbox("Write checkpoints", &pathtracer::checkpoint_settings.enabled);
+		ImGui::SliderFloat("Interval (s)", &pathtracer::checkpoint_settings.interval, 1.0f, 600.0f);
+		ImGui::Text("File: %s", pathtracer::checkpoint_settings.filename.c_str());
+		ImGui::Text("Last checkpoint: %d spp%s", pathtracer::lastCheckpointSamples(),
+		            pathtracer::isCheckpointWriting() ? " (writing)" : "");
+		if(!failedCheckpointFile.empty())
+		{
+			ImGui::Text("Could not resume from %s, see the console", failedCheckpointFile.c_str());
+		}
+		if(ImGui::Button("Resume"))
+		{
+			loadCheckpoint(pathtracer::checkpoint_settings.filename);
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Time-to-quality harness
+	///////////////////////////////////////////////////////////////////////////
+	if(ImGui::CollapsingHeader("Time to quality", "quality_ch", true, false))
+	{
+		ImGui::InputInt("Reference spp", &pathtracer::quality_settings.reference_samples);
+		ImGui::SliderFloat("Time budget (s)", &pathtracer::quality_settings.time_budget, 1.0f, 120.0f);
+		if(ImGui::Button("Run on all scenes"))
+		{
+			runQualityHarness();
+		}
+		for(const auto& curve : qualityResults)
+		{
+			if(curve.samples.empty())
+			{
+				continue;
+			}
+			std::vector<float> relmse;
+			for(const auto& s : curve.samples)
+			{
+				relmse.push_back(s.relmse);
+			}
+			ImGui::Text("%s: %d spp, relMSE %.5f, efficiency %.2f", curve.scene_name.c_str(),
+			            curve.samples.back().number_of_samples, curve.samples.back().relmse, curve.efficiency);
+			ImGui::PlotLines(("##" + curve.scene_name).c_str(), relmse.data(), int(relmse.size()), 0,
+			                 "relMSE", 0.0f, FLT_MAX, ImVec2(0, 40));
+		}
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -582,10 +1094,77 @@ void gui()
 
 int main(int argc, char* argv[])
 {
+	executablePath = argv[0];
+	std::string coordinatorAddress;
+	for(int i = 1; i < argc; i++)
+	{
+		if(std::string(argv[i]) == "--time-to-quality")
+		{
+			runQualityTestOnStart = true;
+		}
+		else if(std::string(argv[i]) == "--worker" && i + 1 < argc)
+		{
+			coordinatorAddress = argv[++i];
+		}
+		else if(std::string(argv[i]) == "--resume" && i + 1 < argc)
+		{
+			resumeCheckpointFile = argv[++i];
+		}
+		else if(std::string(argv[i]) == "--scenes" && i + 1 < argc)
+		{
+			sceneFile = argv[++i];
+		}
+		else if(std::string(argv[i]) == "--validate-materials")
+		{
+			// Needs no window, and exits with the number of failed tests
+			int failed = 0;
+			for(const auto& r : pathtracer::validateMaterials())
+			{
+				failed += r.passed ? 0 : 1;
+			}
+			return failed;
+		}
+	}
+
 	g_window = labhelper::init_window_SDL("Pathtracer", 1280, 720);
 
+	///////////////////////////////////////////////////////////////////////////
+	// In worker mode we only need the window for its GL context (models
+	// upload to the GPU when loaded), and render jobs until the coordinator
+	// goes away.
+	///////////////////////////////////////////////////////////////////////////
+	if(!coordinatorAddress.empty())
+	{
+		SDL_HideWindow(g_window);
+		initialize();
+		size_t colon = coordinatorAddress.find_last_of(':');
+		std::string host = coordinatorAddress.substr(0, colon);
+		int port = colon == std::string::npos ? pathtracer::distributed_settings.port
+		                                      : std::stoi(coordinatorAddress.substr(colon + 1));
+		int result = pathtracer::runWorker(host, port, [](const std::string& sceneName) {
+			if(scenes.count(sceneName) != 0 && sceneName != currentScene)
+			{
+				changeScene(sceneName);
+			}
+			return sceneModels(scenes[currentScene]);
+		});
+		cleanupScenes();
+		labhelper::shutDown(g_window);
+		return result;
+	}
+
 	initialize();
 
+	if(!resumeCheckpointFile.empty())
+	{
+		// Keep checkpointing to the file we resume from
+		pathtracer::checkpoint_settings.enabled = true;
+		if(!loadCheckpoint(resumeCheckpointFile))
+		{
+			resumeCheckpointFile.clear();
+		}
+	}
+
 	bool stopRendering = false;
 	auto startTime = std::chrono::system_clock::now();
 
@@ -605,6 +1184,13 @@ int main(int argc, char* argv[])
 		// render to window
 		display();
 
+		// The harness needs the pathtraced image to be sized by display() first
+		if(runQualityTestOnStart)
+		{
+			runQualityHarness();
+			stopRendering = true;
+		}
+
 		// Then render overlay GUI.
 		if(showUI)
 		{
@@ -618,6 +1204,9 @@ int main(int argc, char* argv[])
 		SDL_GL_SwapWindow(g_window);
 	}
 
+	pathtracer::stopCoordinator();
+	pathtracer::stopCheckpointing();
+
 	// Delete Models
 	cleanupScenes();
 
@@ -17,6 +17,11 @@ WiSample sampleHemisphereCosine(const vec3& wo, const vec3& n)
 	return r;
 }
 
+float pdfHemisphereCosine(const vec3& wi, const vec3& n)
+{
+	return max(0.0f, dot(wi, n)) / M_PI;
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // A Lambertian (diffuse) material
 ///////////////////////////////////////////////////////////////////////////
@@ -36,80 +41,159 @@ WiSample Diffuse::sample_wi(const vec3& wo, const vec3& n) const
 	return r;
 }
 
+float Diffuse::pdf(const vec3& wi, const vec3& wo, const vec3& n) const
+{
+	return pdfHemisphereCosine(wi, n);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// A Blinn-Phong microfacet BRDF, D(h) = (s + 2) / 2pi * (n.h)^s, with the
+// Cook-Torrance shadowing term. The Fresnel term is applied by the BSDFs
+// that use it.
+///////////////////////////////////////////////////////////////////////////
 vec3 MicrofacetBRDF::f(const vec3& wi, const vec3& wo, const vec3& n) const
 {
-	return vec3(0.0f);
+	const float n_dot_wi = dot(n, wi);
+	const float n_dot_wo = dot(n, wo);
+	if(n_dot_wi <= 0.0f || n_dot_wo <= 0.0f)
+		return vec3(0.0f);
+	const vec3 wh = normalize(wi + wo);
+	const float n_dot_wh = max(0.0f, dot(n, wh));
+	const float wo_dot_wh = max(EPSILON, dot(wo, wh));
+	const float D = (shininess + 2.0f) / (2.0f * M_PI) * pow(n_dot_wh, shininess);
+	const float G = min(1.0f, min(2.0f * n_dot_wh * n_dot_wo / wo_dot_wh, 2.0f * n_dot_wh * n_dot_wi / wo_dot_wh));
+	return vec3(D * G / (4.0f * n_dot_wo * n_dot_wi));
 }
 
+///////////////////////////////////////////////////////////////////////////
+// Sample a microfacet normal with pdf D(h) (n.h), which has the closed form
+// cos(theta_h) = u^(1 / (s + 1)), and reflect wo in it. (The distribution
+// of visible normals has no closed form for Blinn-Phong.) Reflections that
+// end up below the surface are returned with pdf 0, and are not part of
+// pdf(), so the pdf integrates to the fraction of samples that are kept.
+///////////////////////////////////////////////////////////////////////////
 WiSample MicrofacetBRDF::sample_wi(const vec3& wo, const vec3& n) const
 {
-	WiSample r = sampleHemisphereCosine(wo, n);
+	WiSample r;
+	const float cos_theta = pow(randf(), 1.0f / (shininess + 1.0f));
+	const float sin_theta = sqrt(max(0.0f, 1.0f - cos_theta * cos_theta));
+	const float phi = 2.0f * M_PI * randf();
+	const vec3 wh = tangentSpace(n) * vec3(sin_theta * cos(phi), sin_theta * sin(phi), cos_theta);
+	r.wi = reflect(-wo, wh);
+	r.pdf = pdf(r.wi, wo, n);
 	r.f = f(r.wi, wo, n);
-
 	return r;
 }
 
+float MicrofacetBRDF::pdf(const vec3& wi, const vec3& wo, const vec3& n) const
+{
+	if(dot(n, wi) <= 0.0f || dot(n, wo) <= 0.0f)
+		return 0.0f;
+	const vec3 wh = normalize(wi + wo);
+	const float n_dot_wh = dot(n, wh);
+	const float wo_dot_wh = dot(wo, wh);
+	if(n_dot_wh <= 0.0f || wo_dot_wh <= 0.0f)
+		return 0.0f;
+	const float pdf_wh = (shininess + 1.0f) / (2.0f * M_PI) * pow(n_dot_wh, shininess);
+	return pdf_wh / (4.0f * wo_dot_wh);
+}
 
+///////////////////////////////////////////////////////////////////////////
+// Schlick's approximation, with the half vector between wi and wo
+///////////////////////////////////////////////////////////////////////////
 float BSDF::fresnel(const vec3& wi, const vec3& wo) const
 {
-	return 0.0f;
+	const vec3 wh = normalize(wi + wo);
+	return R0 + (1.0f - R0) * pow(1.0f - max(0.0f, dot(wh, wi)), 5.0f);
 }
 
-
+///////////////////////////////////////////////////////////////////////////
+// The BSDFs below pick one of their lobes to sample, but return the full
+// f and the pdf of the whole mixture for the chosen direction. That keeps
+// sample_wi() consistent with f() and pdf(), which multiple importance
+// sampling with the light sources relies on.
+///////////////////////////////////////////////////////////////////////////
 vec3 DielectricBSDF::f(const vec3& wi, const vec3& wo, const vec3& n) const
 {
-	return vec3(0);
+	const float F = fresnel(wi, wo);
+	return F * reflective_material->f(wi, wo, n) + (1.0f - F) * transmissive_material->f(wi, wo, n);
 }
 
 WiSample DielectricBSDF::sample_wi(const vec3& wo, const vec3& n) const
 {
 	WiSample r;
-
-	r = sampleHemisphereCosine(wo, n);
+	if(randf() < 0.5f)
+	{
+		r = reflective_material->sample_wi(wo, n);
+	}
+	else
+	{
+		r = transmissive_material->sample_wi(wo, n);
+	}
+	r.pdf = pdf(r.wi, wo, n);
 	r.f = f(r.wi, wo, n);
-
 	return r;
 }
 
+float DielectricBSDF::pdf(const vec3& wi, const vec3& wo, const vec3& n) const
+{
+	return 0.5f * reflective_material->pdf(wi, wo, n) + 0.5f * transmissive_material->pdf(wi, wo, n);
+}
+
 vec3 MetalBSDF::f(const vec3& wi, const vec3& wo, const vec3& n) const
 {
-	return vec3(0);
+	return fresnel(wi, wo) * color * reflective_material->f(wi, wo, n);
 }
 
 WiSample MetalBSDF::sample_wi(const vec3& wo, const vec3& n) const
 {
-	WiSample r;
-	r = sampleHemisphereCosine(wo, n);
+	WiSample r = reflective_material->sample_wi(wo, n);
 	r.f = f(r.wi, wo, n);
 	return r;
 }
 
+float MetalBSDF::pdf(const vec3& wi, const vec3& wo, const vec3& n) const
+{
+	return reflective_material->pdf(wi, wo, n);
+}
+
 
 vec3 BSDFLinearBlend::f(const vec3& wi, const vec3& wo, const vec3& n) const
 {
-	return vec3(0.0);
+	return w * bsdf0->f(wi, wo, n) + (1.0f - w) * bsdf1->f(wi, wo, n);
 }
 
 WiSample BSDFLinearBlend::sample_wi(const vec3& wo, const vec3& n) const
 {
-	return WiSample{};
+	WiSample r;
+	if(randf() < w)
+	{
+		r = bsdf0->sample_wi(wo, n);
+	}
+	else
+	{
+		r = bsdf1->sample_wi(wo, n);
+	}
+	r.pdf = pdf(r.wi, wo, n);
+	r.f = f(r.wi, wo, n);
+	return r;
+}
+
+float BSDFLinearBlend::pdf(const vec3& wi, const vec3& wo, const vec3& n) const
+{
+	return w * bsdf0->pdf(wi, wo, n) + (1.0f - w) * bsdf1->pdf(wi, wo, n);
 }
 
 
 #if SOLUTION_PROJECT == PROJECT_REFRACTIONS
 ///////////////////////////////////////////////////////////////////////////
-// A perfect specular refraction.
+// A perfect specular refraction. It is a delta distribution, so f() is zero
+// for any direction it is asked about; only sample_wi() finds the one
+// direction that it scatters to.
 ///////////////////////////////////////////////////////////////////////////
 vec3 GlassBTDF::f(const vec3& wi, const vec3& wo, const vec3& n) const
 {
-	if(sameHemisphere(wi, wo, n))
-	{
-		return vec3(0);
-	}
-	else
-	{
-		return vec3(1);
-	}
+	return vec3(0);
 }
 
 WiSample GlassBTDF::sample_wi(const vec3& wo, const vec3& n) const
@@ -154,10 +238,17 @@ WiSample GlassBTDF::sample_wi(const vec3& wo, const vec3& n) const
 	}
 	r.pdf = abs(dot(r.wi, n));
 	r.f = vec3(1.0f, 1.0f, 1.0f);
+	r.specular = true;
 
 	return r;
 }
 
+float GlassBTDF::pdf(const vec3& wi, const vec3& wo, const vec3& n) const
+{
+	// A delta distribution, which can never be hit by another technique
+	return 0.0f;
+}
+
 vec3 BTDFLinearBlend::f(const vec3& wi, const vec3& wo, const vec3& n) const
 {
 	return w * btdf0->f(wi, wo, n) + (1.0f - w) * btdf1->f(wi, wo, n);
@@ -177,5 +268,39 @@ WiSample BTDFLinearBlend::sample_wi(const vec3& wo, const vec3& n) const
 	}
 }
 
+float BTDFLinearBlend::pdf(const vec3& wi, const vec3& wo, const vec3& n) const
+{
+	return w * btdf0->pdf(wi, wo, n) + (1.0f - w) * btdf1->pdf(wi, wo, n);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// The specular part has no f() or pdf() of its own, so they are just those
+// of the opaque part, scaled by how likely it is to be chosen
+///////////////////////////////////////////////////////////////////////////
+vec3 TransparentBSDF::f(const vec3& wi, const vec3& wo, const vec3& n) const
+{
+	return (1.0f - transparency) * opaque_material->f(wi, wo, n);
+}
+
+WiSample TransparentBSDF::sample_wi(const vec3& wo, const vec3& n) const
+{
+	if(randf() < transparency)
+	{
+		WiSample r = specular_material->sample_wi(wo, n);
+		r.f *= transparency;
+		r.pdf *= transparency;
+		return r;
+	}
+	WiSample r = opaque_material->sample_wi(wo, n);
+	r.f = f(r.wi, wo, n);
+	r.pdf = pdf(r.wi, wo, n);
+	return r;
+}
+
+float TransparentBSDF::pdf(const vec3& wi, const vec3& wo, const vec3& n) const
+{
+	return (1.0f - transparency) * opaque_material->pdf(wi, wo, n);
+}
+
 #endif
 } // namespace pathtracer
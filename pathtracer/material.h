@@ -12,6 +12,9 @@ struct WiSample
 	vec3 wi = vec3(0);
 	vec3 f = vec3(0);
 	float pdf = 0.f;
+	// Chosen from a delta distribution. Only the ratio of f and pdf means
+	// anything, and f() and pdf() can never return the direction.
+	bool specular = false;
 };
 
 ///////////////////////////////////////////////////////////////////////////
@@ -25,6 +28,8 @@ public:
 	// Sample a suitable direction and return the brdf in that direction as
 	// well as the pdf (~probability) that the direction was chosen.
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const = 0;
+	// The pdf with which sample_wi() would choose wi
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const = 0;
 };
 
 ///////////////////////////////////////////////////////////////////////////
@@ -39,6 +44,8 @@ public:
 	// Sample a suitable direction and return the btdf in that direction as
 	// well as the pdf (~probability) that the direction was chosen.
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const = 0;
+	// The pdf with which sample_wi() would choose wi
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const = 0;
 };
 
 
@@ -61,6 +68,8 @@ public:
 	// Sample a suitable direction and return the bsdf in that direction as
 	// well as the pdf (~probability) that the direction was chosen.
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const = 0;
+	// The pdf with which sample_wi() would choose wi
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const = 0;
 
 	// Calculate the fresnel term
 	float fresnel(const vec3& wi, const vec3& wo) const;
@@ -79,6 +88,7 @@ public:
 	}
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const override;
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const override;
 };
 
 
@@ -94,6 +104,7 @@ public:
 	}
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const override;
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const override;
 };
 
 
@@ -113,6 +124,7 @@ public:
 
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const override;
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const override;
 };
 
 ///////////////////////////////////////////////////////////////////////////
@@ -131,6 +143,7 @@ public:
 
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const override;
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const override;
 };
 
 
@@ -155,6 +168,7 @@ public:
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const override;
 
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const override;
 };
 
 #if SOLUTION_PROJECT == PROJECT_REFRACTIONS
@@ -172,6 +186,7 @@ public:
 
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const override;
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const override;
 };
 
 class BTDFLinearBlend : public BTDF
@@ -188,6 +203,28 @@ public:
 	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const override;
 
 	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const override;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// A blend of a specular BTDF (with weight `transparency`) and an opaque
+/// BSDF
+///////////////////////////////////////////////////////////////////////////
+class TransparentBSDF : public BSDF
+{
+public:
+	float transparency;
+	const BTDF* specular_material;
+	const BSDF* opaque_material;
+
+	TransparentBSDF(float _transparency, const BTDF* specular, const BSDF* opaque)
+	    : transparency(_transparency), specular_material(specular), opaque_material(opaque)
+	{
+	}
+
+	virtual vec3 f(const vec3& wi, const vec3& wo, const vec3& n) const override;
+	virtual WiSample sample_wi(const vec3& wo, const vec3& n) const override;
+	virtual float pdf(const vec3& wi, const vec3& wo, const vec3& n) const override;
 };
 #endif
 
@@ -0,0 +1,289 @@
+#include "photonmap.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <omp.h>
+#include "Pathtracer.h"
+#include "embree.h"
+#include "material.h"
+#include "sampling.h"
+
+using namespace std;
+
+namespace pathtracer
+{
+PhotonSettings photon_settings;
+PhotonStatistics last_photon_statistics;
+
+///////////////////////////////////////////////////////////////////////////////
+// A stored photon. The direction it came from is packed into 16 + 16 bits
+// (octahedral mapping), which keeps a photon at 28 bytes.
+///////////////////////////////////////////////////////////////////////////////
+struct Photon
+{
+	vec3 position;
+	vec3 power;
+	uint32_t wi;
+};
+
+static uint32_t packDirection(const vec3& d)
+{
+	vec2 p = vec2(d.x, d.z) / (abs(d.x) + abs(d.y) + abs(d.z));
+	if(d.y < 0.0f)
+	{
+		p = (1.0f - abs(vec2(p.y, p.x))) * vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	const uvec2 q = uvec2(round(clamp(p * 0.5f + 0.5f, 0.0f, 1.0f) * 65535.0f));
+	return q.x | (q.y << 16);
+}
+
+static vec3 unpackDirection(uint32_t packed)
+{
+	const vec2 p = vec2(float(packed & 0xffff), float(packed >> 16)) / 65535.0f * 2.0f - 1.0f;
+	vec3 d = vec3(p.x, 1.0f - abs(p.x) - abs(p.y), p.y);
+	if(d.y < 0.0f)
+	{
+		const vec2 folded = (1.0f - abs(vec2(d.z, d.x))) * vec2(d.x >= 0.0f ? 1.0f : -1.0f, d.z >= 0.0f ? 1.0f : -1.0f);
+		d.x = folded.x;
+		d.z = folded.y;
+	}
+	return normalize(d);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The photons of the current pass, sorted by grid cell. The cells are twice
+// the gather radius, so a gather only has to visit the 2x2x2 cells that the
+// sphere around the point overlaps. Cells are hashed into `cell_start`,
+// which holds the index of the first photon of each bucket.
+///////////////////////////////////////////////////////////////////////////////
+static vector<Photon> photons;
+static vector<uint32_t> cell_start;
+static uint32_t cell_mask = 0;
+static float cell_size = 1.0f;
+static float gather_radius = 0.0f;
+static vector<vector<Photon>> thread_photons;
+
+static inline uint32_t hashCell(const ivec3& c)
+{
+	return (uint32_t(c.x) * 73856093u ^ uint32_t(c.y) * 19349663u ^ uint32_t(c.z) * 83492791u) & cell_mask;
+}
+
+static uint32_t tableSize(int photon_count)
+{
+	uint32_t size = 1024;
+	while(size < uint32_t(std::max(photon_count, 0)))
+	{
+		size *= 2;
+	}
+	return size;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The radius after `pass` passes: r_i^2 = r_(i-1)^2 (i + alpha) / (i + 1)
+///////////////////////////////////////////////////////////////////////////////
+static float progressiveRadius(int pass)
+{
+	float r2 = photon_settings.initial_radius * photon_settings.initial_radius;
+	for(int i = 1; i <= pass; i++)
+	{
+		r2 *= (float(i) + photon_settings.alpha) / float(i + 1);
+	}
+	return sqrt(r2);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Follow one photon from the light. It only continues through the specular
+// (glass) part of the materials it hits, chosen with the probability of the
+// material's transparency, which keeps its power unchanged. Once it has been
+// through glass, it is stored on every surface that is not pure glass.
+///////////////////////////////////////////////////////////////////////////////
+static void tracePhoton(Ray ray, vec3 power, vector<Photon>& out, std::atomic<int>& stored, int max_stored, int& dropped)
+{
+	bool through_glass = false;
+	for(int depth = 0; depth < photon_settings.max_depth; depth++)
+	{
+		if(!intersect(ray))
+		{
+			return;
+		}
+		Intersection hit = getIntersection(ray);
+		const float transparency = hit.material->m_transparency;
+		if(through_glass && transparency < 1.0f)
+		{
+			if(stored.fetch_add(1, std::memory_order_relaxed) < max_stored)
+			{
+				out.push_back({ hit.position, power, packDirection(hit.wo) });
+			}
+			else
+			{
+				dropped++;
+			}
+		}
+		if(randf() >= transparency)
+		{
+			return;
+		}
+#if SOLUTION_PROJECT == PROJECT_REFRACTIONS
+		GlassBTDF glass(hit.material->m_ior);
+		WiSample s = glass.sample_wi(hit.wo, hit.shading_normal);
+		through_glass = true;
+		ray = Ray(offsetRayOrigin(hit, s.wi), s.wi);
+#else
+		return;
+#endif
+	}
+}
+
+void tracePhotons(int sample_index, uint32_t sample_stream)
+{
+	photons.clear();
+	PhotonStatistics& stats = last_photon_statistics;
+	stats = PhotonStatistics();
+	const vec3 intensity = point_light.intensity_multiplier * point_light.color;
+	if(!photon_settings.enabled || photon_settings.photons_per_pass <= 0 || intensity == vec3(0.0f))
+	{
+		return;
+	}
+	auto trace_start = std::chrono::high_resolution_clock::now();
+
+	///////////////////////////////////////////////////////////////////////
+	// What is left of the memory cap after the grid is what the photons
+	// get. They are held twice, in the per-thread lists and sorted.
+	///////////////////////////////////////////////////////////////////////
+	const int emitted = photon_settings.photons_per_pass;
+	const uint32_t table_size = tableSize(emitted);
+	const long long budget = (long long)(photon_settings.max_memory_mb) * 1024 * 1024
+	                         - (long long)(table_size + 1) * sizeof(uint32_t);
+	const int max_stored = int(std::min<long long>(std::max<long long>(budget, 0) / (2 * sizeof(Photon)), INT32_MAX));
+
+	// A point light of intensity I emits 4 pi I in total
+	const vec3 photon_power = 4.0f * M_PI * intensity / float(emitted);
+	thread_photons.resize(omp_get_max_threads());
+	std::atomic<int> stored(0);
+	int dropped = 0;
+#pragma omp parallel reduction(+ : dropped)
+	{
+		vector<Photon>& out = thread_photons[omp_get_thread_num()];
+		out.clear();
+#pragma omp for schedule(static)
+		for(int i = 0; i < emitted; i++)
+		{
+			// Keep clear of the seeds of the camera samples
+			seedRandom(uint32_t(i), uint32_t(sample_index) | sample_stream | 0x80000000u);
+			const float z = 1.0f - 2.0f * randf();
+			const float r = sqrt(std::max(0.0f, 1.0f - z * z));
+			const float phi = 2.0f * M_PI * randf();
+			tracePhoton(Ray(point_light.position, vec3(r * cos(phi), r * sin(phi), z)), photon_power, out, stored,
+			            max_stored, dropped);
+		}
+	}
+	auto build_start = std::chrono::high_resolution_clock::now();
+
+	///////////////////////////////////////////////////////////////////////
+	// Sort the photons into the grid: find the bucket of each photon and
+	// count them in parallel, prefix sum, then scatter. The scatter runs in
+	// thread order, which keeps the photons of a bucket in the same order
+	// from run to run.
+	///////////////////////////////////////////////////////////////////////
+	gather_radius = progressiveRadius(sample_index);
+	cell_size = 2.0f * gather_radius;
+	cell_mask = table_size - 1;
+	cell_start.assign(table_size + 1, 0);
+	const int number_of_lists = int(thread_photons.size());
+	vector<size_t> list_offset(number_of_lists + 1, 0);
+	for(int t = 0; t < number_of_lists; t++)
+	{
+		list_offset[t + 1] = list_offset[t] + thread_photons[t].size();
+	}
+	const size_t total = list_offset[number_of_lists];
+	vector<uint32_t> buckets(total);
+#pragma omp parallel for schedule(dynamic)
+	for(int t = 0; t < number_of_lists; t++)
+	{
+		const vector<Photon>& out = thread_photons[t];
+		for(size_t i = 0; i < out.size(); i++)
+		{
+			const uint32_t bucket = hashCell(ivec3(floor(out[i].position / cell_size)));
+			buckets[list_offset[t] + i] = bucket;
+#pragma omp atomic
+			cell_start[bucket + 1]++;
+		}
+	}
+	for(uint32_t i = 0; i < table_size; i++)
+	{
+		cell_start[i + 1] += cell_start[i];
+	}
+	photons.resize(total);
+	vector<uint32_t> cursor(cell_start.begin(), cell_start.end() - 1);
+	for(int t = 0; t < number_of_lists; t++)
+	{
+		const vector<Photon>& out = thread_photons[t];
+		for(size_t i = 0; i < out.size(); i++)
+		{
+			photons[cursor[buckets[list_offset[t] + i]]++] = out[i];
+		}
+	}
+	auto build_end = std::chrono::high_resolution_clock::now();
+
+	stats.emitted = emitted;
+	stats.stored = int(total);
+	stats.dropped = dropped;
+	stats.trace_seconds = std::chrono::duration<double>(build_start - trace_start).count();
+	stats.build_seconds = std::chrono::duration<double>(build_end - build_start).count();
+	stats.radius = gather_radius;
+	stats.memory_bytes = photons.capacity() * sizeof(Photon) + cell_start.capacity() * sizeof(uint32_t);
+	for(const auto& out : thread_photons)
+	{
+		stats.memory_bytes += out.capacity() * sizeof(Photon);
+	}
+}
+
+bool hasCausticPhotons()
+{
+	return photon_settings.enabled && !photons.empty();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Density estimation with a constant kernel: the flux of the photons within
+// the radius that arrived on the side of the surface that is looked at,
+// weighted by the material, over the area of the disc
+///////////////////////////////////////////////////////////////////////////////
+vec3 gatherCaustics(const vec3& position, const vec3& wo, const vec3& n, const BSDF& material)
+{
+	const float r2 = gather_radius * gather_radius;
+	const ivec3 lo = ivec3(floor((position - vec3(gather_radius)) / cell_size));
+	// Different cells can share a bucket, which must only be visited once
+	uint32_t buckets[8];
+	int number_of_buckets = 0;
+	for(int c = 0; c < 8; c++)
+	{
+		const uint32_t bucket = hashCell(lo + ivec3(c & 1, (c >> 1) & 1, c >> 2));
+		if(std::find(buckets, buckets + number_of_buckets, bucket) == buckets + number_of_buckets)
+		{
+			buckets[number_of_buckets++] = bucket;
+		}
+	}
+	vec3 sum(0.0f);
+	for(int b = 0; b < number_of_buckets; b++)
+	{
+		for(uint32_t i = cell_start[buckets[b]]; i < cell_start[buckets[b] + 1]; i++)
+		{
+			const Photon& p = photons[i];
+			const vec3 d = p.position - position;
+			if(dot(d, d) > r2)
+			{
+				continue;
+			}
+			const vec3 wi = unpackDirection(p.wi);
+			if(dot(wi, n) <= 0.0f)
+			{
+				continue;
+			}
+			sum += material.f(wi, wo, n) * p.power;
+		}
+	}
+	return sum / (M_PI * r2);
+}
+} // namespace pathtracer
@@ -0,0 +1,78 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+
+using namespace glm;
+
+namespace pathtracer
+{
+class BSDF;
+
+///////////////////////////////////////////////////////////////////////////////
+// Caustics through photon mapping
+//
+// Light from the point light that reaches a surface through glass is found
+// by neither the shadow rays (they stop at the glass) nor by sampling the
+// materials (they never hit a point). Before every pass, photons are traced
+// from the point light, and those that hit a non-specular surface after
+// passing through glass are stored in a hash grid. The camera paths then
+// estimate the caustic light at their first non-specular surface from the
+// photons within a radius.
+//
+// Each pass uses new photons and a smaller radius (progressive photon
+// mapping as formulated by Knaus and Zwicker), so the average over the
+// passes that the image holds converges.
+///////////////////////////////////////////////////////////////////////////////
+struct PhotonSettings
+{
+	bool enabled = false;
+	int photons_per_pass = 200000;
+	// Gather radius of the first pass, in world units
+	float initial_radius = 0.2f;
+	// How fast the radius shrinks. Lower is faster, with more bias left
+	// in the early passes.
+	float alpha = 0.7f;
+	// Photons stored in one pass are capped to fit in this, together with
+	// the grid
+	int max_memory_mb = 64;
+	int max_depth = 16;
+};
+extern PhotonSettings photon_settings;
+
+struct PhotonStatistics
+{
+	int emitted = 0;
+	int stored = 0;
+	// Photons that did not fit under the memory cap
+	int dropped = 0;
+	double trace_seconds = 0.0;
+	double build_seconds = 0.0;
+	float radius = 0.0f;
+	size_t memory_bytes = 0;
+
+	double photonsPerSecond() const
+	{
+		return trace_seconds > 0.0 ? double(emitted) / trace_seconds : 0.0;
+	}
+};
+extern PhotonStatistics last_photon_statistics;
+
+///////////////////////////////////////////////////////////////////////////
+/// Trace and store the photons for a pass. Called by tracePaths before the
+/// camera paths are traced. Photons are seeded from their index and the
+/// pass (or:ed with the sample stream, see tracePaths), so a pass is
+/// reproducible.
+///////////////////////////////////////////////////////////////////////////
+void tracePhotons(int sample_index, uint32_t sample_stream = 0);
+
+///////////////////////////////////////////////////////////////////////////
+/// Whether there are photons to gather in the current pass
+///////////////////////////////////////////////////////////////////////////
+bool hasCausticPhotons();
+
+///////////////////////////////////////////////////////////////////////////
+/// The caustic radiance leaving a point in direction wo
+///////////////////////////////////////////////////////////////////////////
+vec3 gatherCaustics(const vec3& position, const vec3& wo, const vec3& n, const BSDF& material);
+} // namespace pathtracer
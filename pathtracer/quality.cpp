@@ -0,0 +1,240 @@
+#include "quality.h"
+#include "Pathtracer.h"
+#include "embree.h"
+#include "guiding.h"
+#include "photonmap.h"
+#include "radiancecache.h"
+#include <MappedFile.h>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stb_image.h>
+#include <stb_image_write.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+QualitySettings quality_settings;
+
+// The reference is rendered from its own random numbers. With the same ones
+// the first samples of a measured image would equal those of the reference,
+// and the error would come out far too low.
+const uint32_t reference_sample_stream = 0x40000000u;
+
+void computeError(const vector<vec3>& image, const vector<vec3>& reference, float& rmse, float& relmse)
+{
+	double squared_error = 0.0;
+	double relative_squared_error = 0.0;
+	for(size_t i = 0; i < image.size(); i++)
+	{
+		for(int c = 0; c < 3; c++)
+		{
+			double diff = double(image[i][c]) - double(reference[i][c]);
+			// The small epsilon keeps black reference pixels from dominating
+			double r = double(reference[i][c]);
+			squared_error += diff * diff;
+			relative_squared_error += (diff * diff) / (r * r + 1e-2);
+		}
+	}
+	double n = std::max(double(image.size()) * 3.0, 1.0);
+	rmse = float(sqrt(squared_error / n));
+	relmse = float(relative_squared_error / n);
+}
+
+// A hash of everything besides the scene and resolution that the reference
+// depends on, so that a cached one is not used after any of it changed
+static uint64_t referenceHash()
+{
+	vector<float> values = { float(settings.max_bounces),
+	                         float(quality_settings.reference_samples),
+	                         environment.multiplier,
+	                         point_light.intensity_multiplier,
+	                         point_light.color.r,
+	                         point_light.color.g,
+	                         point_light.color.b,
+	                         point_light.position.x,
+	                         point_light.position.y,
+	                         point_light.position.z,
+	                         photon_settings.enabled ? 1.0f : 0.0f,
+	                         float(photon_settings.photons_per_pass),
+	                         photon_settings.initial_radius,
+	                         photon_settings.alpha,
+	                         float(photon_settings.max_depth) };
+	for(const DiscLight& l : disc_lights)
+	{
+		const float v[] = { l.intensity_multiplier, l.color.r, l.color.g, l.color.b,
+		                    l.position.x, l.position.y, l.position.z,
+		                    l.direction.x, l.direction.y, l.direction.z, l.radius };
+		values.insert(values.end(), v, v + sizeof(v) / sizeof(v[0]));
+	}
+	return labhelper::fnv1a((const uint8_t*)values.data(), values.size() * sizeof(float)) ^ hashSceneMaterials();
+}
+
+static string referenceFilename(const string& scene_name)
+{
+	stringstream ss;
+	ss << quality_settings.reference_directory << "reference_" << scene_name << "_" << rendered_image.width
+	   << "x" << rendered_image.height << "_" << hex << setw(16) << setfill('0') << referenceHash() << ".hdr";
+	return ss.str();
+}
+
+// Create the reference directory if it is not there. Only the last level
+// is created, its parent is expected to exist.
+static void createReferenceDirectory()
+{
+	string directory = quality_settings.reference_directory;
+	while(!directory.empty() && (directory.back() == '/' || directory.back() == '\\'))
+	{
+		directory.pop_back();
+	}
+	if(directory.empty())
+	{
+		return;
+	}
+#ifdef _WIN32
+	_mkdir(directory.c_str());
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+}
+
+void loadOrRenderReference(const string& scene_name, const mat4& V, const mat4& P, vector<vec3>& reference)
+{
+	const string filename = referenceFilename(scene_name);
+	const int w = rendered_image.width;
+	const int h = rendered_image.height;
+
+	///////////////////////////////////////////////////////////////////////////
+	// Try the cached reference first
+	///////////////////////////////////////////////////////////////////////////
+	int width, height, components;
+	stbi_set_flip_vertically_on_load(true);
+	float* data = stbi_loadf(filename.c_str(), &width, &height, &components, 3);
+	if(data != nullptr)
+	{
+		if(width == w && height == h)
+		{
+			reference.assign((vec3*)data, (vec3*)data + w * h);
+			stbi_image_free(data);
+			cout << "Loaded reference image " << filename << ".\n";
+			return;
+		}
+		stbi_image_free(data);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Otherwise render one, regardless of the sample limit in the settings.
+	// The biased radiance cache would end up in the ground truth, and
+	// guiding restarts the image when it is done training, so both are off.
+	///////////////////////////////////////////////////////////////////////////
+	cout << "Rendering reference image for " << scene_name << " (" << quality_settings.reference_samples
+	     << " spp)..." << flush;
+	const int old_max_paths_per_pixel = settings.max_paths_per_pixel;
+	settings.max_paths_per_pixel = 0;
+	const bool old_guiding = guiding_settings.enabled;
+	const bool old_radiance_cache = radiance_cache_settings.enabled;
+	guiding_settings.enabled = false;
+	radiance_cache_settings.enabled = false;
+	restart();
+	for(int i = 0; i < quality_settings.reference_samples; i++)
+	{
+		tracePaths(V, P, reference_sample_stream);
+	}
+	settings.max_paths_per_pixel = old_max_paths_per_pixel;
+	guiding_settings.enabled = old_guiding;
+	radiance_cache_settings.enabled = old_radiance_cache;
+	reference = rendered_image.data;
+	cout << "done.\n";
+
+	// Store upside down so that the .hdr file can be viewed in any image viewer
+	vector<vec3> flipped(w * h);
+	for(int y = 0; y < h; y++)
+	{
+		std::copy(reference.begin() + y * w, reference.begin() + (y + 1) * w, flipped.begin() + (h - 1 - y) * w);
+	}
+	createReferenceDirectory();
+	if(!stbi_write_hdr(filename.c_str(), w, h, 3, &flipped[0].x))
+	{
+		cout << "Could not write reference image " << filename << ".\n";
+	}
+	restart();
+}
+
+QualityCurve measureTimeToQuality(const string& scene_name, const mat4& V, const mat4& P, const vector<vec3>& reference)
+{
+	QualityCurve curve;
+	curve.scene_name = scene_name;
+	if(reference.size() != rendered_image.data.size())
+	{
+		cout << "Reference image for " << scene_name << " does not match the current resolution.\n";
+		return curve;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Only the time spent in tracePaths counts towards the budget, not the
+	// time spent comparing against the reference.
+	///////////////////////////////////////////////////////////////////////////
+	restart();
+	chrono::duration<float> render_time(0.0f);
+	while(render_time.count() < quality_settings.time_budget)
+	{
+		const int samples_before = rendered_image.number_of_samples;
+		auto start = chrono::high_resolution_clock::now();
+		tracePaths(V, P);
+		render_time += chrono::high_resolution_clock::now() - start;
+		if(rendered_image.number_of_samples == samples_before)
+		{
+			// Max paths per pixel reached
+			break;
+		}
+
+		QualitySample sample;
+		sample.seconds = render_time.count();
+		sample.number_of_samples = rendered_image.number_of_samples;
+		computeError(rendered_image.data, reference, sample.rmse, sample.relmse);
+		curve.samples.push_back(sample);
+	}
+
+	if(!curve.samples.empty())
+	{
+		const QualitySample& last = curve.samples.back();
+		curve.efficiency = 1.0f / std::max(last.relmse * last.seconds, 1e-20f);
+		cout << scene_name << ": " << last.number_of_samples << " spp in " << last.seconds
+		     << " s, RMSE = " << last.rmse << ", relMSE = " << last.relmse
+		     << ", efficiency = " << curve.efficiency << "\n";
+	}
+	return curve;
+}
+
+void writeQualityCurveCSV(const string& filename, const QualityCurve& curve)
+{
+	ifstream existing(filename);
+	const bool write_header = !existing.good();
+	existing.close();
+
+	ofstream csv(filename, ios::app);
+	if(!csv.is_open())
+	{
+		cout << "Could not open file " << filename << " for writing.\n";
+		return;
+	}
+	if(write_header)
+	{
+		csv << "scene,seconds,samples,rmse,relmse\n";
+	}
+	for(const auto& s : curve.samples)
+	{
+		csv << curve.scene_name << "," << s.seconds << "," << s.number_of_samples << "," << s.rmse << ","
+		    << s.relmse << "\n";
+	}
+}
+} // namespace pathtracer
@@ -0,0 +1,79 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////////
+// Time-to-quality harness settings
+///////////////////////////////////////////////////////////////////////////////
+struct QualitySettings
+{
+	// Samples per pixel used when a reference image has to be rendered
+	int reference_samples = 4096;
+	// Wall-clock budget (in seconds) given to each test configuration
+	float time_budget = 10.0f;
+	// Where reference images are cached between runs
+	std::string reference_directory = "../scenes/references/";
+};
+extern QualitySettings quality_settings;
+
+///////////////////////////////////////////////////////////////////////////////
+// One point on an error vs. time curve
+///////////////////////////////////////////////////////////////////////////////
+struct QualitySample
+{
+	float seconds;
+	int number_of_samples;
+	float rmse;
+	float relmse;
+};
+
+struct QualityCurve
+{
+	std::string scene_name;
+	std::vector<QualitySample> samples;
+	// Inverse of (relMSE * time) at the end of the budget. Higher is better,
+	// and it is comparable between configurations with different costs.
+	float efficiency = 0.0f;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Compare two images of the same size. relMSE is normalized per channel
+/// by the squared reference value, so that dark and bright regions weigh
+/// in equally.
+///////////////////////////////////////////////////////////////////////////
+void computeError(const std::vector<vec3>& image,
+                  const std::vector<vec3>& reference,
+                  float& rmse,
+                  float& relmse);
+
+///////////////////////////////////////////////////////////////////////////
+/// Load the reference image for a scene from the reference directory, or
+/// render it with `reference_samples` paths per pixel (and store it) if
+/// there is none for the current resolution, settings, lights and
+/// materials. References are rendered without guiding or the radiance
+/// cache.
+///////////////////////////////////////////////////////////////////////////
+void loadOrRenderReference(const std::string& scene_name,
+                           const mat4& V,
+                           const mat4& P,
+                           std::vector<vec3>& reference);
+
+///////////////////////////////////////////////////////////////////////////
+/// Render the scene with the current settings for `time_budget` seconds
+/// and record the error against the reference after every pass.
+///////////////////////////////////////////////////////////////////////////
+QualityCurve measureTimeToQuality(const std::string& scene_name,
+                                  const mat4& V,
+                                  const mat4& P,
+                                  const std::vector<vec3>& reference);
+
+///////////////////////////////////////////////////////////////////////////
+/// Append a curve to a CSV file (scene, seconds, samples, rmse, relmse)
+///////////////////////////////////////////////////////////////////////////
+void writeQualityCurveCSV(const std::string& filename, const QualityCurve& curve);
+} // namespace pathtracer
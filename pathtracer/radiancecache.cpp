@@ -0,0 +1,263 @@
+#include "radiancecache.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Pathtracer.h"
+#include "embree.h"
+#include "sampling.h"
+#include "labhelper.h"
+
+namespace pathtracer
+{
+RadianceCacheSettings radiance_cache_settings;
+
+// How far past its hash an entry may be placed
+const int max_probes = 8;
+
+struct CacheEntry
+{
+	// A second hash of the key, 0 if the entry is free
+	std::atomic<uint32_t> checksum;
+	std::atomic<uint32_t> count;
+	std::atomic<float> radiance[3];
+};
+
+static std::unique_ptr<CacheEntry[]> entries;
+static size_t number_of_entries = 0;
+static std::atomic<size_t> used_entries(0);
+
+///////////////////////////////////////////////////////////////////////////////
+// What the cache was filled with. The cache is cleared when any of it
+// changes.
+///////////////////////////////////////////////////////////////////////////////
+struct MaterialState
+{
+	vec3 color;
+	float shininess;
+	float metalness;
+	float fresnel;
+	vec3 emission;
+	float transparency;
+	float ior;
+};
+
+struct CacheState
+{
+	float cell_size = 0.0f;
+	float max_shininess = 0.0f;
+	float max_metalness = 0.0f;
+	float environment_multiplier = 0.0f;
+	PointLight point_light = {};
+	std::vector<DiscLight> disc_lights;
+	// Of every model in the scene, in order
+	std::vector<MaterialState> materials;
+};
+static CacheState filled_with;
+
+static bool operator==(const PointLight& a, const PointLight& b)
+{
+	return a.intensity_multiplier == b.intensity_multiplier && a.color == b.color && a.position == b.position;
+}
+
+static bool operator==(const DiscLight& a, const DiscLight& b)
+{
+	return a.intensity_multiplier == b.intensity_multiplier && a.color == b.color && a.position == b.position
+	       && a.direction == b.direction && a.radius == b.radius;
+}
+
+static bool operator==(const MaterialState& a, const MaterialState& b)
+{
+	return a.color == b.color && a.shininess == b.shininess && a.metalness == b.metalness
+	       && a.fresnel == b.fresnel && a.emission == b.emission && a.transparency == b.transparency
+	       && a.ior == b.ior;
+}
+
+static bool operator==(const CacheState& a, const CacheState& b)
+{
+	return a.cell_size == b.cell_size && a.max_shininess == b.max_shininess
+	       && a.max_metalness == b.max_metalness && a.environment_multiplier == b.environment_multiplier
+	       && a.point_light == b.point_light && a.disc_lights == b.disc_lights && a.materials == b.materials;
+}
+
+static void atomicAdd(std::atomic<float>& a, float value)
+{
+	float current = a.load(std::memory_order_relaxed);
+	while(!a.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+	{
+	}
+}
+
+static inline uint32_t hash(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The hash that picks the entry, and an independent one that tells keys
+// that land on the same entry apart
+///////////////////////////////////////////////////////////////////////////////
+static void hashCell(const vec3& position, const vec3& normal, uint32_t& index_hash, uint32_t& checksum)
+{
+	const ivec3 cell = ivec3(floor(position / radiance_cache_settings.cell_size));
+	const vec3 a = abs(normal);
+	const int axis = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+	const uint32_t face = uint32_t(axis * 2 + (normal[axis] < 0.0f ? 1 : 0));
+	index_hash = hash(uint32_t(cell.z) + hash(uint32_t(cell.y) + hash(uint32_t(cell.x) + hash(face))));
+	checksum = hash(uint32_t(cell.x) ^ hash(uint32_t(cell.y) ^ hash(uint32_t(cell.z) ^ hash(face + 0x9e3779b9u))));
+	if(checksum == 0)
+	{
+		checksum = 1;
+	}
+}
+
+void clearRadianceCache()
+{
+	for(size_t i = 0; i < number_of_entries; i++)
+	{
+		entries[i].checksum.store(0, std::memory_order_relaxed);
+		entries[i].count.store(0, std::memory_order_relaxed);
+		for(int c = 0; c < 3; c++)
+		{
+			entries[i].radiance[c].store(0.0f, std::memory_order_relaxed);
+		}
+	}
+	used_entries = 0;
+}
+
+void beginRadianceCachePass()
+{
+	if(!radiance_cache_settings.enabled)
+	{
+		return;
+	}
+	// Round down to a power of two, so that the index is a mask
+	size_t wanted = 1;
+	const size_t bytes = size_t(std::max(radiance_cache_settings.size_mb, 1)) * 1024 * 1024;
+	while(wanted * 2 * sizeof(CacheEntry) <= bytes)
+	{
+		wanted *= 2;
+	}
+
+	CacheState state;
+	state.cell_size = radiance_cache_settings.cell_size;
+	state.max_shininess = radiance_cache_settings.max_shininess;
+	state.max_metalness = radiance_cache_settings.max_metalness;
+	state.environment_multiplier = environment.multiplier;
+	state.point_light = point_light;
+	state.disc_lights = disc_lights;
+	// The light bounced off a surface depends on its material, and
+	// emissive materials are lights themselves
+	for(const labhelper::Model* model : getSceneModels())
+	{
+		for(const labhelper::Material& m : model->m_materials)
+		{
+			state.materials.push_back({ m.m_color, m.m_shininess, m.m_metalness, m.m_fresnel, m.m_emission,
+			                            m.m_transparency, m.m_ior });
+		}
+	}
+	if(wanted != number_of_entries)
+	{
+		entries.reset(new CacheEntry[wanted]);
+		number_of_entries = wanted;
+		clearRadianceCache();
+	}
+	else if(!(state == filled_with))
+	{
+		clearRadianceCache();
+	}
+	filled_with = state;
+}
+
+RadianceCacheStatus getRadianceCacheStatus()
+{
+	RadianceCacheStatus status;
+	status.entries = number_of_entries;
+	status.used_entries = used_entries;
+	status.memory_bytes = number_of_entries * sizeof(CacheEntry);
+	return status;
+}
+
+bool isRadianceCacheable(float shininess, float metalness)
+{
+	return radiance_cache_settings.enabled && number_of_entries != 0
+	       && shininess <= radiance_cache_settings.max_shininess
+	       && metalness <= radiance_cache_settings.max_metalness;
+}
+
+bool lookupRadianceCache(const vec3& position, const vec3& normal, vec3& radiance)
+{
+	if(number_of_entries == 0)
+	{
+		return false;
+	}
+	const mat3 tbn = labhelper::tangentSpace(normal);
+	const float jitter = radiance_cache_settings.cell_size;
+	const vec3 p = position + tbn * vec3(jitter * (randf() - 0.5f), jitter * (randf() - 0.5f), 0.0f);
+	uint32_t index_hash, checksum;
+	hashCell(p, normal, index_hash, checksum);
+	const size_t mask = number_of_entries - 1;
+	for(int i = 0; i < max_probes; i++)
+	{
+		const CacheEntry& e = entries[(index_hash + i) & mask];
+		const uint32_t c = e.checksum.load(std::memory_order_relaxed);
+		if(c == 0)
+		{
+			return false;
+		}
+		if(c == checksum)
+		{
+			const uint32_t count = e.count.load(std::memory_order_relaxed);
+			if(count < uint32_t(radiance_cache_settings.min_samples) || count == 0)
+			{
+				return false;
+			}
+			radiance = vec3(e.radiance[0].load(std::memory_order_relaxed), e.radiance[1].load(std::memory_order_relaxed),
+			                e.radiance[2].load(std::memory_order_relaxed))
+			           / float(count);
+			return true;
+		}
+	}
+	return false;
+}
+
+void recordRadianceCache(const vec3& position, const vec3& normal, const vec3& radiance)
+{
+	if(number_of_entries == 0 || any(isnan(radiance)) || any(isinf(radiance)))
+	{
+		return;
+	}
+	uint32_t index_hash, checksum;
+	hashCell(position, normal, index_hash, checksum);
+	const size_t mask = number_of_entries - 1;
+	for(int i = 0; i < max_probes; i++)
+	{
+		CacheEntry& e = entries[(index_hash + i) & mask];
+		uint32_t c = e.checksum.load(std::memory_order_relaxed);
+		if(c == 0)
+		{
+			// Claim the free entry, unless another thread got there first
+			if(e.checksum.compare_exchange_strong(c, checksum))
+			{
+				used_entries++;
+				c = checksum;
+			}
+		}
+		if(c == checksum)
+		{
+			for(int k = 0; k < 3; k++)
+			{
+				atomicAdd(e.radiance[k], radiance[k]);
+			}
+			e.count.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+	// The table is full around this hash, drop the sample
+}
+} // namespace pathtracer
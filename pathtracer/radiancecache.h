@@ -0,0 +1,86 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstddef>
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////////
+// A world space radiance cache
+//
+// Outgoing radiance of diffuse-ish surfaces, averaged over cells of a
+// uniform grid (one per cell and dominant normal direction). The cells live
+// in a fixed size hash table, so memory use does not depend on the size of
+// the scene. Every path vertex on such a surface adds its estimate, and
+// paths that reach one at a later bounce can stop there and use the cached
+// average instead of tracing on. That is biased, more so with larger cells
+// and fewer required samples, but converges the bounce lighting much faster.
+///////////////////////////////////////////////////////////////////////////////
+struct RadianceCacheSettings
+{
+	bool enabled = false;
+	// Side of a grid cell in world units
+	float cell_size = 0.5f;
+	// The first bounce at which paths can end in the cache
+	int start_bounce = 1;
+	// Estimates a cell needs before it is used
+	int min_samples = 16;
+	// Surfaces that are shinier, or more metallic than this, look different
+	// from different directions and are left out of the cache
+	float max_shininess = 50.0f;
+	float max_metalness = 0.5f;
+	// Size of the hash table
+	int size_mb = 64;
+};
+extern RadianceCacheSettings radiance_cache_settings;
+
+struct RadianceCacheStatus
+{
+	size_t entries = 0;
+	size_t used_entries = 0;
+	size_t memory_bytes = 0;
+};
+RadianceCacheStatus getRadianceCacheStatus();
+
+///////////////////////////////////////////////////////////////////////////
+/// Throw away everything cached. Called when the scene is rebuilt.
+///////////////////////////////////////////////////////////////////////////
+void clearRadianceCache();
+
+///////////////////////////////////////////////////////////////////////////
+/// Called by tracePaths before each pass. Allocates the table, and clears
+/// it if the settings, the lights or the materials have changed since it
+/// was filled.
+///////////////////////////////////////////////////////////////////////////
+void beginRadianceCachePass();
+
+///////////////////////////////////////////////////////////////////////////
+/// Whether the cache is in use and the material at a hit can be cached
+///////////////////////////////////////////////////////////////////////////
+bool isRadianceCacheable(float shininess, float metalness);
+
+///////////////////////////////////////////////////////////////////////////
+/// The cached outgoing radiance near a point, if the cell has enough
+/// samples. The position is jittered within a cell in the tangent plane,
+/// which turns the blocky look of the grid into noise. Thread safe.
+///////////////////////////////////////////////////////////////////////////
+bool lookupRadianceCache(const vec3& position, const vec3& normal, vec3& radiance);
+
+///////////////////////////////////////////////////////////////////////////
+/// Add an estimate of the outgoing radiance at a point. Thread safe.
+///////////////////////////////////////////////////////////////////////////
+void recordRadianceCache(const vec3& position, const vec3& normal, const vec3& radiance);
+
+///////////////////////////////////////////////////////////////////////////
+/// A path vertex waiting for the radiance found further along the path
+///////////////////////////////////////////////////////////////////////////
+struct RadianceCacheVertex
+{
+	vec3 position;
+	vec3 normal;
+	// Path throughput up to the vertex
+	vec3 throughput;
+	vec3 radiance;
+};
+} // namespace pathtracer
@@ -1,22 +1,70 @@
 #include "sampling.h"
-#include <random>
 #include "labhelper.h"
 #include <omp.h>
 #include <iostream>
 #include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
 
 using namespace glm;
 
 namespace pathtracer
 {
+///////////////////////////////////////////////////////////////////////////////
+// A PCG32 generator (http://www.pcg-random.org). Unlike std::mt19937 it can
+// be reseeded for every pixel sample at the cost of a couple of multiplies.
+///////////////////////////////////////////////////////////////////////////////
+struct alignas(64) PCG32
+{
+	uint64_t state = 0x853c49e6748fea9bULL;
+	uint64_t inc = 0xda3e39cb94b95bdbULL;
+	uint32_t next()
+	{
+		uint64_t old_state = state;
+		state = old_state * 6364136223846793005ULL + inc;
+		uint32_t xorshifted = uint32_t(((old_state >> 18u) ^ old_state) >> 27u);
+		uint32_t rot = uint32_t(old_state >> 59u);
+		return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+	}
+	void seed(uint64_t initial_state, uint64_t sequence)
+	{
+		state = 0u;
+		inc = (sequence << 1u) | 1u;
+		next();
+		state += initial_state;
+		next();
+	}
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // Get a random float. Note that we need one "generator" per thread, or we
 // would need to lock everytime someone called randf().
 ///////////////////////////////////////////////////////////////////////////////
-std::mt19937 generators[24]; // Assuming no more than 24 cores
+static std::vector<PCG32> generators(std::max(omp_get_max_threads(), 1));
+static PCG32& threadGenerator()
+{
+	// Should there ever be more threads than at startup, they share the
+	// last generator rather than write out of bounds
+	const size_t thread = std::min(size_t(omp_get_thread_num()), generators.size() - 1);
+	return generators[thread];
+}
+
 float randf()
 {
-	return float(generators[omp_get_thread_num()]() / double(generators[omp_get_thread_num()].max()));
+	// 24 random bits give every float in [0, 1) with equal spacing
+	return float(threadGenerator().next() >> 8) * (1.0f / 16777216.0f);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Each pixel gets its own PCG stream, and the sample index selects where in
+// that stream we start, so a sample is the same on any thread or process.
+///////////////////////////////////////////////////////////////////////////////
+void seedRandom(uint32_t pixel_index, uint32_t sample_index)
+{
+	// Scramble the sample index so that consecutive samples start far apart
+	uint64_t s = uint64_t(sample_index) * 0x9E3779B97F4A7C15ULL;
+	s ^= s >> 31;
+	threadGenerator().seed(s, pixel_index);
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -86,4 +134,77 @@ bool sameHemisphere(const vec3& i, const vec3& o, const vec3& n)
 {
 	return sign(dot(o, n)) == sign(dot(i, n));
 }
-} // namespace pathtracer
\ No newline at end of file
+
+///////////////////////////////////////////////////////////////////////////
+// Generate uniform barycentric coordinates on a triangle
+///////////////////////////////////////////////////////////////////////////
+glm::vec2 uniformSampleTriangle()
+{
+	float su0 = sqrt(randf());
+	return glm::vec2(1.0f - su0, randf() * su0);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Build the alias table. Buckets are split into those with less and more
+// than the average weight, and each small bucket is topped up with the
+// excess of a large one.
+///////////////////////////////////////////////////////////////////////////
+void AliasTable::build(const std::vector<float>& weights)
+{
+	const int n = int(weights.size());
+	probability.assign(n, 1.0f);
+	alias.resize(n);
+	pdf.assign(n, 0.0f);
+	double sum = 0.0;
+	for(float w : weights)
+	{
+		sum += w;
+	}
+	if(n == 0 || sum <= 0.0)
+	{
+		probability.clear();
+		alias.clear();
+		pdf.clear();
+		return;
+	}
+
+	std::vector<float> scaled(n);
+	std::vector<int> small, large;
+	for(int i = 0; i < n; i++)
+	{
+		pdf[i] = float(weights[i] / sum);
+		scaled[i] = pdf[i] * n;
+		alias[i] = i;
+		if(scaled[i] < 1.0f)
+			small.push_back(i);
+		else
+			large.push_back(i);
+	}
+	while(!small.empty() && !large.empty())
+	{
+		int s = small.back(), l = large.back();
+		small.pop_back();
+		probability[s] = scaled[s];
+		alias[s] = l;
+		scaled[l] = (scaled[l] + scaled[s]) - 1.0f;
+		if(scaled[l] < 1.0f)
+		{
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	// Whatever is left is (up to rounding) exactly average
+	for(int i : small)
+		probability[i] = 1.0f;
+	for(int i : large)
+		probability[i] = 1.0f;
+}
+
+int AliasTable::sample(float u) const
+{
+	const int n = int(probability.size());
+	float scaled = u * n;
+	int i = std::min(int(scaled), n - 1);
+	return (scaled - float(i)) < probability[i] ? i : alias[i];
+}
+} // namespace pathtracer
@@ -1,5 +1,7 @@
 #pragma once
 #include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
 
 namespace pathtracer
 {
@@ -8,6 +10,12 @@ namespace pathtracer
 ///////////////////////////////////////////////////////////////////////////
 float randf();
 
+///////////////////////////////////////////////////////////////////////////
+// Restart the calling thread's random sequence at a point determined only
+// by the pixel and the sample index, which makes every sample reproducible.
+///////////////////////////////////////////////////////////////////////////
+void seedRandom(uint32_t pixel_index, uint32_t sample_index);
+
 ///////////////////////////////////////////////////////////////////////////
 // Generate uniform points on a disc
 ///////////////////////////////////////////////////////////////////////////
@@ -22,4 +30,40 @@ glm::vec3 cosineSampleHemisphere();
 // Check if wi and wo are on the same side of the plane defined by n
 ///////////////////////////////////////////////////////////////////////////
 bool sameHemisphere(const glm::vec3& wi, const glm::vec3& wo, const glm::vec3& n);
+
+///////////////////////////////////////////////////////////////////////////
+// Generate uniform barycentric coordinates (b1, b2) on a triangle
+///////////////////////////////////////////////////////////////////////////
+glm::vec2 uniformSampleTriangle();
+
+///////////////////////////////////////////////////////////////////////////
+// Multiple importance sampling weight for a sample taken with pdf_a, when
+// it could also have been taken with pdf_b
+///////////////////////////////////////////////////////////////////////////
+inline float powerHeuristic(float pdf_a, float pdf_b)
+{
+	pdf_a *= pdf_a;
+	pdf_b *= pdf_b;
+	return pdf_a + pdf_b > 0.0f ? pdf_a / (pdf_a + pdf_b) : 0.0f;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Samples an index with probability proportional to its weight in O(1),
+// using Vose's alias method
+///////////////////////////////////////////////////////////////////////////
+struct AliasTable
+{
+	// Probability of keeping each bucket's own index rather than its alias
+	std::vector<float> probability;
+	std::vector<int> alias;
+	// The normalized weights
+	std::vector<float> pdf;
+
+	void build(const std::vector<float>& weights);
+	int sample(float u) const;
+	bool empty() const
+	{
+		return pdf.empty();
+	}
+};
 } // namespace pathtracer
@@ -0,0 +1,194 @@
+#include "scenefile.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <glm/gtx/transform.hpp>
+
+using namespace std;
+
+namespace pathtracer
+{
+static bool isColorProperty(const string& property)
+{
+	return property == "color" || property == "emission";
+}
+
+static bool isScalarProperty(const string& property)
+{
+	return property == "shininess" || property == "metalness" || property == "fresnel"
+	       || property == "transparency" || property == "ior";
+}
+
+bool loadSceneDescriptions(const string& filename, vector<SceneDescription>& scenes)
+{
+	ifstream file(filename);
+	if(!file)
+	{
+		cout << "Could not open scene file " << filename << ".\n";
+		return false;
+	}
+	scenes.clear();
+	string line;
+	int line_number = 0;
+	while(getline(file, line))
+	{
+		line_number++;
+		istringstream in(line);
+		string directive;
+		if(!(in >> directive) || directive[0] == '#')
+		{
+			continue;
+		}
+		auto error = [&](const string& message) {
+			cout << filename << ":" << line_number << ": " << message << "\n";
+			return false;
+		};
+
+		if(directive == "scene")
+		{
+			SceneDescription scene;
+			getline(in >> ws, scene.name);
+			scene.name.erase(scene.name.find_last_not_of(" \t\r") + 1);
+			if(scene.name.empty())
+			{
+				return error("scene needs a name");
+			}
+			for(const auto& s : scenes)
+			{
+				if(s.name == scene.name)
+				{
+					return error("there already is a scene named " + scene.name);
+				}
+			}
+			scenes.push_back(scene);
+			continue;
+		}
+		if(scenes.empty())
+		{
+			return error(directive + " before the first scene");
+		}
+		SceneDescription& scene = scenes.back();
+
+		if(directive == "camera")
+		{
+			vec3 p, d;
+			if(!(in >> p.x >> p.y >> p.z >> d.x >> d.y >> d.z) || d == vec3(0.0f))
+			{
+				return error("camera needs a position and a direction");
+			}
+			scene.camera_position = p;
+			scene.camera_direction = normalize(d);
+		}
+		else if(directive == "environment")
+		{
+			if(!(in >> scene.environment_map))
+			{
+				return error("environment needs a filename");
+			}
+			if(!(in >> scene.environment_multiplier))
+			{
+				scene.environment_multiplier = 1.0f;
+			}
+		}
+		else if(directive == "point_light")
+		{
+			vec3& p = scene.point_light_position;
+			vec3& c = scene.point_light_color;
+			if(!(in >> p.x >> p.y >> p.z >> c.x >> c.y >> c.z >> scene.point_light_intensity))
+			{
+				return error("point_light needs a position, a color and an intensity");
+			}
+			scene.has_point_light = true;
+		}
+		else if(directive == "model")
+		{
+			SceneDescription::ModelDescription model;
+			if(!(in >> model.filename))
+			{
+				return error("model needs a filename");
+			}
+			scene.models.push_back(model);
+		}
+		else if(directive == "translate" || directive == "rotate" || directive == "scale"
+		        || directive == "material")
+		{
+			if(scene.models.empty())
+			{
+				return error(directive + " before the first model of the scene");
+			}
+			SceneDescription::ModelDescription& model = scene.models.back();
+			vec3 v;
+			if(directive == "translate")
+			{
+				if(!(in >> v.x >> v.y >> v.z))
+				{
+					return error("translate needs x, y and z");
+				}
+				model.transform = model.transform * translate(v);
+			}
+			else if(directive == "rotate")
+			{
+				float degrees;
+				if(!(in >> degrees >> v.x >> v.y >> v.z) || v == vec3(0.0f))
+				{
+					return error("rotate needs an angle and an axis");
+				}
+				model.transform = model.transform * rotate(radians(degrees), normalize(v));
+			}
+			else if(directive == "scale")
+			{
+				if(!(in >> v.x >> v.y >> v.z))
+				{
+					return error("scale needs x, y and z");
+				}
+				model.transform = model.transform * scale(v);
+			}
+			else
+			{
+				SceneDescription::MaterialOverride o;
+				if(!(in >> o.material_index >> o.property) || o.material_index < 0)
+				{
+					return error("material needs an index and a property");
+				}
+				if(isColorProperty(o.property))
+				{
+					if(!(in >> o.value.x >> o.value.y >> o.value.z))
+					{
+						return error(o.property + " needs r, g and b");
+					}
+				}
+				else if(isScalarProperty(o.property))
+				{
+					if(!(in >> o.value.x))
+					{
+						return error(o.property + " needs a value");
+					}
+				}
+				else
+				{
+					return error("unknown material property " + o.property);
+				}
+				model.material_overrides.push_back(o);
+			}
+		}
+		else
+		{
+			return error("unknown directive " + directive);
+		}
+	}
+	for(const auto& s : scenes)
+	{
+		if(s.models.empty())
+		{
+			cout << filename << ": scene " << s.name << " has no models.\n";
+			return false;
+		}
+	}
+	if(scenes.empty())
+	{
+		cout << filename << " has no scenes.\n";
+		return false;
+	}
+	return true;
+}
+} // namespace pathtracer
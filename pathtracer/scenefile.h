@@ -0,0 +1,68 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////////
+// Scene description files
+//
+// The scenes that can be shown are listed in a small text file, rather than
+// in code, and their models are only loaded when a scene is first shown. A
+// file holds any number of scenes, one directive per line:
+//
+//   # A comment
+//   scene <name>
+//   camera <position x y z> <direction x y z>
+//   environment <.hdr file> [multiplier]
+//   point_light <position x y z> <color r g b> <intensity multiplier>
+//   model <.obj file>
+//       translate <x y z>
+//       rotate <degrees> <axis x y z>
+//       scale <x y z>
+//       material <index> <color|emission> <r g b>
+//       material <index> <shininess|metalness|fresnel|transparency|ior> <value>
+//
+// Transforms and material changes apply to the model above them, and the
+// transforms are applied in the order they are listed, like the matrices
+// they multiply. Filenames are relative to the working directory, like
+// those of the shaders.
+///////////////////////////////////////////////////////////////////////////////
+struct SceneDescription
+{
+	struct MaterialOverride
+	{
+		int material_index;
+		std::string property;
+		vec3 value;
+	};
+	struct ModelDescription
+	{
+		std::string filename;
+		mat4 transform = mat4(1.0f);
+		std::vector<MaterialOverride> material_overrides;
+	};
+
+	std::string name;
+	std::vector<ModelDescription> models;
+	vec3 camera_position = vec3(0.0f, 0.0f, 10.0f);
+	vec3 camera_direction = vec3(0.0f, 0.0f, -1.0f);
+	// Empty to keep the environment of the previous scene
+	std::string environment_map;
+	float environment_multiplier = 1.0f;
+	// The point light is left as it is, unless the scene has one
+	bool has_point_light = false;
+	vec3 point_light_position = vec3(0.0f);
+	vec3 point_light_color = vec3(1.0f);
+	float point_light_intensity = 0.0f;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Read the scenes in a file. Prints what is wrong and returns false if
+/// the file can't be read or has an error in it.
+///////////////////////////////////////////////////////////////////////////
+bool loadSceneDescriptions(const std::string& filename, std::vector<SceneDescription>& scenes);
+} // namespace pathtracer
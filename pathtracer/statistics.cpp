@@ -0,0 +1,109 @@
+#include "statistics.h"
+#include <omp.h>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+namespace pathtracer
+{
+StatisticsSettings statistics_settings;
+PassStatistics last_pass_statistics;
+
+///////////////////////////////////////////////////////////////////////////////
+// One slot per OpenMP thread, sized at startup and grown at the start of a
+// pass if more threads are allowed by then.
+///////////////////////////////////////////////////////////////////////////////
+static vector<ThreadStatistics> thread_statistics(std::max(omp_get_max_threads(), 1));
+
+void beginStatisticsPass()
+{
+	thread_statistics.assign(std::max(size_t(omp_get_max_threads()), thread_statistics.size()), ThreadStatistics());
+}
+
+ThreadStatistics& threadStatistics()
+{
+	// Threads beyond those counted share the last slot. Their counts may be
+	// off, but nothing is written out of bounds.
+	const size_t thread = std::min(size_t(omp_get_thread_num()), thread_statistics.size() - 1);
+	return thread_statistics[thread];
+}
+
+static bool endsWith(const string& s, const string& suffix)
+{
+	return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static void writeStatisticsToLog(const PassStatistics& stats, int sample_index)
+{
+	static ofstream log_file;
+	static string log_file_name;
+	if(!log_file.is_open() || log_file_name != statistics_settings.log_filename)
+	{
+		log_file.close();
+		log_file_name = statistics_settings.log_filename;
+		log_file.open(log_file_name, ios::app);
+		if(!log_file.is_open())
+		{
+			cout << "Could not open file " << log_file_name << " for writing.\n";
+			statistics_settings.log_to_file = false;
+			return;
+		}
+		if(!endsWith(log_file_name, ".json") && log_file.tellp() == 0)
+		{
+			log_file << "sample,pass_seconds,primary_rays,secondary_rays,shadow_rays,embree_seconds,"
+			            "shading_seconds,average_path_depth,russian_roulette_kills,environment_hits\n";
+		}
+	}
+
+	const ThreadStatistics& t = stats.totals;
+	if(endsWith(log_file_name, ".json"))
+	{
+		log_file << "{\"sample\": " << sample_index << ", \"pass_seconds\": " << stats.pass_seconds
+		         << ", \"primary_rays\": " << t.primary_rays << ", \"secondary_rays\": " << t.secondary_rays
+		         << ", \"shadow_rays\": " << t.shadow_rays << ", \"embree_seconds\": " << t.embree_seconds
+		         << ", \"shading_seconds\": " << stats.shadingSeconds()
+		         << ", \"average_path_depth\": " << stats.averagePathDepth()
+		         << ", \"russian_roulette_kills\": " << t.russian_roulette_kills
+		         << ", \"environment_hits\": " << t.environment_hits << "}\n";
+	}
+	else
+	{
+		log_file << sample_index << "," << stats.pass_seconds << "," << t.primary_rays << ","
+		         << t.secondary_rays << "," << t.shadow_rays << "," << t.embree_seconds << ","
+		         << stats.shadingSeconds() << "," << stats.averagePathDepth() << ","
+		         << t.russian_roulette_kills << "," << t.environment_hits << "\n";
+	}
+	log_file.flush();
+}
+
+void endStatisticsPass(double pass_seconds, int sample_index)
+{
+	PassStatistics stats;
+	stats.pass_seconds = pass_seconds;
+	stats.number_of_threads = std::min(omp_get_max_threads(), int(thread_statistics.size()));
+	ThreadStatistics& sum = stats.totals;
+	for(int i = 0; i < stats.number_of_threads; i++)
+	{
+		const ThreadStatistics& t = thread_statistics[i];
+		sum.primary_rays += t.primary_rays;
+		sum.secondary_rays += t.secondary_rays;
+		sum.shadow_rays += t.shadow_rays;
+		sum.paths += t.paths;
+		sum.path_vertices += t.path_vertices;
+		sum.russian_roulette_kills += t.russian_roulette_kills;
+		sum.environment_hits += t.environment_hits;
+		sum.radiance_cache_hits += t.radiance_cache_hits;
+		sum.busy_seconds += t.busy_seconds;
+		sum.embree_seconds += t.embree_seconds;
+	}
+	last_pass_statistics = stats;
+
+	if(statistics_settings.log_to_file)
+	{
+		writeStatisticsToLog(stats, sample_index);
+	}
+}
+} // namespace pathtracer
@@ -0,0 +1,102 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////
+// Counters owned by a single OpenMP thread during a pass. Each thread only
+// ever touches its own slot, and the slots are padded to a cache line so
+// that they can be incremented without atomics or false sharing.
+///////////////////////////////////////////////////////////////////////////
+struct alignas(64) ThreadStatistics
+{
+	uint64_t primary_rays = 0;
+	uint64_t secondary_rays = 0;
+	uint64_t shadow_rays = 0;
+	uint64_t paths = 0;
+	// Sum of the number of surface interactions of all paths
+	uint64_t path_vertices = 0;
+	uint64_t russian_roulette_kills = 0;
+	uint64_t environment_hits = 0;
+	// Paths that ended with a value from the radiance cache
+	uint64_t radiance_cache_hits = 0;
+	// Time spent tracing pixels, and the part of that spent inside embree
+	double busy_seconds = 0.0;
+	double embree_seconds = 0.0;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// The statistics for a whole call to tracePaths, summed over all threads
+///////////////////////////////////////////////////////////////////////////
+struct PassStatistics
+{
+	ThreadStatistics totals;
+	int number_of_threads = 0;
+	// Wall clock time of the pass
+	double pass_seconds = 0.0;
+
+	double shadingSeconds() const
+	{
+		return totals.busy_seconds - totals.embree_seconds;
+	}
+	float averagePathDepth() const
+	{
+		return totals.paths > 0 ? float(double(totals.path_vertices) / double(totals.paths)) : 0.0f;
+	}
+	double raysPerSecond() const
+	{
+		uint64_t rays = totals.primary_rays + totals.secondary_rays + totals.shadow_rays;
+		return pass_seconds > 0.0 ? double(rays) / pass_seconds : 0.0;
+	}
+};
+
+struct StatisticsSettings
+{
+	// Timing every embree call is cheap but not free
+	bool measure_embree_time = true;
+	// Append one line per pass to `log_filename` (.csv, or JSON lines if
+	// the filename ends with .json)
+	bool log_to_file = false;
+	std::string log_filename = "pathtracer_statistics.csv";
+};
+extern StatisticsSettings statistics_settings;
+extern PassStatistics last_pass_statistics;
+
+///////////////////////////////////////////////////////////////////////////
+/// Clear the per-thread counters. Called at the start of tracePaths.
+///////////////////////////////////////////////////////////////////////////
+void beginStatisticsPass();
+
+///////////////////////////////////////////////////////////////////////////
+/// The counters of the calling OpenMP thread
+///////////////////////////////////////////////////////////////////////////
+ThreadStatistics& threadStatistics();
+
+///////////////////////////////////////////////////////////////////////////
+/// Sum up the per-thread counters into last_pass_statistics and write
+/// them to the log if enabled. Called at the end of tracePaths.
+///////////////////////////////////////////////////////////////////////////
+void endStatisticsPass(double pass_seconds, int sample_index);
+
+///////////////////////////////////////////////////////////////////////////
+/// Accumulates the time until it goes out of scope into `target`, if
+/// `enabled` is set.
+///////////////////////////////////////////////////////////////////////////
+struct ScopedTimer
+{
+	double* target;
+	std::chrono::high_resolution_clock::time_point start;
+	ScopedTimer(double& _target, bool enabled) : target(enabled ? &_target : nullptr)
+	{
+		if(target)
+			start = std::chrono::high_resolution_clock::now();
+	}
+	~ScopedTimer()
+	{
+		if(target)
+			*target += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+};
+} // namespace pathtracer
@@ -0,0 +1,274 @@
+#include "texture.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <unordered_map>
+
+using namespace std;
+
+namespace pathtracer
+{
+const int tile_size = 8;
+const int tile_texels = tile_size * tile_size;
+
+///////////////////////////////////////////////////////////////////////////////
+// Interleave the bits of the position within a tile (3 bits each)
+///////////////////////////////////////////////////////////////////////////////
+static inline int morton(int x, int y)
+{
+	static const int spread[8] = { 0x00, 0x01, 0x04, 0x05, 0x10, 0x11, 0x14, 0x15 };
+	return spread[x] | (spread[y] << 1);
+}
+
+const vec4& MipTexture::Level::fetch(int x, int y) const
+{
+	const int tile = (y / tile_size) * tiles_x + (x / tile_size);
+	return texels[tile * tile_texels + morton(x % tile_size, y % tile_size)];
+}
+
+vec4& MipTexture::Level::fetch(int x, int y)
+{
+	const int tile = (y / tile_size) * tiles_x + (x / tile_size);
+	return texels[tile * tile_texels + morton(x % tile_size, y % tile_size)];
+}
+
+void MipTexture::allocate(Level& level, int width, int height)
+{
+	level.width = width;
+	level.height = height;
+	level.tiles_x = (width + tile_size - 1) / tile_size;
+	const int tiles_y = (height + tile_size - 1) / tile_size;
+	level.texels.assign(size_t(level.tiles_x) * tiles_y * tile_texels, vec4(0.0f));
+}
+
+void MipTexture::build(const labhelper::Texture& texture, bool srgb)
+{
+	static float srgb_to_linear[256];
+	static float unorm_to_float[256];
+	static bool tables_initialized = false;
+	if(!tables_initialized)
+	{
+		for(int i = 0; i < 256; i++)
+		{
+			float c = float(i) / 255.0f;
+			unorm_to_float[i] = c;
+			srgb_to_linear[i] = c <= 0.04045f ? c / 12.92f : pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		tables_initialized = true;
+	}
+	const float* color_table = srgb ? srgb_to_linear : unorm_to_float;
+
+	levels.clear();
+	levels.emplace_back();
+	allocate(levels[0], texture.width, texture.height);
+	const int n = texture.n_components;
+	for(int y = 0; y < texture.height; y++)
+	{
+		for(int x = 0; x < texture.width; x++)
+		{
+			const uint8_t* t = &texture.data[(size_t(y) * texture.width + x) * n];
+			vec4 c;
+			if(n >= 3)
+			{
+				c = vec4(color_table[t[0]], color_table[t[1]], color_table[t[2]],
+				         n == 4 ? unorm_to_float[t[3]] : 1.0f);
+			}
+			else
+			{
+				c = vec4(vec3(color_table[t[0]]), 1.0f);
+			}
+			levels[0].fetch(x, y) = c;
+		}
+	}
+
+	// Box filter down to 1x1. Odd sizes just drop the last row or column.
+	while(levels.back().width > 1 || levels.back().height > 1)
+	{
+		const Level& src = levels.back();
+		Level dst;
+		allocate(dst, std::max(src.width / 2, 1), std::max(src.height / 2, 1));
+		for(int y = 0; y < dst.height; y++)
+		{
+			const int y0 = std::min(2 * y, src.height - 1), y1 = std::min(2 * y + 1, src.height - 1);
+			for(int x = 0; x < dst.width; x++)
+			{
+				const int x0 = std::min(2 * x, src.width - 1), x1 = std::min(2 * x + 1, src.width - 1);
+				dst.fetch(x, y) =
+				    0.25f * (src.fetch(x0, y0) + src.fetch(x1, y0) + src.fetch(x0, y1) + src.fetch(x1, y1));
+			}
+		}
+		levels.push_back(std::move(dst));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Bilinear lookup with repeat wrapping. Texel centers are at half integers.
+///////////////////////////////////////////////////////////////////////////////
+vec4 MipTexture::bilinear(const Level& level, vec2 uv) const
+{
+	float x = uv.x * level.width - 0.5f;
+	float y = uv.y * level.height - 0.5f;
+	float fx = floor(x), fy = floor(y);
+	float tx = x - fx, ty = y - fy;
+	int x0 = int(fx) % level.width;
+	int y0 = int(fy) % level.height;
+	if(x0 < 0)
+		x0 += level.width;
+	if(y0 < 0)
+		y0 += level.height;
+	int x1 = x0 + 1 == level.width ? 0 : x0 + 1;
+	int y1 = y0 + 1 == level.height ? 0 : y0 + 1;
+	return mix(mix(level.fetch(x0, y0), level.fetch(x1, y0), tx),
+	           mix(level.fetch(x0, y1), level.fetch(x1, y1), tx), ty);
+}
+
+vec4 MipTexture::sample(vec2 uv, float lod) const
+{
+	// Keep the coordinates small so that the float to int conversion in
+	// bilinear() can't overflow
+	uv = uv - floor(uv);
+	lod = clamp(lod, 0.0f, float(levels.size() - 1));
+	int level = int(lod);
+	float t = lod - float(level);
+	if(t == 0.0f)
+	{
+		return bilinear(levels[level], uv);
+	}
+	return mix(bilinear(levels[level], uv), bilinear(levels[level + 1], uv), t);
+}
+
+vec4 MipTexture::sample(vec2 uv, vec2 duvdx, vec2 duvdy) const
+{
+	const vec2 size = vec2(levels[0].width, levels[0].height);
+	float width = std::max(length(duvdx * size), length(duvdy * size));
+	float lod = width > 1.0f ? log2(width) : 0.0f;
+	return sample(uv, lod);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The converted textures. Filled in while the scene is set up, and only read
+// while rendering.
+///////////////////////////////////////////////////////////////////////////////
+static unordered_map<const labhelper::Texture*, MipTexture> mip_textures;
+
+static void convertTexture(const labhelper::Texture& texture, bool srgb)
+{
+	if(!texture.valid || texture.data == nullptr || mip_textures.count(&texture) != 0)
+	{
+		return;
+	}
+	mip_textures[&texture].build(texture, srgb);
+}
+
+void convertTextures(const labhelper::Model* model)
+{
+	for(auto& material : model->m_materials)
+	{
+		convertTexture(material.m_color_texture, true);
+		convertTexture(material.m_emission_texture, true);
+		convertTexture(material.m_shininess_texture, false);
+		convertTexture(material.m_metalness_texture, false);
+		convertTexture(material.m_fresnel_texture, false);
+	}
+}
+
+void releaseTextures(const labhelper::Model* model)
+{
+	for(auto& material : model->m_materials)
+	{
+		mip_textures.erase(&material.m_color_texture);
+		mip_textures.erase(&material.m_emission_texture);
+		mip_textures.erase(&material.m_shininess_texture);
+		mip_textures.erase(&material.m_metalness_texture);
+		mip_textures.erase(&material.m_fresnel_texture);
+	}
+}
+
+const MipTexture* getMipTexture(const labhelper::Texture& texture)
+{
+	if(!texture.valid)
+	{
+		return nullptr;
+	}
+	auto it = mip_textures.find(&texture);
+	return it == mip_textures.end() ? nullptr : &it->second;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Intersect the offset rays with the tangent plane at the hit, and express
+// the offsets of the hit points in uv through a least squares fit to the
+// triangle's dpdu and dpdv.
+///////////////////////////////////////////////////////////////////////////////
+void computeTextureFootprint(const Ray& ray, const RayDifferential& differential, Intersection& hit)
+{
+	hit.duvdx = vec2(0.0f);
+	hit.duvdy = vec2(0.0f);
+	if(!differential.valid)
+	{
+		return;
+	}
+	const vec3 n = hit.geometry_normal;
+	const float plane_d = dot(n, hit.position);
+	const vec3 ox = ray.o + differential.dodx, dx = ray.d + differential.dddx;
+	const vec3 oy = ray.o + differential.dody, dy = ray.d + differential.dddy;
+	const float ndx = dot(n, dx), ndy = dot(n, dy);
+	if(abs(ndx) < 1e-8f || abs(ndy) < 1e-8f)
+	{
+		return;
+	}
+	const vec3 dpdx = ox + ((plane_d - dot(n, ox)) / ndx) * dx - hit.position;
+	const vec3 dpdy = oy + ((plane_d - dot(n, oy)) / ndy) * dy - hit.position;
+
+	const float a00 = dot(hit.dpdu, hit.dpdu), a01 = dot(hit.dpdu, hit.dpdv), a11 = dot(hit.dpdv, hit.dpdv);
+	const float det = a00 * a11 - a01 * a01;
+	if(abs(det) < 1e-12f)
+	{
+		return;
+	}
+	const float inv_det = 1.0f / det;
+	const float bx0 = dot(hit.dpdu, dpdx), bx1 = dot(hit.dpdv, dpdx);
+	const float by0 = dot(hit.dpdu, dpdy), by1 = dot(hit.dpdv, dpdy);
+	hit.duvdx = inv_det * vec2(a11 * bx0 - a01 * bx1, a00 * bx1 - a01 * bx0);
+	hit.duvdy = inv_det * vec2(a11 * by0 - a01 * by1, a00 * by1 - a01 * by0);
+}
+
+vec3 materialColor(const Intersection& hit)
+{
+	const MipTexture* texture = getMipTexture(hit.material->m_color_texture);
+	if(texture)
+	{
+		return vec3(texture->sample(hit.uv, hit.duvdx, hit.duvdy));
+	}
+	return hit.material->m_color;
+}
+
+vec3 materialEmission(const Intersection& hit)
+{
+	const MipTexture* texture = getMipTexture(hit.material->m_emission_texture);
+	if(texture)
+	{
+		return vec3(texture->sample(hit.uv, hit.duvdx, hit.duvdy));
+	}
+	return hit.material->m_emission;
+}
+
+float materialMetalness(const Intersection& hit)
+{
+	const MipTexture* texture = getMipTexture(hit.material->m_metalness_texture);
+	if(texture)
+	{
+		return texture->sample(hit.uv, hit.duvdx, hit.duvdy).x;
+	}
+	return hit.material->m_metalness;
+}
+
+float materialFresnel(const Intersection& hit)
+{
+	const MipTexture* texture = getMipTexture(hit.material->m_fresnel_texture);
+	if(texture)
+	{
+		return texture->sample(hit.uv, hit.duvdx, hit.duvdy).x;
+	}
+	return hit.material->m_fresnel;
+}
+} // namespace pathtracer
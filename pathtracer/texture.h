@@ -0,0 +1,101 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <Model.h>
+#include "embree.h"
+
+using namespace glm;
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////////
+// Textures for the pathtracer
+//
+// The 8-bit textures loaded by labhelper are converted once to linear float,
+// with a mip pyramid built on the CPU. Each level is stored in 8x8 texel
+// tiles with the texels of a tile in Morton order, so that the four texels
+// of a bilinear lookup are almost always in the same one or two cache lines.
+///////////////////////////////////////////////////////////////////////////////
+class MipTexture
+{
+public:
+	///////////////////////////////////////////////////////////////////////
+	/// Convert a loaded texture. Color textures are stored as sRGB and are
+	/// converted to linear.
+	///////////////////////////////////////////////////////////////////////
+	void build(const labhelper::Texture& texture, bool srgb);
+
+	///////////////////////////////////////////////////////////////////////
+	/// Trilinear lookup, where `lod` is the mip level (0 = full resolution)
+	///////////////////////////////////////////////////////////////////////
+	vec4 sample(vec2 uv, float lod) const;
+
+	///////////////////////////////////////////////////////////////////////
+	/// Trilinear lookup with the level chosen from the change of uv over
+	/// one pixel
+	///////////////////////////////////////////////////////////////////////
+	vec4 sample(vec2 uv, vec2 duvdx, vec2 duvdy) const;
+
+	int numberOfLevels() const
+	{
+		return int(levels.size());
+	}
+
+private:
+	struct Level
+	{
+		int width, height;
+		int tiles_x;
+		std::vector<vec4> texels;
+		const vec4& fetch(int x, int y) const;
+		vec4& fetch(int x, int y);
+	};
+	static void allocate(Level& level, int width, int height);
+	vec4 bilinear(const Level& level, vec2 uv) const;
+
+	std::vector<Level> levels;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Convert the textures of a model. Called when a model is added to the
+/// scene. Each texture is only converted the first time.
+///////////////////////////////////////////////////////////////////////////
+void convertTextures(const labhelper::Model* model);
+
+///////////////////////////////////////////////////////////////////////////
+/// Throw away the converted textures of a model. Must be called before the
+/// model is freed, as they are looked up by the address of the texture.
+///////////////////////////////////////////////////////////////////////////
+void releaseTextures(const labhelper::Model* model);
+
+///////////////////////////////////////////////////////////////////////////
+/// The converted version of a texture, or nullptr if it is not valid
+///////////////////////////////////////////////////////////////////////////
+const MipTexture* getMipTexture(const labhelper::Texture& texture);
+
+///////////////////////////////////////////////////////////////////////////
+/// Offsets of the rays through the next pixel in x and y, relative to the
+/// ray through the current one. Used to estimate the footprint of a pixel
+/// on the surface it hits.
+///////////////////////////////////////////////////////////////////////////
+struct RayDifferential
+{
+	bool valid = false;
+	vec3 dodx, dddx;
+	vec3 dody, dddy;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Set hit.duvdx and hit.duvdy from the differentials of the ray that hit.
+/// Leaves them at zero (full resolution lookups) if there are none.
+///////////////////////////////////////////////////////////////////////////
+void computeTextureFootprint(const Ray& ray, const RayDifferential& differential, Intersection& hit);
+
+///////////////////////////////////////////////////////////////////////////
+/// The material's parameters, from its textures if it has them
+///////////////////////////////////////////////////////////////////////////
+vec3 materialColor(const Intersection& hit);
+vec3 materialEmission(const Intersection& hit);
+float materialMetalness(const Intersection& hit);
+float materialFresnel(const Intersection& hit);
+} // namespace pathtracer
@@ -0,0 +1,206 @@
+#include "validation.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include "material.h"
+#include "sampling.h"
+#include "labhelper.h"
+
+using namespace std;
+using namespace glm;
+
+namespace pathtracer
+{
+// Bins over the sphere in cos(theta) and phi, around the normal
+const int theta_bins = 16;
+const int phi_bins = 32;
+// Subdivisions per bin and axis when integrating the pdf
+const int bin_subdivisions = 16;
+
+///////////////////////////////////////////////////////////////////////////////
+// Probability that a chi-square variable with `dof` degrees of freedom is at
+// least `chi2`, using the Wilson-Hilferty normal approximation
+///////////////////////////////////////////////////////////////////////////////
+static float chiSquarePValue(double chi2, int dof)
+{
+	if(dof <= 0)
+	{
+		return 1.0f;
+	}
+	const double k = double(dof);
+	const double z = (pow(chi2 / k, 1.0 / 3.0) - (1.0 - 2.0 / (9.0 * k))) / sqrt(2.0 / (9.0 * k));
+	return float(0.5 * erfc(z / sqrt(2.0)));
+}
+
+static vec3 sphericalDirection(const mat3& frame, float cos_theta, float phi)
+{
+	const float sin_theta = sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+	return frame * vec3(sin_theta * cos(phi), sin_theta * sin(phi), cos_theta);
+}
+
+template<typename Material>
+static MaterialTestResult testMaterial(const string& name, const Material& material, const vec3& wo, const vec3& n, int samples)
+{
+	MaterialTestResult result;
+	result.name = name;
+	seedRandom(0, 0);
+	const mat3 frame = labhelper::tangentSpace(n);
+
+	///////////////////////////////////////////////////////////////////////
+	// Importance sampled albedo, and the histogram of sampled directions
+	///////////////////////////////////////////////////////////////////////
+	vector<double> observed(theta_bins * phi_bins, 0.0);
+	double sum = 0.0, sum2 = 0.0;
+	int kept = 0;
+	for(int i = 0; i < samples; i++)
+	{
+		WiSample s = material.sample_wi(wo, n);
+		if(s.pdf <= 0.0f)
+		{
+			continue;
+		}
+		kept++;
+		double v = s.f.x * abs(dot(s.wi, n)) / s.pdf;
+		sum += v;
+		sum2 += v * v;
+
+		vec3 local = transpose(frame) * s.wi;
+		float phi = atan2(local.y, local.x);
+		if(phi < 0.0f)
+			phi += 2.0f * M_PI;
+		int t = std::min(int((clamp(local.z, -1.0f, 1.0f) + 1.0f) * 0.5f * theta_bins), theta_bins - 1);
+		int p = std::min(int(phi / (2.0f * M_PI) * phi_bins), phi_bins - 1);
+		observed[t * phi_bins + p] += 1.0;
+	}
+	result.albedo_importance = float(sum / samples);
+	result.kept_fraction = float(kept) / float(samples);
+	const double importance_error = sqrt(std::max(0.0, sum2 / samples - (sum / samples) * (sum / samples)) / samples);
+
+	///////////////////////////////////////////////////////////////////////
+	// Albedo with uniformly distributed directions
+	///////////////////////////////////////////////////////////////////////
+	sum = sum2 = 0.0;
+	for(int i = 0; i < samples; i++)
+	{
+		vec3 wi = sphericalDirection(frame, 1.0f - 2.0f * randf(), 2.0f * M_PI * randf());
+		double v = material.f(wi, wo, n).x * abs(dot(wi, n)) * (4.0 * M_PI);
+		sum += v;
+		sum2 += v * v;
+	}
+	result.albedo_uniform = float(sum / samples);
+	const double uniform_error = sqrt(std::max(0.0, sum2 / samples - (sum / samples) * (sum / samples)) / samples);
+
+	///////////////////////////////////////////////////////////////////////
+	// Integrate the pdf over each bin, and pool the bins that are expected
+	// to get too few samples for the test to be meaningful
+	///////////////////////////////////////////////////////////////////////
+	vector<double> expected(theta_bins * phi_bins, 0.0);
+	const double d_cos = 2.0 / (theta_bins * bin_subdivisions);
+	const double d_phi = 2.0 * M_PI / (phi_bins * bin_subdivisions);
+	double pdf_integral = 0.0;
+	for(int t = 0; t < theta_bins; t++)
+	{
+		for(int p = 0; p < phi_bins; p++)
+		{
+			double integral = 0.0;
+			for(int i = 0; i < bin_subdivisions; i++)
+			{
+				for(int j = 0; j < bin_subdivisions; j++)
+				{
+					float cos_theta = float(-1.0 + (t * bin_subdivisions + i + 0.5) * d_cos);
+					float phi = float((p * bin_subdivisions + j + 0.5) * d_phi);
+					integral += material.pdf(sphericalDirection(frame, cos_theta, phi), wo, n);
+				}
+			}
+			integral *= d_cos * d_phi;
+			pdf_integral += integral;
+			expected[t * phi_bins + p] = integral * samples;
+		}
+	}
+	result.pdf_integral = float(pdf_integral);
+
+	double chi2 = 0.0, pooled_observed = 0.0, pooled_expected = 0.0;
+	int dof = -1;
+	for(size_t i = 0; i < expected.size(); i++)
+	{
+		if(expected[i] < 5.0)
+		{
+			pooled_observed += observed[i];
+			pooled_expected += expected[i];
+			continue;
+		}
+		chi2 += (observed[i] - expected[i]) * (observed[i] - expected[i]) / expected[i];
+		dof++;
+	}
+	if(pooled_expected >= 5.0)
+	{
+		chi2 += (pooled_observed - pooled_expected) * (pooled_observed - pooled_expected) / pooled_expected;
+		dof++;
+	}
+	result.chi_square_p_value = chiSquarePValue(chi2, dof);
+
+	///////////////////////////////////////////////////////////////////////
+	// The albedo estimates are allowed to differ by five standard errors.
+	// Samples that sample_wi() rejects (pdf 0) are not part of pdf(), so
+	// the pdf has to integrate to the fraction that was kept.
+	///////////////////////////////////////////////////////////////////////
+	const double albedo_tolerance = 5.0 * sqrt(importance_error * importance_error + uniform_error * uniform_error) + 1e-3;
+	const bool albedo_agrees = abs(result.albedo_importance - result.albedo_uniform) <= albedo_tolerance;
+	const bool pdf_normalized = abs(result.pdf_integral - result.kept_fraction) < 0.01f && result.pdf_integral < 1.01f;
+	result.energy_conserving = result.albedo_importance <= 1.0 + albedo_tolerance;
+	result.passed = albedo_agrees && pdf_normalized && result.chi_square_p_value > 1e-3f;
+	return result;
+}
+
+static string describe(const string& material, float shininess, float cos_theta_o)
+{
+	ostringstream s;
+	s << material << " (s=" << shininess << ", cos wo=" << cos_theta_o << ")";
+	return s.str();
+}
+
+std::vector<MaterialTestResult> validateMaterials(int samples)
+{
+	std::vector<MaterialTestResult> results;
+	// A tilted normal, so that the tangent frames get tested as well
+	const vec3 n = normalize(vec3(0.3f, 0.9f, 0.2f));
+	const mat3 frame = labhelper::tangentSpace(n);
+	const vec3 white(1.0f);
+
+	for(float cos_theta_o : { 0.9f, 0.5f, 0.2f })
+	{
+		const vec3 wo = sphericalDirection(frame, cos_theta_o, 0.7f);
+		Diffuse diffuse(white);
+		results.push_back(testMaterial(describe("Diffuse", 0.0f, cos_theta_o), diffuse, wo, n, samples));
+		for(float shininess : { 1.0f, 10.0f, 100.0f })
+		{
+			MicrofacetBRDF microfacet(shininess);
+			DielectricBSDF dielectric(&microfacet, &diffuse, 0.04f);
+			MetalBSDF metal(&microfacet, white, 0.9f);
+			BSDFLinearBlend blend(0.5f, &metal, &dielectric);
+			results.push_back(
+			    testMaterial(describe("Microfacet", shininess, cos_theta_o), microfacet, wo, n, samples));
+			results.push_back(
+			    testMaterial(describe("Dielectric", shininess, cos_theta_o), dielectric, wo, n, samples));
+			results.push_back(testMaterial(describe("Metal", shininess, cos_theta_o), metal, wo, n, samples));
+			results.push_back(testMaterial(describe("Blend", shininess, cos_theta_o), blend, wo, n, samples));
+		}
+	}
+
+	int failed = 0;
+	cout << "Material validation (" << samples << " samples per test):\n";
+	for(const auto& r : results)
+	{
+		cout << (r.passed ? "  pass " : "  FAIL ") << std::left << std::setw(40) << r.name << std::right
+		     << " albedo " << std::fixed << std::setprecision(4) << r.albedo_importance << " vs "
+		     << r.albedo_uniform << ", pdf integral " << r.pdf_integral << " (kept " << r.kept_fraction
+		     << "), chi2 p " << r.chi_square_p_value << (r.energy_conserving ? "" : ", gains energy") << "\n";
+		cout.unsetf(std::ios::floatfield);
+		failed += r.passed ? 0 : 1;
+	}
+	cout << (results.size() - failed) << "/" << results.size() << " passed.\n";
+	return results;
+}
+} // namespace pathtracer
@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <vector>
+
+namespace pathtracer
+{
+///////////////////////////////////////////////////////////////////////////////
+// Checks that each material's sample_wi(), pdf() and f() agree.
+//
+// White furnace: the albedo of a white material, integral of f * |cos|,
+// is estimated once by importance sampling and once with uniform
+// directions. The two estimates have to agree. An albedo above one is
+// reported, but is a property of the material model rather than an error
+// in the sampling, so it does not fail the test.
+//
+// Chi-square: the directions returned by sample_wi() are binned over the
+// sphere and compared against pdf() integrated over each bin.
+///////////////////////////////////////////////////////////////////////////////
+struct MaterialTestResult
+{
+	std::string name;
+	float albedo_importance = 0.0f;
+	float albedo_uniform = 0.0f;
+	// Integral of pdf() over the sphere, and the fraction of the samples
+	// from sample_wi() with a nonzero pdf. These should be equal.
+	float pdf_integral = 0.0f;
+	float kept_fraction = 0.0f;
+	float chi_square_p_value = 0.0f;
+	bool energy_conserving = false;
+	bool passed = false;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Run the tests for a few configurations of every material, and print
+/// the results. `samples` directions are drawn per test.
+///////////////////////////////////////////////////////////////////////////
+std::vector<MaterialTestResult> validateMaterials(int samples = 1 << 18);
+} // namespace pathtracer
@@ -1,25 +1,63 @@
 #include "heightfield.h"
 
+#include <algorithm>
+#include <cfloat>
 #include <iostream>
 #include <stdint.h>
 #include <vector>
 #include <glm/glm.hpp>
 #include <stb_image.h>
+#include <labhelper.h>
+#include <Parallel.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HEIGHTFIELD_SSE 1
+#include <emmintrin.h>
+#endif
 
 using namespace glm;
 using std::string;
 
+// Bytes of a texture with its full mipmap chain
+static size_t mipmappedTextureBytes(int width, int height, size_t bytesPerTexel)
+{
+	size_t bytes = 0;
+	for (;;)
+	{
+		bytes += size_t(width) * height * bytesPerTexel;
+		if (width == 1 && height == 1)
+		{
+			return bytes;
+		}
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+}
+
 HeightField::HeightField(void)
 	: m_meshResolution(0)
 	, m_vao(UINT32_MAX)
-	, m_positionBuffer(UINT32_MAX)
-	, m_uvBuffer(UINT32_MAX)
 	, m_indexBuffer(UINT32_MAX)
 	, m_numIndices(0)
+	, m_nodeBuffer(UINT32_MAX)
 	, m_texid_hf(UINT32_MAX)
 	, m_texid_diffuse(UINT32_MAX)
+	, m_texid_normals(UINT32_MAX)
 	, m_heightFieldPath("")
 	, m_diffuseTexturePath("")
+	, m_width(0)
+	, m_height(0)
+	, m_heightScale(10.0f)
+	, m_numLevels(0)
+	, m_numLeafNodes(0)
+	, m_lodDistance(20.0f)
+	, m_minLodDistance(1.0f)
+	, m_maxLodDistance(100.0f)
+	, m_triangleBudget(300000)
+	, m_numTriangles(0)
+	, m_meshBytes(0)
+	, m_nodeBytes(0)
+	, m_textureBytes(0)
 {
 }
 
@@ -46,6 +84,15 @@ void HeightField::loadHeightField(const std::string& heigtFieldPath)
 
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, data); // just one component (float)
 	glGenerateMipmap(GL_TEXTURE_2D); // generate mipmaps
+	m_textureBytes += mipmappedTextureBytes(width, height, sizeof(float));
+
+	// keep the heights for sampling on the CPU
+	m_heights.assign(data, data + size_t(width) * height);
+	m_width = width;
+	m_height = height;
+	stbi_image_free(data);
+	buildNodeHeights();
+	buildNormalMap();
 
 	m_heightFieldPath = heigtFieldPath;
 	std::cout << "Successfully loaded heigh field texture: " << heigtFieldPath << ".\n";
@@ -75,6 +122,7 @@ void HeightField::loadDiffuseTexture(const std::string& diffusePath)
 
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data); // plain RGB
 	glGenerateMipmap(GL_TEXTURE_2D);
+	m_textureBytes += mipmappedTextureBytes(width, height, 4); // drivers pad RGB8 to four bytes
 
 	std::cout << "Successfully loaded diffuse texture: " << diffusePath << ".\n";
 }
@@ -82,115 +130,448 @@ void HeightField::loadDiffuseTexture(const std::string& diffusePath)
 
 void HeightField::generateMesh(int tesselation)
 {
-	// Step 1: generate a mesh in range -1 to 1 in x and z
-	// (y is 0 but will be altered in height field vertex shader)
-	// number of triangles determined by tesselation 
-	std::vector<glm::vec3> positions;
-	std::vector<glm::vec2> uvs;
-	std::vector<GLuint> indices;
-
-	float step = 2.0f / tesselation; // step size to cover [-1, 1]
-
-	for (int z = 0; z <= tesselation; ++z) {
-		for (int x = 0; x <= tesselation; ++x) {
-
-			/// MESH DEFINITION
-			// Position: Range [-1, 1] for x and z
-			float px = -1.0f + x * step;
-			float pz = -1.0f + z * step;
-			positions.emplace_back(glm::vec3(px, 0.0f, pz));
-
-
-			// Texture coordinates: Range [0, 1] for u and v
-			float u = float(x) / tesselation;
-			float v = float(z) / tesselation;
-			uvs.emplace_back(glm::vec2(u, v));
-
-			// indices for triangle mesh
-			if (x < tesselation && z < tesselation) {
-				GLuint topLeft = z * (tesselation + 1) + x;
-				GLuint topRight = topLeft + 1;
-				GLuint bottomLeft = topLeft + (tesselation + 1);
-				GLuint bottomRight = bottomLeft + 1;
-
-				indices.insert(indices.end(), { topLeft, bottomLeft, topRight, topRight, bottomLeft, bottomRight });
+	// The patch is a grid of tesselation x tesselation quads. It has no
+	// vertices of its own: heightfield.vert turns the index of a vertex into
+	// its grid coordinates, and maps them into the node it draws. The indices
+	// are 16-bit, so the grid can have at most 255 x 255 vertices, and
+	// 0xffff is left for restarting the strips.
+	m_meshResolution = glm::clamp(tesselation & ~1, 2, 254);
+	const int size = m_meshResolution + 1;
+
+	// The triangles of each quadrant are kept together, so that a node can be
+	// drawn in part where its children take over the rest. Each row of quads
+	// is one strip, going down and right from the top left corner, with the
+	// same triangles and winding as two triangles per quad.
+	const int half = m_meshResolution / 2;
+	std::vector<GLushort> indices;
+	for (int quadrant = 0; quadrant < 4; ++quadrant)
+	{
+		const int x0 = (quadrant & 1) * half;
+		const int z0 = (quadrant >> 1) * half;
+		for (int z = z0; z < z0 + half; ++z)
+		{
+			for (int x = x0; x <= x0 + half; ++x)
+			{
+				indices.push_back(GLushort(z * size + x));
+				indices.push_back(GLushort((z + 1) * size + x));
 			}
+			indices.push_back(UINT16_MAX);
 		}
 	}
 
-	// Step 2: Send data to OpenGL buffers
+	// Send data to OpenGL buffers
 	glGenVertexArrays(1, &m_vao);
 	glBindVertexArray(m_vao);
 
-	// Positions
-	glGenBuffers(1, &m_positionBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, m_positionBuffer);
-	glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-	glEnableVertexAttribArray(0);
-
-	// Texture coordinates
-	glGenBuffers(1, &m_uvBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, m_uvBuffer);
-	glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(glm::vec2), uvs.data(), GL_STATIC_DRAW);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
-	glEnableVertexAttribArray(2);
+	// One node per instance, filled in by submitTriangles()
+	glGenBuffers(1, &m_nodeBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, m_nodeBuffer);
+	glVertexAttribPointer(3, 4, GL_UNSIGNED_SHORT, GL_FALSE, 0, nullptr);
+	glEnableVertexAttribArray(3);
+	glVertexAttribDivisor(3, 1);
 
 	// Indices
 	glGenBuffers(1, &m_indexBuffer);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
 
 	m_numIndices = indices.size();
+	m_meshBytes = indices.size() * sizeof(GLushort);
 
 	// Unbind VAO
 	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
+	buildNodeHeights();
 }
 
-void HeightField::submitTriangles(void)
+// The normal (-slopeX, 1, -slopeZ) on the octahedron |x| + |y| + |z| = 1,
+// seen from above: x and z of the normal scaled by 1 / (|x| + |y| + |z|).
+// The normals of a height field all point up, so the lower half of the
+// octahedron, that would be folded over the corners, is never needed.
+static glm::i16vec2 encodeNormal(float slopeX, float slopeZ)
 {
+	const float scale = 32767.0f / (std::abs(slopeX) + 1.0f + std::abs(slopeZ));
+	return glm::i16vec2(int16_t(std::lround(-slopeX * scale)), int16_t(std::lround(-slopeZ * scale)));
+}
 
-	// Step 3: Bind VAO and draw
-	glBindVertexArray(m_vao);
-	glDrawElements(GL_TRIANGLES, m_numIndices, GL_UNSIGNED_INT, 0);
+static glm::vec3 decodeNormal(glm::vec2 encoded)
+{
+	glm::vec3 normal(encoded.x, 1.0f - std::abs(encoded.x) - std::abs(encoded.y), encoded.y);
+	if (normal.y < 0.0f)
+	{
+		const glm::vec2 folded = (1.0f - glm::abs(glm::vec2(normal.z, normal.x))) * glm::sign(glm::vec2(normal.x, normal.z));
+		normal.x = folded.x;
+		normal.z = folded.y;
+	}
+	return glm::normalize(normal);
+}
 
-	glBindVertexArray(0);
+// The normals of the height map, once, for heightfield.vert and the CPU.
+// Slopes are central differences over about a thousandth of the map, like
+// the shader used to take them, which also smooths out the 8-bit steps of
+// the height map. Rows are split between threads, and four texels of a row
+// are done at a time with SSE.
+void HeightField::buildNormalMap()
+{
+	m_normals.clear();
+	if (m_heights.empty())
+	{
+		return;
+	}
+	const int stepX = std::max(1, int(m_width * 0.001f + 0.5f));
+	const int stepZ = std::max(1, int(m_height * 0.001f + 0.5f));
+	// The mesh spans 2 in x and z across the map
+	const float scaleX = m_heightScale * m_width / (2.0f * 2.0f * stepX);
+	const float scaleZ = m_heightScale * m_height / (2.0f * 2.0f * stepZ);
+	m_normals.resize(m_heights.size());
+
+	const int threads = labhelper::numberOfThreads(size_t(m_height), 64);
+	labhelper::parallelFor(threads, [&](int thread) {
+		for (int z = thread; z < m_height; z += threads)
+		{
+			const float* row = &m_heights[size_t(z) * m_width];
+			const float* below = &m_heights[size_t(std::max(z - stepZ, 0)) * m_width];
+			const float* above = &m_heights[size_t(std::min(z + stepZ, m_height - 1)) * m_width];
+			glm::i16vec2* normals = &m_normals[size_t(z) * m_width];
+			auto scalar = [&](int x) {
+				const float left = row[std::max(x - stepX, 0)];
+				const float right = row[std::min(x + stepX, m_width - 1)];
+				normals[x] = encodeNormal((right - left) * scaleX, (above[x] - below[x]) * scaleZ);
+			};
+
+			int x = 0;
+			for (; x < std::min(stepX, m_width); ++x)
+			{
+				scalar(x);
+			}
+#ifdef HEIGHTFIELD_SSE
+			// Away from the edges, the same as encodeNormal() for four texels
+			const __m128 signMask = _mm_set1_ps(-0.0f);
+			const __m128 one = _mm_set1_ps(1.0f);
+			for (; x + 4 + stepX <= m_width; x += 4)
+			{
+				const __m128 slopeX = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(row + x + stepX), _mm_loadu_ps(row + x - stepX)),
+				                                 _mm_set1_ps(scaleX));
+				const __m128 slopeZ = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(above + x), _mm_loadu_ps(below + x)),
+				                                 _mm_set1_ps(scaleZ));
+				const __m128 length = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(signMask, slopeX), one),
+				                                 _mm_andnot_ps(signMask, slopeZ));
+				const __m128 scale = _mm_div_ps(_mm_set1_ps(-32767.0f), length);
+				const __m128i encodedX = _mm_cvtps_epi32(_mm_mul_ps(slopeX, scale));
+				const __m128i encodedZ = _mm_cvtps_epi32(_mm_mul_ps(slopeZ, scale));
+				// x0 z0 x1 z1 x2 z2 x3 z3
+				const __m128i encoded =
+				    _mm_unpacklo_epi16(_mm_packs_epi32(encodedX, encodedX), _mm_packs_epi32(encodedZ, encodedZ));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(normals + x), encoded);
+			}
+#endif
+			for (; x < m_width; ++x)
+			{
+				scalar(x);
+			}
+		}
+	});
+
+	if (m_texid_normals == UINT32_MAX)
+	{
+		glGenTextures(1, &m_texid_normals);
+	}
+	glBindTexture(GL_TEXTURE_2D, m_texid_normals);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); // the vertex shader only reads level 0
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16_SNORM, m_width, m_height, 0, GL_RG, GL_SHORT, m_normals.data());
+	m_textureBytes += m_normals.size() * sizeof(glm::i16vec2);
 }
 
-// Get height at a given point - USED FOR TREE PLACEMENT
-float HeightField::sampleHeightAt(float u, float v) const
+// The smallest and largest height under each node of the quadtree, for
+// their bounding boxes
+void HeightField::buildNodeHeights()
 {
-	// u,v should be within [0, 1]
-	u = glm::clamp(u, 0.0f, 1.0f);
-	v = glm::clamp(v, 0.0f, 1.0f);
+	m_nodeHeights.clear();
+	if (m_heights.empty() || m_meshResolution == 0)
+	{
+		return;
+	}
 
-	// Bind the height map texture
-	glBindTexture(GL_TEXTURE_2D, m_texid_hf);
+	// Leaf nodes with about one patch vertex per texel, in a power of two
+	m_numLeafNodes = 1;
+	while (m_numLeafNodes * 2 * m_meshResolution <= std::max(m_width, m_height) && m_numLeafNodes < (1 << 14))
+	{
+		m_numLeafNodes *= 2;
+	}
+	m_numLevels = 1;
+	while ((1 << (m_numLevels - 1)) < m_numLeafNodes)
+	{
+		m_numLevels++;
+	}
 
-	// Get the texture dimensions
-	int width, height;
-	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
-	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+	// The texels of each leaf, with one more on each side for the filtering
+	m_nodeHeights.resize(m_numLevels);
+	std::vector<glm::vec2>& leaves = m_nodeHeights[0];
+	leaves.resize(size_t(m_numLeafNodes) * m_numLeafNodes);
+	for (int z = 0; z < m_numLeafNodes; ++z)
+	{
+		const int y0 = std::max(0, int(float(z) / m_numLeafNodes * m_height) - 1);
+		const int y1 = std::min(m_height - 1, int(float(z + 1) / m_numLeafNodes * m_height) + 1);
+		for (int x = 0; x < m_numLeafNodes; ++x)
+		{
+			const int x0 = std::max(0, int(float(x) / m_numLeafNodes * m_width) - 1);
+			const int x1 = std::min(m_width - 1, int(float(x + 1) / m_numLeafNodes * m_width) + 1);
+			glm::vec2 range(FLT_MAX, -FLT_MAX);
+			for (int y = y0; y <= y1; ++y)
+			{
+				const float* row = &m_heights[size_t(y) * m_width];
+				for (int i = x0; i <= x1; ++i)
+				{
+					range.x = std::min(range.x, row[i]);
+					range.y = std::max(range.y, row[i]);
+				}
+			}
+			leaves[size_t(z) * m_numLeafNodes + x] = range * m_heightScale;
+		}
+	}
 
-	// Calculate pixel indices
-	int x = static_cast<int>(u * (width - 1));
-	int y = static_cast<int>(v * (height - 1));
+	// Each node above covers its four children
+	for (int level = 1; level < m_numLevels; ++level)
+	{
+		const int n = m_numLeafNodes >> level;
+		const std::vector<glm::vec2>& children = m_nodeHeights[level - 1];
+		m_nodeHeights[level].resize(size_t(n) * n);
+		for (int z = 0; z < n; ++z)
+		{
+			for (int x = 0; x < n; ++x)
+			{
+				glm::vec2 range(FLT_MAX, -FLT_MAX);
+				for (int child = 0; child < 4; ++child)
+				{
+					const glm::vec2& c = children[size_t(2 * z + (child >> 1)) * (2 * n) + 2 * x + (child & 1)];
+					range = glm::vec2(std::min(range.x, c.x), std::max(range.y, c.y));
+				}
+				m_nodeHeights[level][size_t(z) * n + x] = range;
+			}
+		}
+	}
+}
 
-	// Read pixel data
-	std::vector<float> pixelData(width * height);
-	glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, pixelData.data());
+void HeightField::nodeBox(int level, int x, int z, const glm::mat4& modelMatrix, glm::vec3& boxMin,
+                          glm::vec3& boxMax) const
+{
+	const int n = m_numLeafNodes >> level;
+	const float size = 2.0f / n; // in model space, where the terrain spans [-1, 1]
+	const glm::vec2& heights = m_nodeHeights[level][size_t(z) * n + x];
+	labhelper::transformAABB(modelMatrix, glm::vec3(-1.0f + x * size, heights.x, -1.0f + z * size),
+	                         glm::vec3(-1.0f + (x + 1) * size, heights.y, -1.0f + (z + 1) * size), boxMin, boxMax);
+}
 
-	// Sample the height value
-	float rawHeight = pixelData[y * width + x];
+void HeightField::addNode(int level, int x, int z, int quadrant)
+{
+	m_selectedNodes[quadrant].emplace_back(x, z, level, 0);
+}
 
-	// Apply height scaling (consistent with shader)
-	const float heightScale = 10.0f;  // Match the shader's `heightScale` uniform for terrain
-	return rawHeight * heightScale;
+// Strugar's selection: returns false if the node is out of its range, and
+// left to its parent
+bool HeightField::selectNode(int level, int x, int z, const glm::mat4& modelMatrix, const glm::vec3& cameraPosition,
+                             const labhelper::Frustum& frustum)
+{
+	glm::vec3 boxMin, boxMax;
+	nodeBox(level, x, z, modelMatrix, boxMin, boxMax);
+	auto distanceToBox = [&](const glm::vec3& lo, const glm::vec3& hi) {
+		return glm::length(glm::max(glm::max(lo - cameraPosition, cameraPosition - hi), glm::vec3(0.0f)));
+	};
+	if (distanceToBox(boxMin, boxMax) > m_lodRanges[level])
+	{
+		return false;
+	}
+	if (!labhelper::intersects(frustum, boxMin, boxMax))
+	{
+		// out of view, but taken care of
+		return true;
+	}
+	if (level == 0 || distanceToBox(boxMin, boxMax) > m_lodRanges[level - 1])
+	{
+		for (int quadrant = 0; quadrant < 4; ++quadrant)
+		{
+			addNode(level, x, z, quadrant);
+		}
+		return true;
+	}
+
+	// the children in range draw themselves, and this node the rest
+	for (int quadrant = 0; quadrant < 4; ++quadrant)
+	{
+		if (!selectNode(level - 1, 2 * x + (quadrant & 1), 2 * z + (quadrant >> 1), modelMatrix, cameraPosition,
+		                frustum))
+		{
+			addNode(level, x, z, quadrant);
+		}
+	}
+	return true;
+}
+
+void HeightField::selectNodes(const glm::mat4& modelMatrix, const glm::vec3& cameraPosition,
+                              const labhelper::Frustum& frustum)
+{
+	for (std::vector<glm::u16vec4>& nodes : m_selectedNodes)
+	{
+		nodes.clear();
+	}
+	m_numTriangles = 0;
+	if (m_nodeHeights.empty())
+	{
+		return;
+	}
+
+	// A node can only morph into its parent in time if its range is well
+	// beyond its size, so the ranges start at twice the diagonal of a leaf
+	glm::vec3 leafMin, leafMax;
+	nodeBox(0, 0, 0, modelMatrix, leafMin, leafMax);
+	m_minLodDistance = 2.0f * glm::length(glm::vec2(leafMax.x - leafMin.x, leafMax.z - leafMin.z));
+	m_lodDistance = glm::clamp(m_lodDistance, m_minLodDistance, std::max(m_minLodDistance, m_maxLodDistance));
+
+	// the top level is always in range
+	m_lodRanges.resize(m_numLevels);
+	float range = m_lodDistance;
+	for (int level = 0; level < m_numLevels; ++level)
+	{
+		m_lodRanges[level] = level + 1 < m_numLevels ? range : FLT_MAX / 4.0f;
+		range *= 2.0f;
+	}
+	selectNode(m_numLevels - 1, 0, 0, modelMatrix, cameraPosition, frustum);
+
+	const size_t trianglesPerQuadrant = size_t(m_meshResolution / 2) * (m_meshResolution / 2) * 2;
+	for (const std::vector<glm::u16vec4>& nodes : m_selectedNodes)
+	{
+		m_numTriangles += nodes.size() * trianglesPerQuadrant;
+	}
+
+	// Move the ranges towards the triangle budget a little every frame, so
+	// that the detail follows the camera smoothly
+	if (m_numTriangles > size_t(m_triangleBudget))
+	{
+		m_lodDistance *= 0.95f;
+	}
+	else if (m_numTriangles < size_t(m_triangleBudget) * 8 / 10)
+	{
+		m_lodDistance *= 1.02f;
+	}
 }
 
+void HeightField::submitTriangles(GLuint program)
+{
+	// All quadrants in one buffer, one after the other
+	std::vector<glm::u16vec4> nodes;
+	for (const std::vector<glm::u16vec4>& quadrantNodes : m_selectedNodes)
+	{
+		nodes.insert(nodes.end(), quadrantNodes.begin(), quadrantNodes.end());
+	}
+	if (nodes.empty())
+	{
+		return;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, m_nodeBuffer);
+	glBufferData(GL_ARRAY_BUFFER, nodes.size() * sizeof(glm::u16vec4), nodes.data(), GL_STREAM_DRAW);
+	m_nodeBytes = std::max(m_nodeBytes, nodes.size() * sizeof(glm::u16vec4));
 
+	// Each level morphs into the next over the last third of its range
+	std::vector<glm::vec2> morphRanges(m_numLevels);
+	for (int level = 0; level < m_numLevels; ++level)
+	{
+		const float start = level > 0 ? m_lodRanges[level - 1] : 0.0f;
+		morphRanges[level] = glm::vec2(start + (m_lodRanges[level] - start) * 0.66f, m_lodRanges[level]);
+	}
+	static const char* const uniformNames[] = { "patchResolution", "leafNodesPerSide", "morphRanges" };
+	const GLint* uniforms = labhelper::getUniformLocations(program, uniformNames, 3);
+	glUniform1i(uniforms[0], m_meshResolution);
+	glUniform1f(uniforms[1], float(m_numLeafNodes));
+	glUniform2fv(uniforms[2], m_numLevels, &morphRanges[0].x);
+
+	// Bind VAO and draw the nodes with one call per quadrant. The base
+	// instance needs OpenGL 4.2, so the node attribute is moved instead.
+	// Restarting is only on while the terrain is drawn, since the 32-bit
+	// indices of the models would restart at vertex 0xffff too.
+	glBindVertexArray(m_vao);
+	glEnable(GL_PRIMITIVE_RESTART);
+	glPrimitiveRestartIndex(UINT16_MAX);
+	const GLsizei quadrantIndices = GLsizei(m_numIndices / 4);
+	size_t first = 0;
+	for (int quadrant = 0; quadrant < 4; ++quadrant)
+	{
+		const size_t count = m_selectedNodes[quadrant].size();
+		if (count == 0)
+		{
+			continue;
+		}
+		glVertexAttribPointer(3, 4, GL_UNSIGNED_SHORT, GL_FALSE, 0, (const void*)(first * sizeof(glm::u16vec4)));
+		glDrawElementsInstanced(GL_TRIANGLE_STRIP, quadrantIndices, GL_UNSIGNED_SHORT,
+		                        (const void*)(size_t(quadrant) * quadrantIndices * sizeof(GLushort)), GLsizei(count));
+		first += count;
+	}
+	glDisable(GL_PRIMITIVE_RESTART);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
+// Get height at a given point - USED FOR TREE PLACEMENT
+float HeightField::sampleHeightAt(float u, float v) const
+{
+	if (m_heights.empty())
+	{
+		return 0.0f;
+	}
 
+	// Bilinear filtering between the texel centers, clamped to the edge,
+	// like GL_LINEAR with GL_CLAMP_TO_EDGE
+	float x = glm::clamp(u * m_width - 0.5f, 0.0f, float(m_width - 1));
+	float y = glm::clamp(v * m_height - 0.5f, 0.0f, float(m_height - 1));
+	int x0 = int(x);
+	int y0 = int(y);
+	int x1 = glm::min(x0 + 1, m_width - 1);
+	int y1 = glm::min(y0 + 1, m_height - 1);
+	float fx = x - float(x0);
+	float fy = y - float(y0);
+
+	const float* row0 = &m_heights[size_t(y0) * m_width];
+	const float* row1 = &m_heights[size_t(y1) * m_width];
+	float bottom = row0[x0] + (row0[x1] - row0[x0]) * fx;
+	float top = row1[x0] + (row1[x1] - row1[x0]) * fx;
 
+	// Apply height scaling (consistent with shader)
+	return (bottom + (top - bottom) * fy) * m_heightScale;
+}
 
+void HeightField::sampleHeightsAt(const std::vector<glm::vec2>& uvs, std::vector<float>& heights) const
+{
+	heights.resize(uvs.size());
+	for (size_t i = 0; i < uvs.size(); i++)
+	{
+		heights[i] = sampleHeightAt(uvs[i].x, uvs[i].y);
+	}
+}
+
+glm::vec3 HeightField::sampleNormalAt(float u, float v) const
+{
+	if (m_normals.empty())
+	{
+		return glm::vec3(0.0f, 1.0f, 0.0f);
+	}
+
+	// Bilinear filtering of the encoded normals, as the texture unit does
+	float x = glm::clamp(u * m_width - 0.5f, 0.0f, float(m_width - 1));
+	float y = glm::clamp(v * m_height - 0.5f, 0.0f, float(m_height - 1));
+	int x0 = int(x);
+	int y0 = int(y);
+	int x1 = glm::min(x0 + 1, m_width - 1);
+	int y1 = glm::min(y0 + 1, m_height - 1);
+	float fx = x - float(x0);
+	float fy = y - float(y0);
+
+	const glm::i16vec2* row0 = &m_normals[size_t(y0) * m_width];
+	const glm::i16vec2* row1 = &m_normals[size_t(y1) * m_width];
+	glm::vec2 bottom = glm::mix(glm::vec2(row0[x0]), glm::vec2(row0[x1]), fx);
+	glm::vec2 top = glm::mix(glm::vec2(row1[x0]), glm::vec2(row1[x1]), fx);
+	return decodeNormal(glm::mix(bottom, top, fy) / 32767.0f);
+}
@@ -1,20 +1,64 @@
 #include <string>
+#include <vector>
 #include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <Culling.h>
 
+///////////////////////////////////////////////////////////////////////////////
+// The terrain is drawn with CDLOD (Strugar, "Continuous Distance-Dependent
+// Level of Detail for Rendering Heightmaps"): a quadtree of square nodes over
+// the height map, where every node is drawn with the same small patch mesh.
+// Nodes are picked by their distance to the camera, the farther the larger,
+// and heightfield.vert morphs the vertices of each node into those of the
+// next larger one before it takes over, so there are neither cracks nor pops.
+///////////////////////////////////////////////////////////////////////////////
 class HeightField
 {
 public:
-	int m_meshResolution; // triangles edges per quad side
+	int m_meshResolution; // quads per patch side, even
 	GLuint m_texid_hf;
 	GLuint m_texid_diffuse;
+	GLuint m_texid_normals; // RG16 octahedral normals, see buildNormalMap()
 	GLuint m_vao;
-	GLuint m_positionBuffer;
-	GLuint m_uvBuffer;
-	GLuint m_indexBuffer;
+	// The patch has no vertex buffer: heightfield.vert finds the grid
+	// coordinates of a vertex from its index, gl_VertexID
+	GLuint m_indexBuffer;    // 16-bit triangle strips of the patch, one quadrant after the other
 	GLuint m_numIndices;
+	GLuint m_nodeBuffer;     // the selected nodes, per quadrant
 	std::string m_heightFieldPath;
 	std::string m_diffuseTexturePath;
+	// Copy of the height map on the CPU, with row 0 at v = 0 like the texture
+	std::vector<float> m_heights;
+	int m_width;
+	int m_height;
+	// Scale of the heights, the heightScale uniform of heightfield.vert
+	float m_heightScale;
+	// The normals of the height map, octahedron encoded, same layout as m_heights
+	std::vector<glm::i16vec2> m_normals;
 
+	// The quadtree. Level 0 has the smallest nodes, and the single node of
+	// the top level covers the whole height map. Node (x, z) of level l
+	// starts at uv (x, z) * size with size = 1 / (m_numLeafNodes >> l).
+	int m_numLevels;
+	int m_numLeafNodes; // per side
+	std::vector<std::vector<glm::vec2>> m_nodeHeights; // min and max height of each node, per level
+
+	// Selection: nodes of level l are drawn up to m_lodRanges[l] from the
+	// camera, with m_lodRanges[0] = m_lodDistance and each range twice the
+	// one before. The distance is adapted to keep within the budget.
+	float m_lodDistance;
+	float m_minLodDistance;
+	float m_maxLodDistance;
+	int m_triangleBudget;
+	std::vector<float> m_lodRanges;
+	std::vector<glm::u16vec4> m_selectedNodes[4]; // node x, z and level, per quadrant
+	size_t m_numTriangles;                     // of the last selection
+
+	// GPU memory of the terrain, in bytes
+	size_t m_meshBytes;    // index buffer of the patch
+	size_t m_nodeBytes;    // node buffer, at its largest so far
+	size_t m_textureBytes; // height map and diffuse texture, with their mipmaps
 	HeightField(void);
 
 	/// Load height field
@@ -23,12 +67,33 @@ public:
 	/// Load diffuse map
 	void loadDiffuseTexture(const std::string& diffusePath);
 
-	/// Generate mesh
+	/// Generate the patch mesh, with `tesselation` quads per side, at most 254
 	void generateMesh(int tesselation);
 
-	/// Render height map
-	void submitTriangles(void);
+	/// Pick the nodes to draw this frame. The terrain spans [-1, 1] in x and
+	/// z before `modelMatrix`, and the frustum is in world space.
+	void selectNodes(const glm::mat4& modelMatrix, const glm::vec3& cameraPosition,
+	                 const labhelper::Frustum& frustum);
+
+	/// Render height map, the nodes picked by selectNodes()
+	void submitTriangles(GLuint program);
 
-	/// Get height at a given point
+	/// Get height at a given point, filtered like the shader's texture()
 	float sampleHeightAt(float u, float v) const;
+
+	/// Get the heights at many points at once
+	void sampleHeightsAt(const std::vector<glm::vec2>& uvs, std::vector<float>& heights) const;
+
+	/// Get the normal at a given point, filtered like the shader's normal map.
+	/// It is in the space of the mesh, where the terrain spans [-1, 1] in x
+	/// and z, so it needs the model matrix's normal matrix like in the shader.
+	glm::vec3 sampleNormalAt(float u, float v) const;
+
+private:
+	void buildNormalMap();
+	void buildNodeHeights();
+	bool selectNode(int level, int x, int z, const glm::mat4& modelMatrix, const glm::vec3& cameraPosition,
+	                const labhelper::Frustum& frustum);
+	void nodeBox(int level, int x, int z, const glm::mat4& modelMatrix, glm::vec3& boxMin, glm::vec3& boxMax) const;
+	void addNode(int level, int x, int z, int quadrant);
 };
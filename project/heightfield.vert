@@ -2,8 +2,10 @@
 ///////////////////////////////////////////////////////////////////////////////
 // Input vertex attributes
 ///////////////////////////////////////////////////////////////////////////////
-layout(location = 0) in vec3 position;      // Vertex position
-layout(location = 2) in vec2 texCoordIn;    // Texture coordinates
+// One per node, see HeightField::selectNodes(): the node's x and z in nodes of
+// its level (xy), and its quadtree level (z). The patch itself has no vertex
+// attributes, its vertices are found from gl_VertexID.
+layout(location = 3) in vec4 node;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Input uniform variables
@@ -12,7 +14,11 @@ uniform mat4 modelViewProjectionMatrix;     // MVP matrix
 uniform mat4 modelViewMatrix;               // Model-View matrix
 uniform mat4 normalMatrix;                  // Normal transformation matrix
 uniform sampler2D heightMap;                // Height map texture
+uniform sampler2D normalMap;                // Octahedron encoded normals of the height map
 uniform float heightScale;                  // Scaling factor for height
+uniform int patchResolution;                // Quads per patch side
+uniform float leafNodesPerSide;             // Nodes per side of quadtree level 0
+uniform vec2 morphRanges[16];               // Per level, the distances where morphing starts and ends
 
 ///////////////////////////////////////////////////////////////////////////////
 // Output to fragment shader
@@ -21,36 +27,56 @@ out vec2 texCoord;                          // Pass texture coordinates
 out vec3 viewSpaceNormal;                   // Pass normal in view space
 out vec3 viewSpacePosition;                 // Pass position in view space
 
+// The terrain spans [-1, 1] in x and z, with uv 0 to 1 across it
+vec3 terrainPosition(vec2 uv)
+{
+    float height = texture(heightMap, uv).r * heightScale;
+    return vec3(uv.x * 2.0 - 1.0, height, uv.y * 2.0 - 1.0);
+}
+
+// The inverse of encodeNormal() in heightfield.cpp: a point of the octahedron
+// |x| + |y| + |z| = 1 seen from above, with the lower half folded out over the
+// corners
+vec3 decodeNormal(vec2 encoded)
+{
+    vec3 normal = vec3(encoded.x, 1.0 - abs(encoded.x) - abs(encoded.y), encoded.y);
+    if (normal.y < 0.0)
+    {
+        normal.xz = (1.0 - abs(normal.zx)) * sign(normal.xz);
+    }
+    return normalize(normal);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Main Shader Code
 ///////////////////////////////////////////////////////////////////////////////
 void main() {
-    // Step 1: Displace the position in the y-axis based on the height map
-    float height = texture(heightMap, texCoordIn).r * heightScale;
-    vec3 displacedPosition = position + vec3(0.0, height, 0.0);
-
-    // Step 2: Compute gradients in u and v directions
-    float du = 0.001; // Small offset for gradient computation
-    float dv = 0.001;
-
-    // Sample neighboring heights
-    float heightL = texture(heightMap, texCoordIn + vec2(-du, 0)).r * heightScale;
-    float heightR = texture(heightMap, texCoordIn + vec2(du, 0)).r * heightScale;
-    float heightD = texture(heightMap, texCoordIn + vec2(0, -dv)).r * heightScale;
-    float heightU = texture(heightMap, texCoordIn + vec2(0, dv)).r * heightScale;
+    // Step 1: Morph the vertex towards the grid of the next larger node, where
+    // every other vertex is missing, the closer it gets to the end of the
+    // node's range. Distances are in view space, which is as large as world
+    // space.
+    // The patch is a grid of (patchResolution + 1)^2 vertices, row by row.
+    int gridSize = patchResolution + 1;
+    vec2 gridCoordinate = vec2(gl_VertexID % gridSize, gl_VertexID / gridSize);
+    float nodeSize = exp2(node.z) / leafNodesPerSide; // in uv
+    vec2 nodeOffset = node.xy * nodeSize;
+    float cameraDistance = length((modelViewMatrix * vec4(terrainPosition(nodeOffset + gridCoordinate / float(patchResolution) * nodeSize), 1.0)).xyz);
+    vec2 range = morphRanges[int(node.z)];
+    float morph = clamp((cameraDistance - range.x) / (range.y - range.x), 0.0, 1.0);
+    vec2 morphedCoordinate = gridCoordinate - fract(gridCoordinate * 0.5) * 2.0 * morph;
+    vec2 texCoordIn = nodeOffset + morphedCoordinate / float(patchResolution) * nodeSize;
 
-    // Tangent vectors
-    vec3 tangentU = normalize(vec3(2.0 * du, heightR - heightL, 0.0));
-    vec3 tangentV = normalize(vec3(0.0, heightU - heightD, 2.0 * dv));
+    // Step 2: Displace the position in the y-axis based on the height map
+    vec3 displacedPosition = terrainPosition(texCoordIn);
 
-    // Compute normal using the cross product
-    vec3 normal = normalize(cross(tangentV, tangentU));
+    // Step 3: Fetch the normal, computed once from the height map on load
+    vec3 normal = decodeNormal(texture(normalMap, texCoordIn).rg);
 
-    // Step 3: Transform position and normal to view space
+    // Step 4: Transform position and normal to view space
     viewSpacePosition = (modelViewMatrix * vec4(displacedPosition, 1.0)).xyz;
     viewSpaceNormal = (normalMatrix * vec4(normal, 0.0)).xyz;
 
-    // Step 4: Set final position and pass texture coordinates
+    // Step 5: Set final position and pass texture coordinates
     gl_Position = modelViewProjectionMatrix * vec4(displacedPosition, 1.0);
     texCoord = texCoordIn;
 }
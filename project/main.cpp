@@ -49,6 +49,29 @@ HeightField terrain; // Heightfield object
 
 labhelper::Model* treeModel = nullptr;  // declare tree model globally
 std::vector<glm::vec3> treePositions;   // store tree positions
+int maxTrees = 500;                     // max number of trees, set in the GUI
+bool treesChanged = false;              // regenerate the trees when the GUI slider is released
+const float treeScale = 0.2f;           // TREE SIZE: Scale factor for the trees
+bool useInstancedTrees = true;          // draw all trees with one draw call per tree mesh
+float treePassMilliseconds = 0.0f;      // CPU time of renderTrees(), averaged over frames
+
+// Frustum culling of the trees
+bool useFrustumCulling = true;
+std::vector<glm::mat4> treeModelMatrices; // one per tree position
+labhelper::InstanceGrid treeGrid;         // bounding boxes of the trees
+std::vector<uint32_t> visibleTrees;       // indices of the trees in the view frustum
+std::vector<glm::mat4> visibleTreeMatrices;
+bool allTreeMatricesUploaded = false;     // whether the instances are all trees, or the visible ones
+int treeMeshesDrawn = 0;
+float cullingMilliseconds = 0.0f;         // averaged over frames, like treePassMilliseconds
+
+// Levels of detail of the trees, picked by the size of their error on screen
+bool useTreeLod = true;
+float treeLodPixels = 1.0f;               // largest error on screen, in pixels
+std::vector<uint8_t> treeLevels;          // level each tree was drawn at last, for the hysteresis
+std::vector<uint32_t> treesPerLevel;
+size_t treeTrianglesDrawn = 0;
+size_t treeTrianglesFullDetail = 0;       // the triangles of the same trees without LOD
 
 bool useWireframe = false; // toggle wireframe mode
 
@@ -59,6 +82,7 @@ GLuint shaderProgram;       // Shader for rendering the final image
 GLuint simpleShaderProgram; // Shader used to draw the shadow map
 GLuint backgroundProgram;
 GLuint terrainShaderProgram; // Shader used to draw the terrain
+GLuint treeShaderProgram;    // Shader used to draw instanced trees
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -132,13 +156,18 @@ void loadShaders(bool is_reload)
 	{
 		std::cerr << "Failed to load terrain shader." << std::endl;
 	}
+
+	// Instanced trees, shaded like the other models
+	shader = labhelper::loadShaderProgram("../project/tree.vert", "../project/shading.frag", is_reload);
+	if (shader != 0)
+	{
+		treeShaderProgram = shader;
+	}
 }
 
 // Function to generate tree positions randomly at a specific height range
 void generateTreePositions()
 {
-	const int maxTrees = 500;  // max number of trees
-	const int numTreeAttempts = 1000;  // number of random placement attempts
 	const float minHeight = 0.1f;  // Minimum height for tree placement
 	const float maxHeight = 1.0f;  // Maximum height for tree placement
 
@@ -146,16 +175,19 @@ void generateTreePositions()
 	const float terrainScaleX = 100.0f; // Matches terrainModelMatrix scaling
 	const float terrainScaleZ = 100.0f;
 
+	treePositions.clear();
 	int generatedTreeCount = 0;
 
-	// Log terrain bounds for debugging
-	std::cout << "Terrain bounds: X = [-" << terrainScaleX / 2 << ", " << terrainScaleX / 2
-		<< "], Z = [-" << terrainScaleZ / 2 << ", " << terrainScaleZ / 2 << "]" << std::endl;
+	// Log terrain bounds for debugging (the mesh spans [-1, 1] before scaling)
+	std::cout << "Terrain bounds: X = [-" << terrainScaleX << ", " << terrainScaleX
+		<< "], Z = [-" << terrainScaleZ << ", " << terrainScaleZ << "]" << std::endl;
 
-	// Grid-based sampling to ensure coverage
-	const int gridResolution = 50; 
+	// Grid-based sampling to ensure coverage, with five cells per tree
+	const int gridResolution = std::max(50, int(std::ceil(std::sqrt(5.0f * maxTrees))));
 	const float gridStep = 1.0f / gridResolution;
 
+	std::vector<glm::vec2> samples;
+	samples.reserve(size_t(gridResolution) * gridResolution);
 	for (int gx = 0; gx < gridResolution; ++gx)
 	{
 		for (int gz = 0; gz < gridResolution; ++gz)
@@ -167,38 +199,105 @@ void generateTreePositions()
 			// add randomness within each grid cell
 			u += (static_cast<float>(rand()) / RAND_MAX) * gridStep * 0.5f;
 			v += (static_cast<float>(rand()) / RAND_MAX) * gridStep * 0.5f;
+			samples.emplace_back(u, v);
+		}
+	}
 
-			// we sample height at (u, v)
-			float height = terrain.sampleHeightAt(u, v);
-			std::cout << "Sampled height at (" << u << ", " << v << "): " << height << '\n'; // DEBUG
+	// we sample the heights at all (u, v) at once, from the CPU copy of the height map
+	std::vector<float> heights;
+	terrain.sampleHeightsAt(samples, heights);
 
-			// skip if height is out of range
-			if (height < minHeight || height > maxHeight)
-			{
-				continue;
-			}
+	for (size_t i = 0; i < samples.size(); ++i)
+	{
+		float height = heights[i];
 
-			// Map u, v to world space coordinates
-			float worldX = (u - 0.5f) * terrainScaleX;  // Match terrain scaling
-			float worldZ = (v - 0.5f) * terrainScaleZ;
-			float worldY = height;  // Use sampled height directly
+		// skip if height is out of range
+		if (height < minHeight || height > maxHeight)
+		{
+			continue;
+		}
 
-			// Add the tree position to the list where valid
-			treePositions.emplace_back(glm::vec3(worldX, worldY, worldZ));
-			++generatedTreeCount;
+		// Map u, v to world space coordinates, like the terrain mesh: u = 0..1 is x = -1..1
+		float worldX = (2.0f * samples[i].x - 1.0f) * terrainScaleX;  // Match terrain scaling
+		float worldZ = (2.0f * samples[i].y - 1.0f) * terrainScaleZ;
+		float worldY = height;  // Use sampled height directly
 
-			// Stop if we reach the maximum number of trees
-			if (generatedTreeCount >= maxTrees)
-			{
-				std::cout << "Reached maximum tree limit: " << maxTrees << std::endl;
-				return;
-			}
+		// Add the tree position to the list where valid
+		treePositions.emplace_back(glm::vec3(worldX, worldY, worldZ));
+		++generatedTreeCount;
+
+		// Stop if we reach the maximum number of trees
+		if (generatedTreeCount >= maxTrees)
+		{
+			std::cout << "Reached maximum tree limit: " << maxTrees << std::endl;
+			return;
 		}
 	}
 
 	std::cout << "Generated " << treePositions.size() << " trees." << std::endl;
 }
 
+// Compute the model matrices and bounding boxes of the trees; only needed
+// when the positions change
+void buildTreeInstances()
+{
+	treeModelMatrices.clear();
+	std::vector<glm::vec3> boxMins, boxMaxs;
+	for (const glm::vec3& position : treePositions)
+	{
+		treeModelMatrices.push_back(glm::translate(position) * glm::scale(glm::vec3(treeScale)));
+		glm::vec3 boxMin, boxMax;
+		labhelper::transformAABB(treeModelMatrices.back(), treeModel->m_aabb_min, treeModel->m_aabb_max, boxMin,
+		                         boxMax);
+		boxMins.push_back(boxMin);
+		boxMaxs.push_back(boxMax);
+	}
+	treeGrid.build(boxMins, boxMaxs);
+	treeLevels.assign(treeModelMatrices.size(), 0);
+	allTreeMatricesUploaded = false;
+}
+
+// Pick the level of detail of the visible trees, and sort them by it
+void selectTreeLevels(const glm::mat4& projMatrix)
+{
+	const int levels = labhelper::numberOfLevels(treeModel);
+	treesPerLevel.assign(levels, 0);
+	const float pixelsPerUnit = projMatrix[1][1] * float(windowHeight) / 2.0f;
+	const glm::vec3 treeCenter = 0.5f * (treeModel->m_aabb_min + treeModel->m_aabb_max);
+	for (uint32_t tree : visibleTrees)
+	{
+		int level = 0;
+		if (useTreeLod)
+		{
+			const float distance = length(treePositions[tree] + treeScale * treeCenter - cameraPosition);
+			level = labhelper::selectLevelOfDetail(treeModel, treeLevels[tree], treeScale, distance, pixelsPerUnit,
+			                                       treeLodPixels);
+		}
+		treeLevels[tree] = uint8_t(level);
+		treesPerLevel[level]++;
+	}
+
+	// counting sort, so that the trees of each level can be drawn with one call
+	std::vector<uint32_t> next(levels, 0);
+	for (int level = 1; level < levels; level++)
+	{
+		next[level] = next[level - 1] + treesPerLevel[level - 1];
+	}
+	std::vector<uint32_t> sorted(visibleTrees.size());
+	for (uint32_t tree : visibleTrees)
+	{
+		sorted[next[treeLevels[tree]]++] = tree;
+	}
+	visibleTrees.swap(sorted);
+
+	treeTrianglesDrawn = 0;
+	for (int level = 0; level < levels; level++)
+	{
+		treeTrianglesDrawn += treesPerLevel[level] * labhelper::numberOfTriangles(treeModel, level);
+	}
+	treeTrianglesFullDetail = visibleTrees.size() * labhelper::numberOfTriangles(treeModel);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// This function is called once at the start of the program and never again
 ///////////////////////////////////////////////////////////////////////////////
@@ -238,24 +337,22 @@ void initialize()
 
 	///////////////////////////////////////////////////////////////////////
 	// Generate the height field terrain
-	// using an indexed array of triangles
+	// from one small patch, drawn once per quadtree node
 	///////////////////////////////////////////////////////////////////////
-	terrain.generateMesh(512); // tesselation value
+	terrain.generateMesh(32); // tesselation value of the patch
 	terrain.loadHeightField("../scenes/nlsFinland/L3123F.png"); // Path to your height map
 	terrain.loadDiffuseTexture("../scenes/nlsFinland/L3123F_downscaled.jpg"); // Optional diffuse texture
 
 
 	glEnable(GL_DEPTH_TEST); // enable Z-buffering
 	glEnable(GL_CULL_FACE);  // enables backface culling
-
-	// glEnable(GL_PRIMITIVE_RESTART);
-	// glPrimitiveRestartIndex(UINT32_MAX);
 	
 	///////////////////////////////////////////////////////////////////////
 	// Generate tree positions
 	///////////////////////////////////////////////////////////////////////
 
 	generateTreePositions();
+	buildTreeInstances();
 
 }
 
@@ -335,34 +432,108 @@ void drawScene(GLuint currentShaderProgram,
 ///////////////////////////////////////////////////////////////////////////
 void renderTrees(const glm::mat4& projMatrix, const glm::mat4& viewMatrix)
 {
-	glUseProgram(shaderProgram); // default scene shader for trees
+	// find the trees in the view frustum
+	if (useFrustumCulling)
+	{
+		auto cullingStartTime = std::chrono::high_resolution_clock::now();
+		treeGrid.cull(labhelper::extractFrustum(projMatrix * viewMatrix), visibleTrees);
+		std::chrono::duration<float, std::milli> cullingTime =
+			std::chrono::high_resolution_clock::now() - cullingStartTime;
+		cullingMilliseconds = 0.95f * cullingMilliseconds + 0.05f * cullingTime.count();
+	}
+	else
+	{
+		visibleTrees.resize(treePositions.size());
+		for (size_t i = 0; i < visibleTrees.size(); i++)
+		{
+			visibleTrees[i] = uint32_t(i);
+		}
+		cullingMilliseconds = 0.0f;
+	}
+	selectTreeLevels(projMatrix);
+
+	// instanced shader, or the default scene shader with one render() per tree
+	const GLuint program = useInstancedTrees ? treeShaderProgram : shaderProgram;
+	glUseProgram(program);
 
 	//lighting uniforms
 	vec4 viewSpaceLightPosition = viewMatrix * vec4(lightPosition, 1.0f);
-	labhelper::setUniformSlow(shaderProgram, "viewSpaceLightPosition", vec3(viewSpaceLightPosition));
-	labhelper::setUniformSlow(shaderProgram, "point_light_color", point_light_color);
-	labhelper::setUniformSlow(shaderProgram, "point_light_intensity_multiplier", point_light_intensity_multiplier);
+	labhelper::setUniformSlow(program, "viewSpaceLightPosition", vec3(viewSpaceLightPosition));
+	labhelper::setUniformSlow(program, "point_light_color", point_light_color);
+	labhelper::setUniformSlow(program, "point_light_intensity_multiplier", point_light_intensity_multiplier);
 
 	// environment map uniforms
-	labhelper::setUniformSlow(shaderProgram, "environment_multiplier", environment_multiplier);
-	labhelper::setUniformSlow(shaderProgram, "viewInverse", inverse(viewMatrix));
+	labhelper::setUniformSlow(program, "environment_multiplier", environment_multiplier);
+	labhelper::setUniformSlow(program, "viewInverse", inverse(viewMatrix));
 
-	// Loop over all tree positions to render them
-	const float treeScale = 0.2f; // TREE SIZE: Scale factor for the trees
-	for (const glm::vec3& position : treePositions)
+	if (useInstancedTrees)
+	{
+		// the visible trees and their levels change with the camera, all of
+		// them only with the positions
+		if (useFrustumCulling || useTreeLod)
+		{
+			visibleTreeMatrices.clear();
+			for (uint32_t tree : visibleTrees)
+			{
+				visibleTreeMatrices.push_back(treeModelMatrices[tree]);
+			}
+			labhelper::setInstanceMatrices(treeModel, visibleTreeMatrices);
+			allTreeMatricesUploaded = false;
+		}
+		else if (!allTreeMatricesUploaded)
+		{
+			labhelper::setInstanceMatrices(treeModel, treeModelMatrices);
+			allTreeMatricesUploaded = true;
+		}
+		labhelper::setUniformSlow(program, "viewMatrix", viewMatrix);
+		labhelper::setUniformSlow(program, "projectionMatrix", projMatrix);
+		if (allTreeMatricesUploaded)
+		{
+			labhelper::renderInstanced(treeModel);
+		}
+		else
+		{
+			uint32_t first = 0;
+			for (int level = 0; level < int(treesPerLevel.size()); level++)
+			{
+				labhelper::renderInstanced(treeModel, first, treesPerLevel[level], level);
+				first += treesPerLevel[level];
+			}
+		}
+		treeMeshesDrawn = int(visibleTrees.size() * treeModel->m_meshes.size());
+		return;
+	}
+
+	// model uniforms are set once per tree, so look them up only once
+	static const char* const modelUniformNames[] = { "modelViewProjectionMatrix", "modelViewMatrix",
+		                                             "normalMatrix" };
+	const GLint* modelUniforms = labhelper::getUniformLocations(shaderProgram, modelUniformNames, 3);
+
+	// Loop over the visible trees to render them
+	treeMeshesDrawn = 0;
+	for (uint32_t tree : visibleTrees)
 	{
-		// Computed model matrix for each tree
-		glm::mat4 modelMatrix =
-			glm::translate(position) * glm::scale(glm::vec3(treeScale)); // apply the scaling
-		glm::mat4 mvpMatrix = projMatrix * viewMatrix * modelMatrix;
+		const glm::mat4& modelMatrix = treeModelMatrices[tree];
+		glm::mat4 modelViewMatrix = viewMatrix * modelMatrix;
+		glm::mat4 mvpMatrix = projMatrix * modelViewMatrix;
+		glm::mat4 normalMatrix = inverse(transpose(modelViewMatrix));
 
 		// model uniforms
-		labhelper::setUniformSlow(shaderProgram, "modelViewProjectionMatrix", mvpMatrix);
-		labhelper::setUniformSlow(shaderProgram, "modelViewMatrix", viewMatrix * modelMatrix);
-		labhelper::setUniformSlow(shaderProgram, "normalMatrix", inverse(transpose(viewMatrix * modelMatrix)));
+		glUniformMatrix4fv(modelUniforms[0], 1, false, &mvpMatrix[0].x);
+		glUniformMatrix4fv(modelUniforms[1], 1, false, &modelViewMatrix[0].x);
+		glUniformMatrix4fv(modelUniforms[2], 1, false, &normalMatrix[0].x);
 
-		// render the tree
-		labhelper::render(treeModel);
+		// render the tree, without the meshes outside the view
+		if (useFrustumCulling)
+		{
+			treeMeshesDrawn +=
+				int(labhelper::render(treeModel, labhelper::extractFrustum(mvpMatrix), int(treeLevels[tree])));
+		}
+		else
+		{
+			labhelper::render(treeModel, int(treeLevels[tree]));
+			treeMeshesDrawn += int(treeModel->m_meshes.size());
+		}
 	}
 }
 
@@ -441,12 +612,16 @@ void display(void)
 	mat4 terrainModelMatrix = scale(mat4(1.0f), vec3(100.0f, 1.0f, 100.0f)); // Scale terrain in x and z directions
 	mat4 terrainModelViewProjectionMatrix = projMatrix * viewMatrix * terrainModelMatrix; // compute model view projection matrix
 
+	// pick the quadtree nodes to draw, by their distance to the camera
+	terrain.selectNodes(terrainModelMatrix, cameraPosition, labhelper::extractFrustum(projMatrix * viewMatrix));
+
 	// transform matrices
 	labhelper::setUniformSlow(terrainShaderProgram, "modelViewProjectionMatrix", terrainModelViewProjectionMatrix); // pass MVP matrix to shader
 	labhelper::setUniformSlow(terrainShaderProgram, "modelViewMatrix", viewMatrix * terrainModelMatrix); // pass MV matrix for position transformation
 	labhelper::setUniformSlow(terrainShaderProgram, "normalMatrix", inverse(transpose(viewMatrix * terrainModelMatrix))); // pass normal matrix for lighting calculations
 	labhelper::setUniformSlow(terrainShaderProgram, "heightMap", 0); // Bind height map to texture unit 0 - relevant to heightfield.vert
-	labhelper::setUniformSlow(terrainShaderProgram, "heightScale", 10.0f); //set scale for height (y-axis) displacement - relevant to heightfield.vert
+	labhelper::setUniformSlow(terrainShaderProgram, "normalMap", 2); // Bind normal map to texture unit 2 - relevant to heightfield.vert
+	labhelper::setUniformSlow(terrainShaderProgram, "heightScale", terrain.m_heightScale); //set scale for height (y-axis) displacement - relevant to heightfield.vert, and used by sampleHeightAt
 
 	// Light uniforms
 	labhelper::setUniformSlow(terrainShaderProgram, "viewSpaceLightPosition", vec3(viewMatrix * vec4(lightPosition, 1.0))); // pass light position transformed in view space
@@ -471,12 +646,18 @@ void display(void)
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_2D, terrain.m_texid_diffuse); // Bind diffuse areal photo - texture
 
+	// Bind normal map
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, terrain.m_texid_normals); // Bind normals of the height map
+
 	glActiveTexture(GL_TEXTURE6);
 	glBindTexture(GL_TEXTURE_2D, environmentMap); // Environment map
 
+	// white, rough material - shading.frag reads it from a uniform block
+	labhelper::bindDefaultMaterial();
 
 	// Submit the terrain mesh
-	terrain.submitTriangles();
+	terrain.submitTriangles(terrainShaderProgram);
 
 	// Apply polygon mode based on GUI toggle
 	// disable wireframe after rendering the terrain
@@ -487,8 +668,11 @@ void display(void)
 		// glEnable(GL_BLEND);                       // Re-enable blending
 	}
 
-	// render trees
+	// render trees, and time the CPU side of it
+	auto treeStartTime = std::chrono::high_resolution_clock::now();
 	renderTrees(projMatrix, viewMatrix);
+	std::chrono::duration<float, std::milli> treeTime = std::chrono::high_resolution_clock::now() - treeStartTime;
+	treePassMilliseconds = 0.95f * treePassMilliseconds + 0.05f * treeTime.count();
 
 }
 
@@ -603,7 +787,6 @@ void gui()
 {
 	// Terrain properties for GUI
 	const vec3 terrainScale(100.0f, 1.0f, 100.0f); // match terrainModelMatrix scaling
-	const int terrainTessellation = 512; // match  tessellation value used in `generateMesh`
 	const float terrainWidth = terrainScale.x * 2.0f; // Width in world units
 	const float terrainDepth = terrainScale.z * 2.0f; // depth in world units
 
@@ -612,6 +795,33 @@ void gui()
 	            ImGui::GetIO().Framerate);
 	// tree count
 	ImGui::Text("Number of trees: %d", static_cast<int>(treePositions.size()));
+	ImGui::Text("Tree pass: %.3f ms CPU", treePassMilliseconds);
+	if (ImGui::SliderInt("Max trees", &maxTrees, 0, 50000))
+	{
+		treesChanged = true;
+	}
+	// regenerating is slow, so wait until the slider is released
+	if (treesChanged && !ImGui::IsMouseDown(0))
+	{
+		generateTreePositions();
+		buildTreeInstances();
+		treesChanged = false;
+	}
+	ImGui::Checkbox("Instanced trees", &useInstancedTrees);
+	ImGui::Checkbox("Frustum culling", &useFrustumCulling);
+	ImGui::Text("Visible trees: %d, culled: %d (%.3f ms)", int(visibleTrees.size()),
+	            int(treePositions.size() - visibleTrees.size()), cullingMilliseconds);
+	ImGui::Text("Tree meshes drawn: %d of %d", treeMeshesDrawn,
+	            int(treePositions.size() * treeModel->m_meshes.size()));
+	ImGui::Checkbox("Tree LOD", &useTreeLod);
+	ImGui::SliderFloat("LOD error (pixels)", &treeLodPixels, 0.25f, 8.0f);
+	ImGui::Text("Tree triangles: %.2f M with LOD, %.2f M without", float(treeTrianglesDrawn) / 1e6f,
+	            float(treeTrianglesFullDetail) / 1e6f);
+	for (int level = 0; level < int(treesPerLevel.size()); level++)
+	{
+		ImGui::Text("  Level %d (%d triangles): %d trees", level,
+		            int(labhelper::numberOfTriangles(treeModel, level)), int(treesPerLevel[level]));
+	}
 
 	// Terrain details
 	ImGui::Separator(); // Adds a horizontal line
@@ -619,7 +829,28 @@ void gui()
 	ImGui::Text("Scale: X=%.1f, Y=%.1f, Z=%.1f", terrainScale.x, terrainScale.y, terrainScale.z);
 	ImGui::Text("Width: %.1f units", terrainWidth);
 	ImGui::Text("Depth: %.1f units", terrainDepth);
-	ImGui::Text("Tessellation: %d (triangles per side)", terrainTessellation);
+	ImGui::Text("Patch: %d quads per side, %d levels of %d to 1 nodes per side", terrain.m_meshResolution,
+	            terrain.m_numLevels, terrain.m_numLeafNodes);
+	ImGui::SliderInt("Terrain triangle budget", &terrain.m_triangleBudget, 10000, 2000000);
+	ImGui::Text("Terrain triangles: %d (%d patch quadrants), detail distance %.1f", int(terrain.m_numTriangles),
+	            int(terrain.m_numTriangles / (terrain.m_meshResolution * terrain.m_meshResolution / 2)),
+	            terrain.m_lodDistance);
+	ImGui::Text("Terrain memory: %.1f KB of indices, %.1f KB of nodes, %.1f MB of textures",
+	            float(terrain.m_meshBytes) / 1024.0f, float(terrain.m_nodeBytes) / 1024.0f,
+	            float(terrain.m_textureBytes) / (1024.0f * 1024.0f));
+
+	// Texture cache
+	const labhelper::TextureCacheStats textures = labhelper::textureCacheStats();
+	ImGui::Separator();
+	ImGui::Text("Textures: %d images, %d loading", int(textures.images), int(textures.pending));
+	ImGui::Text("Texture cache hit rate: %.0f%% (%d of %d)",
+	            textures.requests > 0 ? 100.0f * float(textures.hits) / float(textures.requests) : 0.0f,
+	            int(textures.hits), int(textures.requests));
+	ImGui::Text("Texture memory: %.1f MB on GPU (%.1f MB uncompressed), %.1f MB on CPU",
+	            float(textures.gpu_bytes) / (1024.0f * 1024.0f),
+	            float(textures.uncompressed_gpu_bytes) / (1024.0f * 1024.0f),
+	            float(textures.cpu_bytes) / (1024.0f * 1024.0f));
+	ImGui::Text("Texture uploads: %d in %.1f ms", int(textures.uploads), textures.upload_milliseconds);
 
 	// toggle wireframe mode
 	ImGui::Separator();
@@ -649,6 +880,9 @@ int main(int argc, char* argv[])
 		currentTime = timeSinceStart.count();
 		deltaTime = currentTime - previousTime;
 
+		// Upload the textures that were decoded since the last frame
+		labhelper::uploadTextures();
+
 		// Inform imgui of new frame
 		ImGui_ImplSdlGL3_NewFrame(g_window);
 
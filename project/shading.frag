@@ -6,11 +6,14 @@ precision highp float;
 ///////////////////////////////////////////////////////////////////////////////
 // Material
 ///////////////////////////////////////////////////////////////////////////////
-uniform vec3 material_color = vec3(1, 1, 1);
-uniform float material_metalness = 0;
-uniform float material_fresnel = 0;
-uniform float material_shininess = 0;
-uniform vec3 material_emission = vec3(0);
+layout(std140, binding = 0) uniform MaterialBlock
+{
+	vec3 material_color;
+	float material_metalness;
+	vec3 material_emission;
+	float material_fresnel;
+	float material_shininess;
+};
 
 uniform int has_color_texture = 0;
 layout(binding = 0) uniform sampler2D colorMap;
@@ -0,0 +1,37 @@
+#version 420
+///////////////////////////////////////////////////////////////////////////////
+// Input vertex attributes
+///////////////////////////////////////////////////////////////////////////////
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normalIn;
+layout(location = 2) in vec2 texCoordIn;
+// One per tree, see labhelper::setInstanceMatrices()
+layout(location = 3) in mat4 modelMatrix;
+
+///////////////////////////////////////////////////////////////////////////////
+// Input uniform variables
+///////////////////////////////////////////////////////////////////////////////
+uniform mat4 viewMatrix;
+uniform mat4 projectionMatrix;
+
+///////////////////////////////////////////////////////////////////////////////
+// Output to fragment shader
+///////////////////////////////////////////////////////////////////////////////
+out vec2 texCoord;
+out vec3 viewSpaceNormal;
+out vec3 viewSpacePosition;
+
+
+void main()
+{
+	mat4 modelViewMatrix = viewMatrix * modelMatrix;
+	vec4 viewSpacePosition4 = modelViewMatrix * vec4(position, 1.0);
+	gl_Position = projectionMatrix * viewSpacePosition4;
+	texCoord = texCoordIn;
+	// The cofactor matrix is the inverse transpose times the determinant,
+	// which the fragment shader normalizes away. Much cheaper than inverse().
+	mat3 m = mat3(modelViewMatrix);
+	mat3 normalMatrix = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));
+	viewSpaceNormal = normalMatrix * normalIn;
+	viewSpacePosition = viewSpacePosition4.xyz;
+}